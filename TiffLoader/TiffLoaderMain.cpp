@@ -1,17 +1,39 @@
 ﻿#include <iostream>
+#include <stdlib.h>
+#include <string.h>
 #include <direct.h> // _getcwd
 #include "loadtiff.h"
 #include "bmp.h"
+#include "tiffbatch.h"
 #define ImageNum 1
 //#define path "C:\\Users\\macro\\Desktop\\TIF\\"
 #define path "..\\"
+/// <summary>
+/// write a decoded image next to its source as a bitmap
+/// </summary>
+/// <param name="result">batch result</param>
+static void save_bitmap (BATCHRESULT* result)
+{
+	if (result->format == FMT::FMT_RGBA || result->format == FMT::FMT_GREYALPHA) {
+		bmp_image		bmp;
+		char work[256];
+		sprintf_s<256> (work, "%s.bmp", result->filename);
+		bmp.allocate_image (result->width, result->height);
+		bmp.assign_data (reinterpret_cast<char*>(result->data), result->format);
+		if (!bmp.save_image (work))
+			printf ("error");
+	}
+}
+
 /// <summary>
 /// main
 /// 1.set const char name fullpath of tiff file.
 /// 2.run.
+/// or pass the files on the command line
+///   TiffLoader [-j threads] [-m budget_MB] file.tif | directory | @listfile ...
 /// </summary>
-/// <returns></returns>
-int main ()
+/// <returns>number of files that failed</returns>
+int main (int argc, char* argv[])
 {
 	const char name[ImageNum][100] =
 	{
@@ -78,22 +100,38 @@ int main ()
 				//path "spine.tif",
 				//path "surf.tif",
 	};
-	TIFF tiff;
+	TIFFBATCH batch;
+	batch.cmyk_to_rgb = true;  // the bitmap writer only takes RGBA and grey
 
-	for (int i = 0; i < ImageNum; i++) {
-		tiff.file_read (const_cast<char*>(name[i]));
-		auto data = tiff.load_tiff ();
-		if (data == 0) {
-			printf ("TIFF file unreadable %s\n", name[i]);
+	for (int i = 1; i < argc; i++) {
+		if (strcmp (argv[i], "-j") == 0 && i + 1 < argc) {
+			batch.threads = atoi (argv[++i]);
+		}
+		else if (strcmp (argv[i], "-m") == 0 && i + 1 < argc) {
+			batch.memory_budget = strtoull (argv[++i], NULL, 10) * 1024 * 1024;
 		}
-		if (tiff.format == FMT::FMT_RGBA || tiff.format == FMT::FMT_GREYALPHA) {
-			bmp_image		bmp;
-			char work[256];
-			sprintf_s<256> (work, "%s.bmp", name[i]);
-			bmp.allocate_image (tiff.width, tiff.height);
-			bmp.assign_data (reinterpret_cast<char*>(data), tiff.format);
-			if (!bmp.save_image (work))
-				printf ("error");
+		else if (argv[i][0] == '@') {
+			if (batch.add_list (argv[i] + 1) < 0) {
+				printf ("list unreadable %s\n", argv[i] + 1);
+			}
+		}
+		else if (batch.add_directory (argv[i]) < 0) {
+			batch.add_file (argv[i]);
+		}
+	}
+	if (argc < 2) {
+		for (int i = 0; i < ImageNum; i++) {
+			batch.add_file (name[i]);
 		}
 	}
+
+	batch.on_result = [] (BATCHRESULT* result) {
+		if (result->data == 0) {
+			printf ("TIFF file unreadable %s (%s)\n", result->filename, result->error);
+			return;
+		}
+		printf ("%s %d x %d\n", result->filename, result->width, result->height);
+		save_bitmap (result);
+	};
+	return batch.run ();
 }
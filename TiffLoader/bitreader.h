@@ -0,0 +1,258 @@
+#ifndef bitreader_h
+#define bitreader_h
+
+#include <stddef.h>
+#include <string.h>
+
+#if defined(_MSC_VER)
+#include <stdlib.h> // _byteswap_uint64
+#endif
+
+typedef unsigned char BYTE;
+
+/*
+  Bit readers for the decoders.
+
+  MSBREADER takes the most significant bit of each byte first (TIFF sample
+  data, new style LZW, FillOrder 1 CCITT); LSBREADER the least significant
+  bit first (old style LZW, FillOrder 2 CCITT).
+
+  Both keep up to 64 bits in an accumulator. refill() tops it up to at
+  least 56 bits with one unaligned 8 byte load while 8 bytes remain, and
+  byte by byte near the end of the buffer. Up to 32 bits can be taken with
+  getbits, or peek()ed and consume()d after a refill.
+  Past the end of the data the accumulator reads as zeros; getbit and
+  getbits return -1 once the real bits are used up.
+*/
+
+/// <summary>
+/// load 8 bytes as stored (little endian hosts: x86, x64, ARM)
+/// </summary>
+inline unsigned long long bitreader_load64 (const BYTE* p)
+{
+	unsigned long long v;
+	memcpy (&v, p, 8);
+	return v;
+}
+
+/// <summary>
+/// reverse the byte order of 64 bits
+/// </summary>
+inline unsigned long long bitreader_swap64 (unsigned long long v)
+{
+#if defined(_MSC_VER)
+	return _byteswap_uint64 (v);
+#elif defined(__GNUC__)
+	return __builtin_bswap64 (v);
+#else
+	v = ((v & 0x00FF00FF00FF00FFULL) << 8) | ((v >> 8) & 0x00FF00FF00FF00FFULL);
+	v = ((v & 0x0000FFFF0000FFFFULL) << 16) | ((v >> 16) & 0x0000FFFF0000FFFFULL);
+	return (v << 32) | (v >> 32);
+#endif
+}
+
+/// <summary>
+/// most significant bit first reader. The next bit is bit 63 of acc.
+/// </summary>
+class MSBREADER
+{
+private:
+	const BYTE* data;
+	size_t N;
+	size_t pos;                 // next byte to load
+	unsigned long long acc;
+	int count;                  // valid bits in acc
+public:
+	MSBREADER (const BYTE* data, size_t N)
+	{
+		this->data = data;
+		this->N = N;
+		pos = 0;
+		acc = 0;
+		count = 0;
+	}
+	/// <summary>
+	/// make at least 56 bits available, fewer only at the end of the data
+	/// </summary>
+	void refill ()
+	{
+		if (pos + 8 <= N) {
+			// bits beyond the ones counted are loaded again identically next time
+			acc |= bitreader_swap64 (bitreader_load64 (data + pos)) >> count;
+			pos += (63 - count) >> 3;
+			count |= 56;
+		}
+		else {
+			while (count <= 56 && pos < N) {
+				acc |= (unsigned long long)data[pos++] << (56 - count);
+				count += 8;
+			}
+		}
+	}
+	/// <summary>
+	/// the next nbits bits without taking them; refill first
+	/// </summary>
+	/// <param name="nbits">1 to 32</param>
+	unsigned peek (int nbits) const
+	{
+		return (unsigned)(acc >> (64 - nbits));
+	}
+	/// <summary>
+	/// drop bits already peeked
+	/// </summary>
+	/// <param name="nbits">0 to the number available</param>
+	void consume (int nbits)
+	{
+		acc <<= nbits;
+		count -= nbits;
+	}
+	/// <summary>
+	/// bits available without a refill
+	/// </summary>
+	int available () const
+	{
+		return count;
+	}
+	/// <summary>
+	/// read several bits
+	/// </summary>
+	/// <param name="nbits">1 to 32</param>
+	/// <returns>the bits, first bit most significant; -1 if the data runs out</returns>
+	int getbits (int nbits)
+	{
+		unsigned answer;
+		if (nbits <= 0) {
+			return 0;
+		}
+		if (count < nbits) {
+			refill ();
+			if (count < nbits) {
+				acc = 0;
+				count = 0;
+				return -1;
+			}
+		}
+		answer = peek (nbits);
+		consume (nbits);
+		return (int)answer;
+	}
+	/// <summary>
+	/// read one bit
+	/// </summary>
+	/// <returns>0 or 1, -1 at the end of the data</returns>
+	int getbit ()
+	{
+		return getbits (1);
+	}
+	/// <summary>
+	/// skip to the start of the next byte
+	/// </summary>
+	void synch_to_byte ()
+	{
+		consume (count & 7);
+	}
+};
+
+/// <summary>
+/// least significant bit first reader. The next bit is bit 0 of acc.
+/// </summary>
+class LSBREADER
+{
+private:
+	const BYTE* data;
+	size_t N;
+	size_t pos;                 // next byte to load
+	unsigned long long acc;
+	int count;                  // valid bits in acc
+public:
+	LSBREADER (const BYTE* data, size_t N)
+	{
+		this->data = data;
+		this->N = N;
+		pos = 0;
+		acc = 0;
+		count = 0;
+	}
+	/// <summary>
+	/// make at least 56 bits available, fewer only at the end of the data
+	/// </summary>
+	void refill ()
+	{
+		if (pos + 8 <= N) {
+			// bits beyond the ones counted are loaded again identically next time
+			acc |= bitreader_load64 (data + pos) << count;
+			pos += (63 - count) >> 3;
+			count |= 56;
+		}
+		else {
+			while (count <= 56 && pos < N) {
+				acc |= (unsigned long long)data[pos++] << count;
+				count += 8;
+			}
+		}
+	}
+	/// <summary>
+	/// the next nbits bits without taking them; refill first
+	/// </summary>
+	/// <param name="nbits">1 to 32</param>
+	unsigned peek (int nbits) const
+	{
+		return (unsigned)(acc & ((1ULL << nbits) - 1));
+	}
+	/// <summary>
+	/// drop bits already peeked
+	/// </summary>
+	/// <param name="nbits">0 to the number available</param>
+	void consume (int nbits)
+	{
+		acc >>= nbits;
+		count -= nbits;
+	}
+	/// <summary>
+	/// bits available without a refill
+	/// </summary>
+	int available () const
+	{
+		return count;
+	}
+	/// <summary>
+	/// read several bits
+	/// </summary>
+	/// <param name="nbits">1 to 32</param>
+	/// <returns>the bits, first bit least significant; -1 if the data runs out</returns>
+	int getbits (int nbits)
+	{
+		unsigned answer;
+		if (nbits <= 0) {
+			return 0;
+		}
+		if (count < nbits) {
+			refill ();
+			if (count < nbits) {
+				acc = 0;
+				count = 0;
+				return -1;
+			}
+		}
+		answer = peek (nbits);
+		consume (nbits);
+		return (int)answer;
+	}
+	/// <summary>
+	/// read one bit
+	/// </summary>
+	/// <returns>0 or 1, -1 at the end of the data</returns>
+	int getbit ()
+	{
+		return getbits (1);
+	}
+	/// <summary>
+	/// skip to the start of the next byte
+	/// </summary>
+	void synch_to_byte ()
+	{
+		consume (count & 7);
+	}
+};
+
+#endif
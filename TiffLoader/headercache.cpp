@@ -0,0 +1,104 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "loadtiff.h"
+#include "headercache.h"
+
+/// <summary>
+///
+/// </summary>
+/// <param name="capacity">headers to keep</param>
+HEADERCACHE::HEADERCACHE (int capacity)
+{
+	this->capacity = capacity > 0 ? capacity : 1;
+}
+
+/// <summary>
+///
+/// </summary>
+HEADERCACHE::~HEADERCACHE ()
+{
+	clear ();
+}
+
+/// <summary>
+/// one string key for file and IFD
+/// </summary>
+std::string HEADERCACHE::make_key (const std::string& file, unsigned long ifd)
+{
+	char buff[32];
+	sprintf_s (buff, "#%lu", ifd);
+	return file + buff;
+}
+
+/// <summary>
+/// copy a cached header out
+/// </summary>
+/// <param name="file">FileData::identity of the file</param>
+/// <param name="ifd">IFD offset</param>
+/// <param name="header">header to fill</param>
+/// <returns>true if the header was in the cache</returns>
+bool HEADERCACHE::get (const std::string& file, unsigned long ifd, BASICHEADER* header)
+{
+	if (file.empty ()) {
+		return false;
+	}
+	std::string key = make_key (file, ifd);
+	std::lock_guard<std::mutex> guard (lock);
+	auto found = index.find (key);
+	if (found == index.end ()) {
+		return false;
+	}
+	entries.splice (entries.begin (), entries, found->second);
+	header->copy_from (*found->second->header);
+	return true;
+}
+
+/// <summary>
+/// add a validated header, dropping the oldest past the cap
+/// </summary>
+/// <param name="file">FileData::identity of the file</param>
+/// <param name="ifd">IFD offset</param>
+/// <param name="header">the header</param>
+void HEADERCACHE::put (const std::string& file, unsigned long ifd, const BASICHEADER* header)
+{
+	if (file.empty ()) {
+		return;
+	}
+	std::string key = make_key (file, ifd);
+	BASICHEADER* copy = new BASICHEADER ();
+	copy->copy_from (*header);
+	copy->tilecache = NULL;
+
+	std::lock_guard<std::mutex> guard (lock);
+	auto found = index.find (key);
+	if (found != index.end ()) {
+		delete found->second->header;
+		entries.erase (found->second);
+		index.erase (found);
+	}
+	ENTRY entry;
+	entry.key = key;
+	entry.header = copy;
+	entries.push_front (entry);
+	index[key] = entries.begin ();
+	while ((int)entries.size () > capacity) {
+		ENTRY& last = entries.back ();
+		delete last.header;
+		index.erase (last.key);
+		entries.pop_back ();
+	}
+}
+
+/// <summary>
+/// drop every header
+/// </summary>
+void HEADERCACHE::clear ()
+{
+	std::lock_guard<std::mutex> guard (lock);
+	for (auto& entry : entries) {
+		delete entry.header;
+	}
+	entries.clear ();
+	index.clear ();
+}
@@ -0,0 +1,51 @@
+#ifndef headercache_h
+#define headercache_h
+
+#include <mutex>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+class BASICHEADER;
+
+/*
+  Parsed header cache, shared by any number of TIFF objects and threads.
+
+  To use
+	HEADERCACHE headers (64);
+	TIFF tiff;
+	tiff.headercache = &headers;
+	tiff.file_read ("C:\\big.tif");
+	data = tiff.load_tiff ();
+
+  Validated headers are keyed by file (path, size and mtime) and IFD
+  offset. Opening the same file again skips load_header, fill_header and
+  the checks and goes straight to the pixels.
+*/
+
+/// <summary>
+/// thread safe LRU cache of validated headers, capped by entry count
+/// </summary>
+class HEADERCACHE
+{
+private:
+	class ENTRY
+	{
+	public:
+		std::string key;
+		BASICHEADER* header;
+	};
+	std::mutex lock;
+	std::list<ENTRY> entries;   // most recently used first
+	std::unordered_map<std::string, std::list<ENTRY>::iterator> index;
+	int capacity;
+	static std::string make_key (const std::string& file, unsigned long ifd);
+public:
+	explicit HEADERCACHE (int capacity);
+	~HEADERCACHE ();
+	bool get (const std::string& file, unsigned long ifd, BASICHEADER* header);
+	void put (const std::string& file, unsigned long ifd, const BASICHEADER* header);
+	void clear ();
+};
+
+#endif
@@ -0,0 +1,1470 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define JPEG_SSE2
+#endif
+
+#include "loadtiff.h"
+#include "jpegdec.h"
+
+// zigzag order to natural order, padded so a corrupt run can't index past the block
+static const BYTE dezigzag[64 + 16] = {
+	0, 1, 8, 16, 9, 2, 3, 10,
+	17, 24, 32, 25, 18, 11, 4, 5,
+	12, 19, 26, 33, 40, 48, 41, 34,
+	27, 20, 13, 6, 7, 14, 21, 28,
+	35, 42, 49, 56, 57, 50, 43, 36,
+	29, 22, 15, 23, 30, 37, 44, 51,
+	58, 59, 52, 45, 38, 31, 39, 46,
+	53, 60, 61, 54, 47, 55, 62, 63,
+	63, 63, 63, 63, 63, 63, 63, 63,
+	63, 63, 63, 63, 63, 63, 63, 63
+};
+
+// AAN scale factors, cos (k * pi / 16) * sqrt (2) for k > 0
+static const float aanscale[8] = {
+	1.0f, 1.387039845f, 1.306562965f, 1.175875602f,
+	1.0f, 0.785694958f, 0.541196100f, 0.275899379f
+};
+
+/// <summary>
+/// build the lookup tables from a DHT entry
+/// </summary>
+/// <param name="counts">number of codes of each length 1 to 16</param>
+/// <param name="symbols">symbols in code order</param>
+/// <returns>false if the code lengths are impossible</returns>
+bool JPEGHUFFMAN::build (const BYTE* counts, const BYTE* symbols)
+{
+	unsigned int next = 0;
+	int n = 0;
+	int k = 0;
+
+	present = false;
+	for (auto i = 0; i < 16; i++) {
+		for (auto j = 0; j < counts[i]; j++) {
+			if (n >= 256) {
+				return false;
+			}
+			size[n++] = (BYTE)(i + 1);
+		}
+	}
+	size[n] = 0;
+	memcpy (values, symbols, n);
+
+	for (auto len = 1; len <= 16; len++) {
+		delta[len] = k - (int)next;
+		if (size[k] == len) {
+			while (size[k] == len) {
+				code[k++] = (unsigned short)next++;
+			}
+			if (next - 1 >= (1u << len)) {
+				return false;
+			}
+		}
+		maxcode[len] = next << (16 - len);
+		next <<= 1;
+	}
+	maxcode[17] = 0xFFFFFFFF;
+
+	memset (fast, 255, sizeof (fast));
+	for (auto i = 0; i < n; i++) {
+		int s = size[i];
+		if (s <= FAST_BITS) {
+			int c = code[i] << (FAST_BITS - s);
+			int m = 1 << (FAST_BITS - s);
+			for (auto j = 0; j < m; j++) {
+				fast[c + j] = (BYTE)i;
+			}
+		}
+	}
+	present = true;
+	return true;
+}
+
+/// <summary>
+/// take in one table segment
+/// </summary>
+/// <param name="marker">DQT, DHT or DRI, anything else is ignored</param>
+/// <param name="data">segment body, after the length</param>
+/// <param name="len">bytes of body</param>
+/// <returns>false if the segment is corrupt</returns>
+bool JPEGTABLES::segment (int marker, const BYTE* data, int len)
+{
+	switch (marker) {
+	case 0xDB:
+		while (len > 0) {
+			int precision = data[0] >> 4;
+			int index = data[0] & 15;
+			int need = 1 + (precision ? 128 : 64);
+			if (precision > 1 || index > 3 || len < need) {
+				return false;
+			}
+			for (auto i = 0; i < 64; i++) {
+				quant[index][dezigzag[i]] = precision ? (unsigned short)(data[1 + i * 2] << 8 | data[2 + i * 2]) : data[1 + i];
+			}
+			hasquant[index] = true;
+			data += need;
+			len -= need;
+		}
+		return true;
+	case 0xC4:
+		while (len > 0) {
+			int n = 0;
+			if (len < 17) {
+				return false;
+			}
+			int tableclass = data[0] >> 4;
+			int index = data[0] & 15;
+			if (tableclass > 1 || index > 3) {
+				return false;
+			}
+			for (auto i = 0; i < 16; i++) {
+				n += data[1 + i];
+			}
+			if (n > 256 || len < 17 + n) {
+				return false;
+			}
+			if (!(tableclass ? ac[index] : dc[index]).build (data + 1, data + 17)) {
+				return false;
+			}
+			data += 17 + n;
+			len -= 17 + n;
+		}
+		return true;
+	case 0xDD:
+		if (len < 2) {
+			return false;
+		}
+		restart_interval = data[0] << 8 | data[1];
+		return true;
+	default:
+		return true;
+	}
+}
+
+/// <summary>
+/// read the tables out of an abbreviated stream (SOI, tables, EOI), as
+/// stored in the JPEGTables tag
+/// </summary>
+/// <param name="data"></param>
+/// <param name="N"></param>
+/// <returns>false if a table is corrupt</returns>
+bool JPEGTABLES::parse (const BYTE* data, unsigned long N)
+{
+	unsigned long pos = 0;
+
+	while (pos + 4 <= N) {
+		if (data[pos] != 0xFF || data[pos + 1] == 0xFF) {
+			pos++;
+			continue;
+		}
+		int marker = data[pos + 1];
+		if (marker == 0xD9) {
+			break;
+		}
+		if (marker == 0xD8 || marker == 0x01 || marker == 0x00 || (marker >= 0xD0 && marker <= 0xD7)) {
+			pos += 2;
+			continue;
+		}
+		int len = data[pos + 2] << 8 | data[pos + 3];
+		if (len < 2 || pos + 2 + len > N) {
+			return false;
+		}
+		if (!segment (marker, data + pos + 4, len - 2)) {
+			return false;
+		}
+		pos += 2 + len;
+	}
+	return true;
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* IDCT */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+#ifdef JPEG_SSE2
+/// <summary>
+/// four floats, so the butterflies below can be written once for both paths
+/// </summary>
+class F4
+{
+public:
+	__m128 v;
+	F4 ()
+	{
+	}
+	F4 (__m128 v) : v (v)
+	{
+	}
+	explicit F4 (float f) : v (_mm_set1_ps (f))
+	{
+	}
+};
+static inline F4 operator+ (F4 a, F4 b) { return _mm_add_ps (a.v, b.v); }
+static inline F4 operator- (F4 a, F4 b) { return _mm_sub_ps (a.v, b.v); }
+static inline F4 operator* (F4 a, F4 b) { return _mm_mul_ps (a.v, b.v); }
+#endif
+
+/// <summary>
+/// one dimensional floating point AAN inverse DCT (as libjpeg's jidctflt),
+/// on eight scalars or eight vectors of four columns
+/// </summary>
+/// <param name="v">in and out, frequency order in, sample order out</param>
+template <class T> static inline void aan_1d (T* v)
+{
+	T tmp10 = v[0] + v[4];
+	T tmp11 = v[0] - v[4];
+	T tmp13 = v[2] + v[6];
+	T tmp12 = (v[2] - v[6]) * T (1.414213562f) - tmp13;
+	T tmp0 = tmp10 + tmp13;
+	T tmp3 = tmp10 - tmp13;
+	T tmp1 = tmp11 + tmp12;
+	T tmp2 = tmp11 - tmp12;
+
+	T z13 = v[5] + v[3];
+	T z10 = v[5] - v[3];
+	T z11 = v[1] + v[7];
+	T z12 = v[1] - v[7];
+	T tmp7 = z11 + z13;
+	tmp11 = (z11 - z13) * T (1.414213562f);
+	T z5 = (z10 + z12) * T (1.847759065f);
+	tmp10 = z12 * T (1.082392200f) - z5;
+	tmp12 = z10 * T (-2.613125930f) + z5;
+	T tmp6 = tmp12 - tmp7;
+	T tmp5 = tmp11 - tmp6;
+	T tmp4 = tmp10 + tmp5;
+
+	v[0] = tmp0 + tmp7;
+	v[7] = tmp0 - tmp7;
+	v[1] = tmp1 + tmp6;
+	v[6] = tmp1 - tmp6;
+	v[2] = tmp2 + tmp5;
+	v[5] = tmp2 - tmp5;
+	v[4] = tmp3 + tmp4;
+	v[3] = tmp3 - tmp4;
+}
+
+/// <summary>
+/// round an IDCT output to a sample
+/// </summary>
+static inline BYTE descale (float x)
+{
+	if (x < -1024.0f) {
+		x = -1024.0f;
+	}
+	if (x > 1024.0f) {
+		x = 1024.0f;
+	}
+	int s = (int)lrintf (x) + 128;
+	return (BYTE)(s < 0 ? 0 : s > 255 ? 255 : s);
+}
+
+/// <summary>
+/// block with no AC coefficients, every sample is the DC level
+/// </summary>
+/// <param name="size">8, or 4, 2 or 1 for a reduced block</param>
+static void idct_dc (const short* in, const float* qf, BYTE* out, int stride, int size)
+{
+	BYTE s = descale (in[0] * qf[0]);
+	for (auto y = 0; y < size; y++) {
+		memset (out + y * stride, s, size);
+	}
+}
+
+#ifdef JPEG_SSE2
+/// <summary>
+/// 8x8 IDCT as two halves of four columns, transposed between the passes
+/// </summary>
+static void idct_block (const short* in, const float* qf, BYTE* out, int stride)
+{
+	F4 lo[8];
+	F4 hi[8];
+	F4 a[8];
+	F4 b[8];
+
+	for (auto k = 0; k < 8; k++) {
+		__m128i s = _mm_loadu_si128 ((const __m128i*)(in + k * 8));
+		__m128i sign = _mm_srai_epi16 (s, 15);
+		lo[k] = _mm_mul_ps (_mm_cvtepi32_ps (_mm_unpacklo_epi16 (s, sign)), _mm_loadu_ps (qf + k * 8));
+		hi[k] = _mm_mul_ps (_mm_cvtepi32_ps (_mm_unpackhi_epi16 (s, sign)), _mm_loadu_ps (qf + k * 8 + 4));
+	}
+	aan_1d (lo);
+	aan_1d (hi);
+	// a holds rows 0-3 and b rows 4-7, one vector per column
+	for (auto i = 0; i < 4; i++) {
+		a[i] = lo[i];
+		a[i + 4] = hi[i];
+		b[i] = lo[i + 4];
+		b[i + 4] = hi[i + 4];
+	}
+	_MM_TRANSPOSE4_PS (a[0].v, a[1].v, a[2].v, a[3].v);
+	_MM_TRANSPOSE4_PS (a[4].v, a[5].v, a[6].v, a[7].v);
+	_MM_TRANSPOSE4_PS (b[0].v, b[1].v, b[2].v, b[3].v);
+	_MM_TRANSPOSE4_PS (b[4].v, b[5].v, b[6].v, b[7].v);
+	aan_1d (a);
+	aan_1d (b);
+	_MM_TRANSPOSE4_PS (a[0].v, a[1].v, a[2].v, a[3].v);
+	_MM_TRANSPOSE4_PS (a[4].v, a[5].v, a[6].v, a[7].v);
+	_MM_TRANSPOSE4_PS (b[0].v, b[1].v, b[2].v, b[3].v);
+	_MM_TRANSPOSE4_PS (b[4].v, b[5].v, b[6].v, b[7].v);
+
+	const __m128i bias = _mm_set1_epi16 (128);
+	for (auto r = 0; r < 4; r++) {
+		__m128i w = _mm_packs_epi32 (_mm_cvtps_epi32 (a[r].v), _mm_cvtps_epi32 (a[r + 4].v));
+		w = _mm_adds_epi16 (w, bias);
+		_mm_storel_epi64 ((__m128i*)(out + r * stride), _mm_packus_epi16 (w, w));
+		w = _mm_packs_epi32 (_mm_cvtps_epi32 (b[r].v), _mm_cvtps_epi32 (b[r + 4].v));
+		w = _mm_adds_epi16 (w, bias);
+		_mm_storel_epi64 ((__m128i*)(out + (r + 4) * stride), _mm_packus_epi16 (w, w));
+	}
+}
+#else
+/// <summary>
+/// 8x8 IDCT, columns then rows
+/// </summary>
+static void idct_block (const short* in, const float* qf, BYTE* out, int stride)
+{
+	float ws[64];
+	float v[8];
+
+	for (auto x = 0; x < 8; x++) {
+		for (auto k = 0; k < 8; k++) {
+			v[k] = in[k * 8 + x] * qf[k * 8 + x];
+		}
+		aan_1d (v);
+		for (auto k = 0; k < 8; k++) {
+			ws[k * 8 + x] = v[k];
+		}
+	}
+	for (auto y = 0; y < 8; y++) {
+		aan_1d (ws + y * 8);
+		for (auto k = 0; k < 8; k++) {
+			out[y * stride + k] = descale (ws[y * 8 + k]);
+		}
+	}
+}
+#endif
+
+/// <summary>
+/// true if any AC coefficient of a block is set
+/// </summary>
+static bool has_ac (const short* block)
+{
+	for (auto i = 1; i < 64; i++) {
+		if (block[i]) {
+			return true;
+		}
+	}
+	return false;
+}
+
+/// <summary>
+/// reduced IDCT bases. Row n of the S point table is the 8 point IDCT
+/// averaged over output samples n * 8 / S to (n + 1) * 8 / S - 1, so an
+/// S x S block is the 8x8 block box filtered, as libjpeg's reduced IDCTs
+/// give. Coefficients that cancel out over a group come out as zero.
+/// </summary>
+class REDUCEDIDCT
+{
+public:
+	float m4[4][8];
+	float m2[2][8];
+
+	REDUCEDIDCT ()
+	{
+		fill (&m4[0][0], 4);
+		fill (&m2[0][0], 2);
+	}
+	static void fill (float* m, int S)
+	{
+		const double pi = 3.14159265358979323846;
+		int group = 8 / S;
+		for (auto n = 0; n < S; n++) {
+			for (auto k = 0; k < 8; k++) {
+				double sum = 0.0;
+				for (auto j = n * group; j < (n + 1) * group; j++) {
+					sum += cos ((2 * j + 1) * k * pi / 16.0);
+				}
+				sum *= (k == 0 ? sqrt (0.5) : 1.0) / 2.0 / group;
+				m[n * 8 + k] = fabs (sum) < 1e-9 ? 0.0f : (float)sum;
+			}
+		}
+	}
+	static const REDUCEDIDCT& get ()
+	{
+		static const REDUCEDIDCT tables;
+		return tables;
+	}
+};
+
+/// <summary>
+/// S x S output from an 8x8 block of coefficients, for 1/2 and 1/4 scale
+/// </summary>
+/// <param name="in">coefficients, natural order</param>
+/// <param name="qr">plain dequantisation factors</param>
+/// <param name="m">S x 8 basis from REDUCEDIDCT</param>
+template <int S> static void idct_reduced (const short* in, const float* qr, const float (*m)[8], BYTE* out, int stride)
+{
+	float ws[S][8];
+
+	for (auto x = 0; x < 8; x++) {
+		float col[8];
+		bool zero = true;
+		for (auto k = 0; k < 8; k++) {
+			col[k] = in[k * 8 + x] * qr[k * 8 + x];
+			zero = zero && in[k * 8 + x] == 0;
+		}
+		for (auto n = 0; n < S; n++) {
+			float sum = 0.0f;
+			if (!zero) {
+				for (auto k = 0; k < 8; k++) {
+					sum += m[n][k] * col[k];
+				}
+			}
+			ws[n][x] = sum;
+		}
+	}
+	for (auto n = 0; n < S; n++) {
+		for (auto j = 0; j < S; j++) {
+			float sum = 0.0f;
+			for (auto x = 0; x < 8; x++) {
+				sum += ws[n][x] * m[j][x];
+			}
+			out[n * stride + j] = descale (sum);
+		}
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* upsampling and colour */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// double the width of a row, 3/4 nearer sample + 1/4 further one
+/// </summary>
+/// <param name="out">2 * n samples</param>
+/// <param name="in">n samples</param>
+/// <param name="n"></param>
+static void upsample_h2 (BYTE* out, const BYTE* in, int n)
+{
+	auto pair = [out, in, n] (int i) {
+		int left = in[i > 0 ? i - 1 : 0];
+		int right = in[i < n - 1 ? i + 1 : n - 1];
+		int here = in[i] * 3;
+		out[i * 2] = (BYTE)((here + left + 1) >> 2);
+		out[i * 2 + 1] = (BYTE)((here + right + 2) >> 2);
+	};
+	int i = 0;
+
+	if (n > 0) {
+		pair (i++);
+	}
+#ifdef JPEG_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	for (; i + 9 <= n; i += 8) {
+		__m128i left = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(in + i - 1)), zero);
+		__m128i here = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(in + i)), zero);
+		__m128i right = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(in + i + 1)), zero);
+		here = _mm_add_epi16 (here, _mm_add_epi16 (here, here));
+		__m128i even = _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (here, left), _mm_set1_epi16 (1)), 2);
+		__m128i odd = _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (here, right), _mm_set1_epi16 (2)), 2);
+		__m128i lo = _mm_unpacklo_epi16 (even, odd);
+		__m128i hi = _mm_unpackhi_epi16 (even, odd);
+		_mm_storeu_si128 ((__m128i*)(out + i * 2), _mm_packus_epi16 (lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		pair (i);
+	}
+}
+
+/// <summary>
+/// one output row between two input rows, 3/4 nearer row + 1/4 further one
+/// </summary>
+/// <param name="out">n samples</param>
+/// <param name="upper">nearer row</param>
+/// <param name="lower">further row</param>
+/// <param name="n"></param>
+/// <param name="bias">1 for the upper output row, 2 for the lower</param>
+static void upsample_v2 (BYTE* out, const BYTE* upper, const BYTE* lower, int n, int bias)
+{
+	int i = 0;
+#ifdef JPEG_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i b = _mm_set1_epi16 ((short)bias);
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(upper + i)), zero);
+		__m128i c = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(lower + i)), zero);
+		a = _mm_add_epi16 (_mm_add_epi16 (a, _mm_add_epi16 (a, a)), _mm_add_epi16 (c, b));
+		a = _mm_srli_epi16 (a, 2);
+		_mm_storel_epi64 ((__m128i*)(out + i), _mm_packus_epi16 (a, a));
+	}
+#endif
+	for (; i < n; i++) {
+		out[i] = (BYTE)((upper[i] * 3 + lower[i] + bias) >> 2);
+	}
+}
+
+/// <summary>
+/// double a row both ways, vertical 3:1 column sums then the same horizontally
+/// </summary>
+/// <param name="out">2 * n samples</param>
+/// <param name="upper">nearer row</param>
+/// <param name="lower">further row</param>
+/// <param name="n"></param>
+/// <param name="sums">n column sums of workspace</param>
+static void upsample_h2v2 (BYTE* out, const BYTE* upper, const BYTE* lower, int n, unsigned short* sums)
+{
+	auto pair = [out, sums, n] (int i) {
+		int left = sums[i > 0 ? i - 1 : 0];
+		int right = sums[i < n - 1 ? i + 1 : n - 1];
+		int here = sums[i] * 3;
+		out[i * 2] = (BYTE)((here + left + 8) >> 4);
+		out[i * 2 + 1] = (BYTE)((here + right + 7) >> 4);
+	};
+	int i = 0;
+
+#ifdef JPEG_SSE2
+	const __m128i zero = _mm_setzero_si128 ();
+	for (; i + 8 <= n; i += 8) {
+		__m128i a = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(upper + i)), zero);
+		__m128i c = _mm_unpacklo_epi8 (_mm_loadl_epi64 ((const __m128i*)(lower + i)), zero);
+		_mm_storeu_si128 ((__m128i*)(sums + i), _mm_add_epi16 (_mm_add_epi16 (a, _mm_add_epi16 (a, a)), c));
+	}
+#endif
+	for (; i < n; i++) {
+		sums[i] = (unsigned short)(upper[i] * 3 + lower[i]);
+	}
+	i = 0;
+	if (n > 0) {
+		pair (i++);
+	}
+#ifdef JPEG_SSE2
+	for (; i + 9 <= n; i += 8) {
+		__m128i left = _mm_loadu_si128 ((const __m128i*)(sums + i - 1));
+		__m128i here = _mm_loadu_si128 ((const __m128i*)(sums + i));
+		__m128i right = _mm_loadu_si128 ((const __m128i*)(sums + i + 1));
+		here = _mm_add_epi16 (here, _mm_add_epi16 (here, here));
+		__m128i even = _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (here, left), _mm_set1_epi16 (8)), 4);
+		__m128i odd = _mm_srli_epi16 (_mm_add_epi16 (_mm_add_epi16 (here, right), _mm_set1_epi16 (7)), 4);
+		__m128i lo = _mm_unpacklo_epi16 (even, odd);
+		__m128i hi = _mm_unpackhi_epi16 (even, odd);
+		_mm_storeu_si128 ((__m128i*)(out + i * 2), _mm_packus_epi16 (lo, hi));
+	}
+#endif
+	for (; i < n; i++) {
+		pair (i);
+	}
+}
+
+/// <summary>
+/// libjpeg's fixed point YCbCr to RGB tables
+/// </summary>
+class YCCTABLES
+{
+public:
+	int cr_r[256];
+	int cb_b[256];
+	int cr_g[256];
+	int cb_g[256];
+
+	YCCTABLES ()
+	{
+		const int half = 1 << 15;
+		for (auto i = 0; i < 256; i++) {
+			int x = i - 128;
+			cr_r[i] = (91881 * x + half) >> 16;
+			cb_b[i] = (116130 * x + half) >> 16;
+			cr_g[i] = -46802 * x;
+			cb_g[i] = -22554 * x + half;
+		}
+	}
+	static const YCCTABLES& get ()
+	{
+		static const YCCTABLES tables;
+		return tables;
+	}
+};
+
+static inline BYTE clamp_sample (int x)
+{
+	return (BYTE)(x < 0 ? 0 : x > 255 ? 255 : x);
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* decoder */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// one colour component of a frame
+/// </summary>
+class JPEGCOMPONENT
+{
+public:
+	int id;
+	int h, v;                       // sampling factors
+	int tq;                         // quantisation table
+	int td, ta;                     // Huffman tables in the current scan
+	const JPEGHUFFMAN* dctable;
+	const JPEGHUFFMAN* actable;
+	int bw, bh;                     // blocks across and down, padded to whole MCUs
+	int blocksw, blocksh;           // blocks holding image data, a single component scan codes just these
+	int bs;                         // samples across a decoded block, 8 unless scaled down
+	int eh, ev;                     // sampling factors of the decoded plane, h and v unless scaled down
+	int dw, dh;                     // samples across and down
+	int dcpred;
+	BYTE* plane;                    // bw * bs by bh * bs samples
+	short* coefs;                   // progressive only, 64 per block in natural order
+	float qf[64];                   // dequantisation with the IDCT scaling folded in
+	float qr[64];                   // plain dequantisation, for the reduced IDCTs
+
+	JPEGCOMPONENT ()
+	{
+		id = 0;
+		h = v = 1;
+		tq = td = ta = 0;
+		dctable = actable = NULL;
+		bw = bh = dw = dh = 0;
+		blocksw = blocksh = 0;
+		bs = 8;
+		eh = ev = 1;
+		dcpred = 0;
+		plane = NULL;
+		coefs = NULL;
+	}
+	~JPEGCOMPONENT ()
+	{
+		delete[] plane;
+		delete[] coefs;
+	}
+};
+
+/// <summary>
+/// state for decoding one stream
+/// </summary>
+class JPEGDECODER
+{
+public:
+	const BYTE* data;
+	unsigned long N;
+	unsigned long pos;
+	unsigned long long acc;         // bit buffer, next bit at the top
+	int count;                      // bits in acc
+	bool atmarker;                  // ran into a marker, feed zeros from now on
+	const JPEGTABLES* shared;
+	JPEGTABLES local;
+	JPEGCOMPONENT comp[4];
+	int ncomp;
+	int width;
+	int height;
+	int scale;                      // 1, 2, 4 or 8, output is the frame divided by this
+	int outwidth;
+	int outheight;
+	int hmax, vmax;
+	int mcux, mcuy;                 // MCUs across and down
+	bool progressive;
+	bool frame;
+	int restart_interval;
+	int eobrun;
+	/* current scan */
+	int ns;
+	int order[4];
+	int ss, se, ah, al;
+	/* output */
+	BYTE* rowbuf[4];
+	unsigned short* sums;
+
+	JPEGDECODER (const BYTE* data, unsigned long N, const JPEGTABLES* shared, int scale)
+	{
+		this->data = data;
+		this->N = N;
+		this->shared = shared;
+		this->scale = scale;
+		outwidth = outheight = 0;
+		pos = 0;
+		acc = 0;
+		count = 0;
+		atmarker = false;
+		ncomp = 0;
+		width = height = 0;
+		hmax = vmax = 1;
+		mcux = mcuy = 0;
+		progressive = false;
+		frame = false;
+		restart_interval = shared && shared->restart_interval > 0 ? shared->restart_interval : 0;
+		local.ycbcr = shared ? shared->ycbcr : false;
+		eobrun = 0;
+		ns = 0;
+		ss = se = ah = al = 0;
+		for (auto i = 0; i < 4; i++) {
+			order[i] = 0;
+			rowbuf[i] = NULL;
+		}
+		sums = NULL;
+	}
+	~JPEGDECODER ()
+	{
+		for (auto i = 0; i < 4; i++) {
+			delete[] rowbuf[i];
+		}
+		delete[] sums;
+	}
+
+	void run ();
+	void start_of_frame (const BYTE* p, int len, bool isprogressive);
+	void start_of_scan (const BYTE* p, int len);
+	void decode_scan ();
+	void decode_block (JPEGCOMPONENT* c, int bx, int by, short* block);
+	void restart ();
+	void transform (JPEGCOMPONENT* c, const short* block, BYTE* out, bool ac);
+	void finish ();
+	BYTE* output (unsigned long* Nret);
+	const BYTE* component_row (int index, int y);
+	const JPEGHUFFMAN* huffman (bool isac, int index);
+	void set_quant (JPEGCOMPONENT* c);
+	bool block_baseline (JPEGCOMPONENT* c, short* block);
+	void dc_first (JPEGCOMPONENT* c, short* block);
+	void dc_refine (short* block);
+	void ac_first (JPEGCOMPONENT* c, short* block);
+	void ac_refine (JPEGCOMPONENT* c, short* block);
+
+	/// <summary>
+	/// top the bit buffer up, unstuffing 0xFF 0x00 and stopping at markers
+	/// </summary>
+	void refill ()
+	{
+		while (count <= 56) {
+			unsigned int b = 0;
+			if (!atmarker) {
+				if (pos < N && data[pos] != 0xFF) {
+					b = data[pos++];
+				}
+				else if (pos + 1 < N && data[pos + 1] == 0) {
+					b = 0xFF;
+					pos += 2;
+				}
+				else {
+					atmarker = true;
+				}
+			}
+			acc |= (unsigned long long)b << (56 - count);
+			count += 8;
+		}
+	}
+
+	/// <summary>
+	/// next n bits, 1 to 16
+	/// </summary>
+	unsigned int getbits (int n)
+	{
+		if (count < n) {
+			refill ();
+		}
+		unsigned int answer = (unsigned int)(acc >> (64 - n));
+		acc <<= n;
+		count -= n;
+		return answer;
+	}
+
+	/// <summary>
+	/// s bit signed value of a coefficient or DC difference
+	/// </summary>
+	int extend (int s)
+	{
+		if (s == 0) {
+			return 0;
+		}
+		if (s > 16) {
+			throw general_exception ("parse_error");
+		}
+		int x = (int)getbits (s);
+		return x < (1 << (s - 1)) ? x - (1 << s) + 1 : x;
+	}
+
+	/// <summary>
+	/// next Huffman coded symbol
+	/// </summary>
+	int decode (const JPEGHUFFMAN* h)
+	{
+		if (count < 16) {
+			refill ();
+		}
+		int k = h->fast[acc >> (64 - JPEGHUFFMAN::FAST_BITS)];
+		if (k < 255) {
+			int s = h->size[k];
+			acc <<= s;
+			count -= s;
+			return h->values[k];
+		}
+		unsigned int top = (unsigned int)(acc >> 48);
+		int len;
+		for (len = JPEGHUFFMAN::FAST_BITS + 1; top >= h->maxcode[len]; len++) {
+		}
+		if (len > 16) {
+			throw general_exception ("parse_error");
+		}
+		k = (int)(acc >> (64 - len)) + h->delta[len];
+		if (k < 0 || k > 255) {
+			throw general_exception ("parse_error");
+		}
+		acc <<= len;
+		count -= len;
+		return h->values[k];
+	}
+};
+
+/// <summary>
+/// walk the markers, decoding each scan as it comes
+/// </summary>
+void JPEGDECODER::run ()
+{
+	if (N < 2 || data[0] != 0xFF || data[1] != 0xD8) {
+		throw general_exception ("parse_error");
+	}
+	pos = 2;
+	for (;;) {
+		while (pos < N && data[pos] != 0xFF) {
+			pos++;
+		}
+		while (pos < N && data[pos] == 0xFF) {
+			pos++;
+		}
+		if (pos >= N) {
+			break;
+		}
+		int marker = data[pos++];
+		if (marker == 0xD9) {
+			break;
+		}
+		if (marker == 0xD8 || marker == 0x01 || marker == 0x00 || (marker >= 0xD0 && marker <= 0xD7)) {
+			continue;
+		}
+		if (pos + 2 > N) {
+			break;
+		}
+		int len = data[pos] << 8 | data[pos + 1];
+		if (len < 2 || pos + len > N) {
+			throw general_exception ("parse_error");
+		}
+		const BYTE* p = data + pos + 2;
+		pos += len;
+		switch (marker) {
+		case 0xC0:
+		case 0xC1:
+			start_of_frame (p, len - 2, false);
+			break;
+		case 0xC2:
+			start_of_frame (p, len - 2, true);
+			break;
+		case 0xC4:
+		case 0xDB:
+		case 0xDD:
+			if (!local.segment (marker, p, len - 2)) {
+				throw general_exception ("parse_error");
+			}
+			if (marker == 0xDD) {
+				restart_interval = local.restart_interval;
+			}
+			break;
+		case 0xDA:
+			start_of_scan (p, len - 2);
+			decode_scan ();
+			break;
+		default:
+			// lossless, hierarchical and arithmetic coded frames
+			if (marker >= 0xC3 && marker <= 0xCF) {
+				throw general_exception ("parse_error");
+			}
+			break;
+		}
+	}
+	if (!frame) {
+		throw general_exception ("parse_error");
+	}
+	if (progressive) {
+		finish ();
+	}
+}
+
+/// <summary>
+/// SOF: image size and components, allocates the planes
+/// </summary>
+void JPEGDECODER::start_of_frame (const BYTE* p, int len, bool isprogressive)
+{
+	if (frame || len < 6 || p[0] != 8) {
+		throw general_exception ("parse_error");
+	}
+	height = p[1] << 8 | p[2];
+	width = p[3] << 8 | p[4];
+	ncomp = p[5];
+	if (width == 0 || height == 0 || ncomp < 1 || ncomp > 4 || len < 6 + ncomp * 3) {
+		throw general_exception ("parse_error");
+	}
+	for (auto i = 0; i < ncomp; i++) {
+		JPEGCOMPONENT* c = &comp[i];
+		c->id = p[6 + i * 3];
+		c->h = p[7 + i * 3] >> 4;
+		c->v = p[7 + i * 3] & 15;
+		c->tq = p[8 + i * 3];
+		if (c->h < 1 || c->h > 4 || c->v < 1 || c->v > 4 || c->tq > 3) {
+			throw general_exception ("parse_error");
+		}
+		hmax = c->h > hmax ? c->h : hmax;
+		vmax = c->v > vmax ? c->v : vmax;
+	}
+	mcux = (width + 8 * hmax - 1) / (8 * hmax);
+	mcuy = (height + 8 * vmax - 1) / (8 * vmax);
+	outwidth = (width + scale - 1) / scale;
+	outheight = (height + scale - 1) / scale;
+	for (auto i = 0; i < ncomp; i++) {
+		JPEGCOMPONENT* c = &comp[i];
+		c->bw = mcux * c->h;
+		c->bh = mcuy * c->v;
+		c->blocksw = ((width * c->h + hmax - 1) / hmax + 7) / 8;
+		c->blocksh = ((height * c->v + vmax - 1) / vmax + 7) / 8;
+		// scaled down, subsampled chroma takes a bigger IDCT rather than
+		// being upsampled, as libjpeg does
+		c->bs = 8 / scale;
+		while (c->bs < 8 && c->h * c->bs * 2 <= hmax * 8 / scale && c->v * c->bs * 2 <= vmax * 8 / scale) {
+			c->bs *= 2;
+		}
+		c->eh = c->h * c->bs * scale / 8;
+		c->ev = c->v * c->bs * scale / 8;
+		c->dw = (int)(((long long)width * c->h * c->bs + hmax * 8 - 1) / (hmax * 8));
+		c->dh = (int)(((long long)height * c->v * c->bs + vmax * 8 - 1) / (vmax * 8));
+		c->plane = new BYTE[(size_t)c->bw * c->bs * c->bh * c->bs];
+		if (!c->plane) {
+			throw general_exception ("out_of_memory");
+		}
+		if (isprogressive) {
+			c->coefs = new short[(size_t)c->bw * c->bh * 64];
+			if (!c->coefs) {
+				throw general_exception ("out_of_memory");
+			}
+			memset (c->coefs, 0, (size_t)c->bw * c->bh * 64 * sizeof (short));
+		}
+	}
+	progressive = isprogressive;
+	frame = true;
+}
+
+/// <summary>
+/// a Huffman table, the stream's own if it defined one, else the shared one
+/// </summary>
+const JPEGHUFFMAN* JPEGDECODER::huffman (bool isac, int index)
+{
+	const JPEGHUFFMAN* h = isac ? &local.ac[index] : &local.dc[index];
+	if (!h->present && shared) {
+		h = isac ? &shared->ac[index] : &shared->dc[index];
+	}
+	if (!h->present) {
+		throw general_exception ("parse_error");
+	}
+	return h;
+}
+
+/// <summary>
+/// dequantisation factors for a component, with the AAN scaling and
+/// the final divide by 8 folded in
+/// </summary>
+void JPEGDECODER::set_quant (JPEGCOMPONENT* c)
+{
+	const unsigned short* q;
+
+	if (local.hasquant[c->tq]) {
+		q = local.quant[c->tq];
+	}
+	else if (shared && shared->hasquant[c->tq]) {
+		q = shared->quant[c->tq];
+	}
+	else {
+		throw general_exception ("parse_error");
+	}
+	for (auto y = 0; y < 8; y++) {
+		for (auto x = 0; x < 8; x++) {
+			c->qf[y * 8 + x] = q[y * 8 + x] * aanscale[y] * aanscale[x] * 0.125f;
+			c->qr[y * 8 + x] = q[y * 8 + x];
+		}
+	}
+}
+
+/// <summary>
+/// SOS: which components, which tables and, for progressive, which
+/// coefficients and bits
+/// </summary>
+void JPEGDECODER::start_of_scan (const BYTE* p, int len)
+{
+	if (!frame || len < 1) {
+		throw general_exception ("parse_error");
+	}
+	ns = p[0];
+	if (ns < 1 || ns > ncomp || len < 4 + ns * 2) {
+		throw general_exception ("parse_error");
+	}
+	for (auto i = 0; i < ns; i++) {
+		int j;
+		for (j = 0; j < ncomp; j++) {
+			if (comp[j].id == p[1 + i * 2]) {
+				break;
+			}
+		}
+		if (j == ncomp) {
+			throw general_exception ("parse_error");
+		}
+		order[i] = j;
+		comp[j].td = p[2 + i * 2] >> 4;
+		comp[j].ta = p[2 + i * 2] & 15;
+		if (comp[j].td > 3 || comp[j].ta > 3) {
+			throw general_exception ("parse_error");
+		}
+	}
+	p += 1 + ns * 2;
+	ss = p[0];
+	se = p[1];
+	ah = p[2] >> 4;
+	al = p[2] & 15;
+	if (progressive) {
+		if (ss > se || se > 63 || (ss == 0 && se != 0) || (ss > 0 && ns != 1) || al > 13) {
+			throw general_exception ("parse_error");
+		}
+	}
+	for (auto i = 0; i < ns; i++) {
+		JPEGCOMPONENT* c = &comp[order[i]];
+		if (!progressive) {
+			c->dctable = huffman (false, c->td);
+			c->actable = huffman (true, c->ta);
+			set_quant (c);
+		}
+		else if (ss == 0) {
+			c->dctable = ah == 0 ? huffman (false, c->td) : NULL;
+		}
+		else {
+			c->actable = huffman (true, c->ta);
+		}
+	}
+}
+
+/// <summary>
+/// after a restart interval, drop the bits left and step over the RST marker
+/// </summary>
+void JPEGDECODER::restart ()
+{
+	acc = 0;
+	count = 0;
+	atmarker = false;
+	while (pos + 1 < N && !(data[pos] == 0xFF && data[pos + 1] >= 0xD0 && data[pos + 1] <= 0xD7)) {
+		pos++;
+	}
+	if (pos + 1 < N) {
+		pos += 2;
+	}
+	for (auto i = 0; i < ncomp; i++) {
+		comp[i].dcpred = 0;
+	}
+	eobrun = 0;
+}
+
+/// <summary>
+/// entropy coded data of one scan, then on to the next marker
+/// </summary>
+void JPEGDECODER::decode_scan ()
+{
+	short block[64];
+	int mcus = 0;
+
+	acc = 0;
+	count = 0;
+	atmarker = false;
+	eobrun = 0;
+	for (auto i = 0; i < ncomp; i++) {
+		comp[i].dcpred = 0;
+	}
+	if (ns == 1) {
+		// one component, blocks in raster order
+		JPEGCOMPONENT* c = &comp[order[0]];
+		for (auto by = 0; by < c->blocksh; by++) {
+			for (auto bx = 0; bx < c->blocksw; bx++) {
+				if (restart_interval && mcus && mcus % restart_interval == 0) {
+					restart ();
+				}
+				mcus++;
+				decode_block (c, bx, by, block);
+			}
+		}
+	}
+	else {
+		for (auto my = 0; my < mcuy; my++) {
+			for (auto mx = 0; mx < mcux; mx++) {
+				if (restart_interval && mcus && mcus % restart_interval == 0) {
+					restart ();
+				}
+				mcus++;
+				for (auto i = 0; i < ns; i++) {
+					JPEGCOMPONENT* c = &comp[order[i]];
+					for (auto y = 0; y < c->v; y++) {
+						for (auto x = 0; x < c->h; x++) {
+							decode_block (c, mx * c->h + x, my * c->v + y, block);
+						}
+					}
+				}
+			}
+		}
+	}
+	// the scan ends at the first marker that isn't a restart
+	while (pos + 1 < N) {
+		if (data[pos] == 0xFF) {
+			int next = data[pos + 1];
+			if (next != 0x00 && next != 0xFF && !(next >= 0xD0 && next <= 0xD7)) {
+				break;
+			}
+		}
+		pos++;
+	}
+}
+
+/// <summary>
+/// one 8x8 block. Sequential blocks go straight through the IDCT into the
+/// plane, progressive ones are accumulated as coefficients.
+/// </summary>
+void JPEGDECODER::decode_block (JPEGCOMPONENT* c, int bx, int by, short* block)
+{
+	if (!progressive) {
+		memset (block, 0, 64 * sizeof (short));
+		bool ac = block_baseline (c, block);
+		transform (c, block, c->plane + ((size_t)by * c->bs) * c->bw * c->bs + bx * c->bs, ac);
+		return;
+	}
+	short* coefs = c->coefs + ((size_t)by * c->bw + bx) * 64;
+	if (ss == 0) {
+		if (ah == 0) {
+			dc_first (c, coefs);
+		}
+		else {
+			dc_refine (coefs);
+		}
+	}
+	else {
+		if (ah == 0) {
+			ac_first (c, coefs);
+		}
+		else {
+			ac_refine (c, coefs);
+		}
+	}
+}
+
+/// <summary>
+/// sequential block
+/// </summary>
+/// <returns>true if there were AC coefficients</returns>
+bool JPEGDECODER::block_baseline (JPEGCOMPONENT* c, short* block)
+{
+	bool ac = false;
+
+	c->dcpred += extend (decode (c->dctable));
+	block[0] = (short)c->dcpred;
+	for (auto k = 1; k < 64;) {
+		int rs = decode (c->actable);
+		int r = rs >> 4;
+		int s = rs & 15;
+		if (s == 0) {
+			if (r != 15) {
+				break;
+			}
+			k += 16;
+			continue;
+		}
+		k += r;
+		block[dezigzag[k]] = (short)extend (s);
+		ac = true;
+		k++;
+	}
+	return ac;
+}
+
+/// <summary>
+/// progressive, first DC scan
+/// </summary>
+void JPEGDECODER::dc_first (JPEGCOMPONENT* c, short* block)
+{
+	c->dcpred += extend (decode (c->dctable));
+	block[0] = (short)(c->dcpred * (1 << al));
+}
+
+/// <summary>
+/// progressive, DC refinement, one more bit
+/// </summary>
+void JPEGDECODER::dc_refine (short* block)
+{
+	if (getbits (1)) {
+		block[0] |= (short)(1 << al);
+	}
+}
+
+/// <summary>
+/// progressive, first AC scan of a band
+/// </summary>
+void JPEGDECODER::ac_first (JPEGCOMPONENT* c, short* block)
+{
+	if (eobrun) {
+		eobrun--;
+		return;
+	}
+	for (auto k = ss; k <= se;) {
+		int rs = decode (c->actable);
+		int r = rs >> 4;
+		int s = rs & 15;
+		if (s == 0) {
+			if (r < 15) {
+				eobrun = (1 << r) - 1;
+				if (r) {
+					eobrun += getbits (r);
+				}
+				break;
+			}
+			k += 16;
+			continue;
+		}
+		k += r;
+		block[dezigzag[k]] = (short)(extend (s) * (1 << al));
+		k++;
+	}
+}
+
+/// <summary>
+/// progressive, AC refinement: one more bit of the coefficients already
+/// set, and new coefficients of magnitude 1
+/// </summary>
+void JPEGDECODER::ac_refine (JPEGCOMPONENT* c, short* block)
+{
+	short bit = (short)(1 << al);
+	int k = ss;
+
+	auto refine = [this, bit] (short* p) {
+		if (getbits (1) && (*p & bit) == 0) {
+			*p += *p > 0 ? bit : -bit;
+		}
+	};
+
+	if (eobrun) {
+		eobrun--;
+		for (; k <= se; k++) {
+			short* p = &block[dezigzag[k]];
+			if (*p) {
+				refine (p);
+			}
+		}
+		return;
+	}
+	while (k <= se) {
+		int rs = decode (c->actable);
+		int r = rs >> 4;
+		int s = rs & 15;
+		if (s == 0) {
+			if (r < 15) {
+				eobrun = (1 << r) - 1;
+				if (r) {
+					eobrun += getbits (r);
+				}
+				r = 64;
+			}
+			// r == 15 is a run of 16 zeros, the last of them "written" below
+		}
+		else {
+			if (s != 1) {
+				throw general_exception ("parse_error");
+			}
+			s = getbits (1) ? bit : -bit;
+		}
+		while (k <= se) {
+			short* p = &block[dezigzag[k++]];
+			if (*p) {
+				refine (p);
+			}
+			else {
+				if (r == 0) {
+					*p = (short)s;
+					break;
+				}
+				r--;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// dequantise and inverse transform one block into its place in the plane,
+/// at the component's block size
+/// </summary>
+/// <param name="c"></param>
+/// <param name="block">coefficients, natural order</param>
+/// <param name="out">top left of the block in the plane</param>
+/// <param name="ac">false if only the DC coefficient is set</param>
+void JPEGDECODER::transform (JPEGCOMPONENT* c, const short* block, BYTE* out, bool ac)
+{
+	int stride = c->bw * c->bs;
+
+	if (!ac || c->bs == 1) {
+		idct_dc (block, c->qf, out, stride, c->bs);
+	}
+	else if (c->bs == 8) {
+		idct_block (block, c->qf, out, stride);
+	}
+	else if (c->bs == 4) {
+		idct_reduced<4> (block, c->qr, REDUCEDIDCT::get ().m4, out, stride);
+	}
+	else {
+		idct_reduced<2> (block, c->qr, REDUCEDIDCT::get ().m2, out, stride);
+	}
+}
+
+/// <summary>
+/// progressive, all scans read, transform the coefficients
+/// </summary>
+void JPEGDECODER::finish ()
+{
+	for (auto i = 0; i < ncomp; i++) {
+		JPEGCOMPONENT* c = &comp[i];
+		set_quant (c);
+		for (auto by = 0; by < c->blocksh; by++) {
+			for (auto bx = 0; bx < c->blocksw; bx++) {
+				const short* block = c->coefs + ((size_t)by * c->bw + bx) * 64;
+				transform (c, block, c->plane + ((size_t)by * c->bs) * c->bw * c->bs + bx * c->bs, has_ac (block));
+			}
+		}
+	}
+}
+
+/// <summary>
+/// one row of a component at full resolution
+/// </summary>
+/// <param name="index">component</param>
+/// <param name="y">output row</param>
+/// <returns>width samples, in the plane or in rowbuf</returns>
+const BYTE* JPEGDECODER::component_row (int index, int y)
+{
+	JPEGCOMPONENT* c = &comp[index];
+	int stride = c->bw * c->bs;
+	BYTE* out = rowbuf[index];
+	// at 1/8 every block is a single sample, libjpeg replicates there too
+	bool fancy = scale < 8;
+
+	if (c->eh == hmax && c->ev == vmax) {
+		return c->plane + (size_t)y * stride;
+	}
+	if (fancy && c->eh * 2 == hmax && c->ev == vmax) {
+		upsample_h2 (out, c->plane + (size_t)y * stride, c->dw);
+	}
+	else if (fancy && c->ev * 2 == vmax && (c->eh == hmax || c->eh * 2 == hmax)) {
+		// even rows lean on the row above, odd rows on the row below
+		int upper = y >> 1;
+		int lower = (y & 1) ? upper + 1 : upper - 1;
+		lower = lower < 0 ? 0 : lower >= c->dh ? c->dh - 1 : lower;
+		const BYTE* a = c->plane + (size_t)upper * stride;
+		const BYTE* b = c->plane + (size_t)lower * stride;
+		if (c->eh == hmax) {
+			upsample_v2 (out, a, b, c->dw, (y & 1) ? 2 : 1);
+		}
+		else {
+			upsample_h2v2 (out, a, b, c->dw, sums);
+		}
+	}
+	else {
+		// other ratios, plain replication
+		const BYTE* src = c->plane + (size_t)(y * c->ev / vmax) * stride;
+		for (auto x = 0; x < outwidth; x++) {
+			out[x] = src[x * c->eh / hmax];
+		}
+	}
+	return out;
+}
+
+/// <summary>
+/// upsample, convert and interleave the planes
+/// </summary>
+/// <param name="Nret">return for bytes</param>
+/// <returns>outwidth * outheight * ncomp bytes</returns>
+BYTE* JPEGDECODER::output (unsigned long* Nret)
+{
+	BYTE* answer = NULL;
+	const BYTE* rows[4];
+	const YCCTABLES& ycc = YCCTABLES::get ();
+	bool convert = ncomp == 3 && local.ycbcr;
+
+	for (auto i = 0; i < ncomp; i++) {
+		rowbuf[i] = new BYTE[(size_t)outwidth + 32];
+		if (!rowbuf[i]) {
+			throw general_exception ("out_of_memory");
+		}
+	}
+	sums = new unsigned short[(size_t)outwidth + 32];
+	answer = new BYTE[(size_t)outwidth * outheight * ncomp];
+	if (!sums || !answer) {
+		delete[] answer;
+		throw general_exception ("out_of_memory");
+	}
+	for (auto y = 0; y < outheight; y++) {
+		BYTE* out = answer + (size_t)y * outwidth * ncomp;
+		for (auto i = 0; i < ncomp; i++) {
+			rows[i] = component_row (i, y);
+		}
+		if (ncomp == 1) {
+			memcpy (out, rows[0], outwidth);
+		}
+		else if (convert) {
+			for (auto x = 0; x < outwidth; x++) {
+				int luma = rows[0][x];
+				int cb = rows[1][x];
+				int cr = rows[2][x];
+				out[x * 3 + 0] = clamp_sample (luma + ycc.cr_r[cr]);
+				out[x * 3 + 1] = clamp_sample (luma + ((ycc.cb_g[cb] + ycc.cr_g[cr]) >> 16));
+				out[x * 3 + 2] = clamp_sample (luma + ycc.cb_b[cb]);
+			}
+		}
+		else {
+			for (auto x = 0; x < outwidth; x++) {
+				for (auto i = 0; i < ncomp; i++) {
+					out[x * ncomp + i] = rows[i][x];
+				}
+			}
+		}
+	}
+	*Nret = (unsigned long)outwidth * outheight * ncomp;
+	return answer;
+}
+
+/// <summary>
+/// decode one JPEG stream
+/// </summary>
+/// <param name="data">the stream, SOI to EOI</param>
+/// <param name="N">bytes of stream</param>
+/// <param name="tables">tables the stream may rely on, NULL for none</param>
+/// <param name="width">return for width</param>
+/// <param name="height">return for height</param>
+/// <param name="components">return for samples per pixel</param>
+/// <param name="Nret">return for bytes decoded</param>
+/// <param name="scale">1, or 2, 4 or 8 to decode at reduced size with reduced IDCTs</param>
+/// <returns>interleaved 8 bit samples, RGB if tables->ycbcr was set, 0 on fail</returns>
+BYTE* jpeg_decompress (const BYTE* data, unsigned long N, const JPEGTABLES* tables, int* width, int* height, int* components, unsigned long* Nret, int scale)
+{
+	JPEGDECODER decoder (data, N, tables, scale);
+
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+		return 0;
+	}
+	BYTE* answer;
+
+	try {
+		decoder.run ();
+		answer = decoder.output (Nret);
+		*width = decoder.outwidth;
+		*height = decoder.outheight;
+		*components = decoder.ncomp;
+		return answer;
+	}
+	catch (general_exception) {
+		return 0;
+	}
+}
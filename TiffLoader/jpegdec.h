@@ -0,0 +1,75 @@
+#ifndef jpegdec_h
+#define jpegdec_h
+
+/*
+  JPEG decoder for JPEG compressed TIFF strips and tiles (Compression = 7).
+
+  To use
+	JPEGTABLES tables;
+	tables.ycbcr = true;                          // hand YCbCr back as RGB
+	tables.parse (jpegtables, Njpegtables);       // JPEGTables tag, once per IFD
+	data = jpeg_decompress (tile, Ntile, &tables, &width, &height, &components, &N);
+
+  Huffman coded 8 bit baseline, extended and progressive streams, any
+  sampling factors, restart intervals. Arithmetic coding, 12 bit and
+  lossless JPEG are refused. Tables in the stream itself override the
+  shared ones. Chroma is upsampled the way libjpeg does by default
+  (triangle filter for 2x1, 1x2 and 2x2 sampling).
+
+  scale 2, 4 or 8 decodes straight to 1/2, 1/4 or 1/8 size with reduced
+  (4x4, 2x2, DC only) IDCTs; the full size image is never built.
+*/
+
+typedef unsigned char BYTE;
+
+/// <summary>
+/// one Huffman table. Codes of up to FAST_BITS bits decode with a single lookup.
+/// </summary>
+class JPEGHUFFMAN
+{
+public:
+	enum { FAST_BITS = 9 };
+	bool present;
+	BYTE fast[1 << FAST_BITS];      // index into values, 255 for longer codes
+	unsigned short code[256];
+	BYTE size[257];
+	BYTE values[256];
+	unsigned int maxcode[18];       // first code too long for each length, top aligned to 16 bits
+	int delta[17];                  // index into values minus code, per length
+
+	JPEGHUFFMAN ()
+	{
+		present = false;
+	}
+	bool build (const BYTE* counts, const BYTE* symbols);
+};
+
+/// <summary>
+/// quantisation and Huffman tables, either shared by every strip or tile
+/// of an IFD (the JPEGTables tag) or defined by one stream
+/// </summary>
+class JPEGTABLES
+{
+public:
+	unsigned short quant[4][64];    // natural order
+	bool hasquant[4];
+	JPEGHUFFMAN dc[4];
+	JPEGHUFFMAN ac[4];
+	int restart_interval;           // from a DRI segment, -1 if there was none
+	bool ycbcr;                     // three components are YCbCr, convert them to RGB
+
+	JPEGTABLES ()
+	{
+		for (auto i = 0; i < 4; i++) {
+			hasquant[i] = false;
+		}
+		restart_interval = -1;
+		ycbcr = false;
+	}
+	bool parse (const BYTE* data, unsigned long N);
+	bool segment (int marker, const BYTE* data, int len);
+};
+
+BYTE* jpeg_decompress (const BYTE* data, unsigned long N, const JPEGTABLES* tables, int* width, int* height, int* components, unsigned long* Nret, int scale = 1);
+
+#endif
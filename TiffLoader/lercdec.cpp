@@ -0,0 +1,1445 @@
+#include <stdio.h>
+#include <string.h>
+#include <limits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define LERC_SSE2
+#endif
+
+#include "loadtiff.h"
+#include "lercdec.h"
+
+#define LERC_MAXBYTES 0x7FFFFFFF
+
+static const int typesize[8] = { 1, 1, 2, 2, 4, 4, 4, 8 };
+
+// the format is little endian, so are the hosts this builds for
+static inline unsigned int read32 (const BYTE* p)
+{
+	unsigned int x;
+	memcpy (&x, p, 4);
+	return x;
+}
+
+static inline unsigned long long read64 (const BYTE* p)
+{
+	unsigned long long x;
+	memcpy (&x, p, 8);
+	return x;
+}
+
+static inline int readint (const BYTE* p)
+{
+	int x;
+	memcpy (&x, p, 4);
+	return x;
+}
+
+static inline double readdouble (const BYTE* p)
+{
+	double x;
+	memcpy (&x, p, 8);
+	return x;
+}
+
+/// <summary>
+/// element count of a bit stuffed array, stored in 1, 2 or 4 bytes
+/// </summary>
+static inline unsigned int read_count (const BYTE* p, int nb)
+{
+	if (nb == 1) {
+		return p[0];
+	}
+	if (nb == 2) {
+		return p[0] | p[1] << 8;
+	}
+	return read32 (p);
+}
+
+/// <summary>
+/// 32 bit word j of a stream of little endian words, short or missing words read as 0
+/// </summary>
+static inline unsigned int read_word (const BYTE* p, size_t N, size_t j)
+{
+	unsigned int x = 0;
+	if (j * 4 + 4 <= N) {
+		return read32 (p + j * 4);
+	}
+	if (j * 4 < N) {
+		memcpy (&x, p + j * 4, N - j * 4);
+	}
+	return x;
+}
+
+static inline int highbit (unsigned int x)
+{
+	int n = 0;
+	while (x >>= 1) {
+		n++;
+	}
+	return n;
+}
+
+/// <summary>
+/// LERC 2 checksum, over the blob from just after the checksum field
+/// </summary>
+static unsigned int fletcher32 (const BYTE* p, size_t len)
+{
+	unsigned int sum1 = 0xFFFF;
+	unsigned int sum2 = 0xFFFF;
+	size_t words = len / 2;
+
+	while (words) {
+		size_t block = words >= 359 ? 359 : words;
+		words -= block;
+		do {
+			sum1 += *p++ << 8;
+			sum1 += *p++;
+			sum2 += sum1;
+		} while (--block);
+		sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+		sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	}
+	if (len & 1) {
+		sum1 += *p << 8;
+		sum2 += sum1;
+	}
+	sum1 = (sum1 & 0xFFFF) + (sum1 >> 16);
+	sum2 = (sum2 & 0xFFFF) + (sum2 >> 16);
+	return sum2 << 16 | sum1;
+}
+
+/// <summary>
+/// run length coded validity mask: a 16 bit count, that many literal bytes
+/// if it is positive, one byte repeated -count times if not, -32768 ends it
+/// </summary>
+static void rle_decode (const BYTE* p, size_t N, BYTE* out, size_t Nout)
+{
+	size_t pos = 0;
+	size_t at = 0;
+
+	for (;;) {
+		if (N - pos < 2) {
+			throw general_exception ("parse_error");
+		}
+		int count = (short)(p[pos] | p[pos + 1] << 8);
+		pos += 2;
+		if (count == -32768) {
+			break;
+		}
+		if (count > 0) {
+			if (N - pos < (size_t)count || Nout - at < (size_t)count) {
+				throw general_exception ("parse_error");
+			}
+			memcpy (out + at, p + pos, count);
+			pos += count;
+			at += count;
+		}
+		else {
+			if (N - pos < 1 || Nout - at < (size_t)-count) {
+				throw general_exception ("parse_error");
+			}
+			memset (out + at, p[pos], -count);
+			pos++;
+			at += -count;
+		}
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* bit unstuffing */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+#ifdef LERC_SSE2
+/// <summary>
+/// four values of up to 25 bits, each wholly inside the 32 bits loaded for it.
+/// SSE2 has no per lane shift, so each lane is multiplied by 2 ^ (8 - shift)
+/// into 64 bits and the product shifted down by 8.
+/// </summary>
+/// <param name="words">32 bits starting at the byte holding each value's first bit</param>
+/// <param name="scale">2 ^ (8 - bit offset in that byte), per lane</param>
+/// <param name="mask">(1 &lt;&lt; bits) - 1</param>
+static inline __m128i extract4 (__m128i words, __m128i scale, __m128i mask)
+{
+	__m128i even = _mm_srli_epi64 (_mm_mul_epu32 (words, scale), 8);
+	__m128i odd = _mm_srli_epi64 (_mm_mul_epu32 (_mm_srli_epi64 (words, 32), _mm_srli_epi64 (scale, 32)), 8);
+	return _mm_and_si128 (_mm_or_si128 (even, _mm_slli_epi64 (odd, 32)), mask);
+}
+#endif
+
+/// <summary>
+/// LERC 2 from version 3: values packed least significant bit first, the
+/// stream cut to the bytes actually used.
+/// Eight values always take exactly bits bytes, so the byte offsets and
+/// shifts within a group of eight are worked out once and every group
+/// is two extract4s.
+/// </summary>
+/// <param name="p">packed values</param>
+/// <param name="avail">bytes readable from p, at least (count * bits + 7) / 8</param>
+/// <param name="dst">count values</param>
+/// <param name="count"></param>
+/// <param name="bits">1 to 32</param>
+static void unstuff_lsb (const BYTE* p, size_t avail, unsigned int* dst, unsigned int count, int bits)
+{
+	unsigned int mask = bits >= 32 ? 0xFFFFFFFFu : (1u << bits) - 1;
+	unsigned int i = 0;
+	size_t pos = 0;
+
+#ifdef LERC_SSE2
+	if (bits <= 25) {
+		int offset[8];
+		unsigned int scale[8];
+		for (auto k = 0; k < 8; k++) {
+			offset[k] = k * bits >> 3;
+			scale[k] = 1u << (8 - (k * bits & 7));
+		}
+		__m128i scalelo = _mm_loadu_si128 ((const __m128i*)scale);
+		__m128i scalehi = _mm_loadu_si128 ((const __m128i*)(scale + 4));
+		__m128i vmask = _mm_set1_epi32 ((int)mask);
+		const BYTE* q = p;
+		for (; i + 8 <= count && (size_t)(q - p) + offset[7] + 4 <= avail; i += 8, q += bits) {
+			__m128i lo = _mm_setr_epi32 ((int)read32 (q + offset[0]), (int)read32 (q + offset[1]),
+										 (int)read32 (q + offset[2]), (int)read32 (q + offset[3]));
+			__m128i hi = _mm_setr_epi32 ((int)read32 (q + offset[4]), (int)read32 (q + offset[5]),
+										 (int)read32 (q + offset[6]), (int)read32 (q + offset[7]));
+			_mm_storeu_si128 ((__m128i*)(dst + i), extract4 (lo, scalelo, vmask));
+			_mm_storeu_si128 ((__m128i*)(dst + i + 4), extract4 (hi, scalehi, vmask));
+		}
+		pos = (size_t)i * bits;
+	}
+#endif
+	for (; i < count; i++, pos += bits) {
+		size_t at = pos >> 3;
+		unsigned long long w = 0;
+		if (at + 8 <= avail) {
+			w = read64 (p + at);
+		}
+		else {
+			memcpy (&w, p + at, avail - at);
+		}
+		dst[i] = (unsigned int)(w >> (pos & 7)) & mask;
+	}
+}
+
+/// <summary>
+/// LERC 1 and LERC 2 before version 3: values packed most significant bit
+/// first in little endian 32 bit words, the bytes used of the last word
+/// stored as its top bytes
+/// </summary>
+/// <param name="p">packed values, (count * bits + 7) / 8 bytes</param>
+/// <param name="dst">count values</param>
+/// <param name="count"></param>
+/// <param name="bits">1 to 32</param>
+static void unstuff_msb (const BYTE* p, unsigned int* dst, unsigned int count, int bits)
+{
+	size_t nbits = (size_t)count * bits;
+	size_t words = (nbits + 31) / 32;
+	size_t bytes = (nbits + 7) / 8;
+	size_t tail = bytes - (words - 1) * 4;
+	unsigned int last = 0;
+	size_t pos = 0;
+
+	if (count == 0) {
+		return;
+	}
+	memcpy (&last, p + (words - 1) * 4, tail);
+	last <<= 8 * (4 - tail);
+	for (auto i = 0U; i < count; i++, pos += bits) {
+		size_t j = pos >> 5;
+		unsigned long long w = (unsigned long long)(j + 1 < words ? read32 (p + j * 4) : last) << 32;
+		if (j + 2 < words) {
+			w |= read32 (p + j * 4 + 4);
+		}
+		else if (j + 2 == words) {
+			w |= last;
+		}
+		dst[i] = (unsigned int)((w << (pos & 31)) >> (64 - bits));
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* dequantisation */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// offset + q * 2 * maxZError, clamped to the blob's maximum
+/// </summary>
+template <class T>
+static inline void dequantize (T* dst, size_t stride, const unsigned int* q, int n, double offset, double scale, double zmax)
+{
+	for (auto j = 0; j < n; j++) {
+		double z = offset + q[j] * scale;
+		dst[j * stride] = (T)(zmax < z ? zmax : z);
+	}
+}
+
+#ifdef LERC_SSE2
+/// <summary>
+/// the float rows of a block, four values at a time. The arithmetic is
+/// still done in double so the result is the same as the scalar loop.
+/// Stuffed values are at most 31 bits so the signed conversion is safe.
+/// </summary>
+static inline void dequantize (float* dst, size_t stride, const unsigned int* q, int n, double offset, double scale, double zmax)
+{
+	auto j = 0;
+
+	if (stride == 1) {
+		__m128d voffset = _mm_set1_pd (offset);
+		__m128d vscale = _mm_set1_pd (scale);
+		__m128d vzmax = _mm_set1_pd (zmax);
+		for (; j + 4 <= n; j += 4) {
+			__m128i v = _mm_loadu_si128 ((const __m128i*)(q + j));
+			__m128d lo = _mm_add_pd (voffset, _mm_mul_pd (_mm_cvtepi32_pd (v), vscale));
+			__m128d hi = _mm_add_pd (voffset, _mm_mul_pd (_mm_cvtepi32_pd (_mm_srli_si128 (v, 8)), vscale));
+			lo = _mm_min_pd (lo, vzmax);
+			hi = _mm_min_pd (hi, vzmax);
+			_mm_storeu_ps (dst + j, _mm_movelh_ps (_mm_cvtpd_ps (lo), _mm_cvtpd_ps (hi)));
+		}
+	}
+	for (; j < n; j++) {
+		double z = offset + q[j] * scale;
+		dst[j * stride] = (float)(zmax < z ? zmax : z);
+	}
+}
+
+static inline void dequantize (double* dst, size_t stride, const unsigned int* q, int n, double offset, double scale, double zmax)
+{
+	auto j = 0;
+
+	if (stride == 1) {
+		__m128d voffset = _mm_set1_pd (offset);
+		__m128d vscale = _mm_set1_pd (scale);
+		__m128d vzmax = _mm_set1_pd (zmax);
+		for (; j + 2 <= n; j += 2) {
+			__m128i v = _mm_loadl_epi64 ((const __m128i*)(q + j));
+			__m128d z = _mm_add_pd (voffset, _mm_mul_pd (_mm_cvtepi32_pd (v), vscale));
+			_mm_storeu_pd (dst + j, _mm_min_pd (z, vzmax));
+		}
+	}
+	for (; j < n; j++) {
+		double z = offset + q[j] * scale;
+		dst[j * stride] = zmax < z ? zmax : z;
+	}
+}
+#endif
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* Huffman coded 8 bit data */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// LERC 2 Huffman code table. Codes of up to LUT_BITS bits decode with a
+/// single lookup, longer ones are searched for.
+/// </summary>
+class LERCHUFFMAN
+{
+public:
+	enum { LUT_BITS = 12 };
+	int size;
+	BYTE* lengths;
+	unsigned int* codes;
+	int* longcodes;                 // symbols with codes longer than lutbits
+	int Nlong;
+	int lutbits;
+	unsigned int lut[1 << LUT_BITS];    // symbol << 8 | length, 0 for longer codes
+
+	LERCHUFFMAN ()
+	{
+		size = 0;
+		lengths = NULL;
+		codes = NULL;
+		longcodes = NULL;
+		Nlong = 0;
+		lutbits = 0;
+	}
+	~LERCHUFFMAN ()
+	{
+		delete[] lengths;
+		delete[] codes;
+		delete[] longcodes;
+	}
+	void build ();
+	int symbol (const BYTE* p, size_t N, size_t* bitpos) const;
+};
+
+/// <summary>
+/// fill the lookup table from lengths and codes
+/// </summary>
+void LERCHUFFMAN::build ()
+{
+	int maxlen = 0;
+
+	for (auto s = 0; s < size; s++) {
+		if (lengths[s] > maxlen) {
+			maxlen = lengths[s];
+		}
+	}
+	if (maxlen == 0) {
+		throw general_exception ("parse_error");
+	}
+	lutbits = maxlen < LUT_BITS ? maxlen : LUT_BITS;
+	memset (lut, 0, sizeof (lut));
+	longcodes = new int[size];
+	if (!longcodes) {
+		throw general_exception ("out_of_memory");
+	}
+	for (auto s = 0; s < size; s++) {
+		int len = lengths[s];
+		if (len == 0) {
+			continue;
+		}
+		if (len > lutbits) {
+			longcodes[Nlong++] = s;
+			continue;
+		}
+		unsigned int first = codes[s] << (lutbits - len);
+		for (auto r = 0U; r < 1U << (lutbits - len); r++) {
+			lut[first + r] = (unsigned int)s << 8 | len;
+		}
+	}
+}
+
+/// <summary>
+/// decode one symbol
+/// </summary>
+/// <param name="p">coded data, most significant bit first in little endian words</param>
+/// <param name="N">bytes of p</param>
+/// <param name="bitpos">bits used so far, advanced</param>
+/// <returns>the symbol</returns>
+inline int LERCHUFFMAN::symbol (const BYTE* p, size_t N, size_t* bitpos) const
+{
+	size_t j = *bitpos >> 5;
+	unsigned long long w = (unsigned long long)read_word (p, N, j) << 32 | read_word (p, N, j + 1);
+	unsigned int window = (unsigned int)((w << (*bitpos & 31)) >> 32);
+	unsigned int entry = lut[window >> (32 - lutbits)];
+
+	if (entry) {
+		*bitpos += entry & 0xFF;
+		return (int)(entry >> 8);
+	}
+	for (auto k = 0; k < Nlong; k++) {
+		int s = longcodes[k];
+		if ((window >> (32 - lengths[s])) == codes[s]) {
+			*bitpos += lengths[s];
+			return s;
+		}
+	}
+	throw general_exception ("parse_error");
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* blobs */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// state for decoding the blobs of one strip or tile
+/// </summary>
+class LERCDECODER
+{
+public:
+	BYTE* out;
+	size_t used;
+	BYTE* scratch;                  // one blob, when blobs hold one sample each
+	int width;
+	int height;
+	// LERC 2 header
+	int version;
+	int rows, cols, depth;
+	int nvalid;
+	int microblock;
+	int blobsize;
+	int type;
+	double maxzerror, zmin, zmax;
+	size_t headerbytes;
+	double* zmins;                  // per sample, from version 4
+	double* zmaxs;
+	BYTE* mask;                     // validity, a bit per pixel, most significant first
+	size_t maskpixels;              // kept for the next blob, which may reuse it
+	unsigned int* quant;            // unstuffed values of one block
+	size_t quantsize;
+
+	LERCDECODER ()
+	{
+		out = NULL;
+		used = 0;
+		scratch = NULL;
+		width = height = 0;
+		version = 0;
+		rows = cols = depth = 0;
+		nvalid = 0;
+		microblock = 0;
+		blobsize = 0;
+		type = LERC_UNDEFINED;
+		maxzerror = zmin = zmax = 0;
+		headerbytes = 0;
+		zmins = NULL;
+		zmaxs = NULL;
+		mask = NULL;
+		maskpixels = 0;
+		quant = NULL;
+		quantsize = 0;
+	}
+	~LERCDECODER ()
+	{
+		delete[] out;
+		delete[] scratch;
+		delete[] zmins;
+		delete[] zmaxs;
+		delete[] mask;
+		delete[] quant;
+	}
+	bool valid (size_t k) const
+	{
+		return (mask[k >> 3] & (0x80 >> (k & 7))) != 0;
+	}
+	void run (const BYTE* data, size_t N, const LERCPARAMETERS* params);
+	void set_mask (size_t pixels, bool all);
+	void reserve (size_t count);
+	size_t bitstuffed (const BYTE* p, size_t N, unsigned int maxcount, unsigned int* count);
+	size_t unstuff (const BYTE* p, size_t N, unsigned int* dst, unsigned int count, int bits);
+	size_t header2 (const BYTE* p, size_t N);
+	size_t read_mask (const BYTE* p, size_t N);
+	template <class T> void blob2 (const BYTE* p, T* data);
+	template <class T> size_t tile (const BYTE* p, size_t N, T* data, int i0, int i1, int j0, int j1, int dim);
+	template <class T> void huffman (const BYTE* p, size_t N, T* data, int mode);
+	size_t blob1 (const BYTE* p, size_t N, float* data);
+	size_t tile1 (const BYTE* p, size_t N, float* data, int i0, int i1, int j0, int j1, bool zpart, double maxz, float maxval);
+	size_t bitstuffed1 (const BYTE* p, size_t N, unsigned int* count);
+};
+
+/// <summary>
+/// size the mask for a new blob and set every pixel valid or invalid
+/// </summary>
+void LERCDECODER::set_mask (size_t pixels, bool all)
+{
+	if (pixels != maskpixels) {
+		delete[] mask;
+		mask = NULL;
+		maskpixels = 0;
+		mask = new BYTE[(pixels + 7) / 8];
+		if (!mask) {
+			throw general_exception ("out_of_memory");
+		}
+		maskpixels = pixels;
+	}
+	memset (mask, all ? 0xFF : 0, (pixels + 7) / 8);
+}
+
+/// <summary>
+/// make room in quant
+/// </summary>
+void LERCDECODER::reserve (size_t count)
+{
+	if (count <= quantsize) {
+		return;
+	}
+	delete[] quant;
+	quant = NULL;
+	quantsize = 0;
+	quant = new unsigned int[count];
+	if (!quant) {
+		throw general_exception ("out_of_memory");
+	}
+	quantsize = count;
+}
+
+/// <summary>
+/// unpack count values of bits bits in the blob version's layout
+/// </summary>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::unstuff (const BYTE* p, size_t N, unsigned int* dst, unsigned int count, int bits)
+{
+	size_t bytes = ((size_t)count * bits + 7) / 8;
+
+	if (bytes > N) {
+		throw general_exception ("parse_error");
+	}
+	if (version >= 3) {
+		unstuff_lsb (p, N, dst, count, bits);
+	}
+	else {
+		unstuff_msb (p, dst, count, bits);
+	}
+	return bytes;
+}
+
+/// <summary>
+/// one LERC 2 bit stuffed array into quant: a byte with the bit count, the
+/// size of the element count and a lookup table flag, the element count,
+/// then either the values or a table of distinct values and indices into it
+/// </summary>
+/// <param name="p"></param>
+/// <param name="N">bytes available</param>
+/// <param name="maxcount">most elements expected</param>
+/// <param name="count">return for the number of elements</param>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::bitstuffed (const BYTE* p, size_t N, unsigned int maxcount, unsigned int* count)
+{
+	size_t pos = 1;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int head = p[0];
+	int nb = (head >> 6) == 0 ? 4 : 3 - (head >> 6);
+	bool lut = (head & 0x20) != 0;
+	int bits = head & 31;
+	if (nb == 0 || N - pos < (size_t)nb) {
+		throw general_exception ("parse_error");
+	}
+	unsigned int n = read_count (p + pos, nb);
+	pos += nb;
+	if (n > maxcount) {
+		throw general_exception ("parse_error");
+	}
+	reserve (n);
+	if (!lut) {
+		if (bits == 0) {
+			memset (quant, 0, n * sizeof (unsigned int));
+		}
+		else {
+			pos += unstuff (p + pos, N - pos, quant, n, bits);
+		}
+	}
+	else {
+		unsigned int table[256];
+		if (bits == 0 || N - pos < 1) {
+			throw general_exception ("parse_error");
+		}
+		int Ntable = p[pos++] - 1;
+		if (Ntable < 1) {
+			throw general_exception ("parse_error");
+		}
+		table[0] = 0;
+		pos += unstuff (p + pos, N - pos, table + 1, Ntable, bits);
+		pos += unstuff (p + pos, N - pos, quant, n, highbit (Ntable) + 1);
+		for (auto i = 0U; i < n; i++) {
+			if (quant[i] > (unsigned int)Ntable) {
+				throw general_exception ("parse_error");
+			}
+			quant[i] = table[quant[i]];
+		}
+	}
+	*count = n;
+	return pos;
+}
+
+/// <summary>
+/// decode the blobs of one strip or tile, interleaving them if each has fewer samples than the TIFF
+/// </summary>
+/// <param name="data"></param>
+/// <param name="N">bytes of data</param>
+/// <param name="params">sample layout wanted</param>
+void LERCDECODER::run (const BYTE* data, size_t N, const LERCPARAMETERS* params)
+{
+	int samples = params->depth;
+	int filled = 0;
+	size_t pos = 0;
+
+	if (params->type < 0 || params->type >= LERC_UNDEFINED || samples < 1) {
+		throw general_exception ("parse_error");
+	}
+	size_t bytes = typesize[params->type];
+	while (filled < samples) {
+		const BYTE* p = data + pos;
+		size_t left = N - pos;
+		bool lerc1 = left >= 10 && !memcmp (p, "CntZImage ", 10);
+		if (lerc1) {
+			if (left < 34 || readint (p + 10) != 11 || readint (p + 14) != 8) {
+				throw general_exception ("parse_error");
+			}
+			rows = readint (p + 18);
+			cols = readint (p + 22);
+			depth = 1;
+			type = LERC_FLOAT;
+		}
+		else {
+			headerbytes = header2 (p, left);
+		}
+		if (type != params->type || depth > samples - filled) {
+			throw general_exception ("parse_error");
+		}
+		if (rows <= 0 || cols <= 0 || (size_t)rows * cols > LERC_MAXBYTES / bytes / samples) {
+			throw general_exception ("parse_error");
+		}
+		if (filled == 0) {
+			width = cols;
+			height = rows;
+			used = (size_t)rows * cols * samples * bytes;
+			out = new BYTE[used];
+			if (!out) {
+				throw general_exception ("out_of_memory");
+			}
+		}
+		else if (cols != width || rows != height) {
+			throw general_exception ("parse_error");
+		}
+		size_t pixels = (size_t)rows * cols;
+		BYTE* target = out;
+		if (depth != samples) {
+			if (!scratch) {
+				scratch = new BYTE[pixels * samples * bytes];
+				if (!scratch) {
+					throw general_exception ("out_of_memory");
+				}
+			}
+			target = scratch;
+		}
+
+		if (lerc1) {
+			pos += blob1 (p, left, (float*)target);
+		}
+		else {
+			switch (type) {
+			case LERC_CHAR: blob2 (p, (signed char*)target); break;
+			case LERC_BYTE: blob2 (p, (unsigned char*)target); break;
+			case LERC_SHORT: blob2 (p, (short*)target); break;
+			case LERC_USHORT: blob2 (p, (unsigned short*)target); break;
+			case LERC_INT: blob2 (p, (int*)target); break;
+			case LERC_UINT: blob2 (p, (unsigned int*)target); break;
+			case LERC_FLOAT: blob2 (p, (float*)target); break;
+			case LERC_DOUBLE: blob2 (p, (double*)target); break;
+			}
+			pos += blobsize;
+		}
+
+		// missing values, as GDAL hands them back
+		if (type == LERC_FLOAT || type == LERC_DOUBLE) {
+			for (auto k = 0UL; k < pixels; k++) {
+				if (valid (k)) {
+					continue;
+				}
+				for (auto d = 0; d < depth; d++) {
+					if (type == LERC_FLOAT) {
+						((float*)target)[k * depth + d] = std::numeric_limits<float>::quiet_NaN ();
+					}
+					else {
+						((double*)target)[k * depth + d] = std::numeric_limits<double>::quiet_NaN ();
+					}
+				}
+			}
+		}
+		if (target != out) {
+			for (auto k = 0UL; k < pixels; k++) {
+				memcpy (out + (k * samples + filled) * bytes, target + k * depth * bytes, depth * bytes);
+			}
+		}
+		filled += depth;
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* LERC 2 */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// read and check a LERC 2 header
+/// </summary>
+/// <param name="p">start of the blob</param>
+/// <param name="N">bytes available</param>
+/// <returns>header bytes</returns>
+size_t LERCDECODER::header2 (const BYTE* p, size_t N)
+{
+	unsigned int checksum = 0;
+	size_t pos = 6;
+
+	if (N < 10 || memcmp (p, "Lerc2 ", 6)) {
+		throw general_exception ("parse_error");
+	}
+	version = readint (p + pos);
+	pos += 4;
+	if (version < 1 || version > 4) {
+		// 5 and 6 aren't written to TIFFs, which name version 4 in LercParameters
+		throw general_exception ("parse_error");
+	}
+	if (version >= 3) {
+		if (N - pos < 4) {
+			throw general_exception ("parse_error");
+		}
+		checksum = read32 (p + pos);
+		pos += 4;
+	}
+	int nints = version >= 4 ? 7 : 6;
+	if (N - pos < (size_t)nints * 4 + 24) {
+		throw general_exception ("parse_error");
+	}
+	rows = readint (p + pos);
+	pos += 4;
+	cols = readint (p + pos);
+	pos += 4;
+	depth = 1;
+	if (version >= 4) {
+		depth = readint (p + pos);
+		pos += 4;
+	}
+	nvalid = readint (p + pos);
+	microblock = readint (p + pos + 4);
+	blobsize = readint (p + pos + 8);
+	type = readint (p + pos + 12);
+	pos += 16;
+	maxzerror = readdouble (p + pos);
+	zmin = readdouble (p + pos + 8);
+	zmax = readdouble (p + pos + 16);
+	pos += 24;
+
+	if (rows <= 0 || cols <= 0 || depth <= 0 || depth > 16 || type < 0 || type >= LERC_UNDEFINED) {
+		throw general_exception ("parse_error");
+	}
+	if (nvalid < 0 || (double)nvalid > (double)rows * cols) {
+		throw general_exception ("parse_error");
+	}
+	if (blobsize < (int)pos || (size_t)blobsize > N) {
+		throw general_exception ("parse_error");
+	}
+	if (version >= 3 && fletcher32 (p + 14, blobsize - 14) != checksum) {
+		throw general_exception ("parse_error");
+	}
+	return pos;
+}
+
+/// <summary>
+/// the validity mask: a byte count then the run length coded bits. All
+/// valid and none valid take no bytes; a count of 0 otherwise keeps the
+/// previous blob's mask.
+/// </summary>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::read_mask (const BYTE* p, size_t N)
+{
+	size_t pixels = (size_t)rows * cols;
+
+	if (N < 4) {
+		throw general_exception ("parse_error");
+	}
+	int Nmask = readint (p);
+	if (Nmask < 0 || (size_t)Nmask > N - 4) {
+		throw general_exception ("parse_error");
+	}
+	if (nvalid == 0 || (size_t)nvalid == pixels) {
+		if (Nmask != 0) {
+			throw general_exception ("parse_error");
+		}
+		set_mask (pixels, nvalid != 0);
+	}
+	else if (Nmask > 0) {
+		set_mask (pixels, false);
+		rle_decode (p + 4, Nmask, mask, (pixels + 7) / 8);
+	}
+	else if (maskpixels != pixels) {
+		throw general_exception ("parse_error");
+	}
+
+	// the header's count of valid pixels sizes everything that follows
+	size_t count = 0;
+	for (auto k = 0UL; k < pixels; k++) {
+		count += valid (k);
+	}
+	if (count != (size_t)nvalid) {
+		throw general_exception ("parse_error");
+	}
+	return 4 + Nmask;
+}
+
+/// <summary>
+/// decode a LERC 2 blob whose header has been read
+/// </summary>
+/// <param name="p">start of the blob, blobsize bytes</param>
+/// <param name="data">rows * cols * depth values</param>
+template <class T>
+void LERCDECODER::blob2 (const BYTE* p, T* data)
+{
+	size_t N = blobsize;
+	size_t pos = headerbytes;
+	size_t pixels = (size_t)rows * cols;
+	size_t tbytes = sizeof (T);
+	bool constant = zmin == zmax;
+
+	pos += read_mask (p + pos, N - pos);
+	memset (data, 0, pixels * depth * tbytes);
+	if (nvalid == 0) {
+		return;
+	}
+	delete[] zmins;
+	delete[] zmaxs;
+	zmins = zmaxs = NULL;
+	zmins = new double[depth];
+	zmaxs = new double[depth];
+	if (!zmins || !zmaxs) {
+		throw general_exception ("out_of_memory");
+	}
+	for (auto d = 0; d < depth; d++) {
+		zmins[d] = zmin;
+		zmaxs[d] = zmax;
+	}
+	if (!constant && version >= 4) {
+		if (N - pos < 2 * depth * tbytes) {
+			throw general_exception ("parse_error");
+		}
+		constant = true;
+		for (auto d = 0; d < depth; d++) {
+			T lo, hi;
+			memcpy (&lo, p + pos + d * tbytes, tbytes);
+			memcpy (&hi, p + pos + (depth + d) * tbytes, tbytes);
+			zmins[d] = (double)lo;
+			zmaxs[d] = (double)hi;
+			constant = constant && lo == hi;
+		}
+		pos += 2 * depth * tbytes;
+	}
+	if (constant) {
+		for (auto k = 0UL; k < pixels; k++) {
+			if (valid (k)) {
+				for (auto d = 0; d < depth; d++) {
+					data[k * depth + d] = (T)zmins[d];
+				}
+			}
+		}
+		return;
+	}
+
+	if (N - pos < 1) {
+		throw general_exception ("parse_error");
+	}
+	if (p[pos++]) {
+		// the valid values as they are, in one sweep
+		if ((N - pos) / (depth * tbytes) < (size_t)nvalid) {
+			throw general_exception ("parse_error");
+		}
+		for (auto k = 0UL; k < pixels; k++) {
+			if (valid (k)) {
+				memcpy (data + k * depth, p + pos, depth * tbytes);
+				pos += depth * tbytes;
+			}
+		}
+		return;
+	}
+	if (version > 1 && (type == LERC_CHAR || type == LERC_BYTE) && maxzerror == 0.5) {
+		if (N - pos < 1) {
+			throw general_exception ("parse_error");
+		}
+		int mode = p[pos++];
+		if (mode > 2) {
+			throw general_exception ("parse_error");
+		}
+		if (mode) {
+			huffman (p + pos, N - pos, data, mode);
+			return;
+		}
+	}
+
+	if (microblock <= 0 || microblock > 32) {
+		throw general_exception ("parse_error");
+	}
+	int tilesdown = (rows + microblock - 1) / microblock;
+	int tilesacross = (cols + microblock - 1) / microblock;
+	for (auto ty = 0; ty < tilesdown; ty++) {
+		int i0 = ty * microblock;
+		int i1 = i0 + microblock < rows ? i0 + microblock : rows;
+		for (auto tx = 0; tx < tilesacross; tx++) {
+			int j0 = tx * microblock;
+			int j1 = j0 + microblock < cols ? j0 + microblock : cols;
+			for (auto d = 0; d < depth; d++) {
+				pos += tile (p + pos, N - pos, data, i0, i1, j0, j1, d);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// the type the offset of a bit stuffed block is stored in, narrowed by
+/// the top two bits of the block's flag byte
+/// </summary>
+static int offset_type (int type, int code)
+{
+	switch (type) {
+	case LERC_SHORT:
+	case LERC_INT:
+		return type - code;
+	case LERC_USHORT:
+	case LERC_UINT:
+		return type - 2 * code;
+	case LERC_FLOAT:
+		return code == 0 ? type : code == 1 ? LERC_SHORT : LERC_BYTE;
+	case LERC_DOUBLE:
+		return code == 0 ? type : type - 2 * code + 1;
+	default:
+		return type;
+	}
+}
+
+static double read_offset (const BYTE* p, int type)
+{
+	signed char c;
+	short s;
+	unsigned short us;
+	int i;
+	unsigned int ui;
+	float f;
+
+	switch (type) {
+	case LERC_CHAR: memcpy (&c, p, 1); return c;
+	case LERC_BYTE: return p[0];
+	case LERC_SHORT: memcpy (&s, p, 2); return s;
+	case LERC_USHORT: memcpy (&us, p, 2); return us;
+	case LERC_INT: memcpy (&i, p, 4); return i;
+	case LERC_UINT: memcpy (&ui, p, 4); return ui;
+	case LERC_FLOAT: memcpy (&f, p, 4); return f;
+	default: return readdouble (p);
+	}
+}
+
+/// <summary>
+/// one sample of one micro block: all zero, raw, constant or bit stuffed
+/// </summary>
+/// <param name="p"></param>
+/// <param name="N">bytes available</param>
+/// <param name="data">the blob's values</param>
+/// <param name="i0">first row</param>
+/// <param name="i1">row past the end</param>
+/// <param name="j0">first column</param>
+/// <param name="j1">column past the end</param>
+/// <param name="dim">sample</param>
+/// <returns>bytes used</returns>
+template <class T>
+size_t LERCDECODER::tile (const BYTE* p, size_t N, T* data, int i0, int i1, int j0, int j1, int dim)
+{
+	size_t pos = 1;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int flag = p[0];
+	if (((flag >> 2) & 15) != ((j0 >> 3) & 15)) {
+		// integrity check, the block's column
+		throw general_exception ("parse_error");
+	}
+	int code = flag >> 6;
+	flag &= 3;
+
+	if (flag == 2) {
+		// zero, which the data already is
+		return pos;
+	}
+	if (flag == 0) {
+		for (auto i = i0; i < i1; i++) {
+			for (auto j = j0; j < j1; j++) {
+				size_t k = (size_t)i * cols + j;
+				if (valid (k)) {
+					if (N - pos < sizeof (T)) {
+						throw general_exception ("parse_error");
+					}
+					memcpy (data + k * depth + dim, p + pos, sizeof (T));
+					pos += sizeof (T);
+				}
+			}
+		}
+		return pos;
+	}
+
+	int otype = offset_type (type, code);
+	if (otype < 0 || otype >= LERC_UNDEFINED || N - pos < (size_t)typesize[otype]) {
+		throw general_exception ("parse_error");
+	}
+	double offset = read_offset (p + pos, otype);
+	pos += typesize[otype];
+
+	if (flag == 3) {
+		for (auto i = i0; i < i1; i++) {
+			for (auto j = j0; j < j1; j++) {
+				size_t k = (size_t)i * cols + j;
+				if (valid (k)) {
+					data[k * depth + dim] = (T)offset;
+				}
+			}
+		}
+		return pos;
+	}
+
+	unsigned int maxcount = (i1 - i0) * (j1 - j0);
+	unsigned int count;
+	pos += bitstuffed (p + pos, N - pos, maxcount, &count);
+	double scale = 2 * maxzerror;
+	double top = version >= 4 && depth > 1 ? zmaxs[dim] : zmax;
+	if (count == maxcount) {
+		for (auto i = i0; i < i1; i++) {
+			dequantize (data + ((size_t)i * cols + j0) * depth + dim, depth, quant + (size_t)(i - i0) * (j1 - j0), j1 - j0, offset, scale, top);
+		}
+		return pos;
+	}
+	const unsigned int* q = quant;
+	for (auto i = i0; i < i1; i++) {
+		for (auto j = j0; j < j1; j++) {
+			size_t k = (size_t)i * cols + j;
+			if (valid (k)) {
+				if (q == quant + count) {
+					throw general_exception ("parse_error");
+				}
+				double z = offset + *q++ * scale;
+				data[k * depth + dim] = (T)(top < z ? top : z);
+			}
+		}
+	}
+	return pos;
+}
+
+/// <summary>
+/// 8 bit data Huffman coded, either the values themselves (mode 2) or the
+/// difference from the pixel to the left, or above at the start of a run (mode 1)
+/// </summary>
+/// <param name="p">code table then codes</param>
+/// <param name="N">bytes available</param>
+/// <param name="data"></param>
+/// <param name="mode"></param>
+template <class T>
+void LERCDECODER::huffman (const BYTE* p, size_t N, T* data, int mode)
+{
+	LERCHUFFMAN table;
+	size_t pos = 16;
+
+	if (N < 16 || readint (p) < 2) {
+		throw general_exception ("parse_error");
+	}
+	int size = readint (p + 4);
+	int i0 = readint (p + 8);
+	int i1 = readint (p + 12);
+	if (size <= 0 || size > 65536 || i0 < 0 || i0 >= i1 || i1 - 1 >= 2 * size) {
+		throw general_exception ("parse_error");
+	}
+
+	// code lengths, then the codes themselves, for symbols i0 to i1 - 1 wrapping around size
+	unsigned int count;
+	pos += bitstuffed (p + pos, N - pos, i1 - i0, &count);
+	if (count != (unsigned int)(i1 - i0)) {
+		throw general_exception ("parse_error");
+	}
+	table.size = size;
+	table.lengths = new BYTE[size];
+	table.codes = new unsigned int[size];
+	if (!table.lengths || !table.codes) {
+		throw general_exception ("out_of_memory");
+	}
+	memset (table.lengths, 0, size);
+	memset (table.codes, 0, size * sizeof (unsigned int));
+	size_t bitpos = 0;
+	for (auto i = i0; i < i1; i++) {
+		int s = i < size ? i : i - size;
+		unsigned int len = quant[i - i0];
+		if (len > 32) {
+			throw general_exception ("parse_error");
+		}
+		table.lengths[s] = (BYTE)len;
+		if (len) {
+			size_t j = bitpos >> 5;
+			unsigned long long w = (unsigned long long)read_word (p + pos, N - pos, j) << 32 | read_word (p + pos, N - pos, j + 1);
+			table.codes[s] = (unsigned int)((w << (bitpos & 31)) >> (64 - len));
+			bitpos += len;
+		}
+	}
+	pos += (bitpos + 31) / 32 * 4;
+	if (pos > N) {
+		throw general_exception ("parse_error");
+	}
+	table.build ();
+
+	int offset = type == LERC_CHAR ? 128 : 0;
+	const BYTE* codes = p + pos;
+	size_t Ncodes = N - pos;
+	bitpos = 0;
+	if (mode == 2) {
+		// plain codes run pixel by pixel, every sample of a pixel together
+		for (size_t k = 0; k < (size_t)rows * cols; k++) {
+			if (valid (k)) {
+				for (auto d = 0; d < depth; d++) {
+					data[k * depth + d] = (T)(table.symbol (codes, Ncodes, &bitpos) - offset);
+				}
+			}
+		}
+		if (bitpos > Ncodes * 8) {
+			throw general_exception ("parse_error");
+		}
+		return;
+	}
+
+	// delta codes run a sample at a time, against the left neighbour or the one above
+	for (auto d = 0; d < depth; d++) {
+		T prev = 0;
+		for (auto i = 0; i < rows; i++) {
+			for (auto j = 0; j < cols; j++) {
+				size_t k = (size_t)i * cols + j;
+				if (!valid (k)) {
+					continue;
+				}
+				T value = (T)(table.symbol (codes, Ncodes, &bitpos) - offset);
+				if (j > 0 && valid (k - 1)) {
+					value += prev;
+				}
+				else if (i > 0 && valid (k - cols)) {
+					value += data[(k - cols) * depth + d];
+				}
+				else {
+					value += prev;
+				}
+				prev = value;
+				data[k * depth + d] = value;
+			}
+		}
+		if (bitpos > Ncodes * 8) {
+			throw general_exception ("parse_error");
+		}
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* LERC 1 */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// one LERC 1 bit stuffed array into quant
+/// </summary>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::bitstuffed1 (const BYTE* p, size_t N, unsigned int* count)
+{
+	size_t pos = 1;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int nb = (p[0] >> 6) == 0 ? 4 : 3 - (p[0] >> 6);
+	int bits = p[0] & 63;
+	if (nb == 0 || bits >= 32 || N - pos < (size_t)nb) {
+		throw general_exception ("parse_error");
+	}
+	unsigned int n = read_count (p + pos, nb);
+	pos += nb;
+	if ((double)n * bits > (double)(N - pos) * 8) {
+		throw general_exception ("parse_error");
+	}
+	reserve (n);
+	if (bits == 0) {
+		memset (quant, 0, n * sizeof (unsigned int));
+	}
+	else {
+		unstuff_msb (p + pos, quant, n, bits);
+		pos += ((size_t)n * bits + 7) / 8;
+	}
+	*count = n;
+	return pos;
+}
+
+/// <summary>
+/// decode a LERC 1 (CntZImage) blob: a count part, which is the validity
+/// mask, then a z part with the values, each split into tiles
+/// </summary>
+/// <param name="p"></param>
+/// <param name="N">bytes available</param>
+/// <param name="data">rows * cols values</param>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::blob1 (const BYTE* p, size_t N, float* data)
+{
+	size_t pixels = (size_t)rows * cols;
+	double maxz = readdouble (p + 26);
+	size_t pos = 34;
+
+	memset (data, 0, pixels * sizeof (float));
+	set_mask (pixels, true);
+	for (auto part = 0; part < 2; part++) {
+		if (N - pos < 16) {
+			throw general_exception ("parse_error");
+		}
+		int tilesdown = readint (p + pos);
+		int tilesacross = readint (p + pos + 4);
+		int Nbytes = readint (p + pos + 8);
+		float maxval;
+		memcpy (&maxval, p + pos + 12, 4);
+		pos += 16;
+		if (Nbytes < 0 || (size_t)Nbytes > N - pos) {
+			throw general_exception ("parse_error");
+		}
+		if (part == 0 && tilesdown == 0 && tilesacross == 0) {
+			if (Nbytes == 0) {
+				set_mask (pixels, maxval > 0);
+			}
+			else {
+				set_mask (pixels, false);
+				rle_decode (p + pos, Nbytes, mask, (pixels + 7) / 8);
+			}
+		}
+		else {
+			if (tilesdown <= 0 || tilesacross <= 0 || tilesdown > rows || tilesacross > cols) {
+				throw general_exception ("parse_error");
+			}
+			const BYTE* q = p + pos;
+			size_t left = Nbytes;
+			int tileh = rows / tilesdown;
+			int tilew = cols / tilesacross;
+			// the tiles that are left over make a short last row and column
+			for (auto ty = 0; ty <= tilesdown; ty++) {
+				int h = ty == tilesdown ? rows % tilesdown : tileh;
+				if (h == 0) {
+					continue;
+				}
+				for (auto tx = 0; tx <= tilesacross; tx++) {
+					int w = tx == tilesacross ? cols % tilesacross : tilew;
+					if (w == 0) {
+						continue;
+					}
+					size_t n = tile1 (q, left, data, ty * tileh, ty * tileh + h, tx * tilew, tx * tilew + w, part == 1, maxz, maxval);
+					q += n;
+					left -= n;
+				}
+			}
+		}
+		pos += Nbytes;
+	}
+	return pos;
+}
+
+/// <summary>
+/// one tile of a LERC 1 part
+/// </summary>
+/// <returns>bytes used</returns>
+size_t LERCDECODER::tile1 (const BYTE* p, size_t N, float* data, int i0, int i1, int j0, int j1, bool zpart, double maxz, float maxval)
+{
+	size_t pos = 1;
+	float offset = 0;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int flag = p[0];
+	int nb = (flag >> 6) == 0 ? 4 : 3 - (flag >> 6);
+
+	if (!zpart) {
+		if (flag == 2 || flag == 3 || flag == 4) {
+			// count 0, -1 or 1 throughout
+			for (auto i = i0; i < i1; i++) {
+				for (auto j = j0; j < j1; j++) {
+					size_t k = (size_t)i * cols + j;
+					if (flag == 4) {
+						mask[k >> 3] |= 0x80 >> (k & 7);
+					}
+					else {
+						mask[k >> 3] &= ~(0x80 >> (k & 7));
+					}
+				}
+			}
+			return pos;
+		}
+	}
+	else if ((flag & 63) == 2) {
+		return pos;
+	}
+	if ((flag & 63) > (zpart ? 3 : 4)) {
+		throw general_exception ("parse_error");
+	}
+	flag &= 63;
+
+	if (flag == 0) {
+		for (auto i = i0; i < i1; i++) {
+			for (auto j = j0; j < j1; j++) {
+				size_t k = (size_t)i * cols + j;
+				if (zpart && !valid (k)) {
+					continue;
+				}
+				float z;
+				if (N - pos < 4) {
+					throw general_exception ("parse_error");
+				}
+				memcpy (&z, p + pos, 4);
+				pos += 4;
+				if (zpart) {
+					data[k] = z;
+				}
+				else if (z > 0) {
+					mask[k >> 3] |= 0x80 >> (k & 7);
+				}
+				else {
+					mask[k >> 3] &= ~(0x80 >> (k & 7));
+				}
+			}
+		}
+		return pos;
+	}
+
+	if (nb == 0 || nb == 3 || N - pos < (size_t)nb) {
+		throw general_exception ("parse_error");
+	}
+	if (nb == 1) {
+		offset = (signed char)p[pos];
+	}
+	else if (nb == 2) {
+		offset = (short)(p[pos] | p[pos + 1] << 8);
+	}
+	else {
+		memcpy (&offset, p + pos, 4);
+	}
+	pos += nb;
+
+	if (zpart && flag == 3) {
+		for (auto i = i0; i < i1; i++) {
+			for (auto j = j0; j < j1; j++) {
+				size_t k = (size_t)i * cols + j;
+				if (valid (k)) {
+					data[k] = offset;
+				}
+			}
+		}
+		return pos;
+	}
+
+	unsigned int count;
+	pos += bitstuffed1 (p + pos, N - pos, &count);
+	const unsigned int* q = quant;
+	double scale = 2 * maxz;
+	for (auto i = i0; i < i1; i++) {
+		for (auto j = j0; j < j1; j++) {
+			size_t k = (size_t)i * cols + j;
+			if (zpart && !valid (k)) {
+				continue;
+			}
+			if (q == quant + count) {
+				throw general_exception ("parse_error");
+			}
+			if (zpart) {
+				float z = (float)(offset + *q++ * scale);
+				data[k] = z < maxval ? z : maxval;
+			}
+			else if (offset + (float)*q++ > 0) {
+				mask[k >> 3] |= 0x80 >> (k & 7);
+			}
+			else {
+				mask[k >> 3] &= ~(0x80 >> (k & 7));
+			}
+		}
+	}
+	return pos;
+}
+
+/// <summary>
+/// decode a LERC strip or tile
+/// </summary>
+/// <param name="data">one or more blobs, any deflate or zstd pass already undone</param>
+/// <param name="N">bytes of data</param>
+/// <param name="params">sample layout and type the TIFF expects</param>
+/// <param name="width">return for the width of the blobs</param>
+/// <param name="height">return for the height of the blobs</param>
+/// <param name="Nret">return for the number of bytes</param>
+/// <returns>width * height * params->depth samples of params->type, 0 on fail</returns>
+BYTE* lerc_decompress (const BYTE* data, unsigned long N, const LERCPARAMETERS* params, int* width, int* height, unsigned long* Nret)
+{
+	LERCDECODER decoder;
+	BYTE* answer;
+
+	try {
+		decoder.run (data, N, params);
+		answer = decoder.out;
+		decoder.out = NULL;
+		*width = decoder.width;
+		*height = decoder.height;
+		*Nret = (unsigned long)decoder.used;
+		return answer;
+	}
+	catch (general_exception) {
+		return 0;
+	}
+}
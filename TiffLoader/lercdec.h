@@ -0,0 +1,63 @@
+#ifndef lercdec_h
+#define lercdec_h
+
+/*
+  LERC decoder for LERC compressed TIFF strips and tiles (Compression = 34887).
+
+  To use
+	LERCPARAMETERS params;
+	params.depth = samplesperpixel;               // 1 for planar files
+	params.type = LERC_FLOAT;                     // what the TIFF says the samples are
+	data = lerc_decompress (strip, Nstrip, &params, &width, &height, &N);
+
+  LERC 2 blobs, versions 1 to 4: bit stuffed micro blocks quantised to
+  twice the blob's max error, constant and raw blocks, the RLE validity
+  mask, one sweep raw data and the 8 bit Huffman modes. LERC 1 (CntZImage)
+  blobs decode to float. Blobs with one value per pixel following each
+  other are taken as successive samples. Invalid pixels come back as NaN
+  for float types and 0 for integers. The deflate or zstd pass named by
+  the LercParameters tag is undone by the caller first.
+
+  Samples come back as the blob holds them. libtiff byte swaps a big
+  endian file's samples before encoding them, so they are in file order.
+*/
+
+typedef unsigned char BYTE;
+
+// LERC data types, as numbered in the blob header
+enum LERCTYPE
+{
+	LERC_CHAR = 0,
+	LERC_BYTE = 1,
+	LERC_SHORT = 2,
+	LERC_USHORT = 3,
+	LERC_INT = 4,
+	LERC_UINT = 5,
+	LERC_FLOAT = 6,
+	LERC_DOUBLE = 7,
+	LERC_UNDEFINED = 8,
+};
+
+/// <summary>
+/// the LercParameters tag and the sample layout a blob has to decode to
+/// </summary>
+class LERCPARAMETERS
+{
+public:
+	int version;                    // LERC 2 version the writer used
+	int compression;                // additional compression: 0 none, 1 deflate, 2 zstd
+	int depth;                      // samples per pixel
+	int type;                       // LERCTYPE of the samples
+
+	LERCPARAMETERS ()
+	{
+		version = 4;
+		compression = 0;
+		depth = 1;
+		type = LERC_UNDEFINED;
+	}
+};
+
+BYTE* lerc_decompress (const BYTE* data, unsigned long N, const LERCPARAMETERS* params, int* width, int* height, unsigned long* Nret);
+
+#endif
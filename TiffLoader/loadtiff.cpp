@@ -4,7 +4,7 @@
   Meant to be a pretty comprehensive, one file, portable TIFF reader
   We just read everything in as 8 bit RGBs.
 
-  Current limitations - no JPEG, no alpha, a few odd formats still
+  Current limitations - no old-style JPEG, no alpha, a few odd formats still
 	unsupported
   No sophisticated colour handling
 
@@ -16,8 +16,99 @@
 #include <string.h>
 #include <limits.h>
 #include <math.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define TIFF_SSE2
+#endif
 
 #include "loadtiff.h"
+#include "threadpool.h"
+#include "tilecache.h"
+#include "headercache.h"
+#include "bitreader.h"
+#if TIFF_STATS
+#include <chrono>
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+/// <summary>
+/// CPU time used by the calling thread
+/// </summary>
+/// <returns>seconds, 0 if the clock can't be read</returns>
+static double thread_cpu_seconds ()
+{
+#if defined(_WIN32)
+	FILETIME created, exited, kernel, user;
+	ULARGE_INTEGER k, u;
+
+	if (!GetThreadTimes (GetCurrentThread (), &created, &exited, &kernel, &user)) {
+		return 0;
+	}
+	k.LowPart = kernel.dwLowDateTime;
+	k.HighPart = kernel.dwHighDateTime;
+	u.LowPart = user.dwLowDateTime;
+	u.HighPart = user.dwHighDateTime;
+	return (k.QuadPart + u.QuadPart) * 1e-7;
+#else
+	struct timespec now;
+
+	if (clock_gettime (CLOCK_THREAD_CPUTIME_ID, &now)) {
+		return 0;
+	}
+	return now.tv_sec + now.tv_nsec * 1e-9;
+#endif
+}
+#endif
+
+/// <summary>
+/// times the stages one thread runs back to back: each lap () charges the
+/// time since the last one (or since construction) to a stage.
+/// Without TIFF_STATS it is empty and compiles away.
+/// </summary>
+class STAGETIMER
+{
+#if TIFF_STATS
+private:
+	TIFFSTATS* stats;
+	std::chrono::steady_clock::time_point wall;
+	double cpu;
+public:
+	explicit STAGETIMER (TIFFSTATS* stats)
+	{
+		this->stats = stats;
+		if (stats) {
+			wall = std::chrono::steady_clock::now ();
+			cpu = thread_cpu_seconds ();
+		}
+	}
+	void lap (TIFF_STAGE stage, unsigned long long bytes)
+	{
+		if (stats) {
+			auto wallnow = std::chrono::steady_clock::now ();
+			double cpunow = thread_cpu_seconds ();
+			stats->add (stage, std::chrono::duration<double> (wallnow - wall).count (), cpunow - cpu, bytes);
+			wall = wallnow;
+			cpu = cpunow;
+		}
+	}
+#else
+public:
+	explicit STAGETIMER (TIFFSTATS*)
+	{
+	}
+	void lap (TIFF_STAGE, unsigned long long)
+	{
+	}
+#endif
+};
 
 /// <summary>
 /// load a tiff, setting the background to white
@@ -93,22 +184,180 @@ BYTE* TIFF::floadtiffwhite ()
 /// <returns></returns>
 BYTE* TIFF::load_tiff ()
 {
-	int magic;
-	unsigned long offset;
-	TAG* tags = NULL;
-	int Ntags = 0;
-	int err;
 	BASICHEADER header = {};
 	BYTE* answer;
 
 	format = FMT::FMT_ERROR;
+	status.reset (0);
+	stats.reset ();
+	parse_header (&header);
+	answer = header.load_raster (fd, &format, &status, best_effort);
+	//getchar();
+	width = header.imagewidth;
+	height = header.imageheight;
+	return answer;
+}
+
+/// <summary>
+/// load a tiff as separate planes, without interleaving.
+/// Planar files are decoded straight into the planes; pixel interleaved
+/// files are decoded as usual and split.
+/// </summary>
+/// <param name="Nplanes">return for the number of planes</param>
+/// <returns>Nplanes planes of width * height bytes one after another, in the order of format, 0 on fail</returns>
+BYTE* TIFF::load_tiff_planar (int* Nplanes)
+{
+	BASICHEADER header = {};
+	BYTE* answer;
+
+	format = FMT::FMT_ERROR;
+	stats.reset ();
+	parse_header (&header);
+	answer = header.load_planes (fd, &format, Nplanes);
+	width = header.imagewidth;
+	height = header.imageheight;
+	return answer;
+}
+
+/// <summary>
+/// load a tiff's samples as 32 bit floats, without squashing them to 8 bits.
+/// format is left as FMT_ERROR, the samples are the file's own.
+/// </summary>
+/// <param name="Nsamples">return for the samples per pixel</param>
+/// <returns>width * height * Nsamples floats, 0 on fail</returns>
+float* TIFF::load_tiff_float (int* Nsamples)
+{
+	BASICHEADER header = {};
+	float* answer;
+
+	format = FMT::FMT_ERROR;
+	stats.reset ();
+	parse_header (&header);
+	answer = header.load_float (fd, Nsamples);
+	width = header.imagewidth;
+	height = header.imageheight;
+	return answer;
+}
+
+/// <summary>
+/// load a tiff at reduced resolution, for thumbnails.
+/// JPEG tiles are decoded straight to the reduced size in the DCT domain.
+/// Otherwise each output pixel is the average of a scale x scale block,
+/// taken as the rows are decoded, so only one strip (or row of tiles) of
+/// the full size image is held at a time.
+/// </summary>
+/// <param name="scale">1, 2, 4 or 8</param>
+/// <returns>raster of (width + scale - 1) / scale by (height + scale - 1) / scale pixels, 0 on fail</returns>
+BYTE* TIFF::load_tiff_scaled (int scale)
+{
+	BYTE* answer = 0;
+	unsigned long* sums = 0;
+	const BYTE* row;
+	int outwidth, outheight, depth;
+	int y, x, i, n;
+
+	if (scale != 1 && scale != 2 && scale != 4 && scale != 8) {
+		return 0;
+	}
+	stats.reset ();
+	if (scale > 1) {
+		BASICHEADER header = {};
+
+		format = FMT::FMT_ERROR;
+		parse_header (&header);
+		if (header.scaled_tiles (scale)) {
+			answer = header.load_raster_scaled (fd, &format, scale);
+			width = (header.imagewidth + scale - 1) / scale;
+			height = (header.imageheight + scale - 1) / scale;
+			return answer;
+		}
+	}
+	ROWREADER reader (this);
+	depth = reader.depth;
+	outwidth = (reader.width + scale - 1) / scale;
+	outheight = (reader.height + scale - 1) / scale;
+	try {
+		answer = new BYTE[outwidth * outheight * depth];
+		sums = new unsigned long[outwidth * depth];
+		if (!answer || !sums) {
+			throw general_exception ("out_of_memory");  // OX[
+		}
+		for (y = 0; y < outheight; y++) {
+			int rows = reader.height - y * scale < scale ? reader.height - y * scale : scale;
+			memset (sums, 0, outwidth * depth * sizeof (unsigned long));
+			for (i = 0; i < rows; i++) {
+				row = reader.next_row ();
+				if (!row) {
+					throw general_exception ("parse_error");  // OX[
+				}
+				for (x = 0; x < reader.width; x++) {
+					unsigned long* sum = sums + (x / scale) * depth;
+					for (n = 0; n < depth; n++) {
+						sum[n] += row[x * depth + n];
+					}
+				}
+			}
+			BYTE* out = answer + y * outwidth * depth;
+			for (x = 0; x < outwidth; x++) {
+				int cols = reader.width - x * scale < scale ? reader.width - x * scale : scale;
+				unsigned long count = cols * rows;
+				for (n = 0; n < depth; n++) {
+					out[x * depth + n] = (BYTE)((sums[x * depth + n] + count / 2) / count);
+				}
+			}
+		}
+		delete[] sums;
+		width = outwidth;
+		height = outheight;
+		return answer;
+	}
+	catch (general_exception) {
+		delete[] sums;
+		delete[] answer;
+		format = FMT::FMT_ERROR;
+		return 0;
+	}
+}
+
+/// <summary>
+/// parse and validate the first IFD
+/// </summary>
+/// <param name="header">header to fill</param>
+void TIFF::parse_header (BASICHEADER* header)
+{
+	int magic;
+	unsigned long offset;
+
+	fd->buffer_ptr = 0;
 	fd->set_endian ();
 	magic = fd->fget16 ();
 	if (magic != 42) {
-		killtags (tags, Ntags);
 		throw general_exception ("parse_error");  // OX[
 	}
 	offset = fd->fget32 ();
+	parse_ifd (header, offset);
+}
+
+/// <summary>
+/// parse and validate the IFD at offset. The endianness must already be set.
+/// </summary>
+/// <param name="header">header to fill</param>
+/// <param name="offset">IFD position in the file</param>
+void TIFF::parse_ifd (BASICHEADER* header, unsigned long offset)
+{
+	TAG* tags = NULL;
+	int Ntags = 0;
+	int err;
+	STAGETIMER timer (&stats);
+
+	if (headercache && headercache->get (fd->identity, offset, header)) {
+		header->tilecache = tilecache;
+		header->cmyk_to_rgb = cmyk_to_rgb;
+		header->stats = &stats;
+		stats.compression = header->compression;
+		timer.lap (TIFF_STAGE::STAGE_HEADER, 0);
+		return;
+	}
 	fd->buffer_ptr = offset;
 
 	tags = load_header (fd, &Ntags);
@@ -118,32 +367,257 @@ BYTE* TIFF::load_tiff ()
 	}
 	//getchar();
 	//header_defaults (&header);
-	header.endianness = fd->type;
-	header.fill_header (tags, Ntags);
-	err = header.header_fixupsections ();
-	if (err) {
-		killtags (tags, Ntags);
-		throw general_exception ("parse_error");  // OX[
+	header->endianness = fd->type;
+	header->ifdoffset = offset;
+	header->tilecache = tilecache;
+	header->cmyk_to_rgb = cmyk_to_rgb;
+	header->stats = &stats;
+	try {
+		fd->buffer_ptr = offset + 2 + 12 * Ntags;
+		header->nextifd = fd->fget32u ();
 	}
-	//printf("here %d %d\n", header.imagewidth, header.imageheight);
-	//printf("Bitspersample%d %d %d\n", header.bitspersample[0], header.bitspersample[1], header.bitspersample[2]);
-	err = header.header_not_ok ();
-	if (err) {
+	catch (general_exception) {
+		header->nextifd = 0;
+	}
+	try {
+		header->fill_header (tags, Ntags);
+		err = header->header_fixupsections ();
+		if (err) {
+			throw general_exception ("parse_error");  // OX[
+		}
+		header->header_checksections (fd->size);
+		//printf("here %d %d\n", header.imagewidth, header.imageheight);
+		//printf("Bitspersample%d %d %d\n", header.bitspersample[0], header.bitspersample[1], header.bitspersample[2]);
+		err = header->header_not_ok ();
+		if (err) {
+			throw general_exception ("parse_error");  // OX[
+		}
+	}
+	catch (general_exception) {
+		// the header's checks throw too
 		killtags (tags, Ntags);
-		throw general_exception ("parse_error");  // OX[
+		throw;
 	}
-	answer = header.load_raster (fd, &format);
-	//getchar();
-	width = header.imagewidth;
-	height = header.imageheight;
 	//freeheader (&header);
 	killtags (tags, Ntags);
+	if (headercache) {
+		headercache->put (fd->identity, offset, header);
+	}
+	stats.compression = header->compression;
+	timer.lap (TIFF_STAGE::STAGE_HEADER, 2 + 12 * (unsigned long long)Ntags);
+}
+
+/// <summary>
+/// size of the raster load_tiff will return, without decoding it
+/// </summary>
+/// <returns>bytes needed for the decoded image</returns>
+unsigned long long TIFF::raster_bytes ()
+{
+	BASICHEADER header = {};
+
+	parse_header (&header);
+	return (unsigned long long)header.imagewidth * header.imageheight * header.header_Noutsamples ();
+}
+
+/// <summary>
+/// list the resolutions of the first image: the image itself, its
+/// SubIFDs, and the reduced resolution IFDs (NewSubfileType bit 0) that
+/// follow it in the chain. Transparency masks (bit 2), which may sit
+/// between the levels, are skipped. Levels this loader can't decode are
+/// left out.
+/// </summary>
+/// <param name="levels">return for the levels, full resolution first</param>
+/// <returns>number of levels</returns>
+int TIFF::list_levels (std::vector<TIFFLEVEL>* levels)
+{
+	BASICHEADER base;
+	TIFFLEVEL level;
+	unsigned long offset;
+
+	levels->clear ();
+	parse_header (&base);
+	level.offset = base.ifdoffset;
+	level.width = base.imagewidth;
+	level.height = base.imageheight;
+	levels->push_back (level);
+
+	for (auto i = 0; i < base.Nsubifds; i++) {
+		BASICHEADER sub;
+		try {
+			parse_ifd (&sub, base.subifds[i]);
+		}
+		catch (general_exception) {
+			continue;
+		}
+		if (sub.newsubfiletype & 4) {
+			continue;
+		}
+		level.offset = sub.ifdoffset;
+		level.width = sub.imagewidth;
+		level.height = sub.imageheight;
+		level.subifd = true;
+		levels->push_back (level);
+	}
+
+	// the chain carries the next page after the overviews; a bound stops loops
+	offset = base.nextifd;
+	for (auto i = 0; offset != 0 && i < 256; i++) {
+		BASICHEADER next;
+		try {
+			parse_ifd (&next, offset);
+		}
+		catch (general_exception) {
+			break;
+		}
+		offset = next.nextifd;
+		if (next.newsubfiletype & 4) {
+			continue;
+		}
+		// a full resolution image is the next page
+		if ((next.newsubfiletype & 1) == 0) {
+			break;
+		}
+		level.offset = next.ifdoffset;
+		level.width = next.imagewidth;
+		level.height = next.imageheight;
+		level.subifd = false;
+		levels->push_back (level);
+	}
+	return (int)levels->size ();
+}
+
+/// <summary>
+/// load one resolution level
+/// </summary>
+/// <param name="level">level from list_levels</param>
+/// <returns>the raster, 0 on fail</returns>
+BYTE* TIFF::load_tiff_level (const TIFFLEVEL& level)
+{
+	BASICHEADER header;
+	BYTE* answer;
+
+	format = FMT::FMT_ERROR;
+	status.reset (0);
+	stats.reset ();
+	fd->buffer_ptr = 0;
+	fd->set_endian ();
+	parse_ifd (&header, level.offset);
+	answer = header.load_raster (fd, &format, &status, best_effort);
+	width = header.imagewidth;
+	height = header.imageheight;
 	return answer;
 }
+
+/// <summary>
+/// load the smallest level at least width x height, or the full image if
+/// none is that big
+/// </summary>
+/// <param name="width">wanted width</param>
+/// <param name="height">wanted height</param>
+/// <returns>the raster, 0 on fail; this->width and height give the size loaded</returns>
+BYTE* TIFF::load_tiff_closest (int width, int height)
+{
+	std::vector<TIFFLEVEL> levels;
+	int best = 0;
+
+	list_levels (&levels);
+	for (auto i = 1; i < (int)levels.size (); i++) {
+		if (levels[i].width < width || levels[i].height < height) {
+			continue;
+		}
+		if ((double)levels[i].width * levels[i].height < (double)levels[best].width * levels[best].height) {
+			best = i;
+		}
+	}
+	return load_tiff_level (levels[best]);
+}
 /////////////////////////////////////////////////////////////////////////////////////////////////
 ///BASICHEADER
 /////////////////////////////////////////////////////////////////////////////////////////////////
 
+/// <summary>
+/// duplicate an owned array, NULL stays NULL
+/// </summary>
+template <typename T> static T* copy_array (const T* src, long N)
+{
+	T* answer;
+	if (!src || N <= 0) {
+		return NULL;
+	}
+	answer = new T[N];
+	if (!answer) {
+		throw general_exception ("out_of_memory");  // OX[
+	}
+	memcpy (answer, src, N * sizeof (T));
+	return answer;
+}
+
+/// <summary>
+/// make this a deep copy of another header, freeing what this one held
+/// </summary>
+/// <param name="other">header to copy</param>
+void BASICHEADER::copy_from (const BASICHEADER& other)
+{
+	unsigned long* mystripoffsets;
+	unsigned long* mystripbytecounts;
+	unsigned long* mytileoffsets;
+	unsigned long* mytilebytecounts;
+	BYTE* mycolormap;
+	unsigned int* mypalette;
+	double* mysmaxsamplevalue;
+	double* mysminsamplevalue;
+	unsigned long* mysubifds;
+	JPEGTABLES* myjpegtables;
+	LERCPARAMETERS* mylercparameters;
+
+	if (&other == this) {
+		return;
+	}
+	delete[] stripbytecounts;
+	delete[] stripoffsets;
+	delete[] tilebytecounts;
+	delete[] tileoffsets;
+	delete[] colormap;
+	delete[] palette;
+	delete[] smaxsamplevalue;
+	delete[] sminsamplevalue;
+	delete[] subifds;
+	delete jpegtables;
+	delete lercparameters;
+	stripoffsets = stripbytecounts = tileoffsets = tilebytecounts = subifds = NULL;
+	colormap = NULL;
+	palette = NULL;
+	smaxsamplevalue = sminsamplevalue = NULL;
+	jpegtables = NULL;
+	lercparameters = NULL;
+
+	mystripoffsets = copy_array (other.stripoffsets, other.Nstripoffsets);
+	mystripbytecounts = copy_array (other.stripbytecounts, other.Nstripbytecounts);
+	mytileoffsets = copy_array (other.tileoffsets, other.Ntileoffsets);
+	mytilebytecounts = copy_array (other.tilebytecounts, other.Ntilebytecounts);
+	mycolormap = copy_array (other.colormap, (long)other.Ncolormap * 3);
+	mypalette = copy_array (other.palette, other.Npalette);
+	mysmaxsamplevalue = copy_array (other.smaxsamplevalue, other.Nsmaxsamplevalue);
+	mysminsamplevalue = copy_array (other.sminsamplevalue, other.Nsminsamplevalue);
+	mysubifds = copy_array (other.subifds, other.Nsubifds);
+	myjpegtables = other.jpegtables ? new JPEGTABLES (*other.jpegtables) : NULL;
+	mylercparameters = other.lercparameters ? new LERCPARAMETERS (*other.lercparameters) : NULL;
+
+	// plain fields, then the owned arrays
+	memcpy (this, &other, sizeof (BASICHEADER));
+	stripoffsets = mystripoffsets;
+	stripbytecounts = mystripbytecounts;
+	tileoffsets = mytileoffsets;
+	tilebytecounts = mytilebytecounts;
+	colormap = mycolormap;
+	palette = mypalette;
+	smaxsamplevalue = mysmaxsamplevalue;
+	sminsamplevalue = mysminsamplevalue;
+	subifds = mysubifds;
+	jpegtables = myjpegtables;
+	lercparameters = mylercparameters;
+}
+
 /// <summary>
 /// Some TIFF files have tiles in the strip byte counts and so on
 /// fixc this up
@@ -152,6 +626,9 @@ BYTE* TIFF::load_tiff ()
 /// <returns></returns>
 int BASICHEADER::header_fixupsections ()
 {
+	if (rowsperstrip <= 0 || rowsperstrip > imageheight) {
+		rowsperstrip = imageheight;  // default is the whole image in one strip
+	}
 	if (tilewidth == 0 && tileheight == 0) {
 		if (Nstripbytecounts > 0 &&
 			Nstripoffsets > 0 &&
@@ -192,6 +669,30 @@ int BASICHEADER::header_fixupsections ()
 	return -1;
 }
 
+/// <summary>
+/// check every strip or tile against the file once, so decoding needn't.
+/// Byte counts running off the end are cut short, sections starting
+/// outside the file are left empty.
+/// </summary>
+/// <param name="filesize">bytes in the file</param>
+void BASICHEADER::header_checksections (long filesize)
+{
+	unsigned long* offsets = tilewidth ? tileoffsets : stripoffsets;
+	unsigned long* counts = tilewidth ? tilebytecounts : stripbytecounts;
+	int N = tilewidth ? Ntileoffsets : Nstripoffsets;
+	unsigned long end = filesize > 0 ? (unsigned long)filesize : 0;
+
+	for (auto i = 0; i < N; i++) {
+		if (offsets[i] >= end || offsets[i] > INT_MAX) {
+			offsets[i] = end;
+			counts[i] = 0;
+		}
+		else if (counts[i] > end - offsets[i]) {
+			counts[i] = end - offsets[i];
+		}
+	}
+}
+
 /// <summary>
 /// check header
 /// </summary>
@@ -291,12 +792,28 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 {
 	unsigned long ii;
 	int jj;
+	TAG* jpegtag = NULL;
+	TAG* lerctag = NULL;
 
 	for (auto i = 0; i < Ntags; i++) {
 		if (tags[i].bad) {
 			continue;
 		}
 		switch (tags[i].tagid) {
+		case TID::TID_NEWSUBFILETYPE:
+			newsubfiletype = (unsigned long)tags[i].scalar;
+			break;
+		case TID::TID_SUBIFDS:
+			delete[] subifds;  // the tag may be repeated
+			subifds = new unsigned long[tags[i].datacount];
+			if (!subifds) {
+				throw general_exception ("out_of_memory");  // OX[
+			}
+			for (ii = 0; ii < tags[i].datacount; ii++) {
+				subifds[ii] = (unsigned long)tag_get_entry (&tags[i], ii);
+			}
+			Nsubifds = tags[i].datacount;
+			break;
 		case TID::TID_IMAGEWIDTH:
 			imagewidth = (int)tags[i].scalar;
 			break;
@@ -321,6 +838,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			fillorder = (int)tags[i].scalar;
 			break;
 		case TID::TID_STRIPOFFSETS:
+			delete[] stripoffsets;
 			stripoffsets = new unsigned long[tags[i].datacount];
 			if (!stripoffsets) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -337,6 +855,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			rowsperstrip = (int)tags[i].scalar;
 			break;
 		case TID::TID_STRIPBYTECOUNTS:
+			delete[] stripbytecounts;
 			stripbytecounts = new unsigned long[tags[i].datacount];
 			if (!stripbytecounts) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -360,10 +879,21 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 				throw general_exception ("parse_error");  // OX[
 			}
 			Ncolormap = tags[i].datacount / 3;
+			delete[] colormap;
 			colormap = new BYTE[Ncolormap * 3];
 			if (!colormap) {
 				throw general_exception ("out_of_memory");  // OX[
 			}
+			if (tags[i].datatype == TAG_TYPE::TAG_SHORT && tags[i].vector && !tags[i].bad) {
+				// the usual case, read the 16 bit entries directly
+				const unsigned short* entries = static_cast<unsigned short*>(tags[i].vector);
+				for (jj = 0; jj < Ncolormap; jj++) {
+					colormap[jj * 3 + 0] = entries[jj] >> 8;
+					colormap[jj * 3 + 1] = entries[jj + Ncolormap] >> 8;
+					colormap[jj * 3 + 2] = entries[jj + Ncolormap * 2] >> 8;
+				}
+				break;
+			}
 			for (jj = 0; jj < Ncolormap; jj++) {
 				colormap[jj * 3 + 0] = (int)tag_get_entry (&tags[i], jj) / 256;
 			}
@@ -381,6 +911,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			tileheight = (int)tags[i].scalar;
 			break;
 		case TID::TID_TILEOFFSETS:
+			delete[] tileoffsets;
 			tileoffsets = new unsigned long[tags[i].datacount];
 			if (!tileoffsets) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -391,6 +922,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			Ntileoffsets = tags[i].datacount;
 			break;
 		case TID::TID_TILEBYTECOUNTS:
+			delete[] tilebytecounts;
 			tilebytecounts = new unsigned long[tags[i].datacount];
 			if (!tilebytecounts) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -409,6 +941,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			}
 			break;
 		case TID::TID_SMINSAMPLEVALUE:
+			delete[] sminsamplevalue;
 			sminsamplevalue = new double[tags[i].datacount];
 			if (!sminsamplevalue) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -419,6 +952,7 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			Nsminsamplevalue = tags[i].datacount;
 			break;
 		case TID::TID_SMAXSAMPLEVALUE:
+			delete[] smaxsamplevalue;
 			smaxsamplevalue = new double[tags[i].datacount];
 			if (!smaxsamplevalue) {
 				throw general_exception ("out_of_memory");  // OX[
@@ -449,6 +983,12 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 		case TID::TID_EXTRASAMPLES:
 			extrasamples = (int)tags[i].scalar;
 			break;
+		case TID::TID_JPEGTABLES:
+			jpegtag = &tags[i];
+			break;
+		case TID::TID_LERCPARAMETERS:
+			lerctag = &tags[i];
+			break;
 		default:
 			//not supported.
 			//G[ɂȂ
@@ -456,21 +996,98 @@ int BASICHEADER::fill_header (TAG* tags, int Ntags)
 			break;
 		}
 	}
+	if (photo_metric_interpretation == photo_metric_interpretations::PI_RGB_Palette) {
+		build_palette ();
+	}
+	if (compression == COMPRESSION::COMPRESSION_JPEG) {
+		// every strip or tile shares these, so parse them here and not per section
+		delete jpegtables;
+		jpegtables = new JPEGTABLES;
+		if (!jpegtables) {
+			throw general_exception ("out_of_memory");  // OX[
+		}
+		jpegtables->ycbcr = photo_metric_interpretation == photo_metric_interpretations::PI_YCbCr;
+		if (jpegtag && jpegtag->vector && jpegtag->datacount > 1) {
+			if (!jpegtables->parse (static_cast<BYTE*>(jpegtag->vector), jpegtag->datacount)) {
+				throw general_exception ("parse_error");  // OX[
+			}
+		}
+	}
+	if (compression == COMPRESSION::COMPRESSION_LERC) {
+		// the blobs carry the samples in their own type, which has to be the TIFF's
+		delete lercparameters;
+		lercparameters = new LERCPARAMETERS;
+		if (!lercparameters) {
+			throw general_exception ("out_of_memory");  // OX[
+		}
+		if (lerctag && lerctag->datacount >= 1) {
+			lercparameters->version = (int)tag_get_entry (lerctag, 0);
+		}
+		if (lerctag && lerctag->datacount >= 2) {
+			lercparameters->compression = (int)tag_get_entry (lerctag, 1);
+		}
+		lercparameters->depth = planarconfiguration == 2 ? 1 : samplesperpixel;
+		switch (sampleformat[0]) {
+		case SAMPLE_FORMAT::SAMPLEFORMAT_UINT:
+			lercparameters->type = bitspersample[0] == 8 ? LERC_BYTE : bitspersample[0] == 16 ? LERC_USHORT : bitspersample[0] == 32 ? LERC_UINT : LERC_UNDEFINED;
+			break;
+		case SAMPLE_FORMAT::SAMPLEFORMAT_INT:
+			lercparameters->type = bitspersample[0] == 8 ? LERC_CHAR : bitspersample[0] == 16 ? LERC_SHORT : bitspersample[0] == 32 ? LERC_INT : LERC_UNDEFINED;
+			break;
+		case SAMPLE_FORMAT::SAMPLEFORMAT_IEEEFP:
+			lercparameters->type = bitspersample[0] == 32 ? LERC_FLOAT : bitspersample[0] == 64 ? LERC_DOUBLE : LERC_UNDEFINED;
+			break;
+		default:
+			lercparameters->type = LERC_UNDEFINED;
+			break;
+		}
+	}
 
 	return 0;
 }
+
 /// <summary>
-/// 
+/// pack the colormap into RGBA words for pal_to_rgba.
+/// there are at least 256 entries so any 8 bit index can be looked up
+/// without a check; entries past the colormap are opaque black.
 /// </summary>
-/// <returns></returns>
-int BASICHEADER::header_Noutsamples ()
+void BASICHEADER::build_palette ()
 {
-
-	switch (photo_metric_interpretation) {
-	case photo_metric_interpretations::PI_BlackIsZero:
-	case photo_metric_interpretations::PI_WhiteIsZero:
-		return 2;
+	delete[] palette;
+	palette = NULL;
+	Npalette = Ncolormap > 256 ? Ncolormap : 256;
+	palette = new unsigned int[Npalette];
+	if (!palette) {
+		throw general_exception ("out_of_memory");  // OX[
+	}
+	for (auto i = 0; i < Npalette; i++) {
+		BYTE* entry = (BYTE*)&palette[i];
+		if (i < Ncolormap) {
+			entry[0] = colormap[i * 3];
+			entry[1] = colormap[i * 3 + 1];
+			entry[2] = colormap[i * 3 + 2];
+		}
+		else {
+			entry[0] = entry[1] = entry[2] = 0;
+		}
+		entry[3] = 255;
+	}
+}
+/// <summary>
+/// 
+/// </summary>
+/// <returns></returns>
+int BASICHEADER::header_Noutsamples ()
+{
+
+	switch (photo_metric_interpretation) {
+	case photo_metric_interpretations::PI_BlackIsZero:
+	case photo_metric_interpretations::PI_WhiteIsZero:
+		return 2;
 	case photo_metric_interpretations::PI_CMYK:
+		if (cmyk_as_rgba ()) {
+			return 4;
+		}
 		if (extrasamples == 1) {
 			return 5;
 		}
@@ -501,6 +1118,9 @@ int BASICHEADER::header_Ninsamples ()
 	case photo_metric_interpretations::PI_WhiteIsZero:
 		return 1 + ((extrasamples == 1) ? 1 : 0);
 	case photo_metric_interpretations::PI_CMYK:
+		if (cmyk_as_rgba ()) {
+			return 4;
+		}
 		return 4 + ((extrasamples == 1) ? 1 : 0);
 	case photo_metric_interpretations::PI_RGB:
 		return 3 + ((extrasamples == 1) ? 1 : 0);
@@ -523,6 +1143,9 @@ FMT BASICHEADER::header_outputformat ()
 	case photo_metric_interpretations::PI_WhiteIsZero:
 		return FMT::FMT_GREYALPHA;
 	case photo_metric_interpretations::PI_CMYK:
+		if (cmyk_as_rgba ()) {
+			return FMT::FMT_RGBA;
+		}
 		if (extrasamples == 1) {
 			return FMT::FMT_CMYKA;
 		}
@@ -542,343 +1165,1900 @@ FMT BASICHEADER::header_outputformat ()
 
 }
 /// <summary>
-/// 
+/// decode the whole image
 /// </summary>
-BYTE* BASICHEADER::load_raster (FileData* fd, FMT* format)
+/// <param name="fd"></param>
+/// <param name="format">return for the format</param>
+/// <param name="status">return for the sections that failed, may be NULL</param>
+/// <param name="best_effort">keep going when sections fail, leaving them black</param>
+/// <returns>the raster, 0 on fail</returns>
+BYTE* BASICHEADER::load_raster (FileData* fd, FMT* format, TIFFSTATUS* status, bool best_effort)
 {
 	BYTE* answer = 0;
-	BYTE* strip = 0;
 	int i;
-	//unsigned long ii;
-	int row = 0;
-	int swidth, sheight;
-	int tilesacross = 0;
-	int sample_index;
-	int outsamples;
-	int insamples;
+	int N;
+	int err;
+	PREFETCHER* prefetch = NULL;
 	try {
 		*format = header_outputformat ();
-		outsamples = header_Noutsamples ();
-		insamples = header_Ninsamples ();
-
-		answer = new BYTE[imagewidth * imageheight * outsamples];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		for (auto ii = 0;ii < imagewidth * imageheight;ii++) {
-			answer[ii * outsamples + outsamples - 1] = 255;
-		}
-		if (tilewidth) {
-			tilesacross = (imagewidth + tilewidth - 1) / tilewidth;
+		N = raster_sections ();
+		if (status) {
+			status->reset (N);
 		}
+		answer = new_raster ();
+		prefetch = start_prefetch (fd);
 
 		if (planarconfiguration == 2) {
-			if (photo_metric_interpretation == photo_metric_interpretations::PI_RGB) {
-				sample_index = 0;
-				for (i = 0; i < Nstripoffsets; i++) {
-					if (sample_index >= insamples)
-						continue;
-					strip = read_channel (i, &swidth, &sheight, fd);
-					if (!strip) {
-						throw general_exception ("out_of_memory");  // OX[
+			if (decode_planar (fd, prefetch, answer, true, status, best_effort)) {
+				throw general_exception ("out_of_memory");  // OX[
+			}
+		}
+		else {
+			for (i = 0; i < N; i++) {
+				if (!section_wanted (i)) {
+					continue;
+				}
+				wait_section (prefetch, i);
+				err = paste_section (i, fd, answer, 0, imageheight);
+				if (err) {
+					if (status) {
+						status->fail (i, err);
 					}
-					for (auto ii = 0; ii < swidth * sheight; ii++) {
-						answer[((row + ii / swidth) * imagewidth + (ii % swidth)) * outsamples + sample_index] = strip[ii];
+					if (!best_effort) {
+						throw general_exception ("out_of_memory");  // OX[
 					}
+					clear_section (i, answer);
+				}
+			}
+		}
 
-					row += sheight;
-					if (row >= imageheight) {
-						row = 0;
-						sample_index++;
-					}
+		delete prefetch;
+		return answer;
+	}
+	catch (general_exception) {
+		//out_of_memory:
+		//parse_error:
+		delete prefetch;
+		delete[] answer;
+		*format = FMT::FMT_ERROR;
+		return 0;
+	}
+}
 
-					delete[] strip;
+/// <summary>
+/// decode into separate planes rather than pixels
+/// </summary>
+/// <param name="fd"></param>
+/// <param name="format">return for the format the planes make up</param>
+/// <param name="Nplanes">return for the number of planes, header_Ninsamples</param>
+/// <returns>Nplanes planes of imagewidth * imageheight bytes, one after another, 0 on fail</returns>
+BYTE* BASICHEADER::load_planes (FileData* fd, FMT* format, int* Nplanes)
+{
+	BYTE* answer = 0;
+	BYTE* pixels = 0;
+	PREFETCHER* prefetch = NULL;
+	long npixels = (long)imagewidth * imageheight;
+	int planes = header_Ninsamples ();
+
+	try {
+		*format = header_outputformat ();
+		if (planarconfiguration == 2) {
+			answer = new BYTE[npixels * planes];
+			prefetch = start_prefetch (fd);
+			if (decode_planar (fd, prefetch, answer, false)) {
+				throw general_exception ("out_of_memory");  // OX[
+			}
+			delete prefetch;
+			prefetch = NULL;
+		}
+		else {
+			// stored as pixels, so split them up
+			int outsamples = header_Noutsamples ();
+			pixels = load_raster (fd, format);
+			if (!pixels) {
+				throw general_exception ("out_of_memory");  // OX[
+			}
+			answer = new BYTE[npixels * planes];
+			for (auto ii = 0; ii < planes; ii++) {
+				BYTE* plane = answer + npixels * ii;
+				for (long iii = 0; iii < npixels; iii++) {
+					plane[iii] = pixels[iii * outsamples + ii];
 				}
-				return answer;
-			}
-			else if (photo_metric_interpretation == photo_metric_interpretations::PI_CMYK) {
-				sample_index = 0;
-				for (i = 0; i < Nstripoffsets; i++) {
-					if (sample_index >= insamples)
-						continue;
-					strip = read_channel (i, &swidth, &sheight, fd);
-					if (!strip) {
-						throw general_exception ("out_of_memory");  // OX[	
-					}
-					for (auto ii = 0; ii < swidth * sheight; ii++) {
-						answer[((row + ii / swidth) * imagewidth + (ii % swidth)) * outsamples + sample_index] = strip[ii];
-					}
+			}
+			delete[] pixels;
+		}
+		*Nplanes = planes;
+		return answer;
+	}
+	catch (general_exception) {
+		delete prefetch;
+		delete[] pixels;
+		delete[] answer;
+		*format = FMT::FMT_ERROR;
+		*Nplanes = 0;
+		return 0;
+	}
+}
 
-					row += sheight;
-					if (row >= imageheight) {
-						row = 0;
-						sample_index++;
-					}
+/// <summary>
+/// interleave a run of planes into pixels outsamples bytes apart
+/// </summary>
+/// <param name="out">N pixels</param>
+/// <param name="planes">Nplanes pointers to N bytes each</param>
+/// <param name="Nplanes">planes, no more than outsamples</param>
+/// <param name="outsamples">bytes per output pixel</param>
+/// <param name="N">pixels</param>
+static void interleave_planes (BYTE* out, BYTE* const* planes, int Nplanes, int outsamples, long N)
+{
+	long i = 0;
+
+#ifdef TIFF_SSE2
+	if (outsamples == 4 && (Nplanes == 3 || Nplanes == 4)) {
+		// sixteen pixels a step, opaque alpha when there is no fourth plane
+		const __m128i opaque = _mm_set1_epi8 ((char)0xFF);
+		for (; i + 16 <= N; i += 16) {
+			__m128i r = _mm_loadu_si128 ((const __m128i*)(planes[0] + i));
+			__m128i g = _mm_loadu_si128 ((const __m128i*)(planes[1] + i));
+			__m128i b = _mm_loadu_si128 ((const __m128i*)(planes[2] + i));
+			__m128i a = Nplanes == 4 ? _mm_loadu_si128 ((const __m128i*)(planes[3] + i)) : opaque;
+			__m128i rglo = _mm_unpacklo_epi8 (r, g);
+			__m128i rghi = _mm_unpackhi_epi8 (r, g);
+			__m128i balo = _mm_unpacklo_epi8 (b, a);
+			__m128i bahi = _mm_unpackhi_epi8 (b, a);
+			_mm_storeu_si128 ((__m128i*)(out + i * 4), _mm_unpacklo_epi16 (rglo, balo));
+			_mm_storeu_si128 ((__m128i*)(out + i * 4 + 16), _mm_unpackhi_epi16 (rglo, balo));
+			_mm_storeu_si128 ((__m128i*)(out + i * 4 + 32), _mm_unpacklo_epi16 (rghi, bahi));
+			_mm_storeu_si128 ((__m128i*)(out + i * 4 + 48), _mm_unpackhi_epi16 (rghi, bahi));
+		}
+	}
+#endif
+	for (auto ii = 0; ii < Nplanes; ii++) {
+		const BYTE* plane = planes[ii];
+		BYTE* dst = out + ii;
+		for (long iii = i; iii < N; iii++) {
+			dst[iii * outsamples] = plane[iii];
+		}
+	}
+}
 
-					delete[] strip;
-				}
-				return answer;
+/// <summary>
+/// the samples as they are, as 32 bit floats, for data the 8 bit formats
+/// would squash (elevation, reflectance). No photometric conversion: float
+/// samples come back unchanged and integer ones as their values.
+/// Every sample has to be 8, 16, 32 or 64 bits of the same format.
+/// </summary>
+/// <param name="fd"></param>
+/// <param name="Nsamples">return for the samples per pixel</param>
+/// <returns>imagewidth * imageheight * samplesperpixel floats, 0 on fail</returns>
+float* BASICHEADER::load_float (FileData* fd, int* Nsamples)
+{
+	float* answer = 0;
+	BYTE* data = 0;
+	unsigned long N;
+	int bytes = bitspersample[0] / 8;
+	int stripsperimage = rowsperstrip > 0 ? (imageheight + rowsperstrip - 1) / rowsperstrip : 1;
+
+	try {
+		for (auto i = 0; i < samplesperpixel; i++) {
+			if (bitspersample[i] != bitspersample[0] || sampleformat[i] != sampleformat[0]) {
+				throw general_exception ("parse_error");  // OX[
+			}
+		}
+		if (bitspersample[0] != 8 && bitspersample[0] != 16 && bitspersample[0] != 32 && bitspersample[0] != 64) {
+			throw general_exception ("parse_error");  // OX[
+		}
+		if (sampleformat[0] == SAMPLE_FORMAT::SAMPLEFORMAT_IEEEFP ? bytes < 4 :
+			sampleformat[0] != SAMPLE_FORMAT::SAMPLEFORMAT_UINT && sampleformat[0] != SAMPLE_FORMAT::SAMPLEFORMAT_INT) {
+			throw general_exception ("parse_error");  // OX[
+		}
+		// subsampled YCbCr isn't one sample per pixel, planar tiles aren't supported anywhere
+		if ((photo_metric_interpretation == photo_metric_interpretations::PI_YCbCr && compression != COMPRESSION::COMPRESSION_JPEG) ||
+			(tilewidth && planarconfiguration == 2)) {
+			throw general_exception ("parse_error");  // OX[
+		}
+		answer = new float[(size_t)imagewidth * imageheight * samplesperpixel];
+		if (!answer) {
+			throw general_exception ("out_of_memory");  // OX[
+		}
+		memset (answer, 0, (size_t)imagewidth * imageheight * samplesperpixel * sizeof (float));
+
+		int sections = tilewidth ? Ntileoffsets : Nstripoffsets;
+		for (auto index = 0; index < sections; index++) {
+			int x = 0;
+			int y;
+			int width = imagewidth;
+			int height;
+			int plane = 0;
+			int depth = samplesperpixel;
+			unsigned long count;
+			if (tilewidth) {
+				int tilesacross = (imagewidth + tilewidth - 1) / tilewidth;
+				x = (index % tilesacross) * tilewidth;
+				y = (index / tilesacross) * tileheight;
+				width = tilewidth;
+				height = tileheight;
+				fd->buffer_ptr = tileoffsets[index];
+				count = tilebytecounts[index];
 			}
 			else {
+				if (planarconfiguration == 2) {
+					plane = index / stripsperimage;
+					depth = 1;
+					if (plane >= samplesperpixel) {
+						break;
+					}
+					y = (index % stripsperimage) * rowsperstrip;
+				}
+				else {
+					y = index * rowsperstrip;
+				}
+				height = rowsperstrip < imageheight - y ? rowsperstrip : imageheight - y;
+				fd->buffer_ptr = stripoffsets[index];
+				count = stripbytecounts[index];
+			}
+			if (y >= imageheight || height <= 0) {
+				continue;
+			}
+			CODECJOB job;
+			if (section_job (&job, width, height, depth)) {
+				throw general_exception ("parse_error");  // OX[
+			}
+			STAGETIMER timer (stats);
+			data = decompress (fd, count, compression, &job, &N);
+			timer.lap (TIFF_STAGE::STAGE_DECOMPRESS, count);
+			if (!data) {
+				throw general_exception ("parse_error");  // OX[
+			}
+			if (N / bytes / depth / width < (unsigned long)height) {
 				throw general_exception ("parse_error");  // OX[
 			}
+			// the predictor is undone sample by sample as they are converted
+			samples_to_float (answer, x, y, plane, depth, data, width, height);
+			timer.lap (TIFF_STAGE::STAGE_CONVERT, N);
+			delete[] data;
+			data = 0;
 		}
+		*Nsamples = samplesperpixel;
+		return answer;
+	}
+	catch (general_exception) {
+		delete[] data;
+		delete[] answer;
+		return 0;
+	}
+}
 
-		if (Nstripoffsets > 0 && tilesacross == 0) {
-			for (i = 0; i < Nstripoffsets; i++) {
-				strip = read_strip (i, &swidth, &sheight, fd, &insamples);
-				if (!strip) {
-					throw general_exception ("out_of_memory");  // OX[	
+/// <summary>
+/// undo the predictor on one decompressed strip or tile and paste its samples into the float raster
+/// </summary>
+/// <param name="answer">imagewidth * imageheight * samplesperpixel floats</param>
+/// <param name="x">section position in the image</param>
+/// <param name="y"></param>
+/// <param name="plane">first sample the section holds</param>
+/// <param name="depth">samples per pixel in the section</param>
+/// <param name="data">width * height * depth samples, changed in place</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+void BASICHEADER::samples_to_float (float* answer, int x, int y, int plane, int depth, BYTE* data, int width, int height)
+{
+	int bytes = bitspersample[0] / 8;
+	size_t rowsamples = (size_t)width * depth;
+	unsigned long long mask = bytes == 8 ? ~0ULL : (1ULL << (bytes * 8)) - 1;
+	unsigned long long prev[16];
+	BYTE* shuffled = 0;
+	bool big = endianness == ENDIAN::BIG_ENDIAN;
+
+	if (predictor == 3) {
+		shuffled = new BYTE[rowsamples * bytes];
+		if (!shuffled) {
+			throw general_exception ("out_of_memory");  // OX[
+		}
+		// the floating point predictor puts the bytes back most significant first
+		big = true;
+	}
+	for (auto r = 0; r < height && y + r < imageheight; r++) {
+		BYTE* src = data + r * rowsamples * bytes;
+		if (predictor == 3) {
+			// bytes differenced along the row, then split into planes by significance
+			for (auto i = (size_t)depth; i < rowsamples * bytes; i++) {
+				src[i] += src[i - depth];
+			}
+			for (auto i = 0UL; i < rowsamples; i++) {
+				for (auto b = 0; b < bytes; b++) {
+					shuffled[i * bytes + b] = src[b * rowsamples + i];
+				}
+			}
+			src = shuffled;
+		}
+		memset (prev, 0, sizeof (prev));
+		for (auto xx = 0; xx < width && x + xx < imagewidth; xx++) {
+			float* dst = answer + ((size_t)(y + r) * imagewidth + x + xx) * samplesperpixel + plane;
+			for (auto c = 0; c < depth; c++) {
+				const BYTE* s = src + ((size_t)xx * depth + c) * bytes;
+				unsigned long long u = 0;
+				for (auto b = 0; b < bytes; b++) {
+					u |= (unsigned long long)s[big ? bytes - 1 - b : b] << (b * 8);
+				}
+				if (predictor == 2) {
+					u = (u + prev[c]) & mask;
+					prev[c] = u;
+				}
+				if (sampleformat[0] == SAMPLE_FORMAT::SAMPLEFORMAT_IEEEFP) {
+					if (bytes == 4) {
+						unsigned int u32 = (unsigned int)u;
+						float f;
+						memcpy (&f, &u32, 4);
+						dst[c] = f;
+					}
+					else {
+						double d;
+						memcpy (&d, &u, 8);
+						dst[c] = (float)d;
+					}
+				}
+				else if (sampleformat[0] == SAMPLE_FORMAT::SAMPLEFORMAT_INT) {
+					if (bytes < 8 && (u >> (bytes * 8 - 1)) & 1) {
+						u |= ~mask;
+					}
+					dst[c] = (float)(long long)u;
+				}
+				else {
+					dst[c] = (float)u;
 				}
-				pasteflexible (answer, imagewidth, imageheight, outsamples,
-							   strip, swidth, sheight, insamples, 0, row);
-				row += sheight;
-				delete[] strip;
 			}
 		}
+	}
+	delete[] shuffled;
+}
 
-		if (Nstripoffsets > 0 && tilesacross != 0) {
-			Ntileoffsets = Nstripoffsets;
-			tileoffsets = stripoffsets;
-			stripoffsets = 0;
-			Nstripoffsets = 0;
+/// <summary>
+/// planar images, a band of rows at a time. The planes of a band are
+/// decoded side by side on a small pool and then interleaved into the
+/// raster in one pass, or written straight into separate planes.
+/// </summary>
+/// <param name="fd"></param>
+/// <param name="prefetch">read ahead, may be NULL</param>
+/// <param name="answer">raster, or planes of imagewidth * imageheight bytes</param>
+/// <param name="interleave">true for pixels, false for planes</param>
+/// <param name="status">return for the sections that failed, may be NULL</param>
+/// <param name="best_effort">keep going when sections fail, leaving their samples 0</param>
+/// <returns>0 on success, -1 on fail, SECTION_UNSUPPORTED for planar tiles</returns>
+int BASICHEADER::decode_planar (FileData* fd, PREFETCHER* prefetch, BYTE* answer, bool interleave, TIFFSTATUS* status, bool best_effort)
+{
+	int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
+	int planes = header_Ninsamples ();
+	int outsamples = header_Noutsamples ();
+	long npixels = (long)imagewidth * imageheight;
+	BYTE* buffers[16] = {};
+	FileData* views[16] = {};
+	BYTE* bands[16];
+	THREADPOOL* pool = NULL;
+	std::atomic<int> failed (0);
+	int err = 0;
+
+	if (planes > samplesperpixel) {
+		planes = samplesperpixel;
+	}
+	// the planes are read as strips, planar tiles aren't supported anywhere
+	if (tilewidth) {
+		return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
+	}
+	try {
+		for (auto ii = 0; ii < planes; ii++) {
+			views[ii] = new FileData (fd);
+			if (interleave) {
+				buffers[ii] = new BYTE[(long)imagewidth * rowsperstrip];
+			}
 		}
-		if (Ntilebytecounts == 0 && tilesacross != 0) {
-			Ntilebytecounts = Nstripoffsets;
-			tilebytecounts = stripbytecounts;
-			stripbytecounts = 0;
-			Nstripbytecounts = 0;
+		// threads only pay for themselves on big bands
+		if (planes > 1 && (long)imagewidth * rowsperstrip >= 65536) {
+			pool = new THREADPOOL (planes - 1);
 		}
-		if (Ntileoffsets > 0) {
-			for (i = 0; i < Ntileoffsets; i++) {
-				strip = read_tile (i, &swidth, &sheight, fd, &insamples);
-				if (!strip) {
-					throw general_exception ("out_of_memory");  // OX[
-				}
+		for (auto band = 0; band < stripsperimage && !err; band++) {
+			int top = band * rowsperstrip;
+			int rows = imageheight - top < rowsperstrip ? imageheight - top : rowsperstrip;
+			long N = (long)imagewidth * rows;
 
-				pasteflexible (answer, imagewidth, imageheight, outsamples,
-							   strip, swidth, sheight, insamples,
-							   (i % tilesacross) * tilewidth,
-							   (i / tilesacross) * tileheight);
-				delete[] strip;
+			for (auto ii = 0; ii < planes; ii++) {
+				bands[ii] = interleave ? buffers[ii] : answer + npixels * ii + (long)imagewidth * top;
+				wait_section (prefetch, ii * stripsperimage + band);
+			}
+			for (auto ii = 0; ii < planes; ii++) {
+				auto task = [this, &failed, &views, &bands, ii, band, stripsperimage, rows, status, best_effort] {
+					int index = ii * stripsperimage + band;
+					int code;
+					try {
+						code = decode_channel (index, views[ii], bands[ii], rows);
+					}
+					catch (...) {
+						code = static_cast<int>(SECTION_ERROR::SECTION_OUT_OF_MEMORY);
+					}
+					if (code) {
+						failed++;
+						if (status) {
+							status->fail (index, code);
+						}
+						if (best_effort) {
+							memset (bands[ii], 0, (size_t)imagewidth * rows);
+						}
+					}
+				};
+				if (pool && ii > 0) {
+					pool->submit (task);
+				}
+				else {
+					task ();
+				}
+			}
+			if (pool) {
+				pool->wait_all ();
+			}
+			if (failed && !best_effort) {
+				err = -1;
+			}
+			else if (interleave) {
+				STAGETIMER timer (stats);
+				interleave_planes (answer + (long)imagewidth * top * outsamples, bands, planes, outsamples, N);
+				timer.lap (TIFF_STAGE::STAGE_PASTE, (unsigned long long)N * planes);
 			}
 		}
+	}
+	catch (...) {
+		err = -1;
+	}
+	delete pool;
+	for (auto ii = 0; ii < planes; ii++) {
+		delete views[ii];
+		delete[] buffers[ii];
+	}
+	return err;
+}
 
-		return answer;
+/// <summary>
+/// allocate the output raster, alpha set to opaque
+/// </summary>
+/// <param name="scale">1, or the reduction for load_raster_scaled</param>
+/// <returns>imagewidth * imageheight pixels (divided by scale, rounded up) of header_Noutsamples bytes</returns>
+BYTE* BASICHEADER::new_raster (int scale)
+{
+	int outsamples = header_Noutsamples ();
+	int width = (imagewidth + scale - 1) / scale;
+	int height = (imageheight + scale - 1) / scale;
+	BYTE* answer = new BYTE[width * height * outsamples];
+	if (!answer) {
+		throw general_exception ("out_of_memory");  // OX[
 	}
-	catch (general_exception) {
-		//out_of_memory:
-		//parse_error:
-		delete[] answer;
-		delete[] strip;
-		*format = FMT::FMT_ERROR;
-		return 0;
+	for (auto ii = 0;ii < width * height;ii++) {
+		answer[ii * outsamples + outsamples - 1] = 255;
 	}
+	return answer;
 }
 
+/// <summary>
+/// can the tiles be decoded straight to 1 / scale size. Needs JPEG tiles
+/// that divide evenly, so each reduced tile lands on whole pixels.
+/// </summary>
+/// <param name="scale">2, 4 or 8</param>
+/// <returns></returns>
+bool BASICHEADER::scaled_tiles (int scale)
+{
+	return compression == COMPRESSION::COMPRESSION_JPEG && tilewidth > 0 && tileheight > 0 &&
+		planarconfiguration != 2 && tilewidth % scale == 0 && tileheight % scale == 0;
+}
 
+/// <summary>
+/// average a full size tile down by scale, counting only the pixels inside
+/// the image, as load_tiff_scaled does when it averages rows
+/// </summary>
+/// <param name="out">twidth / scale by theight / scale pixels</param>
+/// <param name="tile">twidth by theight pixels of depth bytes</param>
+/// <param name="twidth">a multiple of scale</param>
+/// <param name="theight">a multiple of scale</param>
+/// <param name="depth">bytes per pixel</param>
+/// <param name="width">columns of the tile inside the image</param>
+/// <param name="height">rows of the tile inside the image</param>
+/// <param name="scale">2, 4 or 8</param>
+static void shrink_tile (BYTE* out, const BYTE* tile, int twidth, int theight, int depth, int width, int height, int scale)
+{
+	int owidth = twidth / scale;
+	int oheight = theight / scale;
+
+	memset (out, 0, (size_t)owidth * oheight * depth);
+	for (auto oy = 0; oy < oheight && oy * scale < height; oy++) {
+		int rows = height - oy * scale < scale ? height - oy * scale : scale;
+		for (auto ox = 0; ox < owidth && ox * scale < width; ox++) {
+			int cols = width - ox * scale < scale ? width - ox * scale : scale;
+			unsigned long count = cols * rows;
+			for (auto n = 0; n < depth; n++) {
+				unsigned long sum = 0;
+				for (auto y = 0; y < rows; y++) {
+					const BYTE* p = tile + ((size_t)(oy * scale + y) * twidth + ox * scale) * depth + n;
+					for (auto x = 0; x < cols; x++) {
+						sum += p[x * depth];
+					}
+				}
+				out[((size_t)oy * owidth + ox) * depth + n] = (BYTE)((sum + count / 2) / count);
+			}
+		}
+	}
+}
 
 /// <summary>
-/// 
+/// decode every tile at 1 / scale size and paste it into a reduced raster.
+/// Only the reduced tiles are ever allocated, except for edge tiles that the
+/// image ends part way into a block of: the DCT would average their padding
+/// into the last pixels, so those are decoded at full size and averaged.
 /// </summary>
-/// <param name="index"></param>
-/// <param name="tile_width"></param>
-/// <param name="tile_height"></param>
 /// <param name="fd"></param>
-/// <param name="insamples"></param>
-/// <returns></returns>
-BYTE* BASICHEADER::read_tile (int index, int* tile_width, int* tile_height, FileData* fd, int* insamples)
+/// <param name="format">return for the format</param>
+/// <param name="scale">2, 4 or 8, scaled_tiles must be true</param>
+/// <returns>(imagewidth + scale - 1) / scale by (imageheight + scale - 1) / scale pixels, 0 on fail</returns>
+BYTE* BASICHEADER::load_raster_scaled (FileData* fd, FMT* format, int scale)
 {
-	BYTE* data = 0;
 	BYTE* answer = 0;
-	unsigned long N;
+	BYTE* tile = 0;
+	BYTE* full = 0;
+	PREFETCHER* prefetch = NULL;
+	int outwidth = (imagewidth + scale - 1) / scale;
+	int outheight = (imageheight + scale - 1) / scale;
+	int outsamples = header_Noutsamples ();
+	int tilesacross = (imagewidth + tilewidth - 1) / tilewidth;
+	int swidth, sheight, insamples;
 
 	try {
-		*insamples = header_Ninsamples ();
-
-		//fseek(fp, tileoffsets[index], SEEK_SET);
-		fd->buffer_ptr = tileoffsets[index];
-		data = decompress (fd, tilebytecounts[index], compression, &N, tilewidth, tileheight, T4options);
-		if (!data) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		answer = new BYTE[*insamples * tilewidth * tileheight];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		*tile_width = tilewidth;
-		*tile_height = tileheight;
-
-		switch (photo_metric_interpretation) {
-		case photo_metric_interpretations::PI_WhiteIsZero:
-		case photo_metric_interpretations::PI_BlackIsZero:
-			grey_to_grey (answer, tilewidth, tileheight, data, N, *insamples);
-			if (predictor == 2) {
-				unpredict_samples (answer, tilewidth, tileheight, *insamples);
+		*format = header_outputformat ();
+		answer = new_raster (scale);
+		prefetch = start_prefetch (fd);
+		for (auto i = 0; i < Ntileoffsets; i++) {
+			int x = (i % tilesacross) * tilewidth;
+			int y = (i / tilesacross) * tileheight;
+
+			wait_section (prefetch, i);
+			if ((x + tilewidth > imagewidth && imagewidth % scale) ||
+				(y + tileheight > imageheight && imageheight % scale)) {
+				full = read_tile (i, &swidth, &sheight, fd, &insamples);
+				if (!full) {
+					throw general_exception ("parse_error");  // OX[
+				}
+				tile = new BYTE[(size_t)(swidth / scale) * (sheight / scale) * insamples];
+				if (!tile) {
+					throw general_exception ("out_of_memory");  // OX[
+				}
+				shrink_tile (tile, full, swidth, sheight, insamples, imagewidth - x, imageheight - y, scale);
+				swidth /= scale;
+				sheight /= scale;
+				delete[] full;
+				full = 0;
 			}
-			break;
-		case photo_metric_interpretations::PI_RGB:
-			bitstream_to_rgba (answer, tilewidth, tileheight, data, N, *insamples);
-			if (predictor == 2) {
-				unpredict_samples (answer, tilewidth, *insamples, tileheight);
+			else {
+				tile = read_tile (i, &swidth, &sheight, fd, &insamples, scale);
 			}
-			break;
-		case photo_metric_interpretations::PI_RGB_Palette:
-			pal_to_rgba (answer, tilewidth, tileheight, data, N);
-			break;
-		case photo_metric_interpretations::PI_CMYK:
-			cmyk_to_cmyk (answer, tilewidth, tileheight, data, N, *insamples);
-			break;
-		case photo_metric_interpretations::PI_YCbCr:
-			ycbcr_to_rgba (answer, tilewidth, tileheight, data, N);
-			break;
-		default:
-			//perror("photo_metric_interpretation not supported");
+			if (!tile) {
+				throw general_exception ("parse_error");  // OX[
+			}
+			STAGETIMER timer (stats);
+			pasteflexible (answer, outwidth, outheight, outsamples,
+						   tile, swidth, sheight, insamples,
+						   (i % tilesacross) * swidth,
+						   (i / tilesacross) * sheight);
+			timer.lap (TIFF_STAGE::STAGE_PASTE, (unsigned long long)swidth * sheight * insamples);
+			delete[] tile;
+			tile = 0;
+		}
+		delete prefetch;
+		return answer;
+	}
+	catch (general_exception) {
+		delete prefetch;
+		delete[] full;
+		delete[] tile;
+		delete[] answer;
+		*format = FMT::FMT_ERROR;
+		return 0;
+	}
+}
+
+/// <summary>
+/// number of independently decodable sections (strips, tiles, or one
+/// strip of one plane for planar images)
+/// </summary>
+/// <returns>section count</returns>
+int BASICHEADER::raster_sections ()
+{
+	if (planarconfiguration == 2) {
+		// no tiles: the sections would number none and nothing would fail
+		if (tilewidth ||
+			(photo_metric_interpretation != photo_metric_interpretations::PI_RGB &&
+			photo_metric_interpretation != photo_metric_interpretations::PI_CMYK)) {
+			throw general_exception ("parse_error");  // OX[
+		}
+		return Nstripoffsets;
+	}
+	if (tilewidth) {
+		return Ntileoffsets;
+	}
+	return Nstripoffsets;
+}
+
+/// <summary>
+/// planar images may carry planes that aren't part of the output
+/// </summary>
+/// <param name="index">section index</param>
+/// <returns>true if the section has to be decoded</returns>
+bool BASICHEADER::section_wanted (int index)
+{
+	if (planarconfiguration == 2) {
+		int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
+		return index / stripsperimage < header_Ninsamples ();
+	}
+	return true;
+}
+
+/// <summary>
+/// decode one section and paste it into the raster.
+/// Sections don't overlap so several may be pasted at once, each with
+/// its own FileData cursor.
+/// </summary>
+/// <param name="index">section index</param>
+/// <param name="fd">file cursor</param>
+/// <param name="answer">raster holding image rows top to top + rows - 1</param>
+/// <param name="top">first image row in answer</param>
+/// <param name="rows">rows in answer</param>
+/// <returns>0 on success, else a SECTION_ERROR value</returns>
+int BASICHEADER::paste_section (int index, FileData* fd, BYTE* answer, int top, int rows)
+{
+	BYTE* strip;
+	int swidth, sheight;
+	int insamples;
+	int outsamples = header_Noutsamples ();
+	int err = 0;
+
+	if (planarconfiguration == 2) {
+		int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
+		int sample_index = index / stripsperimage;
+		int row = (index % stripsperimage) * rowsperstrip - top;
+
+		strip = read_channel (index, &swidth, &sheight, fd, &err);
+		if (!strip) {
+			return err;
+		}
+		STAGETIMER timer (stats);
+		for (auto y = 0; y < sheight; y++) {
+			if (row + y < 0 || row + y >= rows) {
+				continue;
+			}
+			BYTE* plane = strip + y * swidth;
+			interleave_planes (answer + (long)(row + y) * imagewidth * outsamples + sample_index, &plane, 1, outsamples, swidth);
+		}
+		timer.lap (TIFF_STAGE::STAGE_PASTE, (unsigned long long)swidth * sheight);
+		delete[] strip;
+		return 0;
+	}
+	if (tilewidth) {
+		int tilesacross = (imagewidth + tilewidth - 1) / tilewidth;
+
+		strip = read_tile (index, &swidth, &sheight, fd, &insamples, 1, &err);
+		if (!strip) {
+			return err;
+		}
+		STAGETIMER timer (stats);
+		pasteflexible (answer, imagewidth, rows, outsamples,
+					   strip, swidth, sheight, insamples,
+					   (index % tilesacross) * tilewidth,
+					   (index / tilesacross) * tileheight - top);
+		timer.lap (TIFF_STAGE::STAGE_PASTE, (unsigned long long)swidth * sheight * insamples);
+		delete[] strip;
+		return 0;
+	}
+	strip = read_strip (index, &swidth, &sheight, fd, &insamples, &err);
+	if (!strip) {
+		return err;
+	}
+	STAGETIMER timer (stats);
+	pasteflexible (answer, imagewidth, rows, outsamples,
+				   strip, swidth, sheight, insamples, 0, index * rowsperstrip - top);
+	timer.lap (TIFF_STAGE::STAGE_PASTE, (unsigned long long)swidth * sheight * insamples);
+	delete[] strip;
+	return 0;
+}
+
+/// <summary>
+/// pixels of the image covered by a section
+/// </summary>
+/// <param name="index">section index</param>
+/// <param name="region">return for the rectangle</param>
+void BASICHEADER::section_region (int index, TIFFREGION* region)
+{
+	region->index = index;
+	if (tilewidth && planarconfiguration != 2) {
+		int tilesacross = (imagewidth + tilewidth - 1) / tilewidth;
+		region->x = (index % tilesacross) * tilewidth;
+		region->y = (index / tilesacross) * tileheight;
+		region->width = tilewidth;
+		region->height = tileheight;
+	}
+	else {
+		if (planarconfiguration == 2) {
+			int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
+			index %= stripsperimage;
+			region->index = index;
+		}
+		region->x = 0;
+		region->y = index * rowsperstrip;
+		region->width = imagewidth;
+		region->height = rowsperstrip;
+	}
+	if (region->x + region->width > imagewidth) {
+		region->width = imagewidth - region->x;
+	}
+	if (region->y + region->height > imageheight) {
+		region->height = imageheight - region->y;
+	}
+}
+
+/// <summary>
+/// black out a section that failed, opaque as new_raster leaves it.
+/// Only the section's own plane is cleared for planar images.
+/// </summary>
+/// <param name="index">section index</param>
+/// <param name="answer">the whole raster</param>
+void BASICHEADER::clear_section (int index, BYTE* answer)
+{
+	TIFFREGION region;
+	int outsamples = header_Noutsamples ();
+	int first = 0;
+	int last = outsamples - 1;
+
+	section_region (index, &region);
+	if (planarconfiguration == 2) {
+		int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
+		first = index / stripsperimage;
+		last = first;
+	}
+	for (auto y = region.y; y < region.y + region.height; y++) {
+		BYTE* row = answer + ((long)y * imagewidth + region.x) * outsamples;
+		for (auto x = 0; x < region.width; x++) {
+			for (auto i = first; i <= last; i++) {
+				row[x * outsamples + i] = i == outsamples - 1 ? 255 : 0;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// start reading the sections ahead of the decoder, if the file is streamed
+/// </summary>
+/// <param name="fd">the file</param>
+/// <returns>the prefetcher, NULL if there is nothing to prefetch</returns>
+PREFETCHER* BASICHEADER::start_prefetch (FileData* fd)
+{
+	if (tilewidth && planarconfiguration != 2) {
+		return PREFETCHER::start (fd, tileoffsets, tilebytecounts, Ntileoffsets);
+	}
+	return PREFETCHER::start (fd, stripoffsets, stripbytecounts, Nstripoffsets);
+}
+
+/// <summary>
+/// block until the prefetcher has read a section, if there is one
+/// </summary>
+/// <param name="prefetch">from start_prefetch, may be NULL</param>
+/// <param name="index">section index</param>
+void BASICHEADER::wait_section (PREFETCHER* prefetch, int index)
+{
+	if (!prefetch) {
+		return;
+	}
+	STAGETIMER timer (stats);
+	prefetch->wait (index);
+	if (tilewidth && planarconfiguration != 2) {
+		timer.lap (TIFF_STAGE::STAGE_READ, index < Ntileoffsets ? tilebytecounts[index] : 0);
+	}
+	else {
+		timer.lap (TIFF_STAGE::STAGE_READ, index < Nstripoffsets ? stripbytecounts[index] : 0);
+	}
+}
+
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/* asynchronous loading section */
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// shared state of one load_tiff_async call.
+/// Owned by the sections in flight; the last one to finish deletes it.
+/// </summary>
+class ASYNCLOAD
+{
+public:
+	BASICHEADER header;
+	FileData* fd;
+	PREFETCHER* prefetch;
+	BYTE* answer;
+	int Nbands;
+	std::atomic<int>* bandleft;   // sections still to finish per region
+	std::atomic<int>* bandfailed;
+	std::atomic<int> remaining;
+	std::atomic<int> failed;
+	std::promise<BYTE*> done;
+	std::function<void (const TIFFREGION& region)> on_region;
+	TIFFSTATUS* status;
+	bool best_effort;
+	ASYNCLOAD ()
+	{
+		fd = NULL;
+		prefetch = NULL;
+		answer = NULL;
+		status = NULL;
+		best_effort = false;
+		Nbands = 0;
+		bandleft = NULL;
+		bandfailed = NULL;
+		remaining = 0;
+		failed = 0;
+	}
+	~ASYNCLOAD ()
+	{
+		delete prefetch;
+		delete[] bandleft;
+		delete[] bandfailed;
+	}
+	/// <summary>
+	/// region a section reports to; all planes of a band report together
+	/// </summary>
+	int band_of (int index)
+	{
+		return index % Nbands;
+	}
+	void run (int index);
+	void finish ();
+};
+
+/// <summary>
+/// worker body: decode one section, report its region when the region
+/// is complete, and the whole image when everything is
+/// </summary>
+/// <param name="index">section index</param>
+void ASYNCLOAD::run (int index)
+{
+	FileData cursor (fd);
+	int err;
+	int band = band_of (index);
+
+	header.wait_section (prefetch, index);
+	try {
+		err = header.paste_section (index, &cursor, answer, 0, header.imageheight);
+	}
+	catch (...) {
+		err = -1;
+	}
+	if (err) {
+		failed++;
+		bandfailed[band] = 1;
+		status->fail (index, err);
+		if (best_effort) {
+			header.clear_section (index, answer);
+		}
+	}
+	if (--bandleft[band] == 0 && on_region) {
+		TIFFREGION region;
+		header.section_region (index, &region);
+		region.ok = bandfailed[band] == 0;
+		region.raster = answer;
+		on_region (region);
+	}
+	if (--remaining == 0) {
+		finish ();
+	}
+}
+
+/// <summary>
+/// complete the future and free the shared state
+/// </summary>
+void ASYNCLOAD::finish ()
+{
+	if (failed && !best_effort) {
+		delete[] answer;
+		answer = NULL;
+	}
+	done.set_value (answer);
+	delete this;
+}
+
+/// <summary>
+/// load a tiff asynchronously. The header is parsed before returning
+/// (errors throw as for load_tiff); the sections are then decoded on the
+/// executor, possibly several at once.
+/// The TIFF must stay alive until the future is ready.
+/// </summary>
+/// <param name="executor">runs the decode tasks</param>
+/// <param name="on_region">
+/// called as each strip / tile (band of strips for planar images) is in the
+/// raster, from whichever worker finished it, possibly concurrently. May be empty.
+/// </param>
+/// <returns>
+/// future raster, 0 for a layout load_tiff can't load either, or if any section
+/// failed and best_effort isn't set. status is complete when it is ready
+/// </returns>
+std::future<BYTE*> TIFF::load_tiff_async (EXECUTOR* executor, std::function<void (const TIFFREGION& region)> on_region)
+{
+	ASYNCLOAD* job = new ASYNCLOAD ();
+	std::future<BYTE*> answer = job->done.get_future ();
+	int N;
+	int stripsperimage;
+
+	try {
+		format = FMT::FMT_ERROR;
+		status.reset (0);
+		stats.reset ();
+		parse_header (&job->header);
+	}
+	catch (general_exception) {
+		delete job;
+		throw;
+	}
+	try {
+		N = job->header.raster_sections ();
+		job->answer = job->header.new_raster ();
+	}
+	catch (general_exception) {
+		// load_raster returns 0 for these, so the future does too
+		delete[] job->answer;
+		job->answer = NULL;
+		job->finish ();
+		return answer;
+	}
+	format = job->header.header_outputformat ();
+	width = job->header.imagewidth;
+	height = job->header.imageheight;
+
+	job->fd = fd;
+	job->on_region = on_region;
+	job->status = &status;
+	job->best_effort = best_effort;
+	status.reset (N);
+	job->Nbands = N > 0 ? N : 1;
+	if (job->header.planarconfiguration == 2) {
+		stripsperimage = (job->header.imageheight + job->header.rowsperstrip - 1) / job->header.rowsperstrip;
+		job->Nbands = stripsperimage;
+	}
+	job->bandleft = new std::atomic<int>[job->Nbands];
+	job->bandfailed = new std::atomic<int>[job->Nbands];
+	for (auto i = 0; i < job->Nbands; i++) {
+		job->bandleft[i] = 0;
+		job->bandfailed[i] = 0;
+	}
+	// listed up front: once the last task is submitted job may already be gone
+	std::vector<int> wanted;
+	for (auto i = 0; i < N; i++) {
+		if (job->header.section_wanted (i)) {
+			job->bandleft[job->band_of (i)]++;
+			wanted.push_back (i);
+		}
+	}
+	if (wanted.empty ()) {
+		job->finish ();
+		return answer;
+	}
+	job->remaining = (int)wanted.size ();
+	job->prefetch = job->header.start_prefetch (fd);
+	for (auto i : wanted) {
+		executor->execute ([job, i] { job->run (i); });
+	}
+	return answer;
+}
+
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/* row reader section */
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// parse the header; rows are decoded as next_row reaches them.
+/// Throws general_exception like load_tiff if the header is bad.
+/// </summary>
+/// <param name="tiff">file to read, must outlive the reader</param>
+ROWREADER::ROWREADER (TIFF* tiff)
+{
+	this->tiff = tiff;
+	prefetch = NULL;
+	band = NULL;
+	bandtop = 0;
+	bandheight = 0;
+	bandindex = -1;
+	row = 0;
+	error = false;
+
+	tiff->format = FMT::FMT_ERROR;
+	tiff->parse_header (&header);
+	header.raster_sections ();  // throws for unsupported layouts
+	format = header.header_outputformat ();
+	width = header.imagewidth;
+	height = header.imageheight;
+	depth = header.header_Noutsamples ();
+	tiff->format = format;
+	tiff->width = width;
+	tiff->height = height;
+
+	// planar images need every plane for a band, out of file order
+	if (header.planarconfiguration != 2) {
+		prefetch = header.start_prefetch (tiff->fd);
+	}
+}
+
+/// <summary>
+/// 
+/// </summary>
+ROWREADER::~ROWREADER ()
+{
+	delete prefetch;
+	delete[] band;
+}
+
+/// <summary>
+/// decode one band of rows: a strip, a row of tiles, or one strip from each plane
+/// </summary>
+/// <param name="index">band number</param>
+/// <returns>true on success</returns>
+bool ROWREADER::load_band (int index)
+{
+	int rowsperband;
+	int first, count, step;
+
+	if (header.tilewidth && header.planarconfiguration != 2) {
+		rowsperband = header.tileheight;
+		first = index * ((header.imagewidth + header.tilewidth - 1) / header.tilewidth);
+		count = (header.imagewidth + header.tilewidth - 1) / header.tilewidth;
+		step = 1;
+	}
+	else if (header.planarconfiguration == 2) {
+		rowsperband = header.rowsperstrip;
+		first = index;
+		count = header.header_Ninsamples ();
+		step = (header.imageheight + header.rowsperstrip - 1) / header.rowsperstrip;
+	}
+	else {
+		rowsperband = header.rowsperstrip;
+		first = index;
+		count = 1;
+		step = 1;
+	}
+	bandtop = index * rowsperband;
+	bandheight = rowsperband < height - bandtop ? rowsperband : height - bandtop;
+	bandindex = index;
+	if (!band) {
+		band = new BYTE[width * rowsperband * depth];
+	}
+	for (auto ii = 0; ii < width * bandheight; ii++) {
+		band[ii * depth + depth - 1] = 255;
+	}
+
+	int N = header.raster_sections ();
+	for (auto i = 0; i < count; i++) {
+		int section = first + i * step;
+		// a band the sections don't reach would come back black
+		if (section >= N) {
+			return false;
+		}
+		header.wait_section (prefetch, section);
+		if (header.paste_section (section, tiff->fd, band, bandtop, bandheight)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// next row of the image
+/// </summary>
+/// <returns>width * depth bytes, valid until the next call; NULL after the last row or on error</returns>
+const BYTE* ROWREADER::next_row ()
+{
+	if (row >= height || error) {
+		return NULL;
+	}
+	if (bandindex < 0 || row >= bandtop + bandheight) {
+		try {
+			if (!load_band (bandindex + 1)) {
+				error = true;
+			}
+		}
+		catch (general_exception) {
+			error = true;
+		}
+		if (error) {
+			return NULL;
+		}
+	}
+	return band + (row++ - bandtop) * width * depth;
+}
+
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/* tile reader section */
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// parse the header; tiles are decoded on request.
+/// Throws general_exception like load_tiff if the header is bad, and
+/// parse_error for planar images, whose tiles have no interleaved form.
+/// </summary>
+/// <param name="tiff">file to read, must outlive the reader</param>
+TILEREADER::TILEREADER (TIFF* tiff)
+{
+	this->tiff = tiff;
+	prefetch = NULL;
+	next = 0;
+	error = SECTION_ERROR::SECTION_OK;
+
+	tiff->format = FMT::FMT_ERROR;
+	tiff->parse_header (&header);
+	if (header.planarconfiguration == 2) {
+		throw general_exception ("parse_error");  // OX[
+	}
+	width = header.imagewidth;
+	height = header.imageheight;
+	depth = header.header_Ninsamples ();
+	if (header.tilewidth) {
+		tilewidth = header.tilewidth;
+		tileheight = header.tileheight;
+		tilesacross = (width + tilewidth - 1) / tilewidth;
+		tilesdown = (height + tileheight - 1) / tileheight;
+	}
+	else {
+		tilewidth = width;
+		tileheight = header.rowsperstrip;
+		tilesacross = 1;
+		tilesdown = header.Nstripoffsets;
+	}
+	tiff->format = header.header_outputformat ();
+	tiff->width = width;
+	tiff->height = height;
+	prefetch = header.start_prefetch (tiff->fd);
+}
+
+/// <summary>
+/// 
+/// </summary>
+TILEREADER::~TILEREADER ()
+{
+	delete prefetch;
+}
+
+/// <summary>
+/// size of the buffer decode_tile needs
+/// </summary>
+/// <returns>tilewidth * tileheight * depth</returns>
+unsigned long TILEREADER::tile_bytes ()
+{
+	return (unsigned long)tilewidth * tileheight * depth;
+}
+
+/// <summary>
+/// decode one tile
+/// </summary>
+/// <param name="col">tile column, 0 to tilesacross - 1</param>
+/// <param name="row">tile row, 0 to tilesdown - 1</param>
+/// <param name="dst">tile_bytes () bytes</param>
+/// <returns>0 on success, -1 for a tile outside the image, else a SECTION_ERROR value</returns>
+int TILEREADER::decode_tile (int col, int row, BYTE* dst)
+{
+	int index = row * tilesacross + col;
+
+	if (col < 0 || col >= tilesacross || row < 0 || row >= tilesdown) {
+		return -1;
+	}
+	if (header.tilewidth) {
+		if (index >= header.Ntileoffsets) {
+			return static_cast<int>(SECTION_ERROR::SECTION_CORRUPT);
+		}
+		return header.decode_tile (index, tiff->fd, dst);
+	}
+	return header.decode_strip (index, tiff->fd, dst);
+}
+
+/// <summary>
+/// decode the tiles in file order, left to right, top to bottom
+/// </summary>
+/// <param name="dst">tile_bytes () bytes</param>
+/// <param name="col">return for the tile column</param>
+/// <param name="row">return for the tile row</param>
+/// <returns>
+/// false after the last tile, or if the tile at col, row fails to decode.
+/// error tells them apart; the next call goes on with the tile after it
+/// </returns>
+bool TILEREADER::next_tile (BYTE* dst, int* col, int* row)
+{
+	int err;
+
+	error = SECTION_ERROR::SECTION_OK;
+	if (next >= tilesacross * tilesdown) {
+		return false;
+	}
+	header.wait_section (prefetch, next);
+	*col = next % tilesacross;
+	*row = next / tilesacross;
+	next++;
+	try {
+		err = decode_tile (*col, *row, dst);
+	}
+	catch (general_exception) {
+		err = static_cast<int>(SECTION_ERROR::SECTION_CORRUPT);
+	}
+	if (err) {
+		error = static_cast<SECTION_ERROR>(err);
+		return false;
+	}
+	return true;
+}
+
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/* prefetch section */
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// start prefetching if the file is being streamed
+/// </summary>
+/// <param name="fd">the file</param>
+/// <param name="offsets">strip or tile offsets, in decode order</param>
+/// <param name="counts">strip or tile byte counts</param>
+/// <param name="N">number of strips or tiles</param>
+/// <returns>the prefetcher, NULL if the file is already in memory</returns>
+PREFETCHER* PREFETCHER::start (FileData* fd, const unsigned long* offsets, const unsigned long* counts, int N)
+{
+	if (!fd->resident || !offsets || !counts || N <= 0) {
+		return NULL;
+	}
+	return new PREFETCHER (fd, offsets, counts, N);
+}
+
+/// <summary>
+/// plan the reads and start the reader thread.
+/// A range joins the previous read if it starts within a page of where
+/// that read ends, up to a few megabytes per read so decoding can start early.
+/// </summary>
+/// <param name="fd">the file</param>
+/// <param name="offsets">strip or tile offsets, in decode order</param>
+/// <param name="counts">strip or tile byte counts</param>
+/// <param name="N">number of strips or tiles</param>
+PREFETCHER::PREFETCHER (FileData* fd, const unsigned long* offsets, const unsigned long* counts, int N)
+{
+	const unsigned long page = 1UL << FileData::PAGE_SHIFT;
+	const unsigned long maxrun = 64 * page;
+
+	this->fd = fd;
+	depth = fd->prefetch_depth > 0 ? fd->prefetch_depth : 1;
+	wanted = -1;
+	done = 0;
+	stopping = false;
+
+	for (auto i = 0; i < N; i++) {
+		unsigned long start = offsets[i];
+		unsigned long end = offsets[i] + counts[i];
+		if (start > (unsigned long)fd->size) {
+			start = fd->size;
+		}
+		if (end > (unsigned long)fd->size || end < start) {
+			end = fd->size;
+		}
+		if (!runstart.empty ()) {
+			unsigned long runend = runstart.back () + runcount.back ();
+			if (start >= runstart.back () && start <= runend + page && end - runstart.back () <= maxrun) {
+				if (end > runend) {
+					runcount.back () = end - runstart.back ();
+				}
+				runof.push_back ((int)runstart.size () - 1);
+				continue;
+			}
+		}
+		runstart.push_back (start);
+		runcount.push_back (end - start);
+		runof.push_back ((int)runstart.size () - 1);
+	}
+	worker = std::thread (&PREFETCHER::worker_main, this);
+}
+
+/// <summary>
+/// stop reading ahead and join the reader thread
+/// </summary>
+PREFETCHER::~PREFETCHER ()
+{
+	{
+		std::lock_guard<std::mutex> guard (lock);
+		stopping = true;
+	}
+	changed.notify_all ();
+	worker.join ();
+}
+
+/// <summary>
+/// reader thread, keeps at most depth reads ahead of the decoder
+/// </summary>
+void PREFETCHER::worker_main ()
+{
+	for (auto run = 0; run < (int)runstart.size (); run++) {
+		{
+			std::unique_lock<std::mutex> guard (lock);
+			changed.wait (guard, [this, run] { return stopping || run <= wanted + depth; });
+			if (stopping) {
+				return;
+			}
+		}
+		fd->ensure (runstart[run], runcount[run]);
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			done = run + 1;
+		}
+		changed.notify_all ();
+	}
+}
+
+/// <summary>
+/// block until a strip or tile has been read
+/// </summary>
+/// <param name="index">strip or tile index</param>
+void PREFETCHER::wait (int index)
+{
+	int run;
+
+	if (index < 0 || index >= (int)runof.size ()) {
+		return;
+	}
+	run = runof[index];
+	std::unique_lock<std::mutex> guard (lock);
+	if (run > wanted) {
+		wanted = run;
+		changed.notify_all ();
+	}
+	changed.wait (guard, [this, run] { return done > run; });
+}
+
+
+
+/// <summary>
+/// 
+/// </summary>
+/// <param name="index"></param>
+/// <param name="tile_width"></param>
+/// <param name="tile_height"></param>
+/// <param name="fd"></param>
+/// <param name="insamples"></param>
+/// <param name="scale">1, or 2, 4 or 8 to decode a JPEG tile at reduced size</param>
+/// <param name="err">return for why it failed, a SECTION_ERROR value, may be NULL</param>
+/// <returns></returns>
+BYTE* BASICHEADER::read_tile (int index, int* tile_width, int* tile_height, FileData* fd, int* insamples, int scale, int* err)
+{
+	BYTE* answer = 0;
+	int width = (tilewidth + scale - 1) / scale;
+	int height = (tileheight + scale - 1) / scale;
+	int code;
+
+	*insamples = header_Ninsamples ();
+	answer = new BYTE[*insamples * width * height];
+	if (!answer) {
+		// out_of_memory:
+		if (err) {
+			*err = static_cast<int>(SECTION_ERROR::SECTION_OUT_OF_MEMORY);
+		}
+		return 0;
+	}
+	*tile_width = width;
+	*tile_height = height;
+	code = decode_tile (index, fd, answer, scale);
+	if (code) {
+		if (err) {
+			*err = code;
+		}
+		delete[] answer;
+		return 0;
+	}
+	return answer;
+}
+
+/// <summary>
+/// decode a tile into a caller supplied buffer
+/// </summary>
+/// <param name="index">tile number</param>
+/// <param name="fd"></param>
+/// <param name="dst">tilewidth * tileheight * header_Ninsamples bytes, each side divided by scale rounding up</param>
+/// <param name="scale">1, or 2, 4 or 8 to decode a JPEG tile at reduced size</param>
+/// <returns>0 on success, else a SECTION_ERROR value</returns>
+int BASICHEADER::decode_tile (int index, FileData* fd, BYTE* dst, int scale)
+{
+	BYTE* data = 0;
+	unsigned long N;
+	CODECJOB job;
+	int err = 0;
+	int width = (tilewidth + scale - 1) / scale;
+	int height = (tileheight + scale - 1) / scale;
+	unsigned long bytes = (unsigned long)width * height * header_Ninsamples ();
+	// converted CMYK tiles are the same size as plain ones, keep them apart
+	std::string file = cmyk_as_rgba () ? fd->identity + "|rgba" : fd->identity;
+
+	if (scale != 1) {
+		// only JPEG can skip the full size decode
+		if (compression != COMPRESSION::COMPRESSION_JPEG) {
+			return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
+		}
+		file += "|/" + std::to_string (scale);
+	}
+	if (tilecache && tilecache->get (file, ifdoffset, index, dst, bytes)) {
+		return 0;
+	}
+	//fseek(fp, tileoffsets[index], SEEK_SET);
+	fd->buffer_ptr = tileoffsets[index];
+	if (section_job (&job, width, height, samplesperpixel, scale)) {
+		return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
+	}
+	STAGETIMER timer (stats);
+	data = decompress (fd, tilebytecounts[index], compression, &job, &N, &err);
+	timer.lap (TIFF_STAGE::STAGE_DECOMPRESS, tilebytecounts[index]);
+	if (!data) {
+		return err;
+	}
+	err = convert_section (dst, width, height, data, N);
+	delete[] data;
+	if (err) {
+		return err;
+	}
+	if (tilecache) {
+		tilecache->put (file, ifdoffset, index, dst, bytes);
+	}
+	return 0;
+}
+
+/// <summary>
+/// 
+/// </summary>
+/// <param name="index"></param>
+/// <param name="strip_width"></param>
+/// <param name="strip_height"></param>
+/// <param name="fd"></param>
+/// <param name="insamples"></param>
+/// <param name="err">return for why it failed, a SECTION_ERROR value, may be NULL</param>
+/// <returns></returns>
+BYTE* BASICHEADER::read_strip (int index, int* strip_width, int* strip_height, FileData* fd, int* insamples, int* err)
+{
+	BYTE* answer = 0;
+	int stripheight = strip_rows (index);
+	int code;
+
+	*insamples = header_Ninsamples ();
+	answer = new BYTE[*insamples * imagewidth * stripheight];
+	if (!answer) {
+		// out_of_memory:
+		if (err) {
+			*err = static_cast<int>(SECTION_ERROR::SECTION_OUT_OF_MEMORY);
+		}
+		return 0;
+	}
+	*strip_width = imagewidth;
+	*strip_height = stripheight;
+	code = decode_strip (index, fd, answer);
+	if (code) {
+		if (err) {
+			*err = code;
+		}
+		delete[] answer;
+		return 0;
+	}
+	return answer;
+}
+
+/// <summary>
+/// decode a strip into a caller supplied buffer
+/// </summary>
+/// <param name="index">strip number</param>
+/// <param name="fd"></param>
+/// <param name="dst">imagewidth * strip_rows (index) * header_Ninsamples bytes</param>
+/// <returns>0 on success, else a SECTION_ERROR value</returns>
+int BASICHEADER::decode_strip (int index, FileData* fd, BYTE* dst)
+{
+	BYTE* data = 0;
+	unsigned long N;
+	int stripheight = strip_rows (index);
+	CODECJOB job;
+	int err = 0;
+
+	//fseek(fp, stripoffsets[index], SEEK_SET);
+	fd->buffer_ptr = stripoffsets[index];
+	if (section_job (&job, imagewidth, stripheight, samplesperpixel)) {
+		return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
+	}
+	STAGETIMER timer (stats);
+	data = decompress (fd, stripbytecounts[index], compression, &job, &N, &err);
+	timer.lap (TIFF_STAGE::STAGE_DECOMPRESS, stripbytecounts[index]);
+	if (!data) {
+		return err;
+	}
+	err = convert_section (dst, imagewidth, stripheight, data, N);
+	delete[] data;
+	return err;
+}
+
+/// <summary>
+/// rows in a strip, the last one may be short
+/// </summary>
+/// <param name="index">strip number</param>
+/// <returns></returns>
+int BASICHEADER::strip_rows (int index)
+{
+	if (index == Nstripoffsets - 1) {
+		// more strips than the image needs leave none for the last
+		return imageheight > rowsperstrip * index ? imageheight - rowsperstrip * index : 0;
+	}
+	return rowsperstrip;
+}
+
+/// <summary>
+/// bytes a strip or tile decodes to
+/// </summary>
+/// <param name="width">section width</param>
+/// <param name="height">section height</param>
+/// <param name="samples">samplesperpixel, or 1 for a plane</param>
+/// <param name="bytes">return for the byte count</param>
+/// <returns>0 on success, -1 if the section is too big or the wrong shape</returns>
+int BASICHEADER::section_bytes (int width, int height, int samples, unsigned long* bytes)
+{
+	unsigned long long answer;
+	unsigned long long bits = 0;
+	int h = YCbCrSubSampling_h > 0 ? YCbCrSubSampling_h : 1;
+	int v = YCbCrSubSampling_v > 0 ? YCbCrSubSampling_v : 1;
+
+	if (width < 0 || height < 0) {
+		return -1;
+	}
+	if (compression == COMPRESSION::COMPRESSION_JPEG) {
+		// the JPEG decoder hands back 8 bit samples, YCbCr already converted
+		answer = (unsigned long long)width * height * samples;
+	}
+	else if (photo_metric_interpretation == photo_metric_interpretations::PI_YCbCr && samples == samplesperpixel) {
+		// blocks of h * v luma samples and a Cb, Cr pair
+		bits = (unsigned long long)((width + h - 1) / h) * (h * v + 2) * bitspersample[0];
+		answer = (unsigned long long)((height + v - 1) / v) * ((bits + 7) / 8);
+	}
+	else {
+		for (auto i = 0; i < samples && i < 16; i++) {
+			bits += bitspersample[samples == samplesperpixel ? i : 0];
+		}
+		if (samples != samplesperpixel) {
+			// a plane, the widest sample
+			for (auto i = 0; i < samplesperpixel && i < 16; i++) {
+				if ((unsigned long long)bitspersample[i] * samples > bits) {
+					bits = (unsigned long long)bitspersample[i] * samples;
+				}
+			}
+		}
+		answer = (unsigned long long)height * (((unsigned long long)width * bits + 7) / 8);
+	}
+	if (answer > 0x7FFFFFFFULL) {
+		return -1;
+	}
+	*bytes = (unsigned long)answer;
+	return 0;
+}
+
+/// <summary>
+/// samples per pixel the conversion to header_Ninsamples reads
+/// </summary>
+/// <returns></returns>
+int BASICHEADER::section_channels ()
+{
+	switch (photo_metric_interpretation) {
+	case photo_metric_interpretations::PI_BlackIsZero:
+	case photo_metric_interpretations::PI_WhiteIsZero:
+	case photo_metric_interpretations::PI_RGB:
+		return header_Ninsamples ();
+	case photo_metric_interpretations::PI_CMYK:
+		return 4 + ((extrasamples == 1) ? 1 : 0);
+	case photo_metric_interpretations::PI_YCbCr:
+		return 3;
+	default:
+		return 1;
+	}
+}
+
+/// <summary>
+/// codec job for a strip or tile, everything but the input. The checks
+/// the sample conversions would otherwise make per sample are made here.
+/// </summary>
+/// <param name="job">return for the job</param>
+/// <param name="width">section width, divided by scale</param>
+/// <param name="height">section height, divided by scale</param>
+/// <param name="samples">samplesperpixel, or 1 for a plane</param>
+/// <param name="scale">JPEG only, decode at 1 / scale size</param>
+/// <returns>0 on success, -1 if the section can't be decoded</returns>
+int BASICHEADER::section_job (CODECJOB* job, int width, int height, int samples, int scale)
+{
+	job->width = width;
+	job->height = height;
+	job->samples = samples;
+	job->T4options = T4options;
+	job->jpegtables = jpegtables;
+	job->lercparameters = lercparameters;
+	job->scale = scale;
+	if (compression != COMPRESSION::COMPRESSION_JPEG && samples == samplesperpixel && samplesperpixel < section_channels ()) {
+		return -1;
+	}
+	for (auto i = 0; i < samplesperpixel && i < 16; i++) {
+		if (sampleformat[i] == SAMPLE_FORMAT::SAMPLEFORMAT_IEEEFP && bitspersample[i] != 32 && bitspersample[i] != 64) {
+			return -1;
+		}
+	}
+	return section_bytes (width, height, samples, &job->expected);
+}
+
+/// <summary>
+/// RGB from the JPEG decoder to opaque RGBA
+/// </summary>
+/// <param name="dst">width * height * 4 bytes</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="data">decoded RGB</param>
+/// <param name="N">bytes of data</param>
+static void jpeg_rgb_to_rgba (BYTE* dst, int width, int height, const BYTE* data, unsigned long N)
+{
+	unsigned long pixels = (unsigned long)width * height;
+
+	if (pixels > N / 3) {
+		pixels = N / 3;
+	}
+	for (auto i = 0UL; i < pixels; i++) {
+		dst[i * 4 + 0] = data[i * 3 + 0];
+		dst[i * 4 + 1] = data[i * 3 + 1];
+		dst[i * 4 + 2] = data[i * 3 + 2];
+		dst[i * 4 + 3] = 255;
+	}
+}
+
+/// <summary>
+/// convert decompressed strip or tile data to header_Ninsamples bytes per pixel
+/// </summary>
+/// <param name="dst">width * height * header_Ninsamples bytes</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="data">decompressed data</param>
+/// <param name="N">bytes of data</param>
+/// <returns>0 on success, else a SECTION_ERROR value</returns>
+int BASICHEADER::convert_section (BYTE* dst, int width, int height, BYTE* data, unsigned long N)
+{
+	int insamples = header_Ninsamples ();
+	bool unpredict = false;     // CMYK undoes the predictor as it unpacks
+	int err = 0;
+	STAGETIMER timer (stats);
+
+	switch (photo_metric_interpretation) {
+	case photo_metric_interpretations::PI_WhiteIsZero:
+	case photo_metric_interpretations::PI_BlackIsZero:
+		err = grey_to_grey (dst, width, height, data, N, insamples);
+		unpredict = predictor == 2;
+		break;
+	case photo_metric_interpretations::PI_RGB:
+		err = bitstream_to_rgba (dst, width, height, data, N, insamples);
+		unpredict = predictor == 2;
+		break;
+	case photo_metric_interpretations::PI_RGB_Palette:
+		err = pal_to_rgba (dst, width, height, data, N);
+		break;
+	case photo_metric_interpretations::PI_CMYK:
+		err = cmyk_to_cmyk (dst, width, height, data, N, insamples);
+		break;
+	case photo_metric_interpretations::PI_YCbCr:
+		if (compression == COMPRESSION::COMPRESSION_JPEG) {
+			// the JPEG decoder has already converted to RGB
+			jpeg_rgb_to_rgba (dst, width, height, data, N);
 			break;
 		}
-
-		delete[] data;
-		return answer;
+		err = ycbcr_to_rgba (dst, width, height, data, N);
+		break;
+	default:
+		perror ("photometric_interpretation not supported");
+		return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
 	}
-	catch (general_exception) {
-		// out_of_memory:
-		delete[] data;
-		delete[] answer;
-		return 0;
+	timer.lap (TIFF_STAGE::STAGE_CONVERT, N);
+	// the converters return their own codes, a failure here is bad data
+	if (err) {
+		return static_cast<int>(SECTION_ERROR::SECTION_CORRUPT);
+	}
+	if (unpredict) {
+		unpredict_samples (dst, width, height, insamples);
+		timer.lap (TIFF_STAGE::STAGE_PREDICTOR, (unsigned long long)width * height * insamples);
 	}
+	return 0;
 }
 
 /// <summary>
-/// 
+/// decode one strip of one plane
 /// </summary>
-/// <param name="index"></param>
-/// <param name="strip_width"></param>
-/// <param name="strip_height"></param>
+/// <param name="index">strip number, plane * strips per image + strip</param>
+/// <param name="channel_width"></param>
+/// <param name="channel_height"></param>
 /// <param name="fd"></param>
-/// <param name="insamples"></param>
-/// <returns></returns>
-BYTE* BASICHEADER::read_strip (int index, int* strip_width, int* strip_height, FileData* fd, int* insamples)
+/// <param name="err">return for why it failed, a SECTION_ERROR value, may be NULL</param>
+/// <returns>imagewidth * strip rows bytes, 0 on fail</returns>
+BYTE* BASICHEADER::read_channel (int index, int* channel_width, int* channel_height, FileData* fd, int* err)
 {
-	BYTE* data = 0;
-	BYTE* answer = 0;
-	unsigned long N;
+	BYTE* out = 0;
 	int stripheight;
+	int code;
+	int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
 
-	//fseek(fp, stripoffsets[index], SEEK_SET);
-	try {
-		fd->buffer_ptr = stripoffsets[index];
-		if (index == Nstripoffsets - 1) {
-			stripheight = imageheight - rowsperstrip * index;
-		}
-		else {
-			stripheight = rowsperstrip;
-		}
-		data = decompress (fd, stripbytecounts[index], compression, &N, imagewidth, stripheight, T4options);
-		if (!data) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-
-		*insamples = header_Ninsamples ();
-		answer = new BYTE[*insamples * imagewidth * stripheight];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[	
-		}
-		*strip_width = imagewidth;
-		*strip_height = stripheight;
-		switch (photo_metric_interpretation) {
-		case photo_metric_interpretations::PI_WhiteIsZero:
-		case photo_metric_interpretations::PI_BlackIsZero:
-			grey_to_grey (answer, imagewidth, stripheight, data, N, *insamples);
-
-			if (predictor == 2) {
-				unpredict_samples (answer, imagewidth, stripheight, *insamples);
-			}
-			break;
-		case photo_metric_interpretations::PI_RGB:
-			bitstream_to_rgba (answer, imagewidth, stripheight, data, N, *insamples);
-			if (predictor == 2) {
-				unpredict_samples (answer, imagewidth, stripheight, *insamples);
-			}
-			break;
-		case photo_metric_interpretations::PI_RGB_Palette:
-			pal_to_rgba (answer, imagewidth, stripheight, data, N);
-			break;
-		case photo_metric_interpretations::PI_CMYK:
-			cmyk_to_cmyk (answer, imagewidth, stripheight, data, N, *insamples);
-			break;
-		case photo_metric_interpretations::PI_YCbCr:
-			ycbcr_to_rgba (answer, imagewidth, stripheight, data, N);
-			break;
-		default:
-			perror ("photometric_interpretation not supported");
+	if ((index % stripsperimage) == stripsperimage - 1) {
+		stripheight = imageheight - rowsperstrip * (index % stripsperimage);
+	}
+	else
+		stripheight = rowsperstrip;
+	out = new BYTE[imagewidth * stripheight];
+	if (!out) {
+		if (err) {
+			*err = static_cast<int>(SECTION_ERROR::SECTION_OUT_OF_MEMORY);
 		}
-		delete[] data;
-		return answer;
+		return 0;
 	}
-	catch (general_exception) {
-		// out_of_memory:
-		delete[] data;
-		delete[] answer;
+	code = decode_channel (index, fd, out, stripheight);
+	if (code) {
+		if (err) {
+			*err = code;
+		}
+		delete[] out;
 		return 0;
 	}
+	*channel_width = imagewidth;
+	*channel_height = stripheight;
+	return out;
 }
+
 /// <summary>
-/// 
+/// decode one strip of one plane into a caller supplied buffer
 /// </summary>
-/// <param name="index"></param>
-/// <param name="channel_width"></param>
-/// <param name="channel_height"></param>
+/// <param name="index">strip number, plane * strips per image + strip</param>
 /// <param name="fd"></param>
-/// <returns></returns>
-BYTE* BASICHEADER::read_channel (int index, int* channel_width, int* channel_height, FileData* fd)
+/// <param name="out">imagewidth * stripheight bytes</param>
+/// <param name="stripheight">rows in the strip</param>
+/// <returns>0 on success, else a SECTION_ERROR value</returns>
+int BASICHEADER::decode_channel (int index, FileData* fd, BYTE* out, int stripheight)
 {
 	BYTE* data = 0;
-	BYTE* out = 0;
 	unsigned long N;
-	int stripheight;
 	int stripsperimage = (imageheight + rowsperstrip - 1) / rowsperstrip;
 	int sample_index;
+	CODECJOB job;
+	int err = 0;
 
 	sample_index = index / stripsperimage;
-	if (sample_index < 0 || sample_index >= samplesperpixel) {
-		return 0;
+	if (sample_index < 0 || sample_index >= samplesperpixel || index >= Nstripoffsets) {
+		return static_cast<int>(SECTION_ERROR::SECTION_CORRUPT);
 	}
 
-	try {
-		//fseek(fp, stripoffsets[index], SEEK_SET);
-		fd->buffer_ptr = stripoffsets[index];
-		if ((index % stripsperimage) == stripsperimage - 1) {
-			stripheight = imageheight - rowsperstrip * (index % stripsperimage);
-		}
-		else
-			stripheight = rowsperstrip;
-		data = decompress (fd, stripbytecounts[index], compression, &N, imagewidth, stripheight, T4options);
-		if (!data) {
-			throw general_exception ("out_of_memory");  // OX[	
-		}
+	//fseek(fp, stripoffsets[index], SEEK_SET);
+	fd->buffer_ptr = stripoffsets[index];
+	if (section_job (&job, imagewidth, stripheight, 1)) {
+		return static_cast<int>(SECTION_ERROR::SECTION_UNSUPPORTED);
+	}
+	STAGETIMER timer (stats);
+	data = decompress (fd, stripbytecounts[index], compression, &job, &N, &err);
+	timer.lap (TIFF_STAGE::STAGE_DECOMPRESS, stripbytecounts[index]);
+	if (!data) {
+		return err;
+	}
+	err = plane_to_channel (out, imagewidth, stripheight, data, N, sample_index);
+	timer.lap (TIFF_STAGE::STAGE_CONVERT, N);
+	delete[] data;
+	if (err) {
+		return static_cast<int>(SECTION_ERROR::SECTION_CORRUPT);
+	}
 
-		out = new BYTE[imagewidth * stripheight];
-		if (!out) {
-			throw general_exception ("out_of_memory");  // OX[	
+	if (predictor == 2) {
+		unpredict_samples (out, imagewidth, stripheight, 1);
+		timer.lap (TIFF_STAGE::STAGE_PREDICTOR, (unsigned long long)imagewidth * stripheight);
+	}
+	return 0;
+}
+/// <summary>
+/// expansion tables for 1, 2 and 4 bit samples.
+/// entry [b] holds the 8, 4 or 2 samples packed MSB first in the byte b,
+/// as raw values (palette indices), scaled to 0-255, or scaled and inverted.
+/// </summary>
+class SUBBYTELUT
+{
+public:
+	BYTE raw[3][256][8];
+	BYTE scaled[3][256][8];
+	BYTE inverted[3][256][8];
+
+	SUBBYTELUT ()
+	{
+		for (auto k = 0; k < 3; k++) {
+			int bps = 1 << k;
+			int max = (1 << bps) - 1;
+			for (auto b = 0; b < 256; b++) {
+				for (auto j = 0; j < 8 / bps; j++) {
+					int val = (b >> (8 - bps * (j + 1))) & max;
+					raw[k][b][j] = (BYTE)val;
+					scaled[k][b][j] = (BYTE)(val * 255 / max);
+					inverted[k][b][j] = (BYTE)(255 - val * 255 / max);
+				}
+			}
 		}
-		*channel_width = imagewidth;
-		*channel_height = stripheight;
-		plane_to_channel (out, imagewidth, stripheight, data, N, index / stripsperimage);
+	}
+	static const SUBBYTELUT* get ()
+	{
+		static const SUBBYTELUT lut;  // initialisation is thread safe
+		return &lut;
+	}
+	/// <summary>
+	/// table slot for a sample size
+	/// </summary>
+	/// <param name="bps">bits per sample</param>
+	/// <returns>0, 1 or 2, -1 if the size has no table</returns>
+	static int slot (int bps)
+	{
+		return bps == 1 ? 0 : bps == 2 ? 1 : bps == 4 ? 2 : -1;
+	}
+};
+
+/// <summary>
+/// expand one packed row, a whole input byte at a time.
+/// samples past the end of the data are set to 0.
+/// </summary>
+/// <param name="out">width bytes</param>
+/// <param name="in">packed row</param>
+/// <param name="Nin">bytes of the row actually present</param>
+/// <param name="width">samples in the row</param>
+/// <param name="table">expansion table for the sample size</param>
+template <int PER> static void unpack_row (BYTE* out, const BYTE* in, long Nin, int width, const BYTE (*table)[8])
+{
+	long full = width / PER;
+	long i;
 
-		if (predictor == 2) {
-			unpredict_samples (out, imagewidth, stripheight, 1);
+	if (full > Nin) {
+		full = Nin;
+	}
+	for (i = 0; i < full; i++) {
+		memcpy (out, table[in[i]], PER);
+		out += PER;
+	}
+	int rest = width - (int)full * PER;
+	if (rest > 0) {
+		if (i < Nin && rest < PER) {
+			memcpy (out, table[in[i]], rest);
+		}
+		else {
+			memset (out, 0, rest);
 		}
-		delete[] data;
-		return out;
 	}
-	catch (general_exception) {
-		// out_of_memory:
-		delete[] data;
-		delete[] out;
-		return 0;
+}
+
+/// <summary>
+/// expand packed 1, 2 or 4 bit samples, one row after another
+/// </summary>
+/// <param name="out">width * height bytes</param>
+/// <param name="bits">packed rows, each starting on a byte</param>
+/// <param name="Nbytes">bytes in bits</param>
+/// <param name="bps">1, 2 or 4</param>
+/// <param name="table">expansion tables, raw, scaled or inverted</param>
+static void unpack_samples (BYTE* out, int width, int height, const BYTE* bits, unsigned long Nbytes, int bps, const BYTE (*table)[256][8])
+{
+	int k = SUBBYTELUT::slot (bps);
+	long rowbytes = ((long)width * bps + 7) / 8;
 
+	for (auto i = 0; i < height; i++) {
+		long pos = rowbytes * i;
+		long Nin = pos < (long)Nbytes ? (long)Nbytes - pos : 0;
+		if (Nin > rowbytes) {
+			Nin = rowbytes;
+		}
+		switch (k) {
+		case 0:
+			unpack_row<8> (out, bits + pos, Nin, width, table[0]);
+			break;
+		case 1:
+			unpack_row<4> (out, bits + pos, Nin, width, table[1]);
+			break;
+		default:
+			unpack_row<2> (out, bits + pos, Nin, width, table[2]);
+			break;
+		}
+		out += width;
 	}
 }
+
 /// <summary>
 /// 
 /// </summary>
@@ -914,18 +3094,21 @@ int BASICHEADER::plane_to_channel (BYTE* out, int width, int height, BYTE* bits,
 			}
 		}
 	}
+	else if (SUBBYTELUT::slot (bitspersample[sample_index]) >= 0) {
+		unpack_samples (out, width, height, bits, Nbytes, bitspersample[sample_index], SUBBYTELUT::get ()->scaled);
+		return 0;
+	}
 	else {
-		BSTREAM* bs = new BSTREAM (bits, Nbytes, BIG_ENDIAN);
+		MSBREADER bs (bits, Nbytes);
 		for (auto i = 0; i < height; i++) {
 			for (auto ii = 0; ii < width; ii++) {
-				val = bs->getbits (bitspersample[sample_index]);
+				val = bs.getbits (bitspersample[sample_index]);
 				val = (val * 255) / ((1 << bitspersample[sample_index]) - 1);
 
 				*out++ = val;
 			}
-			bs->synch_to_byte ();
+			bs.synch_to_byte ();
 		}
-		delete bs;
 		return 0;
 	}
 	return 0;
@@ -964,7 +3147,7 @@ int BASICHEADER::grey_to_grey (BYTE* grey, int width, int height, BYTE* bits, un
 	if (bitstreamflag == 0) {
 		unsigned long i = 0;
 
-		while (i < Nbytes - totbits / 8 + 1) {
+		while (i + totbits / 8 <= Nbytes) {
 			grey[0] = read_byte_sample (bits, 0);
 			if (photo_metric_interpretation == photo_metric_interpretations::PI_WhiteIsZero) {
 				grey[0] = 255 - grey[0];
@@ -992,31 +3175,63 @@ int BASICHEADER::grey_to_grey (BYTE* grey, int width, int height, BYTE* bits, un
 
 		return 0;
 	}
+	else if (samplesperpixel == 1 && SUBBYTELUT::slot (bitspersample[0]) >= 0) {
+		const SUBBYTELUT* lut = SUBBYTELUT::get ();
+		if (photo_metric_interpretation == photo_metric_interpretations::PI_WhiteIsZero) {
+			unpack_samples (grey, width, height, bits, Nbytes, bitspersample[0], lut->inverted);
+		}
+		else {
+			unpack_samples (grey, width, height, bits, Nbytes, bitspersample[0], lut->scaled);
+		}
+		return 0;
+	}
 	else {
-		BSTREAM* bs = new BSTREAM (bits, Nbytes, BIG_ENDIAN);
+		MSBREADER bs (bits, Nbytes);
 		for (auto i = 0; i < height; i++) {
 			for (auto ii = 0; ii < width; ii++) {
-				int val = bs->getbits (bitspersample[0]);
+				int val = bs.getbits (bitspersample[0]);
 				grey[0] = (val * 255) / ((1 << (bitspersample[0])) - 1);
 				if (photo_metric_interpretation == photo_metric_interpretations::PI_WhiteIsZero) {
 					grey[0] = 255 - grey[0];
 				}
 				if (insamples == 2 && samplesperpixel > 1) {
-					val = bs->getbits (bitspersample[1]);
+					val = bs.getbits (bitspersample[1]);
 					grey[1] = (val * 255) / ((1 << (bitspersample[1])) - 1);
 				}
 				for (auto iii = insamples; iii < samplesperpixel; iii++) {
-					bs->getbits (bitspersample[iii]);
+					bs.getbits (bitspersample[iii]);
 				}
 				grey += insamples;
 			}
-			bs->synch_to_byte ();
+			bs.synch_to_byte ();
 		}
-		delete bs;
 		return 0;
 	}
 
 }
+/// <summary>
+/// expand 8 bit indices through the packed palette
+/// </summary>
+/// <param name="rgba">N pixels out</param>
+/// <param name="index">N indices</param>
+/// <param name="N">number of pixels</param>
+/// <param name="palette">256 or more packed entries</param>
+static void palette_expand8 (BYTE* rgba, const BYTE* index, unsigned long N, const unsigned int* palette)
+{
+	unsigned long i = 0;
+
+#ifdef __AVX2__
+	for (; i + 8 <= N; i += 8) {
+		__m256i idx = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const __m128i*)(index + i)));
+		__m256i px = _mm256_i32gather_epi32 ((const int*)palette, idx, 4);
+		_mm256_storeu_si256 ((__m256i*)(rgba + i * 4), px);
+	}
+#endif
+	for (; i < N; i++) {
+		memcpy (rgba + i * 4, &palette[index[i]], 4);
+	}
+}
+
 /// <summary>
 /// 
 /// </summary>
@@ -1028,10 +3243,10 @@ int BASICHEADER::grey_to_grey (BYTE* grey, int width, int height, BYTE* bits, un
 /// <returns></returns>
 int BASICHEADER::pal_to_rgba (BYTE* rgba, int width, int height, BYTE* bits, unsigned long Nbytes)
 {
-	//unsigned long i;
 	unsigned long counter = 0;
+	unsigned long npixels = (unsigned long)width * height;
+	unsigned int black = palette_entry (-1);
 	int index;
-	//int ii, iii;
 	int totbits = 0;
 	int bitstreamflag = 0;
 
@@ -1045,57 +3260,91 @@ int BASICHEADER::pal_to_rgba (BYTE* rgba, int width, int height, BYTE* bits, uns
 		}
 	}
 
-	if (bitstreamflag == 0) {
+	if (bitstreamflag == 0 && samplesperpixel == 1 && bitspersample[0] == 8 && palette) {
+		unsigned long N = Nbytes < npixels ? Nbytes : npixels;
+		palette_expand8 (rgba, bits, N, palette);
+		for (unsigned long i = N; i < npixels; i++) {
+			memcpy (rgba + i * 4, &black, 4);
+		}
+		return 0;
+	}
+	else if (bitstreamflag == 0 && samplesperpixel == 1 && bitspersample[0] == 16) {
+		unsigned long N = Nbytes / 2 < npixels ? Nbytes / 2 : npixels;
+		unsigned int entry;
+		if (endianness == BIG_ENDIAN) {
+			for (unsigned long i = 0; i < N; i++) {
+				entry = palette_entry ((bits[i * 2] << 8) | bits[i * 2 + 1]);
+				memcpy (rgba + i * 4, &entry, 4);
+			}
+		}
+		else {
+			for (unsigned long i = 0; i < N; i++) {
+				entry = palette_entry (bits[i * 2] | (bits[i * 2 + 1] << 8));
+				memcpy (rgba + i * 4, &entry, 4);
+			}
+		}
+		for (unsigned long i = N; i < npixels; i++) {
+			memcpy (rgba + i * 4, &black, 4);
+		}
+		return 0;
+	}
+	else if (bitstreamflag == 0) {
 		unsigned long i = 0;
+		unsigned int entry;
 
-		while (i < Nbytes - totbits / 8 + 1) {
+		while (i + totbits / 8 <= Nbytes && counter < npixels) {
 			index = read_int_sample (bits, 0);
-			bits += bitspersample[0] / 8;
-			i += bitspersample[0] / 8;
-
-			if (index >= 0 && index < Ncolormap) {
-				rgba[0] = colormap[index * 3];
-				rgba[1] = colormap[index * 3 + 1];
-				rgba[2] = colormap[index * 3 + 2];
-			}
-
-			for (auto ii = 1; ii < samplesperpixel; ii++) {
+			entry = palette_entry (index);
+			memcpy (rgba, &entry, 4);
+			for (auto ii = 0; ii < samplesperpixel; ii++) {
 				bits += bitspersample[ii] / 8;
 				i += bitspersample[ii] / 8;
 			}
 			rgba += 4;
 			counter++;
-			if (counter > (unsigned long) (width * height)) {
-				break;
-			}
 		}
 
 		return 0;
 	}
+	else if (samplesperpixel == 1 && SUBBYTELUT::slot (bitspersample[0]) >= 0 && palette) {
+		const BYTE (*table)[8] = SUBBYTELUT::get ()->raw[SUBBYTELUT::slot (bitspersample[0])];
+		int per = 8 / bitspersample[0];
+		long rowbytes = ((long)width * bitspersample[0] + 7) / 8;
+		for (auto i = 0; i < height; i++) {
+			const BYTE* row = bits + rowbytes * i;
+			long Nin = rowbytes * i < (long)Nbytes ? (long)Nbytes - rowbytes * i : 0;
+			int ii = 0;
+			for (long b = 0; b < Nin && b < rowbytes; b++) {
+				const BYTE* indices = table[row[b]];
+				for (auto iii = 0; iii < per && ii < width; iii++, ii++) {
+					memcpy (rgba, &palette[indices[iii]], 4);
+					rgba += 4;
+				}
+			}
+			for (; ii < width; ii++) {
+				memcpy (rgba, &black, 4);
+				rgba += 4;
+			}
+		}
+		return 0;
+	}
 	else {
-		BSTREAM* bs = new BSTREAM (bits, Nbytes, BIG_ENDIAN);
+		MSBREADER bs (bits, Nbytes);
+		unsigned int entry;
 		for (auto i = 0; i < height; i++) {
 			for (auto ii = 0; ii < width; ii++) {
-				index = bs->getbits (bitspersample[0]);
-				if (index >= 0 && index < Ncolormap) {
-					rgba[0] = colormap[index * 3];
-					rgba[1] = colormap[index * 3 + 1];
-					rgba[2] = colormap[index * 3 + 2];
-				}
+				index = bs.getbits (bitspersample[0]);
+				entry = palette_entry (index);
+				memcpy (rgba, &entry, 4);
 				for (auto iii = 1; iii < samplesperpixel; iii++) {
-					bs->getbits (bitspersample[iii]);
+					bs.getbits (bitspersample[iii]);
 				}
 				rgba += 4;
 			}
-			bs->synch_to_byte ();
+			bs.synch_to_byte ();
 		}
-		delete bs;
 		return 0;
 	}
-
-
-
-	return -1;
 }
 /// <summary>
 /// 
@@ -1117,205 +3366,334 @@ int BASICHEADER::ycbcr_to_rgba (BYTE* rgba, int width, int height, BYTE* bits, u
 	int x, y;
 	int ix, iy;
 	//unsigned long counter = 0;
-	try {
 
-		if (YCbCrSubSampling_h * YCbCrSubSampling_v > 16) {
-			throw general_exception ("parse_error");  // OX[
-		}
-		if (LumaGreen == 0.0)
-			LumaGreen = 1.0;
+	if (YCbCrSubSampling_h * YCbCrSubSampling_v > 16) {
+		//parse_error:
+		return -2;
+	}
+	if (LumaGreen == 0.0)
+		LumaGreen = 1.0;
 
-		for (auto i = 0; i < samplesperpixel; i++) {
-			totbits += bitspersample[i];
+	for (auto i = 0; i < samplesperpixel; i++) {
+		totbits += bitspersample[i];
+	}
+	for (auto i = 0; i < samplesperpixel; i++) {
+		if ((bitspersample[i] % 8) != 0) {
+			bitstreamflag = 1;
 		}
-		for (auto i = 0; i < samplesperpixel; i++) {
-			if ((bitspersample[i] % 8) != 0) {
-				bitstreamflag = 1;
+	}
+
+	x = 0; y = 0;
+	// Need for some YcbCr images -
+	//bits += 3;
+	if (bitstreamflag == 0) {
+		unsigned long i = 0;
+		// a block of luma samples, Cb, Cr and any other samples
+		unsigned long block = (totbits - bitspersample[0] + YCbCrSubSampling_h * YCbCrSubSampling_v * bitspersample[0]) / 8;
+
+		while (i + block <= Nbytes) {
+			for (ii = 0; ii < YCbCrSubSampling_h * YCbCrSubSampling_v; ii++) {
+				Y[ii] = read_byte_sample (bits, 0);
+				bits += bitspersample[0] / 8;
+				i += bitspersample[0] / 8;
 			}
-		}
+			Cb = read_byte_sample (bits, 1);
+			bits += bitspersample[1] / 8;
+			i += bitspersample[1] / 8;
+			Cr = read_byte_sample (bits, 2);
+			bits += bitspersample[2] / 8;
+			i += bitspersample[2] / 8;
 
-		x = 0; y = 0;
-		// Need for some YcbCr images -
-		//bits += 3;
-		if (bitstreamflag == 0) {
-			unsigned long i = 0;
 
-			while (i < Nbytes - totbits / 8 + 1) {
-				for (ii = 0; ii < YCbCrSubSampling_h * YCbCrSubSampling_v; ii++) {
-					Y[ii] = read_byte_sample (bits, 0);
-					bits += bitspersample[0] / 8;
-					i += bitspersample[0] / 8;
+			for (ii = 0; ii < YCbCrSubSampling_h * YCbCrSubSampling_v; ii++) {
+				int red, green, blue;
+				red = (int)((Cr - 127) * (2 - 2 * LumaRed) + Y[ii]);
+				blue = (int)((Cb - 127) * (2 - 2 * LumaBlue) + Y[ii]);
+				green = (int)((Y[ii] - LumaBlue * blue - LumaRed * red) / LumaGreen);
+
+				red = red < 0 ? 0 : red > 255 ? 255 : red;
+				green = green < 0 ? 0 : green > 255 ? 255 : green;
+				blue = blue < 0 ? 0 : blue > 255 ? 255 : blue;
+				ix = x + (ii % YCbCrSubSampling_h);
+				iy = y + (ii / YCbCrSubSampling_h);
+				//YcbcrToRGB(Y[ii], Cb, Cr, &r, &g, &b);
+				if (ix < width && iy < height) {
+					rgba[(iy * width + ix) * 4] = red;
+					rgba[(iy * width + ix) * 4 + 1] = green;
+					rgba[(iy * width + ix) * 4 + 2] = blue;
 				}
-				Cb = read_byte_sample (bits, 1);
-				bits += bitspersample[1] / 8;
-				i += bitspersample[1] / 8;
-				Cr = read_byte_sample (bits, 2);
-				bits += bitspersample[2] / 8;
-				i += bitspersample[2] / 8;
-
-
-				for (ii = 0; ii < YCbCrSubSampling_h * YCbCrSubSampling_v; ii++) {
-					int red, green, blue;
-					red = (int)((Cr - 127) * (2 - 2 * LumaRed) + Y[ii]);
-					blue = (int)((Cb - 127) * (2 - 2 * LumaBlue) + Y[ii]);
-					green = (int)((Y[ii] - LumaBlue * blue - LumaRed * red) / LumaGreen);
-
-					red = red < 0 ? 0 : red > 255 ? 255 : red;
-					green = green < 0 ? 0 : green > 255 ? 255 : green;
-					blue = blue < 0 ? 0 : blue > 255 ? 255 : blue;
-					ix = x + (ii % YCbCrSubSampling_h);
-					iy = y + (ii / YCbCrSubSampling_h);
-					//YcbcrToRGB(Y[ii], Cb, Cr, &r, &g, &b);
-					if (ix < width && iy < height) {
-						rgba[(iy * width + ix) * 4] = red;
-						rgba[(iy * width + ix) * 4 + 1] = green;
-						rgba[(iy * width + ix) * 4 + 2] = blue;
-					}
 
-				}
-				x += YCbCrSubSampling_h;
-				if (x >= width) {
-					x = 0;
-					y += YCbCrSubSampling_v;
-				}
-				for (ii = 3; ii < samplesperpixel; ii++) {
-					bits += bitspersample[ii] / 8;
-					i += bitspersample[ii] / 8;
-				}
 			}
-			return 0;
+			x += YCbCrSubSampling_h;
+			if (x >= width) {
+				x = 0;
+				y += YCbCrSubSampling_v;
+			}
+			for (ii = 3; ii < samplesperpixel; ii++) {
+				bits += bitspersample[ii] / 8;
+				i += bitspersample[ii] / 8;
+			}
 		}
 		return 0;
 	}
-	catch (general_exception) {
-		//parse_error:
-		return -2;
+	return 0;
+}
+/// <summary>
+/// one channel of CMYK to RGB, (255 - c) * (255 - k) / 255 rounded
+/// </summary>
+static inline BYTE cmyk_channel (int c, int k)
+{
+	int t = (255 - c) * (255 - k) + 128;
+	return (BYTE)((t + (t >> 8)) >> 8);
+}
+
+/// <summary>
+/// copy one row of 8 bit CMYK(A) pixels, dropping any further samples,
+/// and undo horizontal differencing
+/// </summary>
+/// <param name="out">width * channels bytes</param>
+/// <param name="in">width * stride bytes</param>
+/// <param name="width">pixels</param>
+/// <param name="stride">bytes per input pixel</param>
+/// <param name="channels">4 or 5</param>
+/// <param name="predict">predictor 2</param>
+static void cmyk_row_unpack (BYTE* out, const BYTE* in, int width, int stride, int channels, bool predict)
+{
+	int x = 1;
+
+	if (stride == channels) {
+		memcpy (out, in, (size_t)width * channels);
+	}
+	else {
+		for (auto ii = 0; ii < width; ii++) {
+			memcpy (out + ii * channels, in + ii * stride, channels);
+		}
+	}
+	if (!predict) {
+		return;
+	}
+#ifdef TIFF_SSE2
+	if (channels == 4) {
+		// running sum over four pixels at a time, carrying the last pixel on
+		__m128i carry = _mm_setzero_si128 ();
+		for (x = 0; x + 4 <= width; x += 4) {
+			__m128i v = _mm_loadu_si128 ((const __m128i*)(out + x * 4));
+			v = _mm_add_epi8 (v, _mm_slli_si128 (v, 4));
+			v = _mm_add_epi8 (v, _mm_slli_si128 (v, 8));
+			v = _mm_add_epi8 (v, carry);
+			_mm_storeu_si128 ((__m128i*)(out + x * 4), v);
+			carry = _mm_shuffle_epi32 (v, _MM_SHUFFLE (3, 3, 3, 3));
+		}
+		if (x == 0) {
+			x = 1;
+		}
+	}
+#endif
+	for (; x < width; x++) {
+		for (auto c = 0; c < channels; c++) {
+			out[x * channels + c] += out[(x - 1) * channels + c];
+		}
+	}
+}
+
+/// <summary>
+/// convert a row of CMYK pixels to opaque RGBA in place
+/// </summary>
+/// <param name="p">width * 4 bytes</param>
+/// <param name="width">pixels</param>
+static void cmyk_row_to_rgba (BYTE* p, int width)
+{
+	int x = 0;
+
+#ifdef TIFF_SSE2
+	const __m128i ones = _mm_set1_epi8 ((char)0xFF);
+	const __m128i zero = _mm_setzero_si128 ();
+	const __m128i half = _mm_set1_epi16 (128);
+	const __m128i alpha = _mm_set1_epi32 ((int)0xFF000000);
+	for (; x + 4 <= width; x += 4) {
+		__m128i inv = _mm_xor_si128 (_mm_loadu_si128 ((const __m128i*)(p + x * 4)), ones);
+		__m128i lo = _mm_unpacklo_epi8 (inv, zero);
+		__m128i hi = _mm_unpackhi_epi8 (inv, zero);
+		__m128i klo = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (lo, 0xFF), 0xFF);
+		__m128i khi = _mm_shufflehi_epi16 (_mm_shufflelo_epi16 (hi, 0xFF), 0xFF);
+		lo = _mm_add_epi16 (_mm_mullo_epi16 (lo, klo), half);
+		hi = _mm_add_epi16 (_mm_mullo_epi16 (hi, khi), half);
+		lo = _mm_srli_epi16 (_mm_add_epi16 (lo, _mm_srli_epi16 (lo, 8)), 8);
+		hi = _mm_srli_epi16 (_mm_add_epi16 (hi, _mm_srli_epi16 (hi, 8)), 8);
+		_mm_storeu_si128 ((__m128i*)(p + x * 4), _mm_or_si128 (_mm_packus_epi16 (lo, hi), alpha));
+	}
+#endif
+	for (; x < width; x++) {
+		BYTE* px = p + x * 4;
+		int K = px[3];
+		px[0] = cmyk_channel (px[0], K);
+		px[1] = cmyk_channel (px[1], K);
+		px[2] = cmyk_channel (px[2], K);
+		px[3] = 255;
 	}
-
 }
+
 /// <summary>
-/// 
+/// unpack CMYK(A) samples, or convert them to RGBA when cmyk_as_rgba () is set
 /// </summary>
-/// <param name="cmyk"></param>
+/// <param name="cmyk">output, insamples bytes per pixel</param>
 /// <param name="width"></param>
 /// <param name="height"></param>
 /// <param name="bits"></param>
 /// <param name="Nbytes"></param>
-/// <param name="insamples"></param>
-/// <returns></returns>
+/// <param name="insamples">output samples per pixel</param>
+/// <returns>0 on success</returns>
 int BASICHEADER::cmyk_to_cmyk (BYTE* cmyk, int width, int height, BYTE* bits, unsigned long Nbytes, int insamples)
 {
-	//unsigned long i;
 	int ii;
 	int totbits = 0;
 	int bitstreamflag = 0;
-
-	//int red = 0;
-	// green = 0;
-	//int blue = 0;
+	int channels = 4 + ((extrasamples == 1) ? 1 : 0);
+	bool torgba = cmyk_as_rgba ();
+	bool bytesamples;
 	int x, y;
 	int counter = 0;
 
-	try {
-
-		for (auto i = 0; i < samplesperpixel; i++) {
-			totbits += bitspersample[i];
+	for (auto i = 0; i < samplesperpixel; i++) {
+		totbits += bitspersample[i];
+	}
+	for (auto i = 0; i < samplesperpixel; i++) {
+		if ((bitspersample[i] % 8) != 0) {
+			bitstreamflag = 1;
 		}
-		for (auto i = 0; i < samplesperpixel; i++) {
-			if ((bitspersample[i] % 8) != 0) {
-				bitstreamflag = 1;
-			}
+	}
+	bytesamples = bitstreamflag == 0 && samplesperpixel >= channels;
+	for (auto i = 0; i < channels && bytesamples; i++) {
+		if (bitspersample[i] != 8) {
+			bytesamples = false;
 		}
+	}
 
-		x = 0;
-		y = 0;
-
-		if (bitstreamflag == 0) {
-			unsigned long i = 0;
-			int C, M, Y, K, A{};
-			int Cprev = 0, Yprev = 0, Mprev = 0, Kprev = 0, Aprev = 0;
-			while (i < Nbytes - totbits / 8 + 1) {
-				C = read_byte_sample (bits, 0);
-				bits += bitspersample[0] / 8;
-				i += bitspersample[0] / 8;
-				M = read_byte_sample (bits, 1);
-				bits += bitspersample[1] / 8;
-				i += bitspersample[1] / 8;
-				Y = read_byte_sample (bits, 2);
-				bits += bitspersample[2] / 8;
-				i += bitspersample[2] / 8;
-				K = read_byte_sample (bits, 3);
-				bits += bitspersample[3] / 8;
-				i += bitspersample[3] / 8;
+	x = 0;
+	y = 0;
 
-				if (insamples == 5) {
-					A = read_byte_sample (bits, 4);
-					bits += bitspersample[4] / 8;
-					i += bitspersample[4] / 8;
-				}
+	if (bytesamples) {
+		// whole rows at a time
+		int stride = totbits / 8;
+		long rowbytes = (long)stride * width;
+		BYTE* scratch = 0;
 
-				if (predictor == 2) {
-					C = (C + Cprev) & 0xFF;
-					M = (M + Mprev) & 0xFF;
-					Y = (Y + Yprev) & 0xFF;
-					K = (K + Kprev) & 0xFF;
-					A = (A + Aprev) & 0xFF;
-					Cprev = C;
-					Mprev = M;
-					Yprev = Y;
-					Kprev = K;
-					Aprev = A;
+		if (torgba && channels == 5) {
+			scratch = new BYTE[width * 5];
+			if (!scratch) {
+				return -3;
+			}
+		}
+		for (y = 0; y < height; y++) {
+			long pos = rowbytes * y;
+			int n = width;
+			if (pos + rowbytes > (long)Nbytes) {
+				n = pos < (long)Nbytes ? (int)(((long)Nbytes - pos) / stride) : 0;
+			}
+			if (n == 0) {
+				break;
+			}
+			if (!torgba) {
+				cmyk_row_unpack (cmyk, bits + pos, n, stride, channels, predictor == 2);
+			}
+			else if (channels == 4) {
+				cmyk_row_unpack (cmyk, bits + pos, n, stride, channels, predictor == 2);
+				cmyk_row_to_rgba (cmyk, n);
+			}
+			else {
+				cmyk_row_unpack (scratch, bits + pos, n, stride, channels, predictor == 2);
+				for (x = 0; x < n; x++) {
+					const BYTE* px = scratch + x * 5;
+					cmyk[x * 4] = cmyk_channel (px[0], px[3]);
+					cmyk[x * 4 + 1] = cmyk_channel (px[1], px[3]);
+					cmyk[x * 4 + 2] = cmyk_channel (px[2], px[3]);
+					cmyk[x * 4 + 3] = px[4];
 				}
+			}
+			cmyk += width * insamples;
+		}
+		delete[] scratch;
+		return 0;
+	}
+	else if (bitstreamflag == 0) {
+		unsigned long i = 0;
+		int C, M, Y, K, A{};
+		int Cprev = 0, Yprev = 0, Mprev = 0, Kprev = 0, Aprev = 0;
+		while (i + totbits / 8 <= Nbytes) {
+			C = read_byte_sample (bits, 0);
+			bits += bitspersample[0] / 8;
+			i += bitspersample[0] / 8;
+			M = read_byte_sample (bits, 1);
+			bits += bitspersample[1] / 8;
+			i += bitspersample[1] / 8;
+			Y = read_byte_sample (bits, 2);
+			bits += bitspersample[2] / 8;
+			i += bitspersample[2] / 8;
+			K = read_byte_sample (bits, 3);
+			bits += bitspersample[3] / 8;
+			i += bitspersample[3] / 8;
+
+			if (channels == 5) {
+				A = read_byte_sample (bits, 4);
+				bits += bitspersample[4] / 8;
+				i += bitspersample[4] / 8;
+			}
 
-				//red = (255 * (255 - C) * (255 - K))/(255 * 255);
-				//green = (255 * (255 - M) * (255 - K))/(255 * 255);
-				//blue = (255 * (255 - Y) * (255 - K))/(255 * 255);
-
-				//rgba[0] = red;
-				//rgba[1] = green;
-				//rgba[2] = blue;
+			if (predictor == 2) {
+				C = (C + Cprev) & 0xFF;
+				M = (M + Mprev) & 0xFF;
+				Y = (Y + Yprev) & 0xFF;
+				K = (K + Kprev) & 0xFF;
+				A = (A + Aprev) & 0xFF;
+				Cprev = C;
+				Mprev = M;
+				Yprev = Y;
+				Kprev = K;
+				Aprev = A;
+			}
 
+			if (torgba) {
+				cmyk[0] = cmyk_channel (C, K);
+				cmyk[1] = cmyk_channel (M, K);
+				cmyk[2] = cmyk_channel (Y, K);
+				cmyk[3] = (channels == 5) ? A : 255;
+			}
+			else {
 				cmyk[0] = C;
 				cmyk[1] = M;
 				cmyk[2] = Y;
 				cmyk[3] = K;
-				if (insamples == 5)
+				if (channels == 5)
 					cmyk[4] = A;
-				cmyk += insamples;
+			}
+			cmyk += insamples;
 
-				for (ii = insamples; ii < samplesperpixel; ii++) {
-					bits += bitspersample[ii] / 8;
-					i += bitspersample[ii] / 8;
-				}
+			for (ii = channels; ii < samplesperpixel; ii++) {
+				bits += bitspersample[ii] / 8;
+				i += bitspersample[ii] / 8;
+			}
 
-				x++;
-				if (x == width) {
-					x = 0;
-					y++;
-					Cprev = 0;
-					Mprev = 0;
-					Yprev = 0;
-					Kprev = 0;
-					Aprev = 0;
-				}
-				if (counter++ > width * height) {
-					throw general_exception ("parse_error");  // OX[
-				}
+			x++;
+			if (x == width) {
+				x = 0;
+				y++;
+				Cprev = 0;
+				Mprev = 0;
+				Yprev = 0;
+				Kprev = 0;
+				Aprev = 0;
+			}
+			if (counter++ > width * height) {
+				//parse_error:
+				return -2;
 			}
-			return 0;
-		}
-		else {
-			throw general_exception ("parse_error");  // OX[
 		}
 		return 0;
 	}
-	catch (general_exception) {
+	else {
 		//parse_error:
 		return -2;
 	}
-	catch (...) {
-		return -3;
-	}
 }
 
 
@@ -1351,7 +3729,7 @@ int BASICHEADER::bitstream_to_rgba (BYTE* rgba, int width, int height, BYTE* bit
 	if (bitstreamflag == 0) {
 		unsigned long i = 0;
 
-		while (i < Nbytes - totbits / 8 + 1) {
+		while (i + totbits / 8 <= Nbytes) {
 			rgba[0] = read_byte_sample (bits, 0);
 			bits += bitspersample[0] / 8;
 			i += bitspersample[0] / 8;
@@ -1383,31 +3761,30 @@ int BASICHEADER::bitstream_to_rgba (BYTE* rgba, int width, int height, BYTE* bit
 		return 0;
 	}
 	else {
-		BSTREAM* bs = new BSTREAM (bits, Nbytes, BIG_ENDIAN);
+		MSBREADER bs (bits, Nbytes);
 		for (auto i = 0; i < height; i++) {
 			for (ii = 0; ii < width; ii++) {
-				red = bs->getbits (bitspersample[0]);
+				red = bs.getbits (bitspersample[0]);
 				red = (red * 255) / ((1 << (bitspersample[0])) - 1);
-				green = bs->getbits (bitspersample[1]);
+				green = bs.getbits (bitspersample[1]);
 				green = (green * 255) / ((1 << (bitspersample[1])) - 1);
-				blue = bs->getbits (bitspersample[2]);
+				blue = bs.getbits (bitspersample[2]);
 				blue = (blue * 255) / ((1 << (bitspersample[2])) - 1);
 				rgba[0] = red;
 				rgba[1] = green;
 				rgba[2] = blue;
 				if (insamples == 4) {
-					alpha = bs->getbits (bitspersample[3]);
+					alpha = bs.getbits (bitspersample[3]);
 					alpha = (alpha * 255) / ((1 << (bitspersample[3])) - 1);
 					rgba[3] = alpha;
 				}
 				for (iii = insamples; iii < samplesperpixel; iii++) {
-					bs->getbits (bitspersample[iii]);
+					bs.getbits (bitspersample[iii]);
 				}
 				rgba += insamples;
 			}
-			bs->synch_to_byte ();
+			bs.synch_to_byte ();
 		}
-		delete bs;
 	}
 
 	return 0;
@@ -1479,7 +3856,8 @@ int BASICHEADER::read_byte_sample (BYTE* bytes, int sample_index)
 			real = memread_ieee754f (bytes, endianness == ENDIAN::BIG_ENDIAN ? 1 : 0);
 		}
 		else {
-			throw general_exception ("error");
+			// section_job refuses other widths
+			return 0;
 		}
 		if (sminsamplevalue) {
 			low = smaxsamplevalue[sample_index];
@@ -1532,182 +3910,7 @@ typedef struct
 } LodePNGDecompressSettings;
 
 void invert (BYTE* bits, unsigned long N);
-BYTE* unpackbits (FileData* fd, unsigned long count, unsigned long* Nret);
-BYTE* ccittdecompress (BYTE* in, unsigned long count, unsigned long* Nret, int width, int height, bool eol);
-BYTE* ccittgroup4decompress (BYTE* in, unsigned long count, unsigned long* Nret, int width, int height, int eol);
-int loadlzw (BYTE* out, FileData* fd, unsigned long count, unsigned long* Nret);
-unsigned lodepng_zlib_decompress (BYTE** out, size_t* outsize, const BYTE* in,
-								  size_t insize, const LodePNGDecompressSettings* settings);
-
-/*
-  Master decompression function
-  Params:
-	fp - input file, pointing to start of data section
-	count - number of bytes in stream to decompress
-	Nret - return for number of decompressed bytes
-	width, height - width and height of strip or tile
-	T4option - T4 twiddle
-  Returns: pointer to decompressed dta, 0 on fail
-
-*/
-BYTE* decompress (FileData* fd, unsigned long count, COMPRESSION compression, unsigned long* Nret, int width, int height, unsigned long T4options)
-{
-	BYTE* answer = 0;
-	BYTE* buff = NULL;
-	unsigned long pos = 0;
-	size_t decompsize = 0;
-	LodePNGDecompressSettings settings = {};
-	try {
-		switch (compression) {
-		case COMPRESSION::COMPRESSION_NONE:
-			answer = new BYTE[count];
-			if (!answer) {
-				throw general_exception ("out_of_memory");  // OX[	
-			}
-			//fread(answer, 1, count, fp);
-			fd->memcpy (answer, count);
-			//memcpy(answer,fd->buffer + fd->buffer_ptr, count);
-			//fd->buffer_ptr += count;
-			*Nret = count;
-			return answer;
-		case  COMPRESSION::COMPRESSION_CCITTRLE:
-			buff = new BYTE[count];
-			//unsigned long i = 0;
-			if (!buff) {
-				throw general_exception ("out_of_memory");  // OX[	
-			}
-			//fread(buff, 1, count, fp);
-			fd->memcpy (buff, count);
-			//memcpy(buff, fd->buffer + fd->buffer_ptr, count);
-			//fd->buffer_ptr += count;
-			answer = ccittdecompress (buff, count, Nret, width, height, false);
-			if (answer) {
-				invert (answer, *Nret);
-			}
-			delete[] buff;
-			return answer;
-		case COMPRESSION::COMPRESSION_CCITTFAX3:
-			buff = new BYTE[count];
-			if (!buff) {
-				throw general_exception ("out_of_memory");  // OX[
-			}
-			//fread(buff, 1, count, fp);
-			fd->memcpy (buff, count);
-			//memcpy(buff, fd->buffer + fd->buffer_ptr, count);
-			//fd->buffer_ptr += count;
-			if ((T4options & 0x04) == 0) {
-				answer = ccittdecompress (buff, count, Nret, width, height, true);
-			}
-			else {
-				answer = 0; /* not handling for now */
-			}
-			if (answer) {
-				invert (answer, *Nret);
-			}
-			delete[] buff;
-			return answer;
-		case COMPRESSION::COMPRESSION_CCITTFAX4:
-			buff = new BYTE[count];
-			if (!buff) {
-				throw general_exception ("out_of_memory");  // OX[
-			}
-			//fread(buff, 1, count, fp);
-			fd->memcpy (buff, count);
-			//memcpy(buff, fd->buffer + fd->buffer_ptr, count);
-			//fd->buffer_ptr += count;
-			answer = ccittgroup4decompress (buff, count, Nret, width, height, 0);
-
-			//if (answer) {
-			//	invert (answer, *Nret);
-			//}
-			delete[] buff;
-			return answer;
-		case COMPRESSION::COMPRESSION_PACKBITS:
-			answer = unpackbits (fd, count, Nret);
-			return answer;
-		case COMPRESSION::COMPRESSION_LZW:
-			pos = fd->buffer_ptr;//ftell(fp);
-			int err;
-			err = loadlzw (0, fd, count, Nret);
-			answer = new BYTE[*Nret];
-			if (!answer) {
-				throw general_exception ("out_of_memory");  // OX[	
-			}
-			//fseek(fp, pos, SEEK_SET);
-			fd->buffer_ptr = pos;
-			loadlzw (answer, fd, count, Nret);
-			return answer;
-		case COMPRESSION::COMPRESSION_ADOBE_DEFLATE:
-		case COMPRESSION::COMPRESSION_DEFLATE:
-
-			settings.custom_decoder = 0;
-			settings.ignore_adler32 = 0;
-			buff = new BYTE[count];
-			if (!buff) {
-				throw general_exception ("out_of_memory");  // OX[	
-			}
-			//fread(buff, 1, count, fp);
-			fd->memcpy (buff, count);
-			//memcpy(buff, fd->buffer + fd->buffer_ptr, count);
-			//fd->buffer_ptr += count;
-			*Nret = 0;
-			answer = 0;
-			decompsize = 0;
-			lodepng_zlib_decompress (&answer, &decompsize, buff, count, &settings);
-			*Nret = (unsigned long)decompsize;
-			delete[] buff;
-			return answer;
-		default:
-			//perror("compression not supprted");
-			break;
-			//char work[256];
-			//const char* work2;
-			//switch (compression) {
-			//case COMPRESSION::COMPRESSION_OJPEG:
-			//	work2 = "COMPRESSION_OJPEG";break;
-			//case COMPRESSION::COMPRESSION_JPEG:
-			//	work2 = "COMPRESSION_JPEG";break;
-			//case COMPRESSION::COMPRESSION_NEXT:
-			//	work2 = "COMPRESSION_NEXT";break;
-			//case COMPRESSION::COMPRESSION_CCITTRLEW:
-			//	work2 = "COMPRESSION_CCITTRLEW";break;
-			//case COMPRESSION::COMPRESSION_THUNDERSCAN:
-			//	work2 = "COMPRESSION_THUNDERSCAN";break;
-			//case COMPRESSION::COMPRESSION_IT8CTPAD:
-			//	work2 = "COMPRESSION_IT8CTPAD";break;
-			//case COMPRESSION::COMPRESSION_IT8LW:
-			//	work2 = "COMPRESSION_IT8LW";break;
-			//case COMPRESSION::COMPRESSION_IT8MP:
-			//	work2 = "COMPRESSION_IT8MP";break;
-			//case COMPRESSION::COMPRESSION_IT8BL:
-			//	work2 = "COMPRESSION_IT8BL";break;
-			//case COMPRESSION::COMPRESSION_PIXARFILM:
-			//	work2 = "COMPRESSION_PIXARFILM";break;
-			//case COMPRESSION::COMPRESSION_PIXARLOG:
-			//	work2 = "COMPRESSION_PIXARLOG";break;
-			//case COMPRESSION::COMPRESSION_DCS:
-			//	work2 = "COMPRESSION_DCS";break;
-			//case COMPRESSION::COMPRESSION_JBIG:
-			//	work2 = "COMPRESSION_JBIG";break;
-			//case COMPRESSION::COMPRESSION_SGILOG:
-			//	work2 = "COMPRESSION_SGILOG";break;
-			//case COMPRESSION::COMPRESSION_SGILOG24:
-			//	work2 = "COMPRESSION_SGILOG24";break;
-			//case COMPRESSION::COMPRESSION_JP2000:
-			//	work2 = "COMPRESSION_JP2000";break;
-			//default:
-			//	work2 = "COMPRESSION_UNKNOWN";break;
-			//}
-			//sprintf_s(work, "compression not supported:%s", work2);
-			//throw general_exception(work);
-		}
-		return 0;
-	}
-	catch (general_exception) {
-		//out_of_memory:
-		throw;
-	}
-}
+static unsigned long unpackbits (const BYTE* in, unsigned long count, BYTE* out, unsigned long size);
 
 void invert (BYTE* bits, unsigned long N)
 {
@@ -1721,87 +3924,47 @@ void invert (BYTE* bits, unsigned long N)
 /*
   unpackbits decompressor.
   Nice and easy compression scheme
+  Params:
+	in, count - the packed bytes
+	out, size - output, runs past size are cut short
+  Returns: number of bytes unpacked
 */
-BYTE* unpackbits (FileData* fd, unsigned long count, unsigned long* Nret)
+static unsigned long unpackbits (const BYTE* in, unsigned long count, BYTE* out, unsigned long size)
 {
-	unsigned long pos = fd->buffer_ptr;//ftell(fp);
+	unsigned long i = 0;
 	unsigned long N = 0;
-	//unsigned long i, j;
-	long Nleft;
+	unsigned long run;
 	signed char header;
-	int ch;
-	BYTE* answer = 0;
 
-	try {
-		Nleft = count;
-		while (Nleft > 0) {
-			if ((ch = fd->fgetcc ()) == EOF) {
-				throw general_exception ("parse_error");  // OX[
-			}
-			Nleft--;
-			header = (signed char)ch;
-			if (header > 0) {
-				N += header + 1;
-				for (auto i = 0; i < header + 1; i++) {
-					fd->fgetcc ();
-					Nleft--;
-				}
+	while (i < count && N < size) {
+		header = (signed char)in[i++];
+		if (header >= 0) {
+			run = header + 1;
+			if (run > count - i) {
+				run = count - i;
 			}
-			else if (header > -128) {
-				N += 1 - header;
-				fd->fgetcc ();
-				Nleft--;
-			}
-			else {
+			if (run > size - N) {
+				run = size - N;
 			}
+			memcpy (out + N, in + i, run);
+			i += header + 1;
+			N += run;
 		}
-		//fseek(fp, pos, SEEK_SET);
-		fd->buffer_ptr = pos;
-		Nleft = count;
-		answer = new BYTE[N];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		auto j = 0;
-		while (Nleft > 0) {
-			if ((ch = fd->fgetcc ()) == EOF) {
-				throw general_exception ("parse_error");  // OX[
-			}
-			Nleft--;
-			header = (signed char)ch;
-			if (header > 0) {
-				for (auto i = 0; i < header + 1; i++) {
-					answer[j++] = fd->fgetcc ();
-					Nleft--;
-				}
-			}
-			else if (header > -128) {
-				ch = fd->fgetcc ();
-				Nleft--;
-				for (auto i = 0; i < 1 - header; i++) {
-					answer[j++] = ch;
-				}
+		else if (header > -128) {
+			if (i >= count) {
+				break;
 			}
-			else {
+			run = 1 - header;
+			if (run > size - N) {
+				run = size - N;
 			}
-
+			memset (out + N, in[i++], run);
+			N += run;
+		}
+		else {
 		}
-
-		*Nret = N;
-		return answer;
-	}
-	catch (general_exception) {
-		//parse_error:
-		//out_of_memory:
-		delete[] answer;
-		*Nret = 0;
-		return 0;
-	}
-	catch (...) {
-		delete[] answer;
-		*Nret = 0;
-		return 0;
 	}
+	return N;
 }
 
 typedef struct
@@ -1813,6 +3976,24 @@ typedef struct
 	//BYTE* ptr;
 } ENTRY;
 
+/// <summary>
+/// LZW string table of a thread. The single byte entries are set once,
+/// the rest are written afresh by every strip before they are read.
+/// </summary>
+class LZWSTATE : public CODECSTATE
+{
+public:
+	ENTRY table[1 << 12];
+	LZWSTATE ()
+	{
+		for (auto ii = 0; ii < (1 << 12); ii++) {
+			table[ii].prefix = 0;
+			table[ii].len = 1;
+			table[ii].suffix = ii < 256 ? ii : 0;
+		}
+	}
+};
+
 class HUFFNODE
 {
 public:
@@ -1839,26 +4020,24 @@ public:
 	/// </summary>
 	/// <param name="bs"></param>
 	/// <returns>symbol</returns>
-	int gethuffmansymbol (BSTREAM* bs)
+	template <class READER> int gethuffmansymbol (READER* bs) const
 	{
-
+		const HUFFNODE* node = this;
 		int bit;
 
-		if (zero == NULL && one == NULL) {
-
-			return symbol;
-		}
-		bit = bs->getbit ();
-		//printf("%d", bit);
-		if (bit == 0 && zero) {
-			return zero->gethuffmansymbol (bs);
-		}
-		else if (bit == 1 && one) {
-			return one->gethuffmansymbol (bs);
-		}
-		else {
-			return symbol;
+		while (node->zero != NULL || node->one != NULL) {
+			bit = bs->getbit ();
+			if (bit == 0 && node->zero) {
+				node = node->zero;
+			}
+			else if (bit == 1 && node->one) {
+				node = node->one;
+			}
+			else {
+				break;
+			}
 		}
+		return node->symbol;
 	}
 
 	/// <summary>
@@ -2046,127 +4225,205 @@ struct ccittcode ccitttable[105] =
 	{ 2560, "000000011111", 2560, "000000011111" },
 };
 
-BYTE* ccittdecompress (BYTE* in, unsigned long count, unsigned long* Nret, int width, int height, bool eol)
+/// <summary>
+/// the CCITT code trees. They never change, so they're built once, on
+/// first use, and then shared read only by every strip and thread.
+/// </summary>
+class CCITTTREES
 {
-	HUFFNODE* whitetree = NULL;
-	HUFFNODE* blacktree = NULL;
-	BSTREAM* bs = 0;
-	BSTREAM* bout = 0;
-	int i, ii;
-	int err = 0;
-	int totlen;
-	int len;
-	int whitelen, blacklen;
-	BYTE* answer = 0;
-	int Nout;
-
-	try {
-		Nout = (width + 7) / 8 * height;
-		answer = new BYTE[Nout];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[
+public:
+	HUFFNODE* white;
+	HUFFNODE* black;
+	HUFFNODE* twod;
+	int err;
+	CCITTTREES ()
+	{
+		int i;
+		white = NULL;
+		black = NULL;
+		twod = NULL;
+		err = 0;
+		for (i = 0; i < 105; i++) {
+			white = HUFFNODE::addhuffmansymbol (white, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
 		}
-		bout = new BSTREAM (answer, Nout, BIG_ENDIAN);
-		if (!bout) {
-			throw general_exception ("out_of_memory");  // OX[	
+		for (i = 0; i < 105; i++) {
+			black = HUFFNODE::addhuffmansymbol (black, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
 		}
-		bs = new BSTREAM (in, count, LITTLE_ENDIAN);
-		if (!bs) {
-			throw general_exception ("out_of_memory");  // OX[
+		for (i = 0; i < 11; i++) {
+			twod = HUFFNODE::addhuffmansymbol (twod, ccitt2dtable[i].code, static_cast<int>(ccitt2dtable[i].symbol), &err);
 		}
-		for (i = 0; i < 105; i++) {
-			whitetree = HUFFNODE::addhuffmansymbol (whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
+	}
+	~CCITTTREES ()
+	{
+		delete white;
+		delete black;
+		delete twod;
+	}
+	/// <summary>
+	/// the shared trees
+	/// </summary>
+	/// <returns>the trees, NULL if they couldn't be built</returns>
+	static const CCITTTREES* get ()
+	{
+		static const CCITTTREES trees;  // initialisation is thread safe
+		return trees.err ? NULL : &trees;
+	}
+};
+
+/// <summary>
+/// the reference and current lines of a thread's group 4 decoder,
+/// grown to the widest strip seen and cleared for each new one
+/// </summary>
+class CCITTSTATE : public CODECSTATE
+{
+public:
+	BYTE* reference;
+	BYTE* current;
+	int Nline;                              // room in each line
+	CCITTSTATE ()
+	{
+		reference = NULL;
+		current = NULL;
+		Nline = 0;
+	}
+	~CCITTSTATE ()
+	{
+		delete[] reference;
+		delete[] current;
+	}
+	/// <summary>
+	/// make room for lines of a width
+	/// </summary>
+	/// <param name="width">pixels in a line</param>
+	/// <returns>false if out of memory</returns>
+	bool lines (int width)
+	{
+		if (width < 1) {
+			width = 1;
 		}
-		for (i = 0; i < 105; i++) {
-			blacktree = HUFFNODE::addhuffmansymbol (blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
+		if (width <= Nline) {
+			return true;
 		}
-		if (err) {
-			throw general_exception ("out_of_memory");  // OX[	
+		delete[] reference;
+		delete[] current;
+		Nline = 0;
+		reference = new BYTE[width];
+		current = new BYTE[width];
+		if (!reference || !current) {
+			return false;
 		}
+		Nline = width;
+		return true;
+	}
+};
+
+/// <summary>
+/// CCITT modified Huffman (Compression = 2) and T.4 1D (Compression = 3)
+/// </summary>
+/// <param name="in">the coded strip</param>
+/// <param name="count">bytes in</param>
+/// <param name="out">output</param>
+/// <param name="size">bytes of out</param>
+/// <param name="Nret">return for bytes decoded</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="eol">lines start with EOL codes</param>
+/// <returns>0 on success, -1 on fail</returns>
+int ccittdecompress (const BYTE* in, unsigned long count, BYTE* out, unsigned long size, unsigned long* Nret, int width, int height, bool eol)
+{
+	const HUFFNODE* whitetree = NULL;
+	const HUFFNODE* blacktree = NULL;
+	const CCITTTREES* trees;
+	int i, ii;
+	int totlen;
+	int len;
+	int whitelen, blacklen;
+	unsigned long Nout;
+	LSBREADER bs (in, count);
 
-		//debug(whitetree, 0);
-		if (eol) {
-			len = whitetree->gethuffmansymbol (bs);
-		}
-		for (i = 0; i < height; i++) {
-			totlen = 0;
-			while (totlen < width) {
-				len = whitetree->gethuffmansymbol (bs);
-				if (len == -1) {
-					throw general_exception ("parse_error");  // OX[
-				}
-				if (len == -2) {
-					whitelen = width - totlen;
-				}
-				else {
-					whitelen = len;
-				}
-				while (len >= 64) {
-					len = whitetree->gethuffmansymbol (bs);
-					if (len == EOL || len == -1 || totlen + len + whitelen > width) {
-						throw general_exception ("parse_error");  // OX[
-					}
-					whitelen += len;
-				}
-				for (ii = 0; ii < whitelen; ii++) {
-					bout->writebit (0);
-				}
-				totlen += whitelen;
-				if (totlen >= width) {
-					break;
-				}
-				len = blacktree->gethuffmansymbol (bs);
-				if (len < 0) {
-					throw general_exception ("parse_error");  // OX[
-				}
-				blacklen = len;
-				while (len >= 64) {
-					len = blacktree->gethuffmansymbol (bs);
-					if (len == EOL || len == -1 || totlen + len + blacklen > width) {
-						throw general_exception ("parse_error");  // OX[
-					}
-					blacklen += len;
-				}
-				for (ii = 0; ii < blacklen; ii++) {
-					bout->writebit (1);
-				}
-				totlen += blacklen;
+	Nout = (unsigned long)(width + 7) / 8 * height;
+	if (Nout > size) {
+		Nout = size;
+	}
+	BSTREAM bout (out, Nout, BIG_ENDIAN);
+	trees = CCITTTREES::get ();
+	if (!trees) {
+		return -1;
+	}
+	whitetree = trees->white;
+	blacktree = trees->black;
 
+	//debug(whitetree, 0);
+	if (eol) {
+		len = whitetree->gethuffmansymbol (&bs);
+	}
+	for (i = 0; i < height; i++) {
+		totlen = 0;
+		while (totlen < width) {
+			len = whitetree->gethuffmansymbol (&bs);
+			if (len == -1) {
+				return -1;
+			}
+			if (len == -2) {
+				whitelen = width - totlen;
+			}
+			else {
+				whitelen = len;
+			}
+			while (len >= 64) {
+				len = whitetree->gethuffmansymbol (&bs);
+				if (len == EOL || len == -1 || totlen + len + whitelen > width) {
+					return -1;
+				}
+				whitelen += len;
+			}
+			for (ii = 0; ii < whitelen; ii++) {
+				bout.writebit (0);
+			}
+			totlen += whitelen;
+			if (totlen >= width) {
+				break;
 			}
-			//synch_to_byte(bs);
-			if (width & 0x07) {
-				for (ii = 0; ii < 8 - (width & 0x07); ii++) {
-					bout->writebit (0);
+			len = blacktree->gethuffmansymbol (&bs);
+			if (len < 0) {
+				return -1;
+			}
+			blacklen = len;
+			while (len >= 64) {
+				len = blacktree->gethuffmansymbol (&bs);
+				if (len == EOL || len == -1 || totlen + len + blacklen > width) {
+					return -1;
 				}
+				blacklen += len;
 			}
-			if (eol) {
-				whitetree->gethuffmansymbol (bs);
+			for (ii = 0; ii < blacklen; ii++) {
+				bout.writebit (1);
 			}
-			///synch_to_byte(bs);
+			totlen += blacklen;
+
 		}
-		*Nret = Nout;
-		delete whitetree;
-		delete blacktree;
-		delete bs;
-		delete bout;
-		return answer;
-	}
-	catch (general_exception) {
-		// parse_error:
-		// out_of_memory:
-		delete whitetree;
-		delete blacktree;
-		delete bs;
-		delete bout;
-		delete[] answer;
-		return 0;
+		//synch_to_byte(bs);
+		if (width & 0x07) {
+			for (ii = 0; ii < 8 - (width & 0x07); ii++) {
+				bout.writebit (0);
+			}
+		}
+		if (eol) {
+			whitetree->gethuffmansymbol (&bs);
+		}
+		///synch_to_byte(bs);
 	}
+	*Nret = Nout;
+	return 0;
 }
 
-BYTE* ccittgroup4decompress (BYTE* in, unsigned long count, unsigned long* Nret, int width, int height, int eol)
+/// <summary>
+/// group 4 decode loop, the bit order is fixed by the reader type
+/// </summary>
+template <class READER> static int ccittgroup4decode (READER* bs, BYTE* out, unsigned long size, unsigned long* Nret, int width, int height, int eol, CCITTSTATE* state)
 {
-	BYTE* reference = NULL;
-	BYTE* current = NULL;
+	BYTE* reference;
+	BYTE* current;
 	BYTE* temp;
 	int i;
 	int a0;
@@ -2175,373 +4432,360 @@ BYTE* ccittgroup4decompress (BYTE* in, unsigned long count, unsigned long* Nret,
 	int a1span, a2span;
 	int seg;
 	int b1, b2;
-	HUFFNODE* twodtree = 0;
-	HUFFNODE* whitetree = 0;
-	HUFFNODE* blacktree = 0;
-	BSTREAM* bs = 0;
-	BSTREAM* bout = 0;
+	const HUFFNODE* twodtree = 0;
+	const HUFFNODE* whitetree = 0;
+	const HUFFNODE* blacktree = 0;
+	const CCITTTREES* trees;
 	unsigned long Nout;
-	BYTE* answer = NULL;
-	int err = 0;
 	CCITT mode;
 	int colour;
 
-	try {
-		Nout = (width + 7) / 8 * height;
-		answer = new BYTE[Nout];
-		if (!answer) {
-			throw general_exception ("out_of_memory");  // OX[	
-		}
-		//debug memset
-		memset (answer, 0, Nout);
-		bout = new BSTREAM (answer, Nout, BIG_ENDIAN);
-		if (!bout) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		bs = new BSTREAM (in, count, eol ? LITTLE_ENDIAN : BIG_ENDIAN);
-		if (!bs) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
-		for (i = 0; i < 105; i++) {
-			whitetree = HUFFNODE::addhuffmansymbol (whitetree, ccitttable[i].whitecode, ccitttable[i].whitelen, &err);
-		}
-		for (i = 0; i < 105; i++) {
-			blacktree = HUFFNODE::addhuffmansymbol (blacktree, ccitttable[i].blackcode, ccitttable[i].blacklen, &err);
-		}
-		for (i = 0; i < 11; i++) {
-			twodtree = HUFFNODE::addhuffmansymbol (twodtree, ccitt2dtable[i].code, static_cast<int>(ccitt2dtable[i].symbol), &err);
-		}
-		if (err) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
+	Nout = (unsigned long)(width + 7) / 8 * height;
+	if (Nout > size) {
+		Nout = size;
+	}
+	// lines a damaged strip doesn't reach are left white, what was
+	// decoded before the damage is kept
+	memset (out, 0, Nout);
+	BSTREAM bout (out, Nout, BIG_ENDIAN);
+	trees = CCITTTREES::get ();
+	if (!trees) {
+		return -1;
+	}
+	whitetree = trees->white;
+	blacktree = trees->black;
+	twodtree = trees->twod;
 
-		reference = new BYTE[width];
-		for (i = 0; i < width; i++) {
-			reference[i] = 0;
-		}
-		current = new BYTE[width];
-		if (!current || !reference) {
-			throw general_exception ("out_of_memory");  // OX[
-		}
+	if (!state->lines (width)) {
+		return -1;
+	}
+	reference = state->reference;
+	current = state->current;
+	memset (reference, 0, width);
 
 
-		if (eol) {
-			//int len = 0;
+	if (eol) {
+		//int len = 0;
 
-			while (bs->getbit () == 0) {
-				continue;
-			}
+		while (bs->getbit () == 0) {
+			continue;
 		}
+	}
 
-		for (i = 0; i < height; i++) {
-			a0 = -1;
-			colour = 0;
-			while (a0 < width) {
-				b1 = a0 + 1;
-				while (b1 < width) {
-					if (reference[b1] != colour && (b1 == 0 || reference[b1] != reference[b1 - 1])) {
-						break;
-					}
-					b1++;
-				}
-				for (b2 = b1; b2 < width && reference[b2] == reference[b1]; b2++) {
+	for (i = 0; i < height; i++) {
+		a0 = -1;
+		colour = 0;
+		while (a0 < width) {
+			b1 = a0 + 1;
+			while (b1 < width) {
+				if (reference[b1] != colour && (b1 == 0 || reference[b1] != reference[b1 - 1])) {
+					break;
 				}
+				b1++;
+			}
+			for (b2 = b1; b2 < width && reference[b2] == reference[b1]; b2++) {
+			}
 
-				if (a0 == -1) {
-					a0 = 0;
-				}
+			if (a0 == -1) {
+				a0 = 0;
+			}
 
-				mode = static_cast<CCITT>(twodtree->gethuffmansymbol (bs));
+			mode = static_cast<CCITT>(twodtree->gethuffmansymbol (bs));
 
-				a2 = -1;
-				switch (mode) {
-				case CCITT::CCITT_PASS:
-					a1 = b2;
-					break;
-				case CCITT::CCITT_HORIZONTAL:
-					a1span = 0;
-					a2span = 0;
-					if (colour == 0) {
-						do {
-							seg = whitetree->gethuffmansymbol (bs);
-							a1span += seg;
-						} while (seg >= 64 && a0 + a1span <= width);
-
-						do {
-							seg = blacktree->gethuffmansymbol (bs);
-							a2span += seg;
-						} while (seg >= 64 && a0 + a1span <= width);
-					}
-					else {
-						do {
-							seg = blacktree->gethuffmansymbol (bs);
-							a1span += seg;
-						} while (seg >= 64 && a0 + a1span <= width);
-
-						do {
-							seg = whitetree->gethuffmansymbol (bs);
-							a2span += seg;
-						} while (seg >= 64 && a0 + a1span + a2span <= width);
-					}
-					a1 = a0 + a1span;
-					a2 = a1 + a2span;
-					if (a1 > width) {
-						//printf("Bad span1 %d span2 %d here\n", a1span, a2span);
-						throw general_exception ("parse_error");  // OX[
-					}
-					break;
-				case CCITT::CCITT_VERTICAL_0:
-					a1 = b1;
-					break;
-				case CCITT::CCITT_VERTICAL_R1:
-					a1 = b1 + 1;
-					break;
-				case CCITT::CCITT_VERTICAL_R2:
-					a1 = b1 + 2;
-					break;
-				case CCITT::CCITT_VERTICAL_R3:
-					a1 = b1 + 3;
-					break;
-				case CCITT::CCITT_VERTICAL_L1:
-					a1 = b1 - 1;
-					break;
-				case CCITT::CCITT_VERTICAL_L2:
-					a1 = b1 - 2;
-					break;
-				case CCITT::CCITT_VERTICAL_L3:
-					a1 = b1 - 3;
-					break;
-				case CCITT::CCITT_ENDOFFAXBLOCK:
-					*Nret = Nout;
-					delete twodtree;
-					delete whitetree;
-					delete blacktree;
-					delete[] reference;
-					delete[] current;
-					return answer;
-				default:
-					throw general_exception ("parse_error");  // OX[
+			a2 = -1;
+			switch (mode) {
+			case CCITT::CCITT_PASS:
+				a1 = b2;
+				break;
+			case CCITT::CCITT_HORIZONTAL:
+				a1span = 0;
+				a2span = 0;
+				if (colour == 0) {
+					do {
+						seg = whitetree->gethuffmansymbol (bs);
+						a1span += seg;
+					} while (seg >= 64 && a0 + a1span <= width);
+
+					do {
+						seg = blacktree->gethuffmansymbol (bs);
+						a2span += seg;
+					} while (seg >= 64 && a0 + a1span <= width);
 				}
-
-				if (a1 <= a0 && a0 != 0) {
-					throw general_exception ("parse_error");  // OX[
+				else {
+					do {
+						seg = blacktree->gethuffmansymbol (bs);
+						a1span += seg;
+					} while (seg >= 64 && a0 + a1span <= width);
+
+					do {
+						seg = whitetree->gethuffmansymbol (bs);
+						a2span += seg;
+					} while (seg >= 64 && a0 + a1span + a2span <= width);
 				}
-				if (a0 < 0 || a1 < 0) {
-					throw general_exception ("parse_error");  // OX[
+				a1 = a0 + a1span;
+				a2 = a1 + a2span;
+				if (a1 > width) {
+					//printf("Bad span1 %d span2 %d here\n", a1span, a2span);
+					*Nret = Nout;
+					return 0;
 				}
-				while (a0 < a1 && a0 < width) {
+				break;
+			case CCITT::CCITT_VERTICAL_0:
+				a1 = b1;
+				break;
+			case CCITT::CCITT_VERTICAL_R1:
+				a1 = b1 + 1;
+				break;
+			case CCITT::CCITT_VERTICAL_R2:
+				a1 = b1 + 2;
+				break;
+			case CCITT::CCITT_VERTICAL_R3:
+				a1 = b1 + 3;
+				break;
+			case CCITT::CCITT_VERTICAL_L1:
+				a1 = b1 - 1;
+				break;
+			case CCITT::CCITT_VERTICAL_L2:
+				a1 = b1 - 2;
+				break;
+			case CCITT::CCITT_VERTICAL_L3:
+				a1 = b1 - 3;
+				break;
+			case CCITT::CCITT_ENDOFFAXBLOCK:
+				*Nret = Nout;
+				return 0;
+			default:
+				*Nret = Nout;
+				return 0;
+			}
+
+			if (a1 <= a0 && a0 != 0) {
+				*Nret = Nout;
+				return 0;
+			}
+			if (a0 < 0 || a1 < 0) {
+				*Nret = Nout;
+				return 0;
+			}
+			while (a0 < a1 && a0 < width) {
+				current[a0++] = colour;
+				bout.writebit (colour);
+			}
+			if (mode != CCITT::CCITT_PASS) {
+				colour ^= 1;
+			}
+			if (a1 >= 0) {
+				a0 = a1;
+			}
+			if (a2 != -1) {
+				while (a0 < a2 && a0 < width) {
 					current[a0++] = colour;
-					bout->writebit (colour);
-				}
-				if (mode != CCITT::CCITT_PASS) {
-					colour ^= 1;
-				}
-				if (a1 >= 0) {
-					a0 = a1;
-				}
-				if (a2 != -1) {
-					while (a0 < a2 && a0 < width) {
-						current[a0++] = colour;
-						bout->writebit (colour);
-					}
-					colour ^= 1;
+					bout.writebit (colour);
 				}
+				colour ^= 1;
 			}
-			if (eol) {
-				while (bs->getbit () == 0) {
-					continue;
-				}
+		}
+		if (eol) {
+			while (bs->getbit () == 0) {
+				continue;
 			}
-			temp = reference;
-			reference = current;
-			current = temp;
-			if (width % 8) {
-				while (a0 % 8) {
-					bout->writebit (0);
-					a0++;
-				}
+		}
+		temp = reference;
+		reference = current;
+		current = temp;
+		if (width % 8) {
+			while (a0 % 8) {
+				bout.writebit (0);
+				a0++;
 			}
-
 		}
-		*Nret = Nout;
-		delete twodtree;
-		delete whitetree;
-		delete blacktree;
-		delete[] reference;
-		delete[] current;
-		return answer;
+
 	}
-	catch (general_exception e) {
-		if (strcmp (e.what (), "parse_error") == 0) {
-			*Nret = Nout;
-			return answer;
-		}
-		else if (strcmp (e.what (), "out_of_memory") == 0) {
-			return NULL;
+	*Nret = Nout;
+	return 0;
+}
+
+/// <summary>
+/// CCITT T.6 (Compression = 4)
+/// </summary>
+/// <param name="in">the coded strip</param>
+/// <param name="count">bytes in</param>
+/// <param name="out">output</param>
+/// <param name="size">bytes of out</param>
+/// <param name="Nret">return for bytes decoded</param>
+/// <param name="width"></param>
+/// <param name="height"></param>
+/// <param name="eol">lines end with EOL codes, LSB first</param>
+/// <param name="state">the thread's line buffers</param>
+/// <returns>0 on success, -1 on fail</returns>
+int ccittgroup4decompress (const BYTE* in, unsigned long count, BYTE* out, unsigned long size, unsigned long* Nret, int width, int height, int eol, CCITTSTATE* state)
+{
+	if (eol) {
+		LSBREADER bs (in, count);
+		return ccittgroup4decode (&bs, out, size, Nret, width, height, eol, state);
+	}
+	MSBREADER bs (in, count);
+	return ccittgroup4decode (&bs, out, size, Nret, width, height, eol, state);
+}
+
+/// <summary>
+/// write the string for a code, backwards from its last byte
+/// </summary>
+/// <param name="table">string table</param>
+/// <param name="code">the code</param>
+/// <param name="dst">where the string starts</param>
+/// <param name="len">length of the string</param>
+/// <param name="room">bytes free at dst, the rest of the string is dropped</param>
+/// <returns>first byte of the string</returns>
+static inline int lzw_string (const ENTRY* table, int code, BYTE* dst, unsigned long len, unsigned long room)
+{
+	int ch = 0;
+
+	for (auto i = len; i-- > 0;) {
+		ch = table[code].suffix;
+		if (i < room) {
+			dst[i] = (BYTE)ch;
 		}
+		code = table[code].prefix;
 	}
-	return NULL;
+	return ch;
 }
 
-/*
-load the raster data
-Params: out - return pointer for raster data, 0 for size run
-fp - pointer to an open file
-Nret - number of bytes read
-Returns: 0 on success, -1 on fail.
-*/
-int loadlzw (BYTE* out, FileData* fd, unsigned long count, unsigned long* Nret)
+/// <summary>
+/// LZW code loop, shared by both bit orders
+/// </summary>
+/// <param name="bs">reader positioned after the leading clear code</param>
+/// <param name="out">output</param>
+/// <param name="size">bytes of out, decoding stops when it is full</param>
+/// <param name="table">string table with the single byte entries set</param>
+/// <param name="early">1 for early change (MSB first streams), 0 for old style LSB first</param>
+/// <param name="Nret">return for the number of bytes decoded</param>
+/// <returns>0 on success, -1 on a bad code</returns>
+template <class READER> static int lzw_run (READER* bs, BYTE* out, unsigned long size, ENTRY* table, int early, unsigned long* Nret)
 {
-	int codesize;
-	//int block;
-	int clear;
-	int end;
-	int nextcode;
-	int codelen;
-	BYTE* stream = 0;
-	//int blen = 0;
-	BSTREAM* bs;
-	ENTRY* table = NULL;
-	int pos = 0;
-	int len;
+	const int codesize = 8;
+	const int clear = 1 << codesize;
+	const int end = clear + 1;
+	int nextcode = end + 1;
+	int codelen = codesize + 1;
+	int first = clear;
 	int second;
-	int first;
-	int tempcode;
+	unsigned long len;
 	int ch;
+	unsigned long pos = 0;
 
+	*Nret = 0;
+	while (first == clear) {
+		first = bs->getbits (codelen);
+	}
+	if (first == end || first < 0 || size == 0) {
+		return 0;
+	}
+	if (first > end) {
+		return -1;
+	}
+	ch = first;
+	out[pos++] = (BYTE)ch;
 
-	codesize = 8;
-
-	clear = 1 << codesize;
-	end = clear + 1;
-	nextcode = end + 1;
-	codelen = codesize + 1;
-	try {
-		stream = new BYTE[count];
-		if (!stream) {
-			return -1;
+	while (pos < size) {
+		second = bs->getbits (codelen);
+		if (second < 0) {
+			// no end code, keep what there is
+			break;
 		}
-		//fread(stream, count, 1, fp);
-		fd->memcpy (stream, count);
-		//memcpy(stream, fd->buffer + fd->buffer_ptr, count);
-		//fd->buffer_ptr += count;
-
-		table = new ENTRY[(1 << 12)];
+		if (second == clear) {
+			nextcode = end + 1;
+			codelen = codesize + 1;
+			first = bs->getbits (codelen);
 
-		for (auto ii = 0; ii < nextcode; ii++) {
-			table[ii].prefix = 0;
-			table[ii].len = 1;
-			table[ii].suffix = ii;
+			while (first == clear)
+				first = bs->getbits (codelen);
+			if (first == end || first < 0)
+				break;
+			if (first > end) {
+				return -1;
+			}
+			ch = first;
+			out[pos++] = (BYTE)first;
+			continue;
+		}
+		if (second == end) {
+			break;
+		}
+		if (second > nextcode) {
+			return -1;
 		}
-		bs = new BSTREAM (stream, count, BIG_ENDIAN);
 
-		first = bs->getbits (codelen);
-		if (first != clear) {
-			delete bs;
-			bs = new BSTREAM (stream, count, LITTLE_ENDIAN);
-			first = bs->getbits (codelen);
-			if (first != clear) {
-				throw general_exception ("parse_error");  // OX[
+		if (second == nextcode) {
+			// the string for first and its own first byte
+			len = table[first].len;
+			lzw_string (table, first, out + pos, len, size - pos);
+			if (len < size - pos) {
+				out[pos + len] = (BYTE)ch;
 			}
+			pos += len + 1;
 		}
-		while (first == clear) {
-			first = bs->getbits (codelen);
+		else {
+			len = table[second].len;
+			ch = lzw_string (table, second, out + pos, len, size - pos);
+			pos += len;
 		}
-		ch = first;
-		if (out) {
-			out[0] = ch;
+		if (pos > size) {
+			pos = size;
 		}
-		pos = 1;
 
-		while (1) {
-			second = bs->getbits (codelen);
-			if (second < 0) {
-				throw general_exception ("parse_error");  // OX[
-			}
-			if (second == clear) {
-				nextcode = end + 1;
-				codelen = codesize + 1;
-				first = bs->getbits (codelen);
+		if (nextcode < 4096) {
+			table[nextcode].prefix = first;
+			table[nextcode].len = table[first].len + 1;
+			table[nextcode].suffix = ch;
 
-				while (first == clear)
-					first = bs->getbits (codelen);
-				if (first == end)
-					break;
-				ch = first;
-				if (out) {
-					out[pos++] = first;
-				}
-				else {
-					pos++;
-				}
-				continue;
-			}
-			if (second == end) {
-				break;
-			}
+			nextcode++;
+			if (nextcode == (1 << codelen) - early) {
+				codelen++;
 
-			if (second >= nextcode) {
-				len = table[first].len;
-				// if (len + pos >= width * height)
-				// break;
-				tempcode = first;
-				for (auto ii = 0; ii < len; ii++) {
-					if (out) {
-						out[pos + len - ii - 1] = (BYTE)table[tempcode].suffix;
-					}
-					tempcode = table[tempcode].prefix;
-				}
-				if (out) {
-					out[pos + len] = (BYTE)ch;
-				}
-				pos += len + 1;
-			}
-			else {
-				len = table[second].len;
-				// if (pos + len > width * height)
-				// break;
-				tempcode = second;
-
-				for (auto ii = 0; ii < len; ii++) {
-					ch = table[tempcode].suffix;
-					if (out) {
-						out[pos + len - ii - 1] = (BYTE)table[tempcode].suffix;
-					}
-					tempcode = table[tempcode].prefix;
+				if (codelen == 13) {
+					codelen = 12;
 				}
-				pos += len;
 			}
+		}
 
-			if (nextcode < 4096) {
-				table[nextcode].prefix = first;
-				table[nextcode].len = table[first].len + 1;
-				table[nextcode].suffix = ch;
-
-				nextcode++;
-				if (nextcode == (1 << codelen) - ((bs->endianness == BIG_ENDIAN) ? 1 : 0)) {
-					codelen++;
+		first = second;
+	}
+	*Nret = pos;
+	return 0;
+}
 
-					if (codelen == 13) {
-						codelen = 12;
-					}
-				}
-			}
+/*
+load the raster data
+Params: in, count - the compressed strip or tile
+out, size - return buffer for raster data, decoding stops when it is full
+state - the thread's string table
+Nret - number of bytes decoded
+Returns: 0 on success, -1 on fail.
+*/
+int loadlzw (const BYTE* in, unsigned long count, BYTE* out, unsigned long size, LZWSTATE* state, unsigned long* Nret)
+{
+	int codesize;
+	int clear;
+	ENTRY* table = state->table;
+	int first;
 
-			first = second;
-		}
 
+	codesize = 8;
 
-		delete[] table;
-		delete[] stream;
-		*Nret = pos;
-		return 0;
-	}
-	catch (general_exception) {
+	clear = 1 << codesize;
+	MSBREADER msb (in, count);
+	first = msb.getbits (codesize + 1);
+	if (first == clear) {
+		return lzw_run (&msb, out, size, table, 1, Nret);
+	}
+	LSBREADER lsb (in, count);
+	first = lsb.getbits (codesize + 1);
+	if (first != clear) {
 		//parse_error:
-		delete[] table;
-		delete[] stream;
 		return -1;
 	}
+	return lzw_run (&lsb, out, size, table, 0, Nret);
 }
 
 /// <summary>
@@ -2646,7 +4890,9 @@ int tiffsizeof (TAG_TYPE datatype)
 	case TAG_TYPE::TAG_ASCII: return 1;
 	case TAG_TYPE::TAG_SHORT: return 2;
 	case TAG_TYPE::TAG_LONG: return 4;
+	case TAG_TYPE::TAG_IFD: return 4;
 	case TAG_TYPE::TAG_RATIONAL: return 8;
+	case TAG_TYPE::TAG_UNDEFINED: return 1;
 	default:
 		return 1;
 	}
@@ -2741,7 +4987,7 @@ int load_tags (TAG* tag, FileData* fd)
 
 	try {
 
-		tag->tagid = static_cast<TID>(fd->fget16 ());
+		tag->tagid = static_cast<TID>(fd->fget16u ());
 		tag->datatype = static_cast<TAG_TYPE>(fd->fget16 ());
 		tag->datacount = fd->fget32 ();
 		tag->vector = 0;
@@ -2753,6 +4999,7 @@ int load_tags (TAG* tag, FileData* fd)
 		if (tag->datacount == 1) {
 			switch (tag->datatype) {
 			case TAG_TYPE::TAG_BYTE:
+			case TAG_TYPE::TAG_UNDEFINED:
 				tag->scalar = (double)fd->fgetcc ();
 				fd->fgetcc ();
 				fd->fgetcc ();
@@ -2778,6 +5025,7 @@ int load_tags (TAG* tag, FileData* fd)
 				fd->fgetcc ();
 				break;
 			case TAG_TYPE::TAG_LONG:
+			case TAG_TYPE::TAG_IFD:
 				tag->scalar = (double)fd->fget32u ();
 				break;
 			case TAG_TYPE::TAG_RATIONAL:
@@ -2802,6 +5050,10 @@ int load_tags (TAG* tag, FileData* fd)
 		else {
 			if (datasize > 4) {
 				offset = fd->fget32 ();
+				// the whole vector has to be in the file, checked once here
+				if (tag->datacount > (unsigned long)fd->size || datasize > (unsigned long)fd->size || offset > (unsigned long)fd->size - datasize) {
+					throw general_exception ("parse_error");  // OX[
+				}
 				//pos = ftell(fp);
 				pos = fd->buffer_ptr;
 				//fseek(fp, offset, SEEK_SET);
@@ -2809,6 +5061,7 @@ int load_tags (TAG* tag, FileData* fd)
 			}
 			switch (tag->datatype) {
 			case TAG_TYPE::TAG_BYTE:
+			case TAG_TYPE::TAG_UNDEFINED:
 				tag->vector = new char[datasize];
 				if (!tag->vector) {
 					throw general_exception ("out_of_memory");  // OX[
@@ -2817,6 +5070,10 @@ int load_tags (TAG* tag, FileData* fd)
 				fd->memcpy (tag->vector, datasize);
 				//memcpy(tag->vector, fd->buffer + fd->buffer_ptr, datasize);
 				//fd->buffer_ptr += datasize;
+				// short data sits in the value field, step over the rest of it
+				for (auto i = datasize; i < 4; i++) {
+					fd->fgetcc ();
+				}
 				break;
 			case TAG_TYPE::TAG_ASCII:
 				tag->ascii = fread_asciiz (fd);
@@ -2833,6 +5090,7 @@ int load_tags (TAG* tag, FileData* fd)
 					(static_cast<unsigned short*>(tag->vector))[i] = fd->fget16u ();
 				break;
 			case TAG_TYPE::TAG_LONG:
+			case TAG_TYPE::TAG_IFD:
 				tag->vector = new char[tag->datacount * sizeof (long)];
 				if (!tag->vector) {
 					throw general_exception ("out_of_memory");  // OX[	
@@ -2899,12 +5157,14 @@ double tag_get_entry (TAG* tag, unsigned long index)
 	}
 	switch (tag->datatype) {
 	case TAG_TYPE::TAG_BYTE:
+	case TAG_TYPE::TAG_UNDEFINED:
 		return (double)(static_cast<BYTE*>(tag->vector))[index];
 	case TAG_TYPE::TAG_ASCII:
 		return (double)(static_cast<char*>(tag->vector))[index];
 	case TAG_TYPE::TAG_SHORT:
 		return (double)(static_cast<unsigned short*>(tag->vector))[index];
 	case TAG_TYPE::TAG_LONG:
+	case TAG_TYPE::TAG_IFD:
 		return (double)(static_cast<unsigned long*>(tag->vector))[index];
 	case TAG_TYPE::TAG_RATIONAL:
 		return static_cast<double*>(tag->vector)[index];
@@ -3348,7 +5608,7 @@ typedef struct LodePNGDecompressSettings
 } LodePNGDecompressSettings;
 #endif
 
-#define ERROR_BREAK(c) exit(0)
+#define ERROR_BREAK(c) { error = c; break; }
 
 //#define FIRST_LENGTH_CODE_INDEX 257
 //#define LAST_LENGTH_CODE_INDEX 285
@@ -3394,6 +5654,7 @@ public:
 	unsigned* lengths; /*the lengths of the codes of the 1d-tree*/
 	unsigned maxbitlen; /*maximum number of bits a single code can get*/
 	unsigned numcodes; /*number of symbols in the alphabet = number of codes*/
+	unsigned allocated; /*number of codes the arrays have room for, they are kept when the tree is rebuilt*/
 	//void HuffmanTree_init (HuffmanTree* tree);
 	//void HuffmanTree_cleanup (HuffmanTree* tree)
 	/// <summary>
@@ -3406,6 +5667,7 @@ public:
 		this->lengths = NULL;
 		maxbitlen = 0;
 		numcodes = 0;
+		allocated = 0;
 	}
 
 	/// <summary>
@@ -3434,12 +5696,12 @@ public:
 };
 
 
-unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d, const BYTE* in, size_t* bp, size_t inlength);
+unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d, HuffmanTree* tree_cl, const BYTE* in, size_t* bp, size_t inlength);
 unsigned generateFixedLitLenTree (HuffmanTree* tree);
 unsigned generateFixedDistanceTree (HuffmanTree* tree);
 
 ;
-void getTreeInflateFixed (HuffmanTree* tree_ll, HuffmanTree* tree_d);
+unsigned getTreeInflateFixed (const HuffmanTree** tree_ll, const HuffmanTree** tree_d);
 unsigned huffmanTree_make2DTree (HuffmanTree* tree);
 unsigned huffmanTree_make_from_lengths (HuffmanTree* tree, const unsigned* bitlen, size_t numcodes, unsigned maxbitlen);
 unsigned huffman_decode_symbol (const BYTE* in, size_t* bp, const HuffmanTree* codetree, size_t inbitlength);
@@ -3489,7 +5751,9 @@ public:
 			void* new_data = new char[new_size] {};
 			if (new_data) {
 				// ̈悩Rs[
-				memcpy (data, this->data, this->allocsize);
+				if (this->data) {
+					memcpy (new_data, this->data, this->allocsize);
+				}
 				// ̈폜
 				delete[] this->data;
 				this->allocsize = new_size;
@@ -3566,18 +5830,29 @@ public:
 	/// <param name="pos"></param>
 	/// <param name="inlength"></param>
 	/// <param name="btype"></param>
+	/// <param name="dynamic_ll">rebuilt for a dynamic block</param>
+	/// <param name="dynamic_d">rebuilt for a dynamic block</param>
+	/// <param name="dynamic_cl">scratch for a dynamic block</param>
 	/// <returns></returns>
-	unsigned inflateHuffmanBlock (const BYTE* in, size_t* bp, size_t* pos, size_t inlength, unsigned btype)
+	unsigned inflateHuffmanBlock (const BYTE* in, size_t* bp, size_t* pos, size_t inlength, unsigned btype,
+		HuffmanTree* dynamic_ll, HuffmanTree* dynamic_d, HuffmanTree* dynamic_cl)
 	{
 		unsigned error = 0;
-		HuffmanTree* tree_ll = new HuffmanTree (); /*the huffman tree for literal and length codes*/
-		HuffmanTree* tree_d = new HuffmanTree (); /*the huffman tree for distance codes*/
+		const HuffmanTree* tree_ll = NULL; /*the huffman tree for literal and length codes*/
+		const HuffmanTree* tree_d = NULL; /*the huffman tree for distance codes*/
 		size_t inbitlength = inlength * 8;
 
 
-		if (btype == 1) getTreeInflateFixed (tree_ll, tree_d);
+		if (btype == 1) {
+			error = getTreeInflateFixed (&tree_ll, &tree_d);
+		}
 		else if (btype == 2) {
-			error = getTreeInflateDynamic (tree_ll, tree_d, in, bp, inlength);
+			error = getTreeInflateDynamic (dynamic_ll, dynamic_d, dynamic_cl, in, bp, inlength);
+			tree_ll = dynamic_ll;
+			tree_d = dynamic_d;
+		}
+		else {
+			error = 20; /*invalid block type*/
 		}
 
 		while (!error) /*decode all symbols until end reached, breaks at end code*/
@@ -3665,19 +5940,29 @@ public:
 			}
 		}
 
-		delete tree_ll;
-		delete tree_d;
-
 		return error;
 	}
 };
 
+/// <summary>
+/// the dynamic block trees and output buffer of a thread's inflater,
+/// rebuilt and refilled in place by every stream
+/// </summary>
+class INFLATESTATE : public CODECSTATE
+{
+public:
+	HuffmanTree ll; /*literal and length codes*/
+	HuffmanTree d; /*distance codes*/
+	HuffmanTree cl; /*code length codes*/
+	ucvector out;
+};
+
 
 
 
-unsigned lodepng_inflate (BYTE** out, size_t* outsize, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings);
+unsigned lodepng_inflate (INFLATESTATE* state, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings);
 
-unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings);
+unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings, INFLATESTATE* state);
 
 
 /// <summary>
@@ -3742,7 +6027,9 @@ public:
 			void* new_data = new char[new_size];
 			if (new_data) {
 				// ̈悩Rs[
-				memcpy (data, this->data, this->allocsize);
+				if (this->data) {
+					memcpy (new_data, this->data, this->allocsize);
+				}
 				// 폜
 				delete[] this->data;
 				this->allocsize = new_size;
@@ -3763,16 +6050,37 @@ public:
 };
 
 
-/*get the tree of a deflated block with fixed tree, as specified in the deflate specification*/
-void getTreeInflateFixed (HuffmanTree* tree_ll, HuffmanTree* tree_d)
+/// <summary>
+/// the fixed trees of deflate, identical for every block
+/// </summary>
+class FIXEDTREES
+{
+public:
+	HuffmanTree litlen;
+	HuffmanTree distance;
+	unsigned error;
+	FIXEDTREES ()
+	{
+		error = generateFixedLitLenTree (&litlen);
+		if (!error) {
+			error = generateFixedDistanceTree (&distance);
+		}
+	}
+};
+
+/*get the tree of a deflated block with fixed tree, as specified in the deflate specification.
+The trees are built once, on first use, and then shared read only by every thread.*/
+unsigned getTreeInflateFixed (const HuffmanTree** tree_ll, const HuffmanTree** tree_d)
 {
-	/*TODO: check for out of memory errors*/
-	generateFixedLitLenTree (tree_ll);
-	generateFixedDistanceTree (tree_d);
+	static const FIXEDTREES trees;  // initialisation is thread safe
+	*tree_ll = &trees.litlen;
+	*tree_d = &trees.distance;
+	return trees.error;
 }
 
-/*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree*/
-unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d,
+/*get the tree of a deflated block with dynamic tree, the tree itself is also Huffman compressed with a known tree.
+tree_cl is scratch for the code length codes; all three trees are rebuilt in place*/
+unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d, HuffmanTree* tree_cl,
 								const BYTE* in, size_t* bp, size_t inlength)
 {
 	/*make sure that length values that aren't filled in will be 0, or a wrong tree will be generated*/
@@ -3781,11 +6089,10 @@ unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d,
 	size_t inbitlength = inlength * 8;
 
 	/*see comments in deflateDynamic for explanation of the context and these variables, it is analogous*/
-	unsigned* bitlen_ll = 0; /*lit,len code lengths*/
-	unsigned* bitlen_d = 0; /*dist code lengths*/
+	unsigned bitlen_ll[NUM_DEFLATE_CODE_SYMBOLS]; /*lit,len code lengths*/
+	unsigned bitlen_d[NUM_DISTANCE_SYMBOLS]; /*dist code lengths*/
 	/*code length code lengths ("clcl"), the bit lengths of the huffman tree used to compress bitlen_ll and bitlen_d*/
-	unsigned* bitlen_cl = 0;
-	HuffmanTree* tree_cl = new HuffmanTree (); /*the code tree for code length codes (the huffman tree for compressed huffman trees)*/
+	unsigned bitlen_cl[NUM_CODE_LENGTH_CODES];
 
 	if ((*bp) >> 3 >= inlength - 2) return 49; /*error: the bit pointer is or will go past the memory*/
 
@@ -3799,11 +6106,6 @@ unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d,
 	while (!error) {
 		/*read the code length codes out of 3 * (amount of code length codes) bits*/
 
-		bitlen_cl = new unsigned[NUM_CODE_LENGTH_CODES];
-		if (!bitlen_cl) {
-			ERROR_BREAK (83 /*alloc fail*/);
-		}
-
 		for (i = 0; i < NUM_CODE_LENGTH_CODES; i++) {
 			if (i < HCLEN) bitlen_cl[CLCL_ORDER[i]] = readBitsFromStream (bp, in, 3);
 			else bitlen_cl[CLCL_ORDER[i]] = 0; /*if not, it must stay 0*/
@@ -3813,11 +6115,6 @@ unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d,
 		if (error) break;
 
 		/*now we can use this tree to read the lengths for the tree that this function will return*/
-		bitlen_ll = new unsigned[NUM_DEFLATE_CODE_SYMBOLS];
-		bitlen_d = new unsigned[NUM_DISTANCE_SYMBOLS];
-		if (!bitlen_ll || !bitlen_d) {
-			ERROR_BREAK (83 /*alloc fail*/);
-		}
 		for (i = 0; i < NUM_DEFLATE_CODE_SYMBOLS; i++) {
 			bitlen_ll[i] = 0;
 		}
@@ -3938,11 +6235,6 @@ unsigned getTreeInflateDynamic (HuffmanTree* tree_ll, HuffmanTree* tree_d,
 		break; /*end of error-while*/
 	}
 
-	delete[] bitlen_cl;
-	delete[] bitlen_ll;
-	delete[] bitlen_d;
-	delete tree_cl;
-
 	return error;
 }
 
@@ -3996,11 +6288,6 @@ unsigned huffmanTree_make2DTree (HuffmanTree* tree)
 	unsigned treepos = 0; /*position in the tree (1 of the numcodes columns)*/
 	unsigned n, i;
 
-	tree->tree2d = new unsigned int[tree->numcodes * 2];
-	if (!tree->tree2d) {
-		return 83; /*alloc fail*/
-	}
-
 	/*
 	convert tree1d[] to tree2d[][]. In the 2D array, a value of 32767 means
 	uninited, a value >= numcodes is an address to another bit, a value < numcodes
@@ -4057,42 +6344,31 @@ unsigned huffmanTree_make2DTree (HuffmanTree* tree)
 /// <returns></returns>
 unsigned huffmanTree_make_from_lengths2 (HuffmanTree* tree)
 {
-	uivector* blcount = new uivector ();
-	uivector* nextcode = new uivector ();;
+	unsigned blcount[16] = {};
+	unsigned nextcode[16] = {};
 	unsigned error = 0;
 
-	//uivector_init (&blcount);
-	//uivector_init (&nextcode);
-
-	tree->tree1d = new unsigned[tree->numcodes];
-	if (!tree->tree1d) {
-		error = 83; /*alloc fail*/
-	}
-
-	if (!blcount->uivector_resizev (tree->maxbitlen + 1, 0) || !nextcode->uivector_resizev (tree->maxbitlen + 1, 0)) {
+	if (tree->maxbitlen > 15) {
 		error = 83; /*alloc fail*/
 	}
 
 	if (!error) {
 		/*step 1: count number of instances of each code length*/
 		for (auto bits = 0U; bits < tree->numcodes; bits++) {
-			blcount->data[tree->lengths[bits]]++;
+			blcount[tree->lengths[bits]]++;
 		}
 		/*step 2: generate the nextcode values*/
 		for (auto bits = 1U; bits <= tree->maxbitlen; bits++) {
-			nextcode->data[bits] = (nextcode->data[bits - 1] + blcount->data[bits - 1]) << 1;
+			nextcode[bits] = (nextcode[bits - 1] + blcount[bits - 1]) << 1;
 		}
 		/*step 3: generate all the codes*/
 		for (auto n = 0U; n < tree->numcodes; n++) {
 			if (tree->lengths[n] != 0) {
-				tree->tree1d[n] = nextcode->data[tree->lengths[n]]++;
+				tree->tree1d[n] = nextcode[tree->lengths[n]]++;
 			}
 		}
 	}
 
-	delete blcount;
-	delete nextcode;
-
 	if (!error) {
 		return huffmanTree_make2DTree (tree);
 	}
@@ -4115,9 +6391,18 @@ unsigned huffmanTree_make_from_lengths (HuffmanTree* tree, const unsigned* bitle
 										size_t numcodes, unsigned maxbitlen)
 {
 	unsigned i;
-	tree->lengths = new unsigned[numcodes];
-	if (!tree->lengths) {
-		return 83; /*alloc fail*/
+	if (numcodes > tree->allocated) {
+		delete[] tree->lengths;
+		delete[] tree->tree1d;
+		delete[] tree->tree2d;
+		tree->allocated = 0;
+		tree->lengths = new unsigned[numcodes];
+		tree->tree1d = new unsigned[numcodes];
+		tree->tree2d = new unsigned[numcodes * 2];
+		if (!tree->lengths || !tree->tree1d || !tree->tree2d) {
+			return 83; /*alloc fail*/
+		}
+		tree->allocated = (unsigned)numcodes;
 	}
 	for (i = 0; i < numcodes; i++) {
 		tree->lengths[i] = bitlen[i];
@@ -4161,29 +6446,23 @@ unsigned huffman_decode_symbol (const BYTE* in, size_t* bp,
 
 
 /// <summary>
-/// 
+/// inflate into state->out, emptied first but keeping its allocation
 /// </summary>
-/// <param name="out"></param>
-/// <param name="outsize"></param>
+/// <param name="state"></param>
 /// <param name="in"></param>
 /// <param name="insize"></param>
 /// <param name="settings"></param>
 /// <returns></returns>
-unsigned lodepng_inflate (BYTE** out, size_t* outsize, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings)
+unsigned lodepng_inflate (INFLATESTATE* state, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings)
 {
 #if LODEPNG_CUSTOM_ZLIB_DECODER == 2
 	if (settings->custom_decoder) {
-		return lodepng_custom_inflate (out, outsize, in, insize, settings);
+		return lodepng_custom_inflate (&state->out.data, &state->out.size, in, insize, settings);
 	}
 	else {
 #endif /*LODEPNG_CUSTOM_ZLIB_DECODER == 2*/
-		unsigned error;
-		ucvector* v = new ucvector ();
-		v->ucvector_init_buffer (*out, *outsize);
-		error = lodepng_inflatev (v, in, insize, settings);
-		*out = v->data;
-		*outsize = v->size;
-		return error;
+		state->out.size = 0;
+		return lodepng_inflatev (&state->out, in, insize, settings, state);
 #if LODEPNG_CUSTOM_ZLIB_DECODER == 2
 	}
 #endif /*LODEPNG_CUSTOM_ZLIB_DECODER == 2*/
@@ -4197,8 +6476,9 @@ unsigned lodepng_inflate (BYTE** out, size_t* outsize, const BYTE* in, size_t in
 /// <param name="in"></param>
 /// <param name="insize"></param>
 /// <param name="settings"></param>
+/// <param name="state">trees for dynamic blocks</param>
 /// <returns></returns>
-unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings)
+unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings, INFLATESTATE* state)
 {
 	/*bit pointer in the "in" data, current byte is bp >> 3, current bit is bp & 0x7 (from lsb to msb of the byte)*/
 	size_t bp = 0;
@@ -4225,7 +6505,7 @@ unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const L
 			error = out->inflateNoCompression (in, &bp, &pos, insize); /*no compression*/
 		}
 		else {
-			error = out->inflateHuffmanBlock (in, &bp, &pos, insize, BTYPE); /*compression, BTYPE 01 or 10*/
+			error = out->inflateHuffmanBlock (in, &bp, &pos, insize, BTYPE, &state->ll, &state->d, &state->cl); /*compression, BTYPE 01 or 10*/
 		}
 
 		if (error) {
@@ -4247,7 +6527,8 @@ unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const L
 /// <summary>
 /// Lode's main function, call this
 /// </summary>
-/// <param name="out">malloced return for decompressed output</param>
+/// <param name="state">the calling thread's inflater, its buffer receives the output</param>
+/// <param name="out">return for decompressed output, in state and valid until its next use; NULL if nothing was inflated</param>
 /// <param name="outsize">return for output size</param>
 /// <param name="in">the zlib stream</param>
 /// <param name="insize">number of bytes in input stream</param>
@@ -4260,11 +6541,13 @@ unsigned lodepng_inflatev (ucvector* out, const BYTE* in, size_t insize, const L
 /// Pass 1, 0 if unsure what to do.
 /// </param>
 /// <returns>an error code, 0 on success</returns>
-unsigned lodepng_zlib_decompress (BYTE** out, size_t* outsize, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings)
+unsigned lodepng_zlib_decompress (INFLATESTATE* state, const BYTE** out, size_t* outsize, const BYTE* in, size_t insize, const LodePNGDecompressSettings* settings)
 {
 	unsigned error = 0;
 	unsigned CM, CINFO, FDICT;
 
+	*out = NULL;
+	*outsize = 0;
 	if (insize < 2) {
 		return 53; /*error, size of zlib data too small*/
 	}
@@ -4289,7 +6572,9 @@ unsigned lodepng_zlib_decompress (BYTE** out, size_t* outsize, const BYTE* in, s
 		"The additional flags shall not specify a preset dictionary."*/
 		return 26;
 	}
-	error = lodepng_inflate (out, outsize, in + 2, insize - 2, settings);
+	error = lodepng_inflate (state, in + 2, insize - 2, settings);
+	*out = state->out.size ? state->out.data : NULL;
+	*outsize = state->out.size;
 	if (error) {
 		return error;
 	}
@@ -4306,4 +6591,453 @@ unsigned lodepng_zlib_decompress (BYTE** out, size_t* outsize, const BYTE* in, s
 #if LODEPNG_CUSTOM_ZLIB_DECODER == 1
 }
 #endif /*LODEPNG_CUSTOM_ZLIB_DECODER == 1*/
-}
\ No newline at end of file
+}
+
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/* codec section */
+/*///////////////////////////////////////////////////////////////////////////////////////*/
+/// <summary>
+/// copy a decoded frame into the strip or tile it was for, cropping or padding it
+/// </summary>
+/// <param name="out">the section</param>
+/// <param name="size">bytes of out</param>
+/// <param name="frame">the decoded frame</param>
+/// <param name="framewidth"></param>
+/// <param name="frameheight"></param>
+/// <param name="width">section width</param>
+/// <param name="height">section height</param>
+/// <param name="pixelbytes">bytes per pixel</param>
+/// <returns>bytes written, whole rows up to width * height pixels, the padding zero</returns>
+static unsigned long fit_section (BYTE* out, unsigned long size, const BYTE* frame, int framewidth, int frameheight, int width, int height, int pixelbytes)
+{
+	size_t row = (size_t)width * pixelbytes;
+	size_t framerow = (size_t)framewidth * pixelbytes;
+	size_t copy = row < framerow ? row : framerow;
+	unsigned long N = 0;
+
+	for (auto y = 0; y < height && N + row <= size; y++) {
+		if (y < frameheight) {
+			memcpy (out + N, frame + (size_t)y * framerow, copy);
+			memset (out + N + copy, 0, row - copy);
+		}
+		else {
+			memset (out + N, 0, row);
+		}
+		N += (unsigned long)row;
+	}
+	return N;
+}
+
+/// <summary>
+/// Compression = 1, the bytes as they are
+/// </summary>
+class RAWCODEC : public CODEC
+{
+public:
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE*) const override
+	{
+		*Nret = job.count < job.expected ? job.count : job.expected;
+		memcpy (out, job.in, *Nret);
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 2, 3 and 4, CCITT modified Huffman, T.4 and T.6
+/// </summary>
+class CCITTCODEC : public CODEC
+{
+public:
+	COMPRESSION mode;
+	explicit CCITTCODEC (COMPRESSION compression)
+	{
+		mode = compression;
+	}
+	CODECSTATE* new_state () const override
+	{
+		if (mode == COMPRESSION::COMPRESSION_CCITTFAX4) {
+			return new CCITTSTATE ();
+		}
+		return NULL;
+	}
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE* state) const override
+	{
+		int err;
+
+		switch (mode) {
+		case COMPRESSION::COMPRESSION_CCITTRLE:
+			err = ccittdecompress (job.in, job.count, out, job.expected, Nret, job.width, job.height, false);
+			break;
+		case COMPRESSION::COMPRESSION_CCITTFAX3:
+			if ((job.T4options & 0x04) != 0) {
+				return -1; /* not handling for now */
+			}
+			err = ccittdecompress (job.in, job.count, out, job.expected, Nret, job.width, job.height, true);
+			break;
+		default:
+			err = ccittgroup4decompress (job.in, job.count, out, job.expected, Nret, job.width, job.height, 0, static_cast<CCITTSTATE*>(state));
+			break;
+		}
+		if (err) {
+			return -1;
+		}
+		if (mode != COMPRESSION::COMPRESSION_CCITTFAX4) {
+			invert (out, *Nret);
+		}
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 32773, PackBits
+/// </summary>
+class PACKBITSCODEC : public CODEC
+{
+public:
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE*) const override
+	{
+		*Nret = unpackbits (job.in, job.count, out, job.expected);
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 5, LZW
+/// </summary>
+class LZWCODEC : public CODEC
+{
+public:
+	CODECSTATE* new_state () const override
+	{
+		return new LZWSTATE ();
+	}
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE* state) const override
+	{
+		return loadlzw (job.in, job.count, out, job.expected, static_cast<LZWSTATE*>(state), Nret);
+	}
+};
+
+/// <summary>
+/// Compression = 8 and 32946, zlib deflate
+/// </summary>
+class DEFLATECODEC : public CODEC
+{
+public:
+	CODECSTATE* new_state () const override
+	{
+		return new INFLATESTATE ();
+	}
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE* state) const override
+	{
+		LodePNGDecompressSettings settings = {};
+		const BYTE* data = 0;
+		size_t N = 0;
+
+		if (lodepng_zlib_decompress (static_cast<INFLATESTATE*>(state), &data, &N, job.in, job.count, &settings) || !data) {
+			return -1;
+		}
+		*Nret = N < job.expected ? (unsigned long)N : job.expected;
+		memcpy (out, data, *Nret);
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 7, JPEG (jpegdec.cpp)
+/// </summary>
+class JPEGCODEC : public CODEC
+{
+public:
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE*) const override
+	{
+		BYTE* frame;
+		unsigned long N = 0;
+		int framewidth = 0;
+		int frameheight = 0;
+		int components = 0;
+
+		frame = jpeg_decompress (job.in, job.count, job.jpegtables, &framewidth, &frameheight, &components, &N, job.scale);
+		if (!frame) {
+			return -1;
+		}
+		// the frame needn't match the section, the last strip's is often taller
+		*Nret = fit_section (out, job.expected, frame, framewidth, frameheight, job.width, job.height, components);
+		delete[] frame;
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 50000, Zstandard (zstddec.cpp)
+/// </summary>
+class ZSTDCODEC : public CODEC
+{
+public:
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE*) const override
+	{
+		BYTE* data;
+		unsigned long N = 0;
+
+		data = zstd_decompress (job.in, job.count, &N);
+		if (!data) {
+			return -1;
+		}
+		*Nret = N < job.expected ? N : job.expected;
+		memcpy (out, data, *Nret);
+		delete[] data;
+		return 0;
+	}
+};
+
+/// <summary>
+/// Compression = 34887, LERC (lercdec.cpp)
+/// </summary>
+class LERCCODEC : public CODEC
+{
+public:
+	CODECSTATE* new_state () const override
+	{
+		return new INFLATESTATE ();
+	}
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE* state) const override
+	{
+		LodePNGDecompressSettings settings = {};
+		const BYTE* blob = job.in;
+		unsigned long count = job.count;
+		BYTE* buff = NULL;
+		const BYTE* inflated = NULL;
+		BYTE* frame;
+		size_t decompsize = 0;
+		unsigned long N = 0;
+		int framewidth = 0;
+		int frameheight = 0;
+
+		if (!job.lercparameters) {
+			return -1;
+		}
+		// the blobs may have been deflated or zstd compressed as a whole
+		if (job.lercparameters->compression == 1) {
+			if (lodepng_zlib_decompress (static_cast<INFLATESTATE*>(state), &inflated, &decompsize, job.in, job.count, &settings) || !inflated) {
+				return -1;
+			}
+			blob = inflated;
+			count = (unsigned long)decompsize;
+		}
+		else if (job.lercparameters->compression == 2) {
+			buff = zstd_decompress (job.in, job.count, &count);
+			if (!buff) {
+				return -1;
+			}
+			blob = buff;
+		}
+		else if (job.lercparameters->compression != 0) {
+			return -1;
+		}
+		frame = lerc_decompress (blob, count, job.lercparameters, &framewidth, &frameheight, &N);
+		delete[] buff;
+		if (!frame) {
+			return -1;
+		}
+		if (framewidth <= 0 || frameheight <= 0) {
+			delete[] frame;
+			return -1;
+		}
+		*Nret = fit_section (out, job.expected, frame, framewidth, frameheight, job.width, job.height,
+			(int)(N / ((unsigned long)framewidth * frameheight)));
+		delete[] frame;
+		return 0;
+	}
+};
+
+#if TIFF_WEBP
+/// <summary>
+/// Compression = 50001, WebP (webpdec.cpp)
+/// </summary>
+class WEBPCODEC : public CODEC
+{
+public:
+	int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE*) const override
+	{
+		BYTE* frame;
+		unsigned long N = 0;
+		int framewidth = 0;
+		int frameheight = 0;
+
+		frame = webp_decompress (job.in, job.count, job.samples, &framewidth, &frameheight, &N);
+		if (!frame) {
+			return -1;
+		}
+		*Nret = fit_section (out, job.expected, frame, framewidth, frameheight, job.width, job.height, job.samples);
+		delete[] frame;
+		return 0;
+	}
+};
+#endif
+
+/// <summary>
+/// the built in codecs
+/// </summary>
+CODECREGISTRY::CODECREGISTRY ()
+{
+	tables.push_back (new CODECTABLE ());
+	codecs = tables.back ();
+	add (COMPRESSION::COMPRESSION_NONE, new RAWCODEC ());
+	add (COMPRESSION::COMPRESSION_CCITTRLE, new CCITTCODEC (COMPRESSION::COMPRESSION_CCITTRLE));
+	add (COMPRESSION::COMPRESSION_CCITTFAX3, new CCITTCODEC (COMPRESSION::COMPRESSION_CCITTFAX3));
+	add (COMPRESSION::COMPRESSION_CCITTFAX4, new CCITTCODEC (COMPRESSION::COMPRESSION_CCITTFAX4));
+	add (COMPRESSION::COMPRESSION_PACKBITS, new PACKBITSCODEC ());
+	add (COMPRESSION::COMPRESSION_LZW, new LZWCODEC ());
+	add (COMPRESSION::COMPRESSION_DEFLATE, new DEFLATECODEC ());
+	add (COMPRESSION::COMPRESSION_ADOBE_DEFLATE, new DEFLATECODEC ());
+	add (COMPRESSION::COMPRESSION_JPEG, new JPEGCODEC ());
+	add (COMPRESSION::COMPRESSION_ZSTD, new ZSTDCODEC ());
+	add (COMPRESSION::COMPRESSION_LERC, new LERCCODEC ());
+#if TIFF_WEBP
+	add (COMPRESSION::COMPRESSION_WEBP, new WEBPCODEC ());
+#endif
+}
+
+CODECREGISTRY::~CODECREGISTRY ()
+{
+	for (auto codec : owned) {
+		delete codec;
+	}
+	for (auto table : tables) {
+		delete table;
+	}
+}
+
+/// <summary>
+/// the registry
+/// </summary>
+/// <returns></returns>
+CODECREGISTRY* CODECREGISTRY::get ()
+{
+	static CODECREGISTRY registry;  // initialisation is thread safe
+	return &registry;
+}
+
+/// <summary>
+/// plug in a codec, replacing any already there for the compression
+/// </summary>
+/// <param name="compression">Compression tag value</param>
+/// <param name="codec">allocated with new, the registry owns it</param>
+void CODECREGISTRY::add (COMPRESSION compression, CODEC* codec)
+{
+	std::lock_guard<std::mutex> guard (lock);
+	CODECTABLE* table = new CODECTABLE (*codecs.load ());
+	bool replaced = false;
+
+	owned.push_back (codec);
+	for (auto& entry : *table) {
+		if (entry.first == compression) {
+			entry.second = codec;
+			replaced = true;
+		}
+	}
+	if (!replaced) {
+		table->push_back (std::make_pair (compression, (const CODEC*)codec));
+	}
+	tables.push_back (table);
+	codecs.store (table, std::memory_order_release);
+}
+
+/// <summary>
+/// codec for a compression
+/// </summary>
+/// <param name="compression">Compression tag value</param>
+/// <returns>the codec, NULL if there is none</returns>
+const CODEC* CODECREGISTRY::find (COMPRESSION compression) const
+{
+	const CODECTABLE* table = codecs.load (std::memory_order_acquire);
+
+	for (auto& entry : *table) {
+		if (entry.first == compression) {
+			return entry.second;
+		}
+	}
+	return NULL;
+}
+
+/// <summary>
+/// the codec states of a thread, deleted when the thread ends
+/// </summary>
+class CODECSTATES
+{
+public:
+	std::vector<std::pair<const CODEC*, CODECSTATE*>> states;
+	~CODECSTATES ()
+	{
+		for (auto& entry : states) {
+			delete entry.second;
+		}
+	}
+};
+
+/// <summary>
+/// the calling thread's state for a codec, made on first use
+/// </summary>
+/// <param name="codec">a registered codec</param>
+/// <returns>the state, NULL if the codec keeps none</returns>
+CODECSTATE* CODECREGISTRY::state (const CODEC* codec)
+{
+	static thread_local CODECSTATES states;
+	CODECSTATE* answer;
+
+	for (auto& entry : states.states) {
+		if (entry.first == codec) {
+			return entry.second;
+		}
+	}
+	answer = codec->new_state ();
+	states.states.push_back (std::make_pair (codec, answer));
+	return answer;
+}
+
+/*
+  Master decompression function
+  Params:
+	fd - input file, pointing to start of data section
+	count - number of bytes in stream to decompress
+	compression - picks the codec from CODECREGISTRY
+	job - the section, from BASICHEADER::section_job; in and count are set here
+	Nret - return for number of decompressed bytes, at most job->expected
+	err - return for why it failed, a SECTION_ERROR value, may be NULL
+  Returns: pointer to job->expected bytes of decompressed data, 0 on fail
+
+*/
+BYTE* decompress (FileData* fd, unsigned long count, COMPRESSION compression, CODECJOB* job, unsigned long* Nret, int* err)
+{
+	const CODEC* codec;
+	BYTE* answer = 0;
+	SECTION_ERROR error = SECTION_ERROR::SECTION_OK;
+
+	codec = CODECREGISTRY::get ()->find (compression);
+	if (!codec) {
+		//perror("compression not supprted");
+		error = SECTION_ERROR::SECTION_UNSUPPORTED;
+	}
+	else {
+		// the section was checked against the file by header_checksections
+		job->count = count;
+		job->in = fd->span (&job->count);
+		answer = new BYTE[job->expected ? job->expected : 1];
+		if (!answer) {
+			//out_of_memory:
+			error = SECTION_ERROR::SECTION_OUT_OF_MEMORY;
+		}
+		else {
+			*Nret = 0;
+			// a stream that ends early is as damaged as one the codec rejects
+			if (codec->decode (*job, answer, Nret, CODECREGISTRY::state (codec)) || *Nret < job->expected) {
+				error = SECTION_ERROR::SECTION_CORRUPT;
+				delete[] answer;
+				answer = 0;
+			}
+		}
+	}
+	if (err) {
+		*err = static_cast<int>(error);
+	}
+	return answer;
+}
@@ -3,6 +3,21 @@
 
 
 #include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <future>
+#include <string>
+#include "jpegdec.h"
+#include "zstddec.h"
+#include "lercdec.h"
+#include "webpdec.h"
 
 
 /*
@@ -28,8 +43,58 @@
 	 alpha is premultiplied = composted on black. To get
 		the image composted on white, call floadtiffwhite()
 	 width is image width, height is image height in pixels
+
+	 With TIFF::file_open instead of file_read the file is read lazily:
+	 the header is paged in on demand and the strip / tile data is
+	 prefetched on a background thread while earlier strips decode.
+
+	 TIFF::load_tiff_async decodes the strips / tiles on an EXECUTOR
+	 (e.g. a THREADPOOL) and reports each one as it lands in the raster:
+	   THREADPOOL pool (0);
+	   std::future<BYTE*> raster = tiff.load_tiff_async (&pool,
+		   [] (const TIFFREGION& region) { show (region.x, region.y, region.width, region.height); });
+	   data = raster.get ();
+
+	 CMYK comes back as FMT_CMYK / FMT_CMYKA unless tiff.cmyk_to_rgb is
+	 set, in which case it is converted to FMT_RGBA in the same pass
+	 (a simple (255 - C) * (255 - K) / 255, no colour management).
+
+	 TIFF::load_tiff_float returns the samples themselves as 32 bit floats,
+	 samplesperpixel to a pixel, for float rasters (e.g. LERC compressed
+	 elevation) that the 8 bit formats would squash:
+	   int Nsamples;
+	   float* samples = tiff.load_tiff_float (&Nsamples);
+
+	 Strips and tiles are decoded by the CODEC registered for their
+	 Compression value. Another codec can be plugged in, or a built in one
+	 replaced, before loading:
+	   CODECREGISTRY::get ()->add (COMPRESSION::COMPRESSION_LZW, new MYCODEC ());
+
+	 After load_tiff (or load_tiff_level, load_tiff_async) tiff.status says
+	 which strips or tiles failed and why. Normally any failure fails the
+	 load; with tiff.best_effort set the raster comes back anyway, failed
+	 sections black, and status.valid (index) is the mask of good ones:
+	   tiff.best_effort = true;
+	   data = tiff.load_tiff ();
+	   if (data && tiff.status.failed ())
+		   redecode_later (tiff.status);
+
+	 Built with TIFF_STATS 1, tiff.stats says after each load where the
+	 time went: header parse, waits for file data, decompress, sample
+	 conversion, predictor and paste, each with wall and CPU time and bytes:
+	   data = tiff.load_tiff ();
+	   const STAGESTATS& codec = tiff.stats.get (TIFF_STAGE::STAGE_DECOMPRESS);
+	   printf ("%s %.3fs\n", TIFFSTATS::describe (TIFF_STAGE::STAGE_DECOMPRESS), codec.cpu);
   */
 #define LODEPNG_CUSTOM_ZLIB_DECODER 0
+// WebP strips and tiles (webpdec.cpp), 0 to build without the decoder
+#ifndef TIFF_WEBP
+#define TIFF_WEBP 1
+#endif
+// per stage timings in TIFF::stats, 0 compiles the timers out
+#ifndef TIFF_STATS
+#define TIFF_STATS 0
+#endif
 typedef unsigned char BYTE;
 enum class FMT
 {
@@ -62,23 +127,58 @@ public:
 class FileData
 {
 public:
+	static const int PAGE_SHIFT = 16; // streaming reads are done in 64k pages
 	char* buffer;
 	long size;
 	int buffer_ptr;
 	ENDIAN type;
+	FILE* fp;                               // kept open while streaming
+	std::atomic<unsigned char>* resident;   // per page loaded flag, NULL if the whole file is in memory
+	std::mutex iolock;
+	int prefetch_depth;                     // coalesced ranges read ahead of the decoder
+	FileData* parent;                       // set for a cursor sharing another FileData's buffer
+	std::string identity;                   // path, size and mtime, empty if not read from a file
 	FileData ()
 	{
 		buffer = NULL;
 		size = 0;
 		buffer_ptr = 0;
 		type = LITTLE_ENDIAN;
+		fp = NULL;
+		resident = NULL;
+		prefetch_depth = 4;
+		parent = NULL;
+	}
+	/// <summary>
+	/// a second read cursor over the same file, so several strips can be
+	/// decoded at once. Owns nothing; parent must outlive it.
+	/// </summary>
+	/// <param name="parent">the FileData holding the file</param>
+	explicit FileData (FileData* parent)
+	{
+		buffer = parent->buffer;
+		size = parent->size;
+		buffer_ptr = 0;
+		type = parent->type;
+		fp = NULL;
+		resident = parent->resident;
+		prefetch_depth = parent->prefetch_depth;
+		identity = parent->identity;
+		this->parent = parent;
 	}
 	~FileData ()
 	{
+		if (parent != NULL) {
+			return;
+		}
 		if (buffer != NULL) {
 			delete[] buffer;
 			buffer = NULL;
 		}
+		if (fp != NULL) {
+			fclose (fp);
+		}
+		delete[] resident;
 	}
 	bool FileRead (const char* path)
 	{
@@ -95,9 +195,114 @@ public:
 		fread (buffer, size, 1, fp);
 		fclose (fp);
 		buffer_ptr = 0;
+		identity = FileIdentity (path);
 		return true;
 	}
 	/// <summary>
+	/// key telling files apart for caches: the same path with a different
+	/// size or modification time is a different file
+	/// </summary>
+	/// <param name="path">file name</param>
+	/// <returns>the key, empty if the file can't be found</returns>
+	static std::string FileIdentity (const char* path)
+	{
+		struct _stat st;
+		char stamp[64];
+		if (_stat (path, &st) != 0) {
+			return std::string ();
+		}
+		sprintf_s (stamp, "|%lld|%lld", (long long)st.st_size, (long long)st.st_mtime);
+		return std::string (path) + stamp;
+	}
+	/// <summary>
+	/// size of a file without reading it
+	/// </summary>
+	/// <param name="path">file name</param>
+	/// <returns>size in bytes, -1 if the file can't be opened</returns>
+	static long long FileSize (const char* path)
+	{
+		FILE* fp = NULL;
+		long long answer;
+		fopen_s (&fp, path, "rb");
+		if (!fp) {
+			return -1;
+		}
+		// 64 bit, ftell's long stops at 2GB
+		_fseeki64 (fp, 0, SEEK_END);
+		answer = _ftelli64 (fp);
+		fclose (fp);
+		return answer;
+	}
+	/// <summary>
+	/// open a file for streaming. Nothing is read yet; pages are loaded
+	/// by ensure(), either on demand or ahead of time by a PREFETCHER.
+	/// </summary>
+	/// <param name="path">file name</param>
+	/// <returns>true if the file was opened</returns>
+	bool FileOpen (const char* path)
+	{
+		long npages;
+		fopen_s (&fp, path, "rb");
+		if (!fp) {
+			perror ("error");
+			return false;
+		}
+		fseek (fp, 0, SEEK_END);
+		size = ftell (fp);
+		buffer = new char[size > 0 ? size : 1];
+		npages = (size >> PAGE_SHIFT) + 1;
+		resident = new std::atomic<unsigned char>[npages];
+		for (auto i = 0L; i < npages; i++) {
+			resident[i] = 0;
+		}
+		buffer_ptr = 0;
+		identity = FileIdentity (path);
+		return true;
+	}
+	/// <summary>
+	/// make sure a byte range has been read from disk.
+	/// Missing pages are read in contiguous runs.
+	/// </summary>
+	/// <param name="offset">start of range</param>
+	/// <param name="count">bytes in range</param>
+	void ensure (unsigned long offset, unsigned long count)
+	{
+		unsigned long first, last, page, run;
+
+		if (!resident || (long)offset >= size || count == 0) {
+			return;
+		}
+		if (parent) {
+			parent->ensure (offset, count);
+			return;
+		}
+		if (offset + count > (unsigned long)size || offset + count < offset) {
+			count = size - offset;
+		}
+		first = offset >> PAGE_SHIFT;
+		last = (offset + count - 1) >> PAGE_SHIFT;
+
+		std::lock_guard<std::mutex> guard (iolock);
+		for (page = first; page <= last; page++) {
+			if (resident[page]) {
+				continue;
+			}
+			for (run = page; run + 1 <= last && !resident[run + 1]; run++) {
+			}
+			unsigned long start = page << PAGE_SHIFT;
+			unsigned long end = (run + 1) << PAGE_SHIFT;
+			if (end > (unsigned long)size) {
+				end = size;
+			}
+			fseek (fp, start, SEEK_SET);
+			fread (buffer + start, 1, end - start, fp);
+			for (; page <= run; page++) {
+				resident[page] = 1;
+			}
+			page = run;
+		}
+	}
+	/// <summary>
 	/// ENDIAŇ
 	/// </summary>
 	/// <returns></returns>
@@ -121,23 +326,41 @@ public:
 	/// <returns>Ȃǂݍ݂PoCg</returns>
 	int fgetcc ()
 	{
-		if (buffer_ptr >= size) {
+		if (buffer_ptr < 0 || buffer_ptr >= size) {
 			throw general_exception ("memory_error");  // OX[
 		}
+		if (resident && !resident[buffer_ptr >> PAGE_SHIFT]) {
+			ensure (buffer_ptr, 1);
+		}
 		return (BYTE)buffer[buffer_ptr++];
 	}
 	/// <summary>
+	/// the next n bytes of a value, checked against the file once
+	/// </summary>
+	/// <param name="n">bytes in the value, 2 or 4</param>
+	/// <returns>pointer into the buffer</returns>
+	const BYTE* fgetn (int n)
+	{
+		const BYTE* answer;
+
+		if (buffer_ptr < 0 || buffer_ptr > size - n) {
+			throw general_exception ("memory_error");  // OX[
+		}
+		if (resident) {
+			ensure (buffer_ptr, n);
+		}
+		answer = (const BYTE*)buffer + buffer_ptr;
+		buffer_ptr += n;
+		return answer;
+	}
+	/// <summary>
 	/// ȂRQrbg擾
 	/// </summary>
 	/// <returns></returns>
 	unsigned long fget32u ()
 	{
-		int a, b, c, d;
-
-		a = fgetcc ();
-		b = fgetcc ();
-		c = fgetcc ();
-		d = fgetcc ();
+		const BYTE* p = fgetn (4);
+		unsigned long a = p[0], b = p[1], c = p[2], d = p[3];
 
 		if (type == ENDIAN::BIG_ENDIAN) {
 			return (a << 24) | (b << 16) | (c << 8) | d;
@@ -152,9 +375,8 @@ public:
 	/// <returns></returns>
 	unsigned int fget16u ()
 	{
-		int a, b;
-		a = fgetcc ();
-		b = fgetcc ();
+		const BYTE* p = fgetn (2);
+		int a = p[0], b = p[1];
 		if (type == ENDIAN::BIG_ENDIAN) {
 			return (a << 8) | b;
 		}
@@ -197,10 +419,8 @@ public:
 	/// <returns></returns>
 	int fget16be ()
 	{
-		int c1, c2;
-
-		c2 = fgetcc ();
-		c1 = fgetcc ();
+		const BYTE* p = fgetn (2);
+		int c2 = p[0], c1 = p[1];
 
 		return ((c2 ^ 128) - 128) * 256 + c1;
 	}
@@ -211,12 +431,8 @@ public:
 	/// <returns></returns>
 	long fget32be ()
 	{
-		int c1, c2, c3, c4;
-
-		c4 = fgetcc ();
-		c3 = fgetcc ();
-		c2 = fgetcc ();
-		c1 = fgetcc ();
+		const BYTE* p = fgetn (4);
+		int c4 = p[0], c3 = p[1], c2 = p[2], c1 = p[3];
 		return ((c4 ^ 128) - 128) * 256 * 256 * 256 + c3 * 256 * 256 + c2 * 256 + c1;
 	}
 
@@ -226,10 +442,8 @@ public:
 	/// <returns></returns>
 	int fget16le ()
 	{
-		int c1, c2;
-
-		c1 = fgetcc ();
-		c2 = fgetcc ();
+		const BYTE* p = fgetn (2);
+		int c1 = p[0], c2 = p[1];
 
 		return ((c2 ^ 128) - 128) * 256 + c1;
 	}
@@ -240,20 +454,196 @@ public:
 	/// <returns></returns>
 	long fget32le ()
 	{
-		int c1, c2, c3, c4;
-
-		c1 = fgetcc ();
-		c2 = fgetcc ();
-		c3 = fgetcc ();
-		c4 = fgetcc ();
+		const BYTE* p = fgetn (4);
+		int c1 = p[0], c2 = p[1], c3 = p[2], c4 = p[3];
 		return ((c4 ^ 128) - 128) * 256 * 256 * 256 + c3 * 256 * 256 + c2 * 256 + c1;
 	}
 
 	void memcpy (void* dest, unsigned long datasize)
 	{
+		if (resident) {
+			ensure (buffer_ptr, datasize);
+		}
 		::memcpy (dest, buffer + buffer_ptr, datasize);
 		buffer_ptr += datasize;
 	}
+	/// <summary>
+	/// the next bytes where they are in the buffer, without copying them.
+	/// A range running off the end of the file is cut short, one starting
+	/// outside it is empty.
+	/// </summary>
+	/// <param name="datasize">bytes wanted, return for the bytes there are</param>
+	/// <returns>pointer into the buffer</returns>
+	const BYTE* span (unsigned long* datasize)
+	{
+		const BYTE* answer;
+
+		if (buffer_ptr < 0 || buffer_ptr > size) {
+			*datasize = 0;
+			return (const BYTE*)buffer;
+		}
+		if (*datasize > (unsigned long)(size - buffer_ptr)) {
+			*datasize = size - buffer_ptr;
+		}
+		if (resident) {
+			ensure (buffer_ptr, *datasize);
+		}
+		answer = (const BYTE*)buffer + buffer_ptr;
+		buffer_ptr += *datasize;
+		return answer;
+	}
+};
+
+/// <summary>
+/// reads strip / tile byte ranges ahead of the decoder on a background thread.
+/// Ranges are read in decode order, adjacent ranges are coalesced into one
+/// read, and at most FileData::prefetch_depth reads are in flight ahead of
+/// the range the decoder is waiting for.
+/// </summary>
+class PREFETCHER
+{
+private:
+	FileData* fd;
+	std::vector<unsigned long> runstart;   // coalesced reads
+	std::vector<unsigned long> runcount;
+	std::vector<int> runof;                // range index -> run index
+	int depth;
+	int wanted;     // highest run the decoder has asked for
+	int done;       // runs read so far
+	bool stopping;
+	std::mutex lock;
+	std::condition_variable changed;
+	std::thread worker;
+	void worker_main ();
+public:
+	PREFETCHER (FileData* fd, const unsigned long* offsets, const unsigned long* counts, int N);
+	~PREFETCHER ();
+	void wait (int index);
+	static PREFETCHER* start (FileData* fd, const unsigned long* offsets, const unsigned long* counts, int N);
+};
+
+class EXECUTOR;
+class TILECACHE;
+class HEADERCACHE;
+
+/// <summary>
+/// one resolution of an image, listed by TIFF::list_levels
+/// </summary>
+class TIFFLEVEL
+{
+public:
+	unsigned long offset;   // IFD in the file
+	int width;
+	int height;
+	bool subifd;            // found through the SubIFDs tag rather than the IFD chain
+	TIFFLEVEL ()
+	{
+		offset = 0;
+		width = 0;
+		height = 0;
+		subifd = false;
+	}
+};
+
+/// <summary>
+/// part of the raster that has been decoded, reported by load_tiff_async
+/// </summary>
+class TIFFREGION
+{
+public:
+	int index;      // strip or tile number (band number for planar images)
+	int x;
+	int y;
+	int width;
+	int height;
+	bool ok;        // false if the section failed to decode
+	BYTE* raster;   // the whole output raster, imagewidth pixels per row
+	TIFFREGION ()
+	{
+		index = -1;
+		x = 0;
+		y = 0;
+		width = 0;
+		height = 0;
+		ok = false;
+		raster = NULL;
+	}
+};
+
+/// <summary>
+/// why a strip or tile failed. The values are the ones the section
+/// decode functions return.
+/// </summary>
+enum class SECTION_ERROR
+{
+	SECTION_OK = 0,
+	SECTION_OUT_OF_MEMORY = -1,
+	SECTION_CORRUPT = -2,       // the codec or the sample conversion rejected the data
+	SECTION_UNSUPPORTED = -3,   // no codec for the compression, or a layout that can't be converted
+};
+
+/// <summary>
+/// outcome of the last load, section by section. Sections are numbered
+/// as in the file: strip or tile number, plane * strips per image + strip
+/// for planar images.
+/// </summary>
+class TIFFSTATUS
+{
+public:
+	std::vector<SECTION_ERROR> sections;   // SECTION_OK where the section is in the raster
+	/// <summary>
+	/// start a load of N sections, all good until they fail
+	/// </summary>
+	void reset (int N)
+	{
+		sections.assign (N > 0 ? N : 0, SECTION_ERROR::SECTION_OK);
+	}
+	/// <summary>
+	/// record a failed section. Sections are written by one thread each.
+	/// </summary>
+	/// <param name="index">section number</param>
+	/// <param name="err">the decode function's return, a SECTION_ERROR value</param>
+	void fail (int index, int err)
+	{
+		if (index >= 0 && index < (int)sections.size ()) {
+			sections[index] = err ? static_cast<SECTION_ERROR>(err) : SECTION_ERROR::SECTION_CORRUPT;
+		}
+	}
+	/// <summary>
+	/// the validity mask
+	/// </summary>
+	bool valid (int index) const
+	{
+		return index >= 0 && index < (int)sections.size () && sections[index] == SECTION_ERROR::SECTION_OK;
+	}
+	/// <summary>
+	/// number of sections that failed
+	/// </summary>
+	int failed () const
+	{
+		int answer = 0;
+		for (auto error : sections) {
+			if (error != SECTION_ERROR::SECTION_OK) {
+				answer++;
+			}
+		}
+		return answer;
+	}
+	static const char* describe (SECTION_ERROR error)
+	{
+		switch (error) {
+		case SECTION_ERROR::SECTION_OK:
+			return "ok";
+		case SECTION_ERROR::SECTION_OUT_OF_MEMORY:
+			return "out of memory";
+		case SECTION_ERROR::SECTION_CORRUPT:
+			return "corrupt data";
+		case SECTION_ERROR::SECTION_UNSUPPORTED:
+			return "unsupported compression or layout";
+		default:
+			return "unknown error";
+		}
+	}
 };
 enum class TAG_TYPE
 {
@@ -263,6 +653,8 @@ enum class TAG_TYPE
 	TAG_SHORT = 3,
 	TAG_LONG = 4,
 	TAG_RATIONAL = 5,
+	TAG_UNDEFINED = 7,
+	TAG_IFD = 13,
 };
 
 /* data types
@@ -318,11 +710,15 @@ enum class COMPRESSION
 	COMPRESSION_SGILOG = 34676,
 	COMPRESSION_SGILOG24 = 34677,
 	COMPRESSION_JP2000 = 34712,
+	COMPRESSION_LERC = 34887,
+	COMPRESSION_ZSTD = 50000,
+	COMPRESSION_WEBP = 50001,
 };
 
 enum class TID
 {
 	TID_NONE = 0,
+	TID_NEWSUBFILETYPE = 254,
 	TID_IMAGEWIDTH = 256,
 	TID_IMAGEHEIGHT = 257,
 	TID_BITSPERSAMPLE = 258,
@@ -341,13 +737,16 @@ enum class TID
 	TID_TILELENGTH = 323,
 	TID_TILEOFFSETS = 324,
 	TID_TILEBYTECOUNTS = 325,
+	TID_SUBIFDS = 330,
 	TID_EXTRASAMPLES = 338,
 	TID_SAMPLEFORMAT = 339,
 	TID_SMINSAMPLEVALUE = 340,
 	TID_SMAXSAMPLEVALUE = 341,
+	TID_JPEGTABLES = 347,
 	TID_YCBCRCOEFFICIENTS = 529,
 	TID_YCBCRSUBSAMPLING = 530,
 	TID_YCBCRPOSITIONING = 531,
+	TID_LERCPARAMETERS = 50674,
 	// Artist 315 ASCII - * *
 	// BadFaxLines[1] 326 SHORT or LONG - - -
 	// BitsPerSample 258 SHORT * * *
@@ -490,6 +889,201 @@ public:
 	}
 };
 
+/////////////////////////////////////////////////////////////////////////////////////////////////
+///CODEC
+/////////////////////////////////////////////////////////////////////////////////////////////////
+
+/// <summary>
+/// one strip or tile for a codec: the compressed bytes and the section they decode to
+/// </summary>
+class CODECJOB
+{
+public:
+	const BYTE* in;                         // compressed bytes, in place in the file buffer
+	unsigned long count;
+	int width;                              // section size, already divided by scale
+	int height;
+	int samples;                            // samples per pixel, 1 for a plane
+	unsigned long expected;                 // bytes the section decodes to
+	unsigned long T4options;
+	const JPEGTABLES* jpegtables;           // tables shared by the IFD's JPEG strips or tiles
+	const LERCPARAMETERS* lercparameters;
+	int scale;                              // JPEG only, decode at 1 / scale size
+	CODECJOB ()
+	{
+		in = NULL;
+		count = 0;
+		width = 0;
+		height = 0;
+		samples = 1;
+		expected = 0;
+		T4options = 0;
+		jpegtables = NULL;
+		lercparameters = NULL;
+		scale = 1;
+	}
+};
+
+/// <summary>
+/// scratch a codec keeps from one strip to the next, one per codec per thread
+/// </summary>
+class CODECSTATE
+{
+public:
+	virtual ~CODECSTATE ()
+	{
+	}
+};
+
+/// <summary>
+/// decoder for a Compression value. One instance serves every thread,
+/// anything it changes while decoding belongs in its CODECSTATE.
+/// </summary>
+class CODEC
+{
+public:
+	virtual ~CODEC ()
+	{
+	}
+	/// <summary>
+	/// scratch for a thread, made the first time the thread uses the codec
+	/// </summary>
+	/// <returns>the state, NULL if the codec keeps none</returns>
+	virtual CODECSTATE* new_state () const
+	{
+		return NULL;
+	}
+	/// <summary>
+	/// decode a strip or tile
+	/// </summary>
+	/// <param name="job">input and section</param>
+	/// <param name="out">job.expected bytes</param>
+	/// <param name="Nret">return for the bytes written, at most job.expected</param>
+	/// <param name="state">the calling thread's state from new_state</param>
+	/// <returns>0 on success, -1 on fail</returns>
+	virtual int decode (const CODECJOB& job, BYTE* out, unsigned long* Nret, CODECSTATE* state) const = 0;
+};
+
+/// <summary>
+/// the codecs decompress picks from, by Compression value. The built in
+/// codecs are registered on first use; add() plugs in more or replaces
+/// them and should be called before loading starts.
+/// find() takes no lock: add() copies the table and swaps the copy in,
+/// and the old tables are kept for readers still looking at them.
+/// </summary>
+class CODECREGISTRY
+{
+private:
+	typedef std::vector<std::pair<COMPRESSION, const CODEC*>> CODECTABLE;
+	std::atomic<const CODECTABLE*> codecs;  // the current table, never changed once published
+	std::vector<const CODECTABLE*> tables;  // every table published
+	std::vector<const CODEC*> owned;        // every codec ever added, so thread states keyed on them stay valid
+	std::mutex lock;                        // serialises add
+	CODECREGISTRY ();
+public:
+	~CODECREGISTRY ();
+	static CODECREGISTRY* get ();
+	void add (COMPRESSION compression, CODEC* codec);
+	const CODEC* find (COMPRESSION compression) const;
+	static CODECSTATE* state (const CODEC* codec);
+};
+
+/// <summary>
+/// the stages of a load TIFFSTATS times
+/// </summary>
+enum class TIFF_STAGE
+{
+	STAGE_HEADER = 0,       // load_header, fill_header and the section checks
+	STAGE_READ = 1,         // waiting for the prefetcher to read a section
+	STAGE_DECOMPRESS = 2,   // the codec
+	STAGE_CONVERT = 3,      // samples to the output format, bitstream_to_rgba etc.
+	STAGE_PREDICTOR = 4,    // undoing horizontal differencing
+	STAGE_PASTE = 5,        // sections into the raster
+	STAGE_COUNT = 6,
+};
+
+/// <summary>
+/// totals for one stage. Times are summed over the threads that ran it,
+/// so with sections decoded in parallel they can pass the load's own time.
+/// </summary>
+class STAGESTATS
+{
+public:
+	double wall;                // seconds
+	double cpu;                 // seconds of CPU time of the threads running the stage
+	unsigned long long bytes;   // bytes in: compressed for read and decompress, decoded after
+	unsigned long calls;
+};
+
+/// <summary>
+/// where the time of the last load went. Filled in only when built with
+/// TIFF_STATS 1; otherwise it stays zero and the timers compile to nothing.
+/// </summary>
+class TIFFSTATS
+{
+public:
+	STAGESTATS stages[static_cast<int>(TIFF_STAGE::STAGE_COUNT)];
+	COMPRESSION compression;    // the codec the decompress stage ran
+	std::mutex lock;            // serialises add, so loads of different TIFFs don't contend
+	TIFFSTATS ()
+	{
+		reset ();
+	}
+	TIFFSTATS (const TIFFSTATS& other)
+	{
+		*this = other;
+	}
+	TIFFSTATS& operator = (const TIFFSTATS& other)
+	{
+		// the totals are copied, each copy keeps its own lock
+		if (this != &other) {
+			memcpy (stages, other.stages, sizeof stages);
+			compression = other.compression;
+		}
+		return *this;
+	}
+	void reset ()
+	{
+		memset (stages, 0, sizeof stages);
+		compression = COMPRESSION::COMPRESSION_NONE;
+	}
+	/// <summary>
+	/// add one timed run of a stage, from any thread
+	/// </summary>
+	void add (TIFF_STAGE stage, double wall, double cpu, unsigned long long bytes)
+	{
+		std::lock_guard<std::mutex> guard (lock);
+		STAGESTATS& totals = stages[static_cast<int>(stage)];
+		totals.wall += wall;
+		totals.cpu += cpu;
+		totals.bytes += bytes;
+		totals.calls++;
+	}
+	const STAGESTATS& get (TIFF_STAGE stage) const
+	{
+		return stages[static_cast<int>(stage)];
+	}
+	static const char* describe (TIFF_STAGE stage)
+	{
+		switch (stage) {
+		case TIFF_STAGE::STAGE_HEADER:
+			return "header";
+		case TIFF_STAGE::STAGE_READ:
+			return "read wait";
+		case TIFF_STAGE::STAGE_DECOMPRESS:
+			return "decompress";
+		case TIFF_STAGE::STAGE_CONVERT:
+			return "convert";
+		case TIFF_STAGE::STAGE_PREDICTOR:
+			return "predictor";
+		case TIFF_STAGE::STAGE_PASTE:
+			return "paste";
+		default:
+			return "unknown stage";
+		}
+	}
+};
+
 /////////////////////////////////////////////////////////////////////////////////////////////////
 ///BASICHEADER
 /////////////////////////////////////////////////////////////////////////////////////////////////
@@ -515,6 +1109,8 @@ public:
 	/*  Palette files */
 	BYTE* colormap;
 	int Ncolormap;
+	unsigned int* palette;      // colormap packed as RGBA, built by fill_header
+	int Npalette;
 	/* RGB */
 	int planarconfiguration;
 	int predictor;
@@ -537,6 +1133,12 @@ public:
 	int ConsecutiveBadFaxLines;
 	unsigned long T4options;
 
+	/* JPEG */
+	JPEGTABLES* jpegtables;    // shared tables, parsed once by fill_header
+
+	/* LERC */
+	LERCPARAMETERS* lercparameters;    // from the LercParameters tag and the sample layout
+
 	/* tiling */
 	int tilewidth;
 	int tileheight;
@@ -552,6 +1154,14 @@ public:
 	int Nsminsamplevalue;
 	int extrasamples;
 	ENDIAN endianness;
+	/* pyramids */
+	unsigned long* subifds;
+	int Nsubifds;
+	unsigned long ifdoffset;    // where this IFD is in the file
+	unsigned long nextifd;      // next IFD in the chain, 0 for none
+	TILECACHE* tilecache;       // decoded tiles, NULL for none
+	int cmyk_to_rgb;            // hand CMYK back as RGBA, from TIFF::cmyk_to_rgb
+	TIFFSTATS* stats;           // stage timings, from TIFF::stats
 
 	BASICHEADER ()
 	{
@@ -559,13 +1169,12 @@ public:
 		newsubfiletype = 0;
 		imagewidth = -1;
 		imageheight = -1;
-		bitspersample[0] = -1;
 		compression = COMPRESSION::COMPRESSION_NONE;
 		fillorder = 1;
 		photo_metric_interpretation = photo_metric_interpretations::PI_Not_Defined;
 		stripoffsets = NULL;
 		Nstripoffsets = 0;
-		samplesperpixel = 0;
+		samplesperpixel = 1;
 		rowsperstrip = 0;
 		stripbytecounts = NULL;
 		Nstripbytecounts = 0;
@@ -575,6 +1184,8 @@ public:
 		/*  Palette files */
 		colormap = NULL;
 		Ncolormap = 0;
+		palette = NULL;
+		Npalette = 0;
 		/* RGB */
 		planarconfiguration = 1;
 		predictor = 1;
@@ -596,6 +1207,10 @@ public:
 		//int ConsecutiveBadFaxLines;
 		T4options = 0;
 
+		jpegtables = NULL;
+
+		lercparameters = NULL;
+
 		tilewidth = 0;
 		tileheight = 0;
 		tileoffsets = NULL;
@@ -604,6 +1219,7 @@ public:
 		Ntilebytecounts = 0;
 
 		for (i = 0; i < 16;i++) {
+			bitspersample[i] = 1;   // the spec default, for every sample
 			sampleformat[i] = SAMPLE_FORMAT::SAMPLEFORMAT_UINT;
 		}
 		smaxsamplevalue = NULL;
@@ -612,6 +1228,13 @@ public:
 		Nsminsamplevalue = 0;
 		extrasamples = 0;
 		endianness = ENDIAN::NOT_DEFINED;
+		subifds = NULL;
+		Nsubifds = 0;
+		ifdoffset = 0;
+		nextifd = 0;
+		tilecache = NULL;
+		cmyk_to_rgb = 0;
+		stats = NULL;
 
 		//for cppcheck
 		BadFaxLines = 0;
@@ -626,21 +1249,70 @@ public:
 		delete[] tilebytecounts;
 		delete[] tileoffsets;
 		delete[] colormap;
+		delete[] palette;
 		delete[] smaxsamplevalue;
 		delete[] sminsamplevalue;
+		delete[] subifds;
+		delete jpegtables;
+		delete lercparameters;
 	}
+	void copy_from (const BASICHEADER& other);
 	//void header_defaults ();
 	//void freeheader ();
 	int header_fixupsections ();
+	void header_checksections (long filesize);
 	int header_not_ok ();
 	int fill_header (TAG* tags, int Ntags);
+	void build_palette ();
+	/// <summary>
+	/// packed RGBA for a palette index, opaque black if it is out of range
+	/// </summary>
+	unsigned int palette_entry (int index) const
+	{
+		static const BYTE black[4] = { 0, 0, 0, 255 };
+		unsigned int entry;
+		if (palette && index >= 0 && index < Npalette) {
+			return palette[index];
+		}
+		memcpy (&entry, black, 4);
+		return entry;
+	}
 	int header_Noutsamples ();
 	int header_Ninsamples ();
+	/// <summary>
+	/// CMYK converted to RGBA while unpacking. Planar CMYK is left as it is.
+	/// </summary>
+	bool cmyk_as_rgba () const
+	{
+		return cmyk_to_rgb && photo_metric_interpretation == photo_metric_interpretations::PI_CMYK && planarconfiguration != 2;
+	}
 	FMT header_outputformat ();
-	BYTE* load_raster (FileData* fd, FMT* format);
-	BYTE* read_strip (int index, int* strip_width, int* strip_height, FileData* fd, int* insamples);
-	BYTE* read_tile (int index, int* tile_width, int* tile_height, FileData* fd, int* insamples);
-	BYTE* read_channel (int index, int* channel_width, int* channel_height, FileData* fd);
+	BYTE* load_raster (FileData* fd, FMT* format, TIFFSTATUS* status = NULL, bool best_effort = false);
+	BYTE* load_planes (FileData* fd, FMT* format, int* Nplanes);
+	float* load_float (FileData* fd, int* Nsamples);
+	void samples_to_float (float* answer, int x, int y, int plane, int depth, BYTE* data, int width, int height);
+	int decode_planar (FileData* fd, PREFETCHER* prefetch, BYTE* answer, bool interleave, TIFFSTATUS* status = NULL, bool best_effort = false);
+	BYTE* new_raster (int scale = 1);
+	bool scaled_tiles (int scale);
+	BYTE* load_raster_scaled (FileData* fd, FMT* format, int scale);
+	int raster_sections ();
+	bool section_wanted (int index);
+	int paste_section (int index, FileData* fd, BYTE* answer, int top, int rows);
+	void section_region (int index, TIFFREGION* region);
+	void clear_section (int index, BYTE* answer);
+	PREFETCHER* start_prefetch (FileData* fd);
+	void wait_section (PREFETCHER* prefetch, int index);
+	BYTE* read_strip (int index, int* strip_width, int* strip_height, FileData* fd, int* insamples, int* err = NULL);
+	BYTE* read_tile (int index, int* tile_width, int* tile_height, FileData* fd, int* insamples, int scale = 1, int* err = NULL);
+	int decode_tile (int index, FileData* fd, BYTE* dst, int scale = 1);
+	int decode_strip (int index, FileData* fd, BYTE* dst);
+	int strip_rows (int index);
+	int section_bytes (int width, int height, int samples, unsigned long* bytes);
+	int section_channels ();
+	int section_job (CODECJOB* job, int width, int height, int samples, int scale = 1);
+	int convert_section (BYTE* dst, int width, int height, BYTE* data, unsigned long N);
+	BYTE* read_channel (int index, int* channel_width, int* channel_height, FileData* fd, int* err = NULL);
+	int decode_channel (int index, FileData* fd, BYTE* out, int stripheight);
 	/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
 	/* stip tile and plane loading section*/
 	/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
@@ -715,7 +1387,7 @@ enum class CCITT
 };
 
 
-BYTE* decompress (FileData* fd, unsigned long count, COMPRESSION compression, unsigned long* Nret, int width, int height, unsigned long T4options);
+BYTE* decompress (FileData* fd, unsigned long count, COMPRESSION compression, CODECJOB* job, unsigned long* Nret, int* err = NULL);
 TAG* load_header (FileData* fd, int* Ntags);
 void killtags (TAG* tags, int N);
 int load_tags (TAG* tag, FileData* fd);
@@ -733,12 +1405,22 @@ public:
 	int height;
 	int width;
 	FileData* fd;
+	TILECACHE* tilecache;   // optional, may be shared by many TIFFs
+	HEADERCACHE* headercache;
+	bool cmyk_to_rgb;       // return CMYK images as RGBA
+	bool best_effort;       // return the raster even if sections fail, see status
+	TIFFSTATUS status;      // sections of the last load that failed
+	TIFFSTATS stats;        // time spent per stage in the last load, TIFF_STATS builds only
 	TIFF ()
 	{
 		fd = new FileData ();
 		format = FMT::FMT_ERROR;
 		height = 0;
 		width = 0;
+		tilecache = NULL;
+		headercache = NULL;
+		cmyk_to_rgb = false;
+		best_effort = false;
 	}
 	~TIFF ()
 	{
@@ -748,14 +1430,106 @@ public:
 	/// t@Cǂݍ
 	/// </summary>
 	/// <param name="filename"></param>
-	void file_read (char* filename)
+	/// <returns>true if the file was read</returns>
+	bool file_read (const char* filename)
 	{
 		if (!fd->FileRead (filename)) {
 			perror ("error");
+			return false;
 		}
+		return true;
+	}
+	/// <summary>
+	/// open a file for pipelined loading; reading overlaps decoding
+	/// </summary>
+	/// <param name="filename"></param>
+	/// <param name="prefetch_depth">coalesced reads kept ahead of the decoder</param>
+	/// <returns>true if the file was opened</returns>
+	bool file_open (const char* filename, int prefetch_depth = 4)
+	{
+		fd->prefetch_depth = prefetch_depth > 0 ? prefetch_depth : 1;
+		return fd->FileOpen (filename);
 	}
 	BYTE* floadtiffwhite ();
 	BYTE* load_tiff ();
+	BYTE* load_tiff_planar (int* Nplanes);
+	BYTE* load_tiff_scaled (int scale);
+	float* load_tiff_float (int* Nsamples);
+	std::future<BYTE*> load_tiff_async (EXECUTOR* executor, std::function<void (const TIFFREGION& region)> on_region);
+	void parse_header (BASICHEADER* header);
+	void parse_ifd (BASICHEADER* header, unsigned long offset);
+	unsigned long long raster_bytes ();
+	int list_levels (std::vector<TIFFLEVEL>* levels);
+	BYTE* load_tiff_level (const TIFFLEVEL& level);
+	BYTE* load_tiff_closest (int width, int height);
+};
+
+/// <summary>
+/// reads an image row by row, top to bottom, holding only the strip
+/// (or row of tiles) that the current row is in.
+///   ROWREADER reader (&tiff);
+///   while ((row = reader.next_row ()) != NULL)
+///	     histogram (row, reader.width * reader.depth);
+/// Rows are in the same format load_tiff would return.
+/// </summary>
+class ROWREADER
+{
+private:
+	TIFF* tiff;
+	BASICHEADER header;
+	PREFETCHER* prefetch;
+	BYTE* band;         // decoded rows bandtop to bandtop + bandheight - 1
+	int bandtop;
+	int bandheight;
+	int bandindex;
+	bool load_band (int index);
+public:
+	int width;
+	int height;
+	FMT format;
+	int depth;          // bytes per pixel
+	int row;            // index of the row next_row will return
+	bool error;         // set if a strip failed to decode or is missing
+	explicit ROWREADER (TIFF* tiff);
+	~ROWREADER ();
+	const BYTE* next_row ();
+};
+
+/// <summary>
+/// reads the tiles of an image into caller supplied buffers, without
+/// allocating or pasting into a full raster.
+///   TILEREADER reader (&tiff);
+///   BYTE* tile = new BYTE[reader.tile_bytes ()];
+///   while (reader.next_tile (tile, &col, &row) || reader.error != SECTION_ERROR::SECTION_OK)
+///	     if (reader.error == SECTION_ERROR::SECTION_OK)
+///	         cache.put (col, row, tile);
+/// Tiles are in the file's own layout: depth bytes per pixel (grey, grey +
+/// alpha, RGB, RGBA, CMYK, CMYKA, palette expanded to RGBA), full tile size
+/// including the padding at the right and bottom edges.
+/// Strip images are read as one column of tiles imagewidth wide and
+/// RowsPerStrip high; the last one only holds the remaining rows.
+/// </summary>
+class TILEREADER
+{
+private:
+	TIFF* tiff;
+	BASICHEADER header;
+	PREFETCHER* prefetch;
+	int next;           // tile next_tile will decode
+public:
+	int width;          // image size
+	int height;
+	int tilewidth;
+	int tileheight;
+	int tilesacross;
+	int tilesdown;
+	int depth;          // bytes per pixel of a decoded tile
+	SECTION_ERROR error;    // why next_tile last returned false, SECTION_OK after the last tile
+	explicit TILEREADER (TIFF* tiff);
+	~TILEREADER ();
+	unsigned long tile_bytes ();
+	int decode_tile (int col, int row, BYTE* dst);
+	bool next_tile (BYTE* dst, int* col, int* row);
 };
 
 #endif
@@ -0,0 +1,149 @@
+#ifndef threadpool_h
+#define threadpool_h
+
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <queue>
+#include <vector>
+
+/// <summary>
+/// something that runs tasks, used by TIFF::load_tiff_async.
+/// </summary>
+class EXECUTOR
+{
+public:
+	virtual ~EXECUTOR ()
+	{
+	}
+	/// <summary>
+	/// run a task, now or later, on any thread
+	/// </summary>
+	/// <param name="task">the task, must not throw</param>
+	virtual void execute (std::function<void ()> task) = 0;
+};
+
+/// <summary>
+/// fixed size pool of worker threads.
+/// tasks are run in submission order by whichever worker is free.
+/// </summary>
+class THREADPOOL : public EXECUTOR
+{
+private:
+	std::vector<std::thread> workers;
+	std::queue<std::function<void ()>> tasks;
+	std::mutex lock;
+	std::condition_variable wakeup;
+	std::condition_variable idle;
+	int running;
+	bool stopping;
+
+	/// <summary>
+	/// worker loop. pops tasks until the pool is destroyed.
+	/// </summary>
+	void worker_main ()
+	{
+		for (;;) {
+			std::function<void ()> task;
+			{
+				std::unique_lock<std::mutex> guard (lock);
+				wakeup.wait (guard, [this] { return stopping || !tasks.empty (); });
+				if (tasks.empty ()) {
+					return;
+				}
+				task = std::move (tasks.front ());
+				tasks.pop ();
+				running++;
+			}
+			task ();
+			{
+				std::lock_guard<std::mutex> guard (lock);
+				running--;
+				if (running == 0 && tasks.empty ()) {
+					idle.notify_all ();
+				}
+			}
+		}
+	}
+public:
+	/// <summary>
+	/// start the workers
+	/// </summary>
+	/// <param name="nthreads">number of threads, 0 or less for one per core</param>
+	explicit THREADPOOL (int nthreads)
+	{
+		running = 0;
+		stopping = false;
+		if (nthreads <= 0) {
+			nthreads = default_threads ();
+		}
+		for (auto i = 0; i < nthreads; i++) {
+			workers.push_back (std::thread (&THREADPOOL::worker_main, this));
+		}
+	}
+
+	/// <summary>
+	/// finish the queued tasks and join the workers
+	/// </summary>
+	~THREADPOOL ()
+	{
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			stopping = true;
+		}
+		wakeup.notify_all ();
+		for (auto& worker : workers) {
+			worker.join ();
+		}
+	}
+
+	/// <summary>
+	/// queue a task
+	/// </summary>
+	/// <param name="task">the task, must not throw</param>
+	void submit (std::function<void ()> task)
+	{
+		{
+			std::lock_guard<std::mutex> guard (lock);
+			tasks.push (std::move (task));
+		}
+		wakeup.notify_one ();
+	}
+
+	/// <summary>
+	/// EXECUTOR interface, same as submit
+	/// </summary>
+	void execute (std::function<void ()> task) override
+	{
+		submit (std::move (task));
+	}
+
+	/// <summary>
+	/// block until every queued task has finished
+	/// </summary>
+	void wait_all ()
+	{
+		std::unique_lock<std::mutex> guard (lock);
+		idle.wait (guard, [this] { return running == 0 && tasks.empty (); });
+	}
+
+	/// <summary>
+	/// number of worker threads
+	/// </summary>
+	int size () const
+	{
+		return (int)workers.size ();
+	}
+
+	/// <summary>
+	/// one thread per core, at least one
+	/// </summary>
+	static int default_threads ()
+	{
+		int n = (int)std::thread::hardware_concurrency ();
+		return n > 0 ? n : 1;
+	}
+};
+
+#endif
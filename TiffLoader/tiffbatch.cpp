@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <string.h>
+#include <io.h> // _findfirst
+
+#include "tiffbatch.h"
+#include "threadpool.h"
+#include "headercache.h"
+
+/// <summary>
+///
+/// </summary>
+/// <param name="budget">bytes allowed in flight, 0 for no limit</param>
+MEMORYBUDGET::MEMORYBUDGET (unsigned long long budget)
+{
+	this->budget = budget;
+	used = 0;
+	nextticket = 0;
+}
+
+/// <summary>
+/// start a job, waiting until its first reservation fits
+/// </summary>
+/// <param name="bytes">bytes to reserve</param>
+/// <returns>ticket identifying the job</returns>
+long MEMORYBUDGET::acquire (unsigned long long bytes)
+{
+	std::unique_lock<std::mutex> guard (lock);
+	changed.wait (guard, [this, bytes] {
+		return budget == 0 || used + bytes <= budget || active.empty ();
+	});
+	used += bytes;
+	long ticket = nextticket++;
+	active.insert (ticket);
+	return ticket;
+}
+
+/// <summary>
+/// reserve more for a running job
+/// </summary>
+/// <param name="ticket">ticket from acquire</param>
+/// <param name="bytes">additional bytes</param>
+void MEMORYBUDGET::grow (long ticket, unsigned long long bytes)
+{
+	std::unique_lock<std::mutex> guard (lock);
+	changed.wait (guard, [this, ticket, bytes] {
+		return budget == 0 || used + bytes <= budget || *active.begin () == ticket;
+	});
+	used += bytes;
+}
+
+/// <summary>
+/// end a job and give back everything it reserved
+/// </summary>
+/// <param name="ticket">ticket from acquire</param>
+/// <param name="bytes">total reserved by the job</param>
+void MEMORYBUDGET::release (long ticket, unsigned long long bytes)
+{
+	{
+		std::lock_guard<std::mutex> guard (lock);
+		used -= bytes;
+		active.erase (ticket);
+	}
+	changed.notify_all ();
+}
+
+/// <summary>
+/// add one file to the batch
+/// </summary>
+/// <param name="filename"></param>
+void TIFFBATCH::add_file (const char* filename)
+{
+	files.push_back (filename);
+}
+
+/// <summary>
+/// add the files named in a text file, one per line
+/// </summary>
+/// <param name="listfile"></param>
+/// <returns>number of files added, -1 if the list can't be read</returns>
+int TIFFBATCH::add_list (const char* listfile)
+{
+	FILE* fp = NULL;
+	char line[1024];
+	int N = 0;
+
+	fopen_s (&fp, listfile, "r");
+	if (!fp) {
+		return -1;
+	}
+	while (fgets (line, sizeof (line), fp)) {
+		size_t len = strlen (line);
+		while (len > 0 && (line[len - 1] == '\n' || line[len - 1] == '\r' || line[len - 1] == ' ')) {
+			line[--len] = 0;
+		}
+		if (len == 0 || line[0] == '#') {
+			continue;
+		}
+		add_file (line);
+		N++;
+	}
+	fclose (fp);
+	return N;
+}
+
+/// <summary>
+/// add every .tif / .tiff file in a directory (not recursive)
+/// </summary>
+/// <param name="directory"></param>
+/// <returns>number of files added, -1 if the directory can't be read</returns>
+int TIFFBATCH::add_directory (const char* directory)
+{
+	const char* patterns[2] = { "*.tif", "*.tiff" };
+	struct _finddata_t found;
+	std::string dir = directory;
+	int N = 0;
+	bool opened = false;
+
+	if (!dir.empty () && dir.back () != '\\' && dir.back () != '/') {
+		dir += "\\";
+	}
+	for (auto i = 0; i < 2; i++) {
+		intptr_t handle = _findfirst ((dir + patterns[i]).c_str (), &found);
+		if (handle == -1) {
+			continue;
+		}
+		opened = true;
+		do {
+			if (found.attrib & _A_SUBDIR) {
+				continue;
+			}
+			add_file ((dir + found.name).c_str ());
+			N++;
+		} while (_findnext (handle, &found) == 0);
+		_findclose (handle);
+	}
+	return opened ? N : -1;
+}
+
+/// <summary>
+/// decode every file, calling on_result as each one finishes
+/// </summary>
+/// <returns>number of files that failed</returns>
+int TIFFBATCH::run ()
+{
+	MEMORYBUDGET memory (memory_budget);
+	int failures = 0;
+	{
+		THREADPOOL pool (threads);
+		for (auto i = 0; i < (int)files.size (); i++) {
+			pool.submit ([this, i, &memory, &failures] { decode_one (i, &memory, &failures); });
+		}
+		pool.wait_all ();
+	}
+	return failures;
+}
+
+/// <summary>
+/// worker body: read, size, decode and report one file.
+/// The file data is reserved first, then the raster once the header has
+/// been parsed and its size is known. The parse is kept for the decode.
+/// </summary>
+/// <param name="index">index in the file list</param>
+/// <param name="memory">shared budget</param>
+/// <param name="failures">failure counter (guarded by resultlock)</param>
+void TIFFBATCH::decode_one (int index, MEMORYBUDGET* memory, int* failures)
+{
+	BATCHRESULT result;
+	unsigned long long reserved = 0;
+	long ticket;
+	long long filesize;
+
+	result.index = index;
+	result.filename = files[index].c_str ();
+
+	filesize = FileData::FileSize (result.filename);
+	reserved = filesize > 0 ? filesize : 0;
+	ticket = memory->acquire (reserved);
+	if (filesize < 0) {
+		result.error = "file_error";
+	}
+	else {
+		TIFF tiff;
+		HEADERCACHE header (1);     // sizing the raster parses the header load_tiff needs
+		tiff.cmyk_to_rgb = cmyk_to_rgb;
+		tiff.best_effort = best_effort;
+		tiff.headercache = &header;
+		try {
+			if (!tiff.fd->FileRead (result.filename)) {
+				throw general_exception ("file_error");
+			}
+			unsigned long long rasterbytes = tiff.raster_bytes ();
+			memory->grow (ticket, rasterbytes);
+			reserved += rasterbytes;
+			result.data = tiff.load_tiff ();
+			result.status = tiff.status;
+			if (!result.data) {
+				throw general_exception ("decode_error");
+			}
+			result.width = tiff.width;
+			result.height = tiff.height;
+			result.format = tiff.format;
+		}
+		catch (general_exception e) {
+			result.error = e.what ();
+		}
+		catch (...) {
+			result.error = "out_of_memory";
+		}
+	}
+
+	{
+		std::lock_guard<std::mutex> guard (resultlock);
+		if (!result.data) {
+			(*failures)++;
+		}
+		if (on_result) {
+			on_result (&result);
+		}
+	}
+	delete[] result.data;
+	memory->release (ticket, reserved);
+}
@@ -0,0 +1,118 @@
+#ifndef tiffbatch_h
+#define tiffbatch_h
+
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <set>
+#include <string>
+#include <vector>
+#include "loadtiff.h"
+
+/*
+  Batch loader, decodes many files concurrently.
+
+  To use
+	TIFFBATCH batch;
+	batch.threads = 8;
+	batch.memory_budget = 512 * 1024 * 1024;
+	batch.add_directory ("C:\\scans");
+	batch.on_result = [] (BATCHRESULT* result) {
+		if (result->data)
+			consume (result->data, result->width, result->height, result->format);
+		else
+			printf ("%s: %s\n", result->filename, result->error);
+	};
+	failures = batch.run ();
+
+  on_result is called once per file as soon as that file is finished,
+  in completion order, never from two threads at once.
+  The raster is freed when on_result returns; set data to 0 to keep it
+  (the caller then owns it and must delete[] it).
+
+  With best_effort set a file with damaged strips or tiles still comes
+  back, result->status saying which sections are missing.
+*/
+
+/// <summary>
+/// outcome of one file
+/// </summary>
+class BATCHRESULT
+{
+public:
+	int index;              // position in the file list
+	const char* filename;
+	BYTE* data;             // raster, 0 on error
+	int width;
+	int height;
+	FMT format;
+	const char* error;      // reason, 0 on success
+	TIFFSTATUS status;      // sections that failed, filled whenever the header was read
+	BATCHRESULT ()
+	{
+		index = -1;
+		filename = NULL;
+		data = NULL;
+		width = 0;
+		height = 0;
+		format = FMT::FMT_ERROR;
+		error = NULL;
+	}
+};
+
+/// <summary>
+/// counting limit on bytes held by in-flight decodes.
+/// A request larger than the whole budget is still admitted once nothing
+/// else is held, and the oldest job is always allowed to grow, so a job can
+/// never wait forever.
+/// </summary>
+class MEMORYBUDGET
+{
+private:
+	std::mutex lock;
+	std::condition_variable changed;
+	unsigned long long budget;
+	unsigned long long used;
+	std::set<long> active;  // tickets of jobs holding memory
+	long nextticket;
+public:
+	explicit MEMORYBUDGET (unsigned long long budget);
+	long acquire (unsigned long long bytes);
+	void grow (long ticket, unsigned long long bytes);
+	void release (long ticket, unsigned long long bytes);
+};
+
+/// <summary>
+/// decodes a list of files on a thread pool under a memory budget
+/// </summary>
+class TIFFBATCH
+{
+private:
+	std::vector<std::string> files;
+	std::mutex resultlock;
+	void decode_one (int index, MEMORYBUDGET* memory, int* failures);
+public:
+	int threads;                          // worker threads, 0 for one per core
+	unsigned long long memory_budget;     // bytes of file data plus rasters in flight, 0 for no limit
+	bool cmyk_to_rgb;                     // hand CMYK files back as RGBA
+	bool best_effort;                     // keep rasters with failed sections, see BATCHRESULT::status
+	std::function<void (BATCHRESULT* result)> on_result;
+
+	TIFFBATCH ()
+	{
+		threads = 0;
+		memory_budget = 0;
+		cmyk_to_rgb = false;
+		best_effort = false;
+	}
+	void add_file (const char* filename);
+	int add_list (const char* listfile);
+	int add_directory (const char* directory);
+	int count () const
+	{
+		return (int)files.size ();
+	}
+	int run ();
+};
+
+#endif
@@ -0,0 +1,143 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "tilecache.h"
+
+/// <summary>
+///
+/// </summary>
+/// <param name="capacity">bytes of decoded tiles to keep</param>
+TILECACHE::TILECACHE (unsigned long long capacity)
+{
+	this->capacity = capacity;
+	used = 0;
+	hits = 0;
+	misses = 0;
+}
+
+/// <summary>
+///
+/// </summary>
+TILECACHE::~TILECACHE ()
+{
+	clear ();
+}
+
+/// <summary>
+/// one string key for file, IFD and tile
+/// </summary>
+std::string TILECACHE::make_key (const std::string& file, unsigned long ifd, int tile)
+{
+	char buff[64];
+	sprintf_s (buff, "#%lu#%d", ifd, tile);
+	return file + buff;
+}
+
+/// <summary>
+/// copy a cached tile out
+/// </summary>
+/// <param name="file">FileData::identity of the file</param>
+/// <param name="ifd">IFD offset</param>
+/// <param name="tile">tile index</param>
+/// <param name="dst">buffer for the tile</param>
+/// <param name="bytes">size of the tile</param>
+/// <returns>true if the tile was in the cache</returns>
+bool TILECACHE::get (const std::string& file, unsigned long ifd, int tile, BYTE* dst, unsigned long bytes)
+{
+	if (file.empty ()) {
+		return false;
+	}
+	std::string key = make_key (file, ifd, tile);
+	std::lock_guard<std::mutex> guard (lock);
+	auto found = index.find (key);
+	if (found == index.end () || found->second->bytes != bytes) {
+		misses++;
+		return false;
+	}
+	entries.splice (entries.begin (), entries, found->second);
+	memcpy (dst, found->second->data, bytes);
+	hits++;
+	return true;
+}
+
+/// <summary>
+/// add a tile, dropping old ones to stay under the cap.
+/// Tiles bigger than the whole cache aren't kept.
+/// </summary>
+/// <param name="file">FileData::identity of the file</param>
+/// <param name="ifd">IFD offset</param>
+/// <param name="tile">tile index</param>
+/// <param name="src">the decoded tile</param>
+/// <param name="bytes">size of the tile</param>
+void TILECACHE::put (const std::string& file, unsigned long ifd, int tile, const BYTE* src, unsigned long bytes)
+{
+	if (file.empty () || bytes > capacity) {
+		return;
+	}
+	std::string key = make_key (file, ifd, tile);
+	BYTE* data = new BYTE[bytes];
+	if (!data) {
+		return;
+	}
+	memcpy (data, src, bytes);
+
+	std::lock_guard<std::mutex> guard (lock);
+	auto found = index.find (key);
+	if (found != index.end ()) {
+		// another thread decoded it too
+		used -= found->second->bytes;
+		delete[] found->second->data;
+		entries.erase (found->second);
+		index.erase (found);
+	}
+	ENTRY entry;
+	entry.key = key;
+	entry.data = data;
+	entry.bytes = bytes;
+	entries.push_front (entry);
+	index[key] = entries.begin ();
+	used += bytes;
+	evict ();
+}
+
+/// <summary>
+/// drop least recently used tiles until under the cap. lock must be held.
+/// </summary>
+void TILECACHE::evict ()
+{
+	while (used > capacity && !entries.empty ()) {
+		ENTRY& last = entries.back ();
+		used -= last.bytes;
+		delete[] last.data;
+		index.erase (last.key);
+		entries.pop_back ();
+	}
+}
+
+/// <summary>
+/// drop every tile
+/// </summary>
+void TILECACHE::clear ()
+{
+	std::lock_guard<std::mutex> guard (lock);
+	for (auto& entry : entries) {
+		delete[] entry.data;
+	}
+	entries.clear ();
+	index.clear ();
+	used = 0;
+}
+
+/// <summary>
+/// counters, for tuning the cap
+/// </summary>
+/// <param name="hits">return for lookups served from the cache</param>
+/// <param name="misses">return for lookups that weren't</param>
+/// <param name="used">return for bytes held</param>
+void TILECACHE::stats (unsigned long long* hits, unsigned long long* misses, unsigned long long* used)
+{
+	std::lock_guard<std::mutex> guard (lock);
+	*hits = this->hits;
+	*misses = this->misses;
+	*used = this->used;
+}
@@ -0,0 +1,57 @@
+#ifndef tilecache_h
+#define tilecache_h
+
+#include <mutex>
+#include <list>
+#include <string>
+#include <unordered_map>
+
+typedef unsigned char BYTE;
+
+/*
+  Decoded tile cache, shared by any number of TIFF objects and threads.
+
+  To use
+	TILECACHE cache (256 * 1024 * 1024);
+	TIFF tiff;
+	tiff.tilecache = &cache;
+	tiff.file_read ("C:\\big.tif");
+	data = tiff.load_tiff ();
+
+  Tiles are keyed by file (path, size and mtime), IFD offset and tile
+  index, so a changed file never hits stale tiles. When the cap is passed
+  the least recently used tiles are dropped.
+*/
+
+/// <summary>
+/// thread safe LRU cache of decoded tiles with a byte size cap
+/// </summary>
+class TILECACHE
+{
+private:
+	class ENTRY
+	{
+	public:
+		std::string key;
+		BYTE* data;
+		unsigned long bytes;
+	};
+	std::mutex lock;
+	std::list<ENTRY> entries;   // most recently used first
+	std::unordered_map<std::string, std::list<ENTRY>::iterator> index;
+	unsigned long long capacity;
+	unsigned long long used;
+	unsigned long long hits;
+	unsigned long long misses;
+	static std::string make_key (const std::string& file, unsigned long ifd, int tile);
+	void evict ();
+public:
+	explicit TILECACHE (unsigned long long capacity);
+	~TILECACHE ();
+	bool get (const std::string& file, unsigned long ifd, int tile, BYTE* dst, unsigned long bytes);
+	void put (const std::string& file, unsigned long ifd, int tile, const BYTE* src, unsigned long bytes);
+	void clear ();
+	void stats (unsigned long long* hits, unsigned long long* misses, unsigned long long* used);
+};
+
+#endif
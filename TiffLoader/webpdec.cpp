@@ -0,0 +1,2750 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "loadtiff.h"
+#include "webpdec.h"
+
+#if TIFF_WEBP
+
+#include "bitreader.h"
+
+#define WEBP_BPS 32                     // stride of the macroblock work areas
+#define VP8L_MAGIC 0x2F
+#define VP8L_MAXCACHEBITS 11
+
+enum
+{
+	TRANSFORM_PREDICTOR = 0,
+	TRANSFORM_CROSSCOLOR = 1,
+	TRANSFORM_SUBTRACTGREEN = 2,
+	TRANSFORM_COLORINDEXING = 3,
+};
+
+// the lengths of the code length code come in this order
+static const BYTE codelengthorder[19] = {
+	17, 18, 0, 1, 2, 3, 4, 5, 16, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15
+};
+
+// alphabet sizes of the five codes of a group: green (without the color cache), red, blue, alpha, distance
+static const int alphabetsize[5] = { 256 + 24, 256, 256, 256, 40 };
+
+// sub-block mode tree, leaves as minus the mode
+static const signed char bmodetree[18] = {
+	0, 1, -1, 2, -2, 3, 4, 6, -3, 5, -4, -5, -6, 7, -7, 8, -8, -9
+};
+
+// coefficient position to probability band
+static const BYTE bands[17] = {
+	0, 1, 2, 3, 6, 4, 5, 6, 6, 6, 6, 6, 6, 6, 6, 7, 0
+};
+
+static const BYTE zigzag[16] = {
+	0, 1, 4, 8, 5, 2, 3, 6, 9, 12, 13, 10, 7, 11, 14, 15
+};
+
+// extra bit probabilities of the four largest coefficient categories
+static const BYTE cat3[] = { 173, 148, 140, 0 };
+static const BYTE cat4[] = { 176, 155, 140, 135, 0 };
+static const BYTE cat5[] = { 180, 157, 141, 134, 130, 0 };
+static const BYTE cat6[] = { 254, 254, 243, 230, 196, 177, 153, 140, 133, 130, 129, 0 };
+static const BYTE* const cat3456[4] = { cat3, cat4, cat5, cat6 };
+
+// shift that brings a range back to 128 - 255
+static const BYTE normshift[256] = {
+	0, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
+	3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+};
+
+// probabilities that a key frame updates each token probability
+static const BYTE coeffupdate[4][8][3][11] = {
+	{
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 176, 246, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 223, 241, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 249, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 244, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 234, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 253, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 246, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 239, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 248, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 251, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 251, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 253, 255, 254, 255, 255, 255, 255, 255, 255 },
+		  { 250, 255, 254, 255, 254, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } }
+	},
+	{
+		{ { 217, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 225, 252, 241, 253, 255, 255, 254, 255, 255, 255, 255 },
+		  { 234, 250, 241, 250, 253, 255, 253, 254, 255, 255, 255 } },
+		{ { 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 223, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 238, 253, 254, 254, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 248, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 249, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 253, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 247, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 252, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 253, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 250, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } }
+	},
+	{
+		{ { 186, 251, 250, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 234, 251, 244, 254, 255, 255, 255, 255, 255, 255, 255 },
+		  { 251, 251, 243, 253, 254, 255, 254, 255, 255, 255, 255 } },
+		{ { 255, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 236, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 251, 253, 253, 254, 254, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 254, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } }
+	},
+	{
+		{ { 248, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 250, 254, 252, 254, 255, 255, 255, 255, 255, 255, 255 },
+		  { 248, 254, 249, 253, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 246, 253, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 252, 254, 251, 254, 254, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 254, 252, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 248, 254, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 253, 255, 254, 254, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 251, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 245, 251, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 253, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 251, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 252, 253, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 254, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 252, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 249, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 254, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 253, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 250, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } },
+		{ { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 254, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 },
+		  { 255, 255, 255, 255, 255, 255, 255, 255, 255, 255, 255 } }
+	}
+};
+
+// token probabilities before any updates
+static const BYTE coeffdefault[4][8][3][11] = {
+	{
+		{ { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 } },
+		{ { 253, 136, 254, 255, 228, 219, 128, 128, 128, 128, 128 },
+		  { 189, 129, 242, 255, 227, 213, 255, 219, 128, 128, 128 },
+		  { 106, 126, 227, 252, 214, 209, 255, 255, 128, 128, 128 } },
+		{ { 1, 98, 248, 255, 236, 226, 255, 255, 128, 128, 128 },
+		  { 181, 133, 238, 254, 221, 234, 255, 154, 128, 128, 128 },
+		  { 78, 134, 202, 247, 198, 180, 255, 219, 128, 128, 128 } },
+		{ { 1, 185, 249, 255, 243, 255, 128, 128, 128, 128, 128 },
+		  { 184, 150, 247, 255, 236, 224, 128, 128, 128, 128, 128 },
+		  { 77, 110, 216, 255, 236, 230, 128, 128, 128, 128, 128 } },
+		{ { 1, 101, 251, 255, 241, 255, 128, 128, 128, 128, 128 },
+		  { 170, 139, 241, 252, 236, 209, 255, 255, 128, 128, 128 },
+		  { 37, 116, 196, 243, 228, 255, 255, 255, 128, 128, 128 } },
+		{ { 1, 204, 254, 255, 245, 255, 128, 128, 128, 128, 128 },
+		  { 207, 160, 250, 255, 238, 128, 128, 128, 128, 128, 128 },
+		  { 102, 103, 231, 255, 211, 171, 128, 128, 128, 128, 128 } },
+		{ { 1, 152, 252, 255, 240, 255, 128, 128, 128, 128, 128 },
+		  { 177, 135, 243, 255, 234, 225, 128, 128, 128, 128, 128 },
+		  { 80, 129, 211, 255, 194, 224, 128, 128, 128, 128, 128 } },
+		{ { 1, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 246, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 255, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 } }
+	},
+	{
+		{ { 198, 35, 237, 223, 193, 187, 162, 160, 145, 155, 62 },
+		  { 131, 45, 198, 221, 172, 176, 220, 157, 252, 221, 1 },
+		  { 68, 47, 146, 208, 149, 167, 221, 162, 255, 223, 128 } },
+		{ { 1, 149, 241, 255, 221, 224, 255, 255, 128, 128, 128 },
+		  { 184, 141, 234, 253, 222, 220, 255, 199, 128, 128, 128 },
+		  { 81, 99, 181, 242, 176, 190, 249, 202, 255, 255, 128 } },
+		{ { 1, 129, 232, 253, 214, 197, 242, 196, 255, 255, 128 },
+		  { 99, 121, 210, 250, 201, 198, 255, 202, 128, 128, 128 },
+		  { 23, 91, 163, 242, 170, 187, 247, 210, 255, 255, 128 } },
+		{ { 1, 200, 246, 255, 234, 255, 128, 128, 128, 128, 128 },
+		  { 109, 178, 241, 255, 231, 245, 255, 255, 128, 128, 128 },
+		  { 44, 130, 201, 253, 205, 192, 255, 255, 128, 128, 128 } },
+		{ { 1, 132, 239, 251, 219, 209, 255, 165, 128, 128, 128 },
+		  { 94, 136, 225, 251, 218, 190, 255, 255, 128, 128, 128 },
+		  { 22, 100, 174, 245, 186, 161, 255, 199, 128, 128, 128 } },
+		{ { 1, 182, 249, 255, 232, 235, 128, 128, 128, 128, 128 },
+		  { 124, 143, 241, 255, 227, 234, 128, 128, 128, 128, 128 },
+		  { 35, 77, 181, 251, 193, 211, 255, 205, 128, 128, 128 } },
+		{ { 1, 157, 247, 255, 236, 231, 255, 255, 128, 128, 128 },
+		  { 121, 141, 235, 255, 225, 227, 255, 255, 128, 128, 128 },
+		  { 45, 99, 188, 251, 195, 217, 255, 224, 128, 128, 128 } },
+		{ { 1, 1, 251, 255, 213, 255, 128, 128, 128, 128, 128 },
+		  { 203, 1, 248, 255, 255, 128, 128, 128, 128, 128, 128 },
+		  { 137, 1, 177, 255, 224, 255, 128, 128, 128, 128, 128 } }
+	},
+	{
+		{ { 253, 9, 248, 251, 207, 208, 255, 192, 128, 128, 128 },
+		  { 175, 13, 224, 243, 193, 185, 249, 198, 255, 255, 128 },
+		  { 73, 17, 171, 221, 161, 179, 236, 167, 255, 234, 128 } },
+		{ { 1, 95, 247, 253, 212, 183, 255, 255, 128, 128, 128 },
+		  { 239, 90, 244, 250, 211, 209, 255, 255, 128, 128, 128 },
+		  { 155, 77, 195, 248, 188, 195, 255, 255, 128, 128, 128 } },
+		{ { 1, 24, 239, 251, 218, 219, 255, 205, 128, 128, 128 },
+		  { 201, 51, 219, 255, 196, 186, 128, 128, 128, 128, 128 },
+		  { 69, 46, 190, 239, 201, 218, 255, 228, 128, 128, 128 } },
+		{ { 1, 191, 251, 255, 255, 128, 128, 128, 128, 128, 128 },
+		  { 223, 165, 249, 255, 213, 255, 128, 128, 128, 128, 128 },
+		  { 141, 124, 248, 255, 255, 128, 128, 128, 128, 128, 128 } },
+		{ { 1, 16, 248, 255, 255, 128, 128, 128, 128, 128, 128 },
+		  { 190, 36, 230, 255, 236, 255, 128, 128, 128, 128, 128 },
+		  { 149, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 } },
+		{ { 1, 226, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 247, 192, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 240, 128, 255, 128, 128, 128, 128, 128, 128, 128, 128 } },
+		{ { 1, 134, 252, 255, 255, 128, 128, 128, 128, 128, 128 },
+		  { 213, 62, 250, 255, 255, 128, 128, 128, 128, 128, 128 },
+		  { 55, 93, 255, 128, 128, 128, 128, 128, 128, 128, 128 } },
+		{ { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128 } }
+	},
+	{
+		{ { 202, 24, 213, 235, 186, 191, 220, 160, 240, 175, 255 },
+		  { 126, 38, 182, 232, 169, 184, 228, 174, 255, 187, 128 },
+		  { 61, 46, 138, 219, 151, 178, 240, 170, 255, 216, 128 } },
+		{ { 1, 112, 230, 250, 199, 191, 247, 159, 255, 255, 128 },
+		  { 166, 109, 228, 252, 211, 215, 255, 174, 128, 128, 128 },
+		  { 39, 77, 162, 232, 172, 180, 245, 178, 255, 255, 128 } },
+		{ { 1, 52, 220, 246, 198, 199, 249, 220, 255, 255, 128 },
+		  { 124, 74, 191, 243, 183, 193, 250, 221, 255, 255, 128 },
+		  { 24, 71, 130, 219, 154, 170, 243, 182, 255, 255, 128 } },
+		{ { 1, 182, 225, 249, 219, 240, 255, 224, 128, 128, 128 },
+		  { 149, 150, 226, 252, 216, 205, 255, 171, 128, 128, 128 },
+		  { 28, 108, 170, 242, 183, 194, 254, 223, 255, 255, 128 } },
+		{ { 1, 81, 230, 252, 204, 203, 255, 192, 128, 128, 128 },
+		  { 123, 102, 209, 247, 188, 196, 255, 233, 128, 128, 128 },
+		  { 20, 95, 153, 243, 164, 173, 255, 203, 128, 128, 128 } },
+		{ { 1, 222, 248, 255, 216, 213, 128, 128, 128, 128, 128 },
+		  { 168, 175, 246, 252, 235, 205, 255, 255, 128, 128, 128 },
+		  { 47, 116, 215, 255, 211, 212, 255, 255, 128, 128, 128 } },
+		{ { 1, 121, 236, 253, 212, 214, 255, 255, 128, 128, 128 },
+		  { 141, 84, 213, 252, 201, 202, 255, 219, 128, 128, 128 },
+		  { 42, 80, 160, 240, 162, 185, 255, 205, 128, 128, 128 } },
+		{ { 1, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 244, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 },
+		  { 238, 1, 255, 128, 128, 128, 128, 128, 128, 128, 128 } }
+	}
+};
+
+// sub-block mode probabilities, by the modes above and to the left
+static const BYTE bmodeprob[10][10][9] = {
+	{
+		{ 231, 120, 48, 89, 115, 113, 120, 152, 112 },
+		{ 152, 179, 64, 126, 170, 118, 46, 70, 95 },
+		{ 175, 69, 143, 80, 85, 82, 72, 155, 103 },
+		{ 56, 58, 10, 171, 218, 189, 17, 13, 152 },
+		{ 114, 26, 17, 163, 44, 195, 21, 10, 173 },
+		{ 121, 24, 80, 195, 26, 62, 44, 64, 85 },
+		{ 144, 71, 10, 38, 171, 213, 144, 34, 26 },
+		{ 170, 46, 55, 19, 136, 160, 33, 206, 71 },
+		{ 63, 20, 8, 114, 114, 208, 12, 9, 226 },
+		{ 81, 40, 11, 96, 182, 84, 29, 16, 36 }
+	},
+	{
+		{ 134, 183, 89, 137, 98, 101, 106, 165, 148 },
+		{ 72, 187, 100, 130, 157, 111, 32, 75, 80 },
+		{ 66, 102, 167, 99, 74, 62, 40, 234, 128 },
+		{ 41, 53, 9, 178, 241, 141, 26, 8, 107 },
+		{ 74, 43, 26, 146, 73, 166, 49, 23, 157 },
+		{ 65, 38, 105, 160, 51, 52, 31, 115, 128 },
+		{ 104, 79, 12, 27, 217, 255, 87, 17, 7 },
+		{ 87, 68, 71, 44, 114, 51, 15, 186, 23 },
+		{ 47, 41, 14, 110, 182, 183, 21, 17, 194 },
+		{ 66, 45, 25, 102, 197, 189, 23, 18, 22 }
+	},
+	{
+		{ 88, 88, 147, 150, 42, 46, 45, 196, 205 },
+		{ 43, 97, 183, 117, 85, 38, 35, 179, 61 },
+		{ 39, 53, 200, 87, 26, 21, 43, 232, 171 },
+		{ 56, 34, 51, 104, 114, 102, 29, 93, 77 },
+		{ 39, 28, 85, 171, 58, 165, 90, 98, 64 },
+		{ 34, 22, 116, 206, 23, 34, 43, 166, 73 },
+		{ 107, 54, 32, 26, 51, 1, 81, 43, 31 },
+		{ 68, 25, 106, 22, 64, 171, 36, 225, 114 },
+		{ 34, 19, 21, 102, 132, 188, 16, 76, 124 },
+		{ 62, 18, 78, 95, 85, 57, 50, 48, 51 }
+	},
+	{
+		{ 193, 101, 35, 159, 215, 111, 89, 46, 111 },
+		{ 60, 148, 31, 172, 219, 228, 21, 18, 111 },
+		{ 112, 113, 77, 85, 179, 255, 38, 120, 114 },
+		{ 40, 42, 1, 196, 245, 209, 10, 25, 109 },
+		{ 88, 43, 29, 140, 166, 213, 37, 43, 154 },
+		{ 61, 63, 30, 155, 67, 45, 68, 1, 209 },
+		{ 100, 80, 8, 43, 154, 1, 51, 26, 71 },
+		{ 142, 78, 78, 16, 255, 128, 34, 197, 171 },
+		{ 41, 40, 5, 102, 211, 183, 4, 1, 221 },
+		{ 51, 50, 17, 168, 209, 192, 23, 25, 82 }
+	},
+	{
+		{ 138, 31, 36, 171, 27, 166, 38, 44, 229 },
+		{ 67, 87, 58, 169, 82, 115, 26, 59, 179 },
+		{ 63, 59, 90, 180, 59, 166, 93, 73, 154 },
+		{ 40, 40, 21, 116, 143, 209, 34, 39, 175 },
+		{ 47, 15, 16, 183, 34, 223, 49, 45, 183 },
+		{ 46, 17, 33, 183, 6, 98, 15, 32, 183 },
+		{ 57, 46, 22, 24, 128, 1, 54, 17, 37 },
+		{ 65, 32, 73, 115, 28, 128, 23, 128, 205 },
+		{ 40, 3, 9, 115, 51, 192, 18, 6, 223 },
+		{ 87, 37, 9, 115, 59, 77, 64, 21, 47 }
+	},
+	{
+		{ 104, 55, 44, 218, 9, 54, 53, 130, 226 },
+		{ 64, 90, 70, 205, 40, 41, 23, 26, 57 },
+		{ 54, 57, 112, 184, 5, 41, 38, 166, 213 },
+		{ 30, 34, 26, 133, 152, 116, 10, 32, 134 },
+		{ 39, 19, 53, 221, 26, 114, 32, 73, 255 },
+		{ 31, 9, 65, 234, 2, 15, 1, 118, 73 },
+		{ 75, 32, 12, 51, 192, 255, 160, 43, 51 },
+		{ 88, 31, 35, 67, 102, 85, 55, 186, 85 },
+		{ 56, 21, 23, 111, 59, 205, 45, 37, 192 },
+		{ 55, 38, 70, 124, 73, 102, 1, 34, 98 }
+	},
+	{
+		{ 125, 98, 42, 88, 104, 85, 117, 175, 82 },
+		{ 95, 84, 53, 89, 128, 100, 113, 101, 45 },
+		{ 75, 79, 123, 47, 51, 128, 81, 171, 1 },
+		{ 57, 17, 5, 71, 102, 57, 53, 41, 49 },
+		{ 38, 33, 13, 121, 57, 73, 26, 1, 85 },
+		{ 41, 10, 67, 138, 77, 110, 90, 47, 114 },
+		{ 115, 21, 2, 10, 102, 255, 166, 23, 6 },
+		{ 101, 29, 16, 10, 85, 128, 101, 196, 26 },
+		{ 57, 18, 10, 102, 102, 213, 34, 20, 43 },
+		{ 117, 20, 15, 36, 163, 128, 68, 1, 26 }
+	},
+	{
+		{ 102, 61, 71, 37, 34, 53, 31, 243, 192 },
+		{ 69, 60, 71, 38, 73, 119, 28, 222, 37 },
+		{ 68, 45, 128, 34, 1, 47, 11, 245, 171 },
+		{ 62, 17, 19, 70, 146, 85, 55, 62, 70 },
+		{ 37, 43, 37, 154, 100, 163, 85, 160, 1 },
+		{ 63, 9, 92, 136, 28, 64, 32, 201, 85 },
+		{ 75, 15, 9, 9, 64, 255, 184, 119, 16 },
+		{ 86, 6, 28, 5, 64, 255, 25, 248, 1 },
+		{ 56, 8, 17, 132, 137, 255, 55, 116, 128 },
+		{ 58, 15, 20, 82, 135, 57, 26, 121, 40 }
+	},
+	{
+		{ 164, 50, 31, 137, 154, 133, 25, 35, 218 },
+		{ 51, 103, 44, 131, 131, 123, 31, 6, 158 },
+		{ 86, 40, 64, 135, 148, 224, 45, 183, 128 },
+		{ 22, 26, 17, 131, 240, 154, 14, 1, 209 },
+		{ 45, 16, 21, 91, 64, 222, 7, 1, 197 },
+		{ 56, 21, 39, 155, 60, 138, 23, 102, 213 },
+		{ 83, 12, 13, 54, 192, 255, 68, 47, 28 },
+		{ 85, 26, 85, 85, 128, 128, 32, 146, 171 },
+		{ 18, 11, 7, 63, 144, 171, 4, 4, 246 },
+		{ 35, 27, 10, 146, 174, 171, 12, 26, 128 }
+	},
+	{
+		{ 190, 80, 35, 99, 180, 80, 126, 54, 45 },
+		{ 85, 126, 47, 87, 176, 51, 41, 20, 32 },
+		{ 101, 75, 128, 139, 118, 146, 116, 128, 85 },
+		{ 56, 41, 15, 176, 236, 85, 37, 9, 62 },
+		{ 71, 30, 17, 119, 118, 255, 17, 18, 138 },
+		{ 101, 38, 60, 138, 55, 70, 43, 26, 142 },
+		{ 146, 36, 19, 30, 171, 255, 97, 27, 20 },
+		{ 138, 45, 61, 62, 219, 1, 81, 188, 64 },
+		{ 32, 41, 20, 117, 151, 142, 20, 21, 163 },
+		{ 112, 19, 12, 61, 195, 128, 48, 4, 24 }
+	}
+};
+
+// quantiser index to step size
+static const BYTE dctable[128] = {
+	4, 5, 6, 7, 8, 9, 10, 10, 11, 12, 13, 14, 15, 16, 17, 17,
+	18, 19, 20, 20, 21, 21, 22, 22, 23, 23, 24, 25, 25, 26, 27, 28,
+	29, 30, 31, 32, 33, 34, 35, 36, 37, 37, 38, 39, 40, 41, 42, 43,
+	44, 45, 46, 46, 47, 48, 49, 50, 51, 52, 53, 54, 55, 56, 57, 58,
+	59, 60, 61, 62, 63, 64, 65, 66, 67, 68, 69, 70, 71, 72, 73, 74,
+	75, 76, 76, 77, 78, 79, 80, 81, 82, 83, 84, 85, 86, 87, 88, 89,
+	91, 93, 95, 96, 98, 100, 101, 102, 104, 106, 108, 110, 112, 114, 116, 118,
+	122, 124, 126, 128, 130, 132, 134, 136, 138, 140, 143, 145, 148, 151, 154, 157
+};
+static const unsigned short actable[128] = {
+	4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18, 19,
+	20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34, 35,
+	36, 37, 38, 39, 40, 41, 42, 43, 44, 45, 46, 47, 48, 49, 50, 51,
+	52, 53, 54, 55, 56, 57, 58, 60, 62, 64, 66, 68, 70, 72, 74, 76,
+	78, 80, 82, 84, 86, 88, 90, 92, 94, 96, 98, 100, 102, 104, 106, 108,
+	110, 112, 114, 116, 119, 122, 125, 128, 131, 134, 137, 140, 143, 146, 149, 152,
+	155, 158, 161, 164, 167, 170, 173, 177, 181, 185, 189, 193, 197, 201, 205, 209,
+	213, 217, 221, 225, 229, 234, 239, 245, 249, 254, 259, 264, 269, 274, 279, 284
+};
+
+// the 120 short distance codes, as 16 * dy + 8 - dx
+static const BYTE codetoplane[120] = {
+	0x18, 0x07, 0x17, 0x19, 0x28, 0x06, 0x27, 0x29, 0x16, 0x1a, 0x26, 0x2a,
+	0x38, 0x05, 0x37, 0x39, 0x15, 0x1b, 0x36, 0x3a, 0x25, 0x2b, 0x48, 0x04,
+	0x47, 0x49, 0x14, 0x1c, 0x35, 0x3b, 0x46, 0x4a, 0x24, 0x2c, 0x58, 0x45,
+	0x4b, 0x34, 0x3c, 0x03, 0x57, 0x59, 0x13, 0x1d, 0x56, 0x5a, 0x23, 0x2d,
+	0x44, 0x4c, 0x55, 0x5b, 0x33, 0x3d, 0x68, 0x02, 0x67, 0x69, 0x12, 0x1e,
+	0x66, 0x6a, 0x22, 0x2e, 0x54, 0x5c, 0x43, 0x4d, 0x65, 0x6b, 0x32, 0x3e,
+	0x78, 0x01, 0x77, 0x79, 0x53, 0x5d, 0x11, 0x1f, 0x64, 0x6c, 0x42, 0x4e,
+	0x76, 0x7a, 0x21, 0x2f, 0x75, 0x7b, 0x31, 0x3f, 0x63, 0x6d, 0x52, 0x5e,
+	0x00, 0x74, 0x7c, 0x41, 0x4f, 0x10, 0x20, 0x62, 0x6e, 0x30, 0x73, 0x7d,
+	0x51, 0x5f, 0x40, 0x72, 0x7e, 0x61, 0x6f, 0x50, 0x71, 0x7f, 0x60, 0x70
+};
+
+static inline unsigned int read24 (const BYTE* p)
+{
+	return p[0] | (unsigned int)p[1] << 8 | (unsigned int)p[2] << 16;
+}
+
+static inline unsigned int read32 (const BYTE* p)
+{
+	return read24 (p) | (unsigned int)p[3] << 24;
+}
+
+static inline int clip255 (int x)
+{
+	return x < 0 ? 0 : x > 255 ? 255 : x;
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* lossless */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// a prefix code, looked up on the next 8 bits. Entries are symbol << 8 | length;
+/// a length over 8 marks a second level table for the longer codes, which
+/// starts at the entry's symbol and is indexed by the following length - 8 bits
+/// </summary>
+class WEBPHUFFMAN
+{
+public:
+	unsigned int* table;
+
+	WEBPHUFFMAN ()
+	{
+		table = NULL;
+	}
+	~WEBPHUFFMAN ()
+	{
+		delete[] table;
+	}
+	bool build (const BYTE* lengths, int n);
+};
+
+static inline unsigned int reverse_bits (unsigned int code, int len)
+{
+	unsigned int answer = 0;
+
+	for (auto i = 0; i < len; i++) {
+		answer = answer << 1 | (code & 1);
+		code >>= 1;
+	}
+	return answer;
+}
+
+/// <summary>
+/// build the table from code lengths
+/// </summary>
+/// <returns>false if the lengths don't make a complete code</returns>
+bool WEBPHUFFMAN::build (const BYTE* lengths, int n)
+{
+	int count[16] = { 0 };
+	unsigned int next[16];
+	unsigned int codes[16];
+	int sublen[256];
+	int offset[256];
+	int used = 0;
+	int last = 0;
+	int left = 1;
+	int size;
+
+	delete[] table;
+	table = NULL;
+	for (auto s = 0; s < n; s++) {
+		count[lengths[s]]++;
+		if (lengths[s]) {
+			used++;
+			last = s;
+		}
+	}
+	if (used == 0) {
+		return false;
+	}
+	if (used == 1) {
+		// a lone symbol takes no bits
+		table = new unsigned int[256];
+		if (!table) {
+			throw general_exception ("out_of_memory");
+		}
+		for (auto k = 0; k < 256; k++) {
+			table[k] = (unsigned int)last << 8;
+		}
+		return true;
+	}
+	for (auto len = 1; len < 16; len++) {
+		left = 2 * left - count[len];
+		if (left < 0) {
+			return false;
+		}
+	}
+	if (left != 0) {
+		return false;
+	}
+	count[0] = 0;
+	next[0] = 0;
+	for (auto len = 1; len < 16; len++) {
+		next[len] = (next[len - 1] + count[len - 1]) << 1;
+	}
+
+	// second level tables are as big as the longest code under their root entry needs
+	memcpy (codes, next, sizeof (codes));
+	memset (sublen, 0, sizeof (sublen));
+	for (auto s = 0; s < n; s++) {
+		int len = lengths[s];
+		if (len > 8) {
+			unsigned int root = reverse_bits (codes[len]++, len) & 0xFF;
+			if (len - 8 > sublen[root]) {
+				sublen[root] = len - 8;
+			}
+		}
+	}
+	size = 256;
+	for (auto r = 0; r < 256; r++) {
+		offset[r] = size;
+		if (sublen[r]) {
+			size += 1 << sublen[r];
+		}
+	}
+	table = new unsigned int[size];
+	if (!table) {
+		throw general_exception ("out_of_memory");
+	}
+	for (auto r = 0; r < 256; r++) {
+		if (sublen[r]) {
+			table[r] = (unsigned int)offset[r] << 8 | (8 + sublen[r]);
+		}
+	}
+	for (auto s = 0; s < n; s++) {
+		int len = lengths[s];
+		if (len == 0) {
+			continue;
+		}
+		unsigned int code = reverse_bits (next[len]++, len);
+		if (len <= 8) {
+			for (auto k = code; k < 256; k += 1U << len) {
+				table[k] = (unsigned int)s << 8 | len;
+			}
+		}
+		else {
+			unsigned int* sub = table + offset[code & 0xFF];
+			for (auto k = code >> 8; k < 1U << sublen[code & 0xFF]; k += 1U << (len - 8)) {
+				sub[k] = (unsigned int)s << 8 | (len - 8);
+			}
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// one of the transforms a lossless image went through before coding
+/// </summary>
+class WEBPTRANSFORM
+{
+public:
+	int type;
+	int bits;                       // block size of the sub-image, or pixels packed per pixel
+	int xsize;                      // width the transform works at
+	int ysize;
+	unsigned int* data;             // sub-image of predictor modes or color multipliers, or the palette
+
+	WEBPTRANSFORM ()
+	{
+		type = 0;
+		bits = 0;
+		xsize = ysize = 0;
+		data = NULL;
+	}
+	~WEBPTRANSFORM ()
+	{
+		delete[] data;
+	}
+};
+
+/// <summary>
+/// decoder for a lossless (VP8L) image stream
+/// </summary>
+class VP8LDECODER
+{
+public:
+	LSBREADER br;
+	WEBPTRANSFORM transforms[4];
+	int ntransforms;
+	int seen;                       // transform types read
+	WEBPHUFFMAN* codes;             // five to a group
+	int* groupmap;                  // meta code to group, -1 for ones no block uses
+	unsigned int* meta;             // group of each block, from the entropy image
+	int metabits;
+	int metawidth;
+	unsigned int* cache;
+	unsigned int* argb;             // the image
+
+	VP8LDECODER (const BYTE* data, size_t N) : br (data, N)
+	{
+		ntransforms = 0;
+		seen = 0;
+		codes = NULL;
+		groupmap = NULL;
+		meta = NULL;
+		metabits = 0;
+		metawidth = 0;
+		cache = NULL;
+		argb = NULL;
+	}
+	~VP8LDECODER ()
+	{
+		delete[] codes;
+		delete[] groupmap;
+		delete[] meta;
+		delete[] cache;
+		delete[] argb;
+	}
+	int readbits (int nbits)
+	{
+		int answer = br.getbits (nbits);
+		if (answer < 0) {
+			throw general_exception ("parse_error");
+		}
+		return answer;
+	}
+	int symbol (const WEBPHUFFMAN* code)
+	{
+		if (br.available () < 32) {
+			br.refill ();
+		}
+		unsigned int entry = code->table[br.peek (8)];
+		int len = entry & 0xFF;
+		if (len > 8) {
+			br.consume (8);
+			entry = code->table[(entry >> 8) + br.peek (len - 8)];
+			len = entry & 0xFF;
+		}
+		br.consume (len);
+		return (int)(entry >> 8);
+	}
+	void decode (int xsize, int ysize);
+	void decode_stream (int xsize, int ysize, bool level0, unsigned int** target);
+	void read_transform (int* xsize, int ysize);
+	void read_code (WEBPHUFFMAN* code, int alphabet);
+	void read_codes (int cachebits, int nblocks);
+	int copy_value (int prefix);
+	void decode_pixels (unsigned int* data, int xsize, int ysize, int cachebits, bool usemeta);
+	void add_predictions (const WEBPTRANSFORM* t);
+	void add_colors (const WEBPTRANSFORM* t);
+	void add_green (const WEBPTRANSFORM* t);
+	void map_colors (const WEBPTRANSFORM* t);
+};
+
+static inline int subsample (int size, int bits)
+{
+	return (size + (1 << bits) - 1) >> bits;
+}
+
+/// <summary>
+/// add two pixels channel by channel
+/// </summary>
+static inline unsigned int add_pixels (unsigned int a, unsigned int b)
+{
+	return (((a & 0xFF00FF00u) + (b & 0xFF00FF00u)) & 0xFF00FF00u) | (((a & 0x00FF00FFu) + (b & 0x00FF00FFu)) & 0x00FF00FFu);
+}
+
+static inline unsigned int average2 (unsigned int a, unsigned int b)
+{
+	return (((a ^ b) & 0xFEFEFEFEu) >> 1) + (a & b);
+}
+
+/// <summary>
+/// the top or the left pixel, whichever the top left one is further from
+/// </summary>
+static inline unsigned int select_pixel (unsigned int T, unsigned int L, unsigned int TL)
+{
+	int distance = 0;
+
+	for (auto shift = 0; shift < 32; shift += 8) {
+		int t = (T >> shift) & 0xFF;
+		int l = (L >> shift) & 0xFF;
+		int tl = (TL >> shift) & 0xFF;
+		distance += (l > tl ? l - tl : tl - l) - (t > tl ? t - tl : tl - t);
+	}
+	return distance <= 0 ? T : L;
+}
+
+static inline unsigned int clamped_add_subtract_full (unsigned int a, unsigned int b, unsigned int c)
+{
+	unsigned int answer = 0;
+
+	for (auto shift = 0; shift < 32; shift += 8) {
+		int v = (int)((a >> shift) & 0xFF) + (int)((b >> shift) & 0xFF) - (int)((c >> shift) & 0xFF);
+		answer |= (unsigned int)clip255 (v) << shift;
+	}
+	return answer;
+}
+
+static inline unsigned int clamped_add_subtract_half (unsigned int a, unsigned int b)
+{
+	unsigned int answer = 0;
+
+	for (auto shift = 0; shift < 32; shift += 8) {
+		int x = (a >> shift) & 0xFF;
+		int y = (b >> shift) & 0xFF;
+		answer |= (unsigned int)clip255 (x + (x - y) / 2) << shift;
+	}
+	return answer;
+}
+
+/// <summary>
+/// read one transform and the sub-image it comes with
+/// </summary>
+/// <param name="xsize">image width, narrowed by a palette that packs pixels</param>
+void VP8LDECODER::read_transform (int* xsize, int ysize)
+{
+	int type = readbits (2);
+	WEBPTRANSFORM* t = transforms + ntransforms;
+
+	if (seen & (1 << type)) {
+		throw general_exception ("parse_error");
+	}
+	seen |= 1 << type;
+	ntransforms++;
+	t->type = type;
+	t->xsize = *xsize;
+	t->ysize = ysize;
+	switch (type) {
+	case TRANSFORM_PREDICTOR:
+	case TRANSFORM_CROSSCOLOR:
+		t->bits = readbits (3) + 2;
+		decode_stream (subsample (*xsize, t->bits), subsample (ysize, t->bits), false, &t->data);
+		break;
+	case TRANSFORM_COLORINDEXING:
+	{
+		int ncolors = readbits (8) + 1;
+		t->bits = ncolors > 16 ? 0 : ncolors > 4 ? 1 : ncolors > 2 ? 2 : 3;
+		decode_stream (ncolors, 1, false, &t->data);
+		// the palette is delta coded; indices past its end are transparent black
+		unsigned int* palette = new unsigned int[256];
+		if (!palette) {
+			throw general_exception ("out_of_memory");
+		}
+		memset (palette, 0, 256 * sizeof (unsigned int));
+		palette[0] = t->data[0];
+		for (auto i = 1; i < ncolors; i++) {
+			palette[i] = add_pixels (t->data[i], palette[i - 1]);
+		}
+		delete[] t->data;
+		t->data = palette;
+		*xsize = subsample (*xsize, t->bits);
+		break;
+	}
+	default:
+		break;
+	}
+}
+
+/// <summary>
+/// read a prefix code, either one or two symbols listed or code lengths
+/// that are themselves prefix coded
+/// </summary>
+void VP8LDECODER::read_code (WEBPHUFFMAN* code, int alphabet)
+{
+	BYTE lengths[256 + 24 + (1 << VP8L_MAXCACHEBITS)];
+
+	memset (lengths, 0, alphabet);
+	if (readbits (1)) {
+		int nsymbols = readbits (1) + 1;
+		int first = readbits (readbits (1) ? 8 : 1);
+		if (first < alphabet) {
+			lengths[first] = 1;
+		}
+		if (nsymbols == 2) {
+			int second = readbits (8);
+			if (second < alphabet) {
+				lengths[second] = 1;
+			}
+		}
+	}
+	else {
+		static const BYTE repeatbits[3] = { 2, 3, 7 };
+		static const BYTE repeatoffset[3] = { 3, 3, 11 };
+		BYTE codelengths[19] = { 0 };
+		WEBPHUFFMAN lengthcode;
+		int ncodes = readbits (4) + 4;
+		int maxsymbol = alphabet;
+		int prev = 8;
+		int s = 0;
+
+		for (auto i = 0; i < ncodes; i++) {
+			codelengths[codelengthorder[i]] = (BYTE)readbits (3);
+		}
+		if (!lengthcode.build (codelengths, 19)) {
+			throw general_exception ("parse_error");
+		}
+		if (readbits (1)) {
+			int nbits = 2 + 2 * readbits (3);
+			maxsymbol = 2 + readbits (nbits);
+			if (maxsymbol > alphabet) {
+				throw general_exception ("parse_error");
+			}
+		}
+		while (s < alphabet && maxsymbol-- > 0) {
+			int len = symbol (&lengthcode);
+			if (len < 16) {
+				lengths[s++] = (BYTE)len;
+				if (len) {
+					prev = len;
+				}
+			}
+			else {
+				int repeat = readbits (repeatbits[len - 16]) + repeatoffset[len - 16];
+				if (s + repeat > alphabet) {
+					throw general_exception ("parse_error");
+				}
+				memset (lengths + s, len == 16 ? prev : 0, repeat);
+				s += repeat;
+			}
+		}
+		if (br.available () < 0) {
+			throw general_exception ("parse_error");
+		}
+	}
+	if (!code->build (lengths, alphabet)) {
+		throw general_exception ("parse_error");
+	}
+}
+
+/// <summary>
+/// read the prefix code groups. With an entropy image only the groups its
+/// blocks use are kept, and the image is rewritten to index them
+/// </summary>
+/// <param name="nblocks">blocks in meta, 0 for a single group</param>
+void VP8LDECODER::read_codes (int cachebits, int nblocks)
+{
+	int ngroups = 1;
+	int nused = 0;
+
+	if (nblocks) {
+		for (auto i = 0; i < nblocks; i++) {
+			int g = (meta[i] >> 8) & 0xFFFF;
+			if (g >= ngroups) {
+				ngroups = g + 1;
+			}
+		}
+	}
+	delete[] groupmap;
+	groupmap = NULL;
+	groupmap = new int[ngroups];
+	if (!groupmap) {
+		throw general_exception ("out_of_memory");
+	}
+	if (nblocks) {
+		for (auto g = 0; g < ngroups; g++) {
+			groupmap[g] = -1;
+		}
+		for (auto i = 0; i < nblocks; i++) {
+			int g = (meta[i] >> 8) & 0xFFFF;
+			if (groupmap[g] < 0) {
+				groupmap[g] = nused++;
+			}
+			meta[i] = groupmap[g];
+		}
+	}
+	else {
+		groupmap[0] = nused++;
+	}
+	delete[] codes;
+	codes = NULL;
+	codes = new WEBPHUFFMAN[5 * nused];
+	if (!codes) {
+		throw general_exception ("out_of_memory");
+	}
+	for (auto g = 0; g < ngroups; g++) {
+		WEBPHUFFMAN unused[5];
+		WEBPHUFFMAN* group = groupmap[g] >= 0 ? codes + 5 * groupmap[g] : unused;
+		for (auto j = 0; j < 5; j++) {
+			read_code (group + j, alphabetsize[j] + (j == 0 && cachebits ? 1 << cachebits : 0));
+		}
+	}
+}
+
+/// <summary>
+/// a length or distance from its prefix symbol and extra bits
+/// </summary>
+inline int VP8LDECODER::copy_value (int prefix)
+{
+	if (prefix < 4) {
+		return prefix + 1;
+	}
+	int extra = (prefix - 2) >> 1;
+	int offset = (2 + (prefix & 1)) << extra;
+	return offset + readbits (extra) + 1;
+}
+
+/// <summary>
+/// decode the entropy coded pixels of an image
+/// </summary>
+/// <param name="usemeta">choose the group by the entropy image</param>
+void VP8LDECODER::decode_pixels (unsigned int* data, int xsize, int ysize, int cachebits, bool usemeta)
+{
+	size_t total = (size_t)xsize * ysize;
+	size_t pos = 0;
+	int x = 0;
+	int y = 0;
+	int blockmask = (1 << metabits) - 1;
+	int cacheshift = 32 - cachebits;
+	const WEBPHUFFMAN* group = codes;
+
+	delete[] cache;
+	cache = NULL;
+	if (cachebits) {
+		cache = new unsigned int[1 << cachebits];
+		if (!cache) {
+			throw general_exception ("out_of_memory");
+		}
+		memset (cache, 0, sizeof (unsigned int) << cachebits);
+	}
+	while (pos < total) {
+		if (usemeta && (x & blockmask) == 0) {
+			group = codes + 5 * meta[(y >> metabits) * metawidth + (x >> metabits)];
+		}
+		int green = symbol (group);
+		if (green < 256) {
+			int red = symbol (group + 1);
+			int blue = symbol (group + 2);
+			int alpha = symbol (group + 3);
+			unsigned int pixel = (unsigned int)alpha << 24 | red << 16 | green << 8 | blue;
+			data[pos++] = pixel;
+			if (cache) {
+				cache[(0x1E35A7BDu * pixel) >> cacheshift] = pixel;
+			}
+			if (++x == xsize) {
+				x = 0;
+				y++;
+			}
+		}
+		else if (green < 256 + 24) {
+			size_t length = copy_value (green - 256);
+			int code = copy_value (symbol (group + 4));
+			size_t distance;
+			if (code > 120) {
+				distance = code - 120;
+			}
+			else {
+				// the first 120 are short offsets in two dimensions
+				int plane = codetoplane[code - 1];
+				int offset = (plane >> 4) * xsize + 8 - (plane & 0xF);
+				distance = offset >= 1 ? offset : 1;
+			}
+			if (distance > pos || length > total - pos) {
+				throw general_exception ("parse_error");
+			}
+			for (auto k = 0U; k < length; k++, pos++) {
+				unsigned int pixel = data[pos - distance];
+				data[pos] = pixel;
+				if (cache) {
+					cache[(0x1E35A7BDu * pixel) >> cacheshift] = pixel;
+				}
+			}
+			x += (int)(length % xsize);
+			y += (int)(length / xsize);
+			if (x >= xsize) {
+				x -= xsize;
+				y++;
+			}
+			if (usemeta && pos < total) {
+				group = codes + 5 * meta[(y >> metabits) * metawidth + (x >> metabits)];
+			}
+		}
+		else {
+			unsigned int pixel = cache[green - 256 - 24];
+			data[pos++] = pixel;
+			cache[(0x1E35A7BDu * pixel) >> cacheshift] = pixel;
+			if (++x == xsize) {
+				x = 0;
+				y++;
+			}
+		}
+		if (br.available () < 0) {
+			throw general_exception ("parse_error");
+		}
+	}
+}
+
+/// <summary>
+/// decode an image stream: the main image with its transforms, entropy
+/// image and color cache, or one of the sub-images, which have only the cache
+/// </summary>
+/// <param name="target">where the pixels go, freed by the owner</param>
+void VP8LDECODER::decode_stream (int xsize, int ysize, bool level0, unsigned int** target)
+{
+	int cachebits = 0;
+	int nblocks = 0;
+
+	if (level0) {
+		while (readbits (1)) {
+			read_transform (&xsize, ysize);
+		}
+	}
+	if (readbits (1)) {
+		cachebits = readbits (4);
+		if (cachebits < 1 || cachebits > VP8L_MAXCACHEBITS) {
+			throw general_exception ("parse_error");
+		}
+	}
+	if (level0 && readbits (1)) {
+		metabits = readbits (3) + 2;
+		metawidth = subsample (xsize, metabits);
+		nblocks = metawidth * subsample (ysize, metabits);
+		decode_stream (metawidth, subsample (ysize, metabits), false, &meta);
+	}
+	read_codes (cachebits, nblocks);
+	*target = new unsigned int[(size_t)xsize * ysize];
+	if (!*target) {
+		throw general_exception ("out_of_memory");
+	}
+	decode_pixels (*target, xsize, ysize, cachebits, nblocks != 0);
+}
+
+/// <summary>
+/// undo the predictor transform: each pixel is a residual from a prediction
+/// out of its left, top, top right and top left neighbours, by a mode per block
+/// </summary>
+void VP8LDECODER::add_predictions (const WEBPTRANSFORM* t)
+{
+	int w = t->xsize;
+	int blockwidth = subsample (w, t->bits);
+	unsigned int* p = argb;
+
+	// top row: black, then the left pixel
+	p[0] = add_pixels (p[0], 0xFF000000u);
+	for (auto x = 1; x < w; x++) {
+		p[x] = add_pixels (p[x], p[x - 1]);
+	}
+	for (auto y = 1; y < t->ysize; y++) {
+		unsigned int* row = argb + (size_t)y * w;
+		const unsigned int* modes = t->data + (y >> t->bits) * blockwidth;
+		// left column: the pixel above
+		row[0] = add_pixels (row[0], row[-w]);
+		for (auto x = 1; x < w; ) {
+			int end = ((x >> t->bits) + 1) << t->bits;
+			if (end > w) {
+				end = w;
+			}
+			int mode = (modes[x >> t->bits] >> 8) & 0xF;
+			for (; x < end; x++) {
+				unsigned int L = row[x - 1];
+				unsigned int T = row[x - w];
+				unsigned int TR = row[x - w + 1];
+				unsigned int TL = row[x - w - 1];
+				unsigned int pred;
+				switch (mode) {
+				case 1: pred = L; break;
+				case 2: pred = T; break;
+				case 3: pred = TR; break;
+				case 4: pred = TL; break;
+				case 5: pred = average2 (average2 (L, TR), T); break;
+				case 6: pred = average2 (L, TL); break;
+				case 7: pred = average2 (L, T); break;
+				case 8: pred = average2 (TL, T); break;
+				case 9: pred = average2 (T, TR); break;
+				case 10: pred = average2 (average2 (L, TL), average2 (T, TR)); break;
+				case 11: pred = select_pixel (T, L, TL); break;
+				case 12: pred = clamped_add_subtract_full (L, T, TL); break;
+				case 13: pred = clamped_add_subtract_half (average2 (L, T), TL); break;
+				default: pred = 0xFF000000u; break;
+				}
+				row[x] = add_pixels (row[x], pred);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// undo the cross color transform, which took part of green out of red and
+/// blue and part of red out of blue, with multipliers per block
+/// </summary>
+void VP8LDECODER::add_colors (const WEBPTRANSFORM* t)
+{
+	int w = t->xsize;
+	int blockwidth = subsample (w, t->bits);
+
+	for (auto y = 0; y < t->ysize; y++) {
+		unsigned int* row = argb + (size_t)y * w;
+		const unsigned int* blocks = t->data + (y >> t->bits) * blockwidth;
+		for (auto x = 0; x < w; x++) {
+			unsigned int m = blocks[x >> t->bits];
+			int greentored = (signed char)(m & 0xFF);
+			int greentoblue = (signed char)((m >> 8) & 0xFF);
+			int redtoblue = (signed char)((m >> 16) & 0xFF);
+			unsigned int pixel = row[x];
+			int green = (signed char)((pixel >> 8) & 0xFF);
+			int red = (pixel >> 16) & 0xFF;
+			int blue = pixel & 0xFF;
+			red = (red + ((greentored * green) >> 5)) & 0xFF;
+			blue += (greentoblue * green) >> 5;
+			blue += (redtoblue * (signed char)red) >> 5;
+			row[x] = (pixel & 0xFF00FF00u) | (unsigned int)red << 16 | (blue & 0xFF);
+		}
+	}
+}
+
+/// <summary>
+/// undo the subtract green transform
+/// </summary>
+void VP8LDECODER::add_green (const WEBPTRANSFORM* t)
+{
+	size_t total = (size_t)t->xsize * t->ysize;
+
+	for (size_t i = 0; i < total; i++) {
+		unsigned int pixel = argb[i];
+		unsigned int green = (pixel >> 8) & 0xFF;
+		unsigned int redblue = ((pixel & 0x00FF00FFu) + (green << 16 | green)) & 0x00FF00FFu;
+		argb[i] = (pixel & 0xFF00FF00u) | redblue;
+	}
+}
+
+/// <summary>
+/// look the palette indices, held in green and packed up to 8 to a pixel, up
+/// </summary>
+void VP8LDECODER::map_colors (const WEBPTRANSFORM* t)
+{
+	int w = t->xsize;
+	size_t total = (size_t)w * t->ysize;
+	const unsigned int* palette = t->data;
+
+	if (t->bits == 0) {
+		for (size_t i = 0; i < total; i++) {
+			argb[i] = palette[(argb[i] >> 8) & 0xFF];
+		}
+		return;
+	}
+	int packedwidth = subsample (w, t->bits);
+	int bitsperpixel = 8 >> t->bits;
+	unsigned int mask = (1U << bitsperpixel) - 1;
+	unsigned int* wide = new unsigned int[total];
+	if (!wide) {
+		throw general_exception ("out_of_memory");
+	}
+	for (auto y = 0; y < t->ysize; y++) {
+		const unsigned int* src = argb + (size_t)y * packedwidth;
+		unsigned int* dst = wide + (size_t)y * w;
+		unsigned int packed = 0;
+		for (auto x = 0; x < w; x++) {
+			if ((x & ((1 << t->bits) - 1)) == 0) {
+				packed = (src[x >> t->bits] >> 8) & 0xFF;
+			}
+			dst[x] = palette[packed & mask];
+			packed >>= bitsperpixel;
+		}
+	}
+	delete[] argb;
+	argb = wide;
+}
+
+/// <summary>
+/// decode the main image stream and undo its transforms, last first
+/// </summary>
+void VP8LDECODER::decode (int xsize, int ysize)
+{
+	decode_stream (xsize, ysize, true, &argb);
+	for (auto i = ntransforms - 1; i >= 0; i--) {
+		const WEBPTRANSFORM* t = transforms + i;
+		switch (t->type) {
+		case TRANSFORM_PREDICTOR:
+			add_predictions (t);
+			break;
+		case TRANSFORM_CROSSCOLOR:
+			add_colors (t);
+			break;
+		case TRANSFORM_SUBTRACTGREEN:
+			add_green (t);
+			break;
+		case TRANSFORM_COLORINDEXING:
+			map_colors (t);
+			break;
+		}
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* lossy */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// boolean entropy decoder, which everything in a lossy frame is coded with
+/// </summary>
+class VP8BOOL
+{
+public:
+	const BYTE* p;
+	const BYTE* end;
+	unsigned long long value;
+	unsigned int range;             // 128 to 255 between bits
+	int bits;                       // bits of value below the 8 being decoded
+	bool eof;                       // needed bits past the end
+
+	VP8BOOL ()
+	{
+		init (NULL, 0);
+	}
+	void init (const BYTE* data, size_t N)
+	{
+		p = data;
+		end = data + N;
+		value = 0;
+		range = 255;
+		bits = -8;
+		eof = false;
+		load ();
+	}
+	void load ()
+	{
+		if (end - p >= 8) {
+			value = value << 56 | bitreader_swap64 (bitreader_load64 (p)) >> 8;
+			p += 7;
+			bits += 56;
+		}
+		else if (p < end) {
+			value = value << 8 | *p++;
+			bits += 8;
+		}
+		else if (!eof) {
+			value <<= 8;
+			bits += 8;
+			eof = true;
+		}
+		else {
+			bits = 0;
+		}
+	}
+	int getbit (int prob)
+	{
+		int bit;
+
+		if (bits < 0) {
+			load ();
+		}
+		unsigned int split = 1 + (((range - 1) * prob) >> 8);
+		if ((unsigned int)(value >> bits) >= split) {
+			range -= split;
+			value -= (unsigned long long)split << bits;
+			bit = 1;
+		}
+		else {
+			range = split;
+			bit = 0;
+		}
+		int shift = normshift[range];
+		range <<= shift;
+		bits -= shift;
+		return bit;
+	}
+	int getvalue (int nbits)
+	{
+		int answer = 0;
+
+		while (nbits-- > 0) {
+			answer = answer << 1 | getbit (128);
+		}
+		return answer;
+	}
+	int getsigned (int nbits)
+	{
+		int answer = getvalue (nbits);
+		return getbit (128) ? -answer : answer;
+	}
+};
+
+/// <summary>
+/// loop filter settings for a macroblock
+/// </summary>
+class VP8FILTER
+{
+public:
+	BYTE limit;                     // 0 for no filtering
+	BYTE ilevel;
+	BYTE hev;                       // high edge variance threshold
+	BYTE inner;                     // filter the sub-block edges too
+
+	VP8FILTER ()
+	{
+		limit = ilevel = hev = inner = 0;
+	}
+};
+
+enum
+{
+	B_DC_PRED = 0,
+	B_TM_PRED,
+	B_VE_PRED,
+	B_HE_PRED,
+	B_RD_PRED,
+	B_VR_PRED,
+	B_LD_PRED,
+	B_VL_PRED,
+	B_HD_PRED,
+	B_HU_PRED,
+};
+
+/// <summary>
+/// decoder for a lossy (VP8) key frame, into planes of whole macroblocks
+/// </summary>
+class VP8DECODER
+{
+public:
+	VP8BOOL br;                     // first partition: headers and modes
+	VP8BOOL parts[8];               // coefficient partitions, by macroblock row
+	int nparts;
+	int width, height;
+	int mbw, mbh;
+	// segments
+	bool segmentation;
+	bool updatemap;
+	bool absolute;
+	int quantizer[4];
+	int filterlevel[4];
+	BYTE segprob[3];
+	// loop filter
+	int filtertype;                 // 0 off, 1 simple, 2 normal
+	bool simple;
+	int level;
+	int sharpness;
+	bool lfdelta;
+	int refdelta[4];
+	int modedelta[4];
+	VP8FILTER strengths[4][2];      // by segment and 4x4 prediction
+	// dequantisation by segment, DC and AC
+	int y1dq[4][2];
+	int y2dq[4][2];
+	int uvdq[4][2];
+	BYTE coeffprob[4][8][3][11];
+	bool useskip;
+	int skipprob;
+	// planes
+	BYTE* Y;
+	BYTE* U;
+	BYTE* V;
+	int ystride;
+	int uvstride;
+	VP8FILTER* filters;             // per macroblock
+	BYTE* topmodes;                 // sub-block modes along the bottom of the row above
+	BYTE* topnz;                    // non-zero blocks above: luma bits 0-3, u 4-5, v 6-7
+	BYTE* topnzdc;
+	// the current macroblock
+	int segment;
+	bool skip;
+	bool is4x4;
+	int ymode;
+	int uvmode;
+	BYTE imodes[16];
+	BYTE leftmodes[4];
+	unsigned int leftnz;
+	int leftnzdc;
+	short coeffs[384];
+	BYTE ywork[17 * WEBP_BPS];      // a row and column of neighbours and the macroblock
+	BYTE uwork[9 * WEBP_BPS];
+	BYTE vwork[9 * WEBP_BPS];
+
+	VP8DECODER ()
+	{
+		nparts = 0;
+		width = height = 0;
+		mbw = mbh = 0;
+		segmentation = updatemap = false;
+		absolute = true;
+		memset (quantizer, 0, sizeof (quantizer));
+		memset (filterlevel, 0, sizeof (filterlevel));
+		memset (segprob, 255, sizeof (segprob));
+		filtertype = 0;
+		simple = false;
+		level = sharpness = 0;
+		lfdelta = false;
+		memset (refdelta, 0, sizeof (refdelta));
+		memset (modedelta, 0, sizeof (modedelta));
+		useskip = false;
+		skipprob = 0;
+		Y = U = V = NULL;
+		ystride = uvstride = 0;
+		filters = NULL;
+		topmodes = NULL;
+		topnz = NULL;
+		topnzdc = NULL;
+		segment = 0;
+		skip = is4x4 = false;
+		ymode = uvmode = 0;
+		leftnz = 0;
+		leftnzdc = 0;
+	}
+	~VP8DECODER ()
+	{
+		delete[] Y;
+		delete[] U;
+		delete[] V;
+		delete[] filters;
+		delete[] topmodes;
+		delete[] topnz;
+		delete[] topnzdc;
+	}
+	void run (const BYTE* data, size_t N);
+	void read_segments ();
+	void read_filter ();
+	void read_partitions (const BYTE* data, size_t N);
+	void read_quantisers ();
+	void read_probabilities ();
+	void set_strengths ();
+	void read_modes (int mbx);
+	bool read_residuals (int mbx, VP8BOOL* tb);
+	int read_coeffs (VP8BOOL* tb, int type, int ctx, const int* dq, int n, short* out);
+	void reconstruct (int mbx, int mby);
+	void loop_filter ();
+	void to_rgb (BYTE* out, int samples) const;
+};
+
+void VP8DECODER::read_segments ()
+{
+	segmentation = br.getbit (128) != 0;
+	if (!segmentation) {
+		return;
+	}
+	updatemap = br.getbit (128) != 0;
+	if (br.getbit (128)) {
+		absolute = br.getbit (128) != 0;
+		for (auto s = 0; s < 4; s++) {
+			quantizer[s] = br.getbit (128) ? br.getsigned (7) : 0;
+		}
+		for (auto s = 0; s < 4; s++) {
+			filterlevel[s] = br.getbit (128) ? br.getsigned (6) : 0;
+		}
+	}
+	if (updatemap) {
+		for (auto s = 0; s < 3; s++) {
+			segprob[s] = br.getbit (128) ? (BYTE)br.getvalue (8) : 255;
+		}
+	}
+}
+
+void VP8DECODER::read_filter ()
+{
+	simple = br.getbit (128) != 0;
+	level = br.getvalue (6);
+	sharpness = br.getvalue (3);
+	lfdelta = br.getbit (128) != 0;
+	if (lfdelta && br.getbit (128)) {
+		for (auto i = 0; i < 4; i++) {
+			if (br.getbit (128)) {
+				refdelta[i] = br.getsigned (6);
+			}
+		}
+		for (auto i = 0; i < 4; i++) {
+			if (br.getbit (128)) {
+				modedelta[i] = br.getsigned (6);
+			}
+		}
+	}
+	filtertype = level == 0 ? 0 : simple ? 1 : 2;
+}
+
+/// <summary>
+/// set up the coefficient partitions, which follow the first one, their sizes first
+/// </summary>
+void VP8DECODER::read_partitions (const BYTE* data, size_t N)
+{
+	nparts = 1 << br.getvalue (2);
+	size_t last = nparts - 1;
+	if (N < 3 * last) {
+		throw general_exception ("parse_error");
+	}
+	const BYTE* sizes = data;
+	const BYTE* part = data + 3 * last;
+	size_t left = N - 3 * last;
+	for (size_t k = 0; k < last; k++) {
+		size_t size = read24 (sizes + 3 * k);
+		if (size > left) {
+			size = left;
+		}
+		parts[k].init (part, size);
+		part += size;
+		left -= size;
+	}
+	if (left == 0) {
+		throw general_exception ("parse_error");
+	}
+	parts[last].init (part, left);
+}
+
+static inline int clip_index (int q, int max)
+{
+	return q < 0 ? 0 : q > max ? max : q;
+}
+
+void VP8DECODER::read_quantisers ()
+{
+	int base = br.getvalue (7);
+	int y1dc = br.getbit (128) ? br.getsigned (4) : 0;
+	int y2dc = br.getbit (128) ? br.getsigned (4) : 0;
+	int y2ac = br.getbit (128) ? br.getsigned (4) : 0;
+	int uvdc = br.getbit (128) ? br.getsigned (4) : 0;
+	int uvac = br.getbit (128) ? br.getsigned (4) : 0;
+
+	for (auto s = 0; s < 4; s++) {
+		int q = base;
+		if (segmentation) {
+			q = quantizer[s] + (absolute ? 0 : base);
+		}
+		y1dq[s][0] = dctable[clip_index (q + y1dc, 127)];
+		y1dq[s][1] = actable[clip_index (q, 127)];
+		y2dq[s][0] = dctable[clip_index (q + y2dc, 127)] * 2;
+		// x * 155 / 100
+		y2dq[s][1] = (actable[clip_index (q + y2ac, 127)] * 101581) >> 16;
+		if (y2dq[s][1] < 8) {
+			y2dq[s][1] = 8;
+		}
+		uvdq[s][0] = dctable[clip_index (q + uvdc, 117)];
+		uvdq[s][1] = actable[clip_index (q + uvac, 127)];
+	}
+}
+
+void VP8DECODER::read_probabilities ()
+{
+	for (auto t = 0; t < 4; t++) {
+		for (auto b = 0; b < 8; b++) {
+			for (auto c = 0; c < 3; c++) {
+				for (auto p = 0; p < 11; p++) {
+					coeffprob[t][b][c][p] = br.getbit (coeffupdate[t][b][c][p]) ? (BYTE)br.getvalue (8) : coeffdefault[t][b][c][p];
+				}
+			}
+		}
+	}
+	useskip = br.getbit (128) != 0;
+	if (useskip) {
+		skipprob = br.getvalue (8);
+	}
+}
+
+/// <summary>
+/// loop filter limits for each segment, with and without 4x4 prediction
+/// </summary>
+void VP8DECODER::set_strengths ()
+{
+	for (auto s = 0; s < 4; s++) {
+		int base = level;
+		if (segmentation) {
+			base = filterlevel[s] + (absolute ? 0 : level);
+		}
+		for (auto i4x4 = 0; i4x4 <= 1; i4x4++) {
+			VP8FILTER* f = &strengths[s][i4x4];
+			int lvl = base;
+			if (lfdelta) {
+				lvl += refdelta[0];
+				if (i4x4) {
+					lvl += modedelta[0];
+				}
+			}
+			lvl = clip_index (lvl, 63);
+			if (lvl > 0) {
+				int ilevel = lvl;
+				if (sharpness > 0) {
+					ilevel >>= sharpness > 4 ? 2 : 1;
+					if (ilevel > 9 - sharpness) {
+						ilevel = 9 - sharpness;
+					}
+				}
+				if (ilevel < 1) {
+					ilevel = 1;
+				}
+				f->ilevel = (BYTE)ilevel;
+				f->limit = (BYTE)(2 * lvl + ilevel);
+				f->hev = lvl >= 40 ? 2 : lvl >= 15 ? 1 : 0;
+			}
+			else {
+				f->limit = 0;
+			}
+			f->inner = (BYTE)i4x4;
+		}
+	}
+}
+
+/// <summary>
+/// segment, skip flag and prediction modes of a macroblock, from the first partition
+/// </summary>
+void VP8DECODER::read_modes (int mbx)
+{
+	BYTE* top = topmodes + 4 * mbx;
+
+	segment = 0;
+	if (updatemap) {
+		segment = !br.getbit (segprob[0]) ? br.getbit (segprob[1]) : br.getbit (segprob[2]) + 2;
+	}
+	skip = useskip && br.getbit (skipprob);
+	is4x4 = !br.getbit (145);
+	if (!is4x4) {
+		ymode = br.getbit (156) ? (br.getbit (128) ? B_TM_PRED : B_HE_PRED) : (br.getbit (163) ? B_VE_PRED : B_DC_PRED);
+		memset (top, ymode, 4);
+		memset (leftmodes, ymode, 4);
+	}
+	else {
+		for (auto y = 0; y < 4; y++) {
+			int mode = leftmodes[y];
+			for (auto x = 0; x < 4; x++) {
+				const BYTE* prob = bmodeprob[top[x]][mode];
+				int i = bmodetree[br.getbit (prob[0])];
+				while (i > 0) {
+					i = bmodetree[2 * i + br.getbit (prob[i])];
+				}
+				mode = -i;
+				top[x] = (BYTE)mode;
+				imodes[4 * y + x] = (BYTE)mode;
+			}
+			leftmodes[y] = (BYTE)mode;
+		}
+	}
+	uvmode = !br.getbit (142) ? B_DC_PRED : !br.getbit (114) ? B_VE_PRED : br.getbit (183) ? B_TM_PRED : B_HE_PRED;
+}
+
+/// <summary>
+/// coefficient tokens of one 4x4 block, dequantised into zigzag order
+/// </summary>
+/// <param name="type">0 luma after a DC block, 1 luma DC, 2 chroma, 3 luma with DC</param>
+/// <param name="n">first coefficient</param>
+/// <returns>one past the last coefficient decoded</returns>
+int VP8DECODER::read_coeffs (VP8BOOL* tb, int type, int ctx, const int* dq, int n, short* out)
+{
+	const BYTE* p = coeffprob[type][bands[n]][ctx];
+
+	for (; n < 16; n++) {
+		if (!tb->getbit (p[0])) {
+			return n;
+		}
+		while (!tb->getbit (p[1])) {
+			if (++n == 16) {
+				return 16;
+			}
+			p = coeffprob[type][bands[n]][0];
+		}
+		const BYTE (*next)[11] = coeffprob[type][bands[n + 1]];
+		int v;
+		if (!tb->getbit (p[2])) {
+			v = 1;
+			p = next[1];
+		}
+		else {
+			if (!tb->getbit (p[3])) {
+				if (!tb->getbit (p[4])) {
+					v = 2;
+				}
+				else {
+					v = 3 + tb->getbit (p[5]);
+				}
+			}
+			else if (!tb->getbit (p[6])) {
+				if (!tb->getbit (p[7])) {
+					v = 5 + tb->getbit (159);
+				}
+				else {
+					v = 7 + 2 * tb->getbit (165);
+					v += tb->getbit (145);
+				}
+			}
+			else {
+				int bit1 = tb->getbit (p[8]);
+				int bit0 = tb->getbit (p[9 + bit1]);
+				int cat = 2 * bit1 + bit0;
+				v = 0;
+				for (const BYTE* tab = cat3456[cat]; *tab; tab++) {
+					v += v + tb->getbit (*tab);
+				}
+				v += 3 + (8 << cat);
+			}
+			p = next[2];
+		}
+		out[zigzag[n]] = (short)((tb->getbit (128) ? -v : v) * dq[n > 0]);
+	}
+	return 16;
+}
+
+/// <summary>
+/// inverse Walsh-Hadamard transform of the luma DC block into the DC of each luma block
+/// </summary>
+static void inverse_wht (const short* in, short* out)
+{
+	int tmp[16];
+
+	for (auto i = 0; i < 4; i++) {
+		int a0 = in[0 + i] + in[12 + i];
+		int a1 = in[4 + i] + in[8 + i];
+		int a2 = in[4 + i] - in[8 + i];
+		int a3 = in[0 + i] - in[12 + i];
+		tmp[0 + i] = a0 + a1;
+		tmp[8 + i] = a0 - a1;
+		tmp[4 + i] = a3 + a2;
+		tmp[12 + i] = a3 - a2;
+	}
+	for (auto i = 0; i < 4; i++) {
+		int dc = tmp[0 + i * 4] + 3;
+		int a0 = dc + tmp[3 + i * 4];
+		int a1 = tmp[1 + i * 4] + tmp[2 + i * 4];
+		int a2 = tmp[1 + i * 4] - tmp[2 + i * 4];
+		int a3 = dc - tmp[3 + i * 4];
+		out[0] = (short)((a0 + a1) >> 3);
+		out[16] = (short)((a3 + a2) >> 3);
+		out[32] = (short)((a0 - a1) >> 3);
+		out[48] = (short)((a3 - a2) >> 3);
+		out += 64;
+	}
+}
+
+/// <summary>
+/// the residual coefficients of a macroblock
+/// </summary>
+/// <returns>true if any block has coefficients</returns>
+bool VP8DECODER::read_residuals (int mbx, VP8BOOL* tb)
+{
+	short* dst = coeffs;
+	const int* ydq = y1dq[segment];
+	bool nonzero = false;
+	int first;
+	int type;
+	unsigned int tnz, lnz;
+	unsigned int outtnz, outlnz;
+
+	memset (coeffs, 0, sizeof (coeffs));
+	if (!is4x4) {
+		short dc[16] = { 0 };
+		int nz = read_coeffs (tb, 1, topnzdc[mbx] + leftnzdc, y2dq[segment], 0, dc);
+		topnzdc[mbx] = leftnzdc = nz > 0;
+		inverse_wht (dc, coeffs);
+		first = 1;
+		type = 0;
+	}
+	else {
+		first = 0;
+		type = 3;
+	}
+
+	tnz = topnz[mbx] & 0x0F;
+	lnz = leftnz & 0x0F;
+	for (auto y = 0; y < 4; y++) {
+		int l = lnz & 1;
+		for (auto x = 0; x < 4; x++) {
+			int nz = read_coeffs (tb, type, l + (tnz & 1), ydq, first, dst);
+			l = nz > first;
+			tnz = (tnz >> 1) | (l << 7);
+			nonzero |= nz > 1 || dst[0] != 0;
+			dst += 16;
+		}
+		tnz >>= 4;
+		lnz = (lnz >> 1) | (l << 7);
+	}
+	outtnz = tnz;
+	outlnz = lnz >> 4;
+
+	for (auto ch = 0; ch < 4; ch += 2) {
+		tnz = topnz[mbx] >> (4 + ch);
+		lnz = leftnz >> (4 + ch);
+		for (auto y = 0; y < 2; y++) {
+			int l = lnz & 1;
+			for (auto x = 0; x < 2; x++) {
+				int nz = read_coeffs (tb, 2, l + (tnz & 1), uvdq[segment], 0, dst);
+				l = nz > 0;
+				tnz = (tnz >> 1) | (l << 3);
+				nonzero |= nz > 1 || dst[0] != 0;
+				dst += 16;
+			}
+			tnz >>= 2;
+			lnz = (lnz >> 1) | (l << 5);
+		}
+		outtnz |= (tnz << 4) << ch;
+		outlnz |= (lnz & 0xF0) << ch;
+	}
+	topnz[mbx] = (BYTE)outtnz;
+	leftnz = outlnz;
+	return nonzero;
+}
+
+static inline BYTE clip8 (int v)
+{
+	return (BYTE)(v < 0 ? 0 : v > 255 ? 255 : v);
+}
+
+/// <summary>
+/// inverse DCT of a 4x4 block, added to the prediction
+/// </summary>
+static void inverse_dct_add (const short* in, BYTE* dst)
+{
+	int C[16];
+	int* tmp = C;
+
+	// 20091 / 65536 = sqrt(2) * cos(pi / 8) - 1, 35468 / 65536 = sqrt(2) * sin(pi / 8)
+	for (auto i = 0; i < 4; i++) {
+		int a = in[0] + in[8];
+		int b = in[0] - in[8];
+		int c = (int)(((long long)in[4] * 35468) >> 16) - (in[12] + (int)(((long long)in[12] * 20091) >> 16));
+		int d = (in[4] + (int)(((long long)in[4] * 20091) >> 16)) + (int)(((long long)in[12] * 35468) >> 16);
+		tmp[0] = a + d;
+		tmp[1] = b + c;
+		tmp[2] = b - c;
+		tmp[3] = a - d;
+		tmp += 4;
+		in++;
+	}
+	tmp = C;
+	for (auto i = 0; i < 4; i++) {
+		int dc = tmp[0] + 4;
+		int a = dc + tmp[8];
+		int b = dc - tmp[8];
+		int c = (int)(((long long)tmp[4] * 35468) >> 16) - (tmp[12] + (int)(((long long)tmp[12] * 20091) >> 16));
+		int d = (tmp[4] + (int)(((long long)tmp[4] * 20091) >> 16)) + (int)(((long long)tmp[12] * 35468) >> 16);
+		dst[0] = clip8 (dst[0] + ((a + d) >> 3));
+		dst[1] = clip8 (dst[1] + ((b + c) >> 3));
+		dst[2] = clip8 (dst[2] + ((b - c) >> 3));
+		dst[3] = clip8 (dst[3] + ((a - d) >> 3));
+		tmp++;
+		dst += WEBP_BPS;
+	}
+}
+
+#define AVG3(a, b, c) ((BYTE)(((a) + 2 * (b) + (c) + 2) >> 2))
+#define AVG2(a, b) ((BYTE)(((a) + (b) + 1) >> 1))
+#define DST(x, y) dst[(x) + (y) * WEBP_BPS]
+
+static void true_motion (BYTE* dst, int size)
+{
+	const BYTE* top = dst - WEBP_BPS;
+
+	for (auto y = 0; y < size; y++) {
+		int left = dst[-1] - top[-1];
+		for (auto x = 0; x < size; x++) {
+			dst[x] = clip8 (top[x] + left);
+		}
+		dst += WEBP_BPS;
+	}
+}
+
+static void fill_block (BYTE* dst, int value, int size)
+{
+	for (auto y = 0; y < size; y++) {
+		memset (dst + y * WEBP_BPS, value, size);
+	}
+}
+
+/// <summary>
+/// predict a 16x16 luma or 8x8 chroma block; DC leaves out the edges off the frame
+/// </summary>
+static void predict_block (BYTE* dst, int mode, int size, bool hastop, bool hasleft)
+{
+	int shift = size == 16 ? 4 : 3;
+	int dc = 0;
+
+	switch (mode) {
+	case B_TM_PRED:
+		true_motion (dst, size);
+		break;
+	case B_VE_PRED:
+		for (auto y = 0; y < size; y++) {
+			memcpy (dst + y * WEBP_BPS, dst - WEBP_BPS, size);
+		}
+		break;
+	case B_HE_PRED:
+		for (auto y = 0; y < size; y++) {
+			memset (dst + y * WEBP_BPS, dst[y * WEBP_BPS - 1], size);
+		}
+		break;
+	default:
+		if (hastop) {
+			for (auto i = 0; i < size; i++) {
+				dc += dst[i - WEBP_BPS];
+			}
+		}
+		if (hasleft) {
+			for (auto i = 0; i < size; i++) {
+				dc += dst[i * WEBP_BPS - 1];
+			}
+		}
+		if (hastop && hasleft) {
+			dc = (dc + size) >> (shift + 1);
+		}
+		else if (hastop || hasleft) {
+			dc = (dc + (size >> 1)) >> shift;
+		}
+		else {
+			dc = 0x80;
+		}
+		fill_block (dst, dc, size);
+		break;
+	}
+}
+
+/// <summary>
+/// predict a 4x4 luma sub-block from its neighbours, the four above and right included
+/// </summary>
+static void predict_subblock (BYTE* dst, int mode)
+{
+	const BYTE* top = dst - WEBP_BPS;
+	int dc = 4;
+
+	switch (mode) {
+	case B_DC_PRED:
+		for (auto i = 0; i < 4; i++) {
+			dc += top[i] + dst[i * WEBP_BPS - 1];
+		}
+		fill_block (dst, dc >> 3, 4);
+		break;
+	case B_TM_PRED:
+		true_motion (dst, 4);
+		break;
+	case B_VE_PRED:
+	{
+		BYTE vals[4] = {
+			AVG3 (top[-1], top[0], top[1]),
+			AVG3 (top[0], top[1], top[2]),
+			AVG3 (top[1], top[2], top[3]),
+			AVG3 (top[2], top[3], top[4])
+		};
+		for (auto i = 0; i < 4; i++) {
+			memcpy (dst + i * WEBP_BPS, vals, 4);
+		}
+		break;
+	}
+	case B_HE_PRED:
+	{
+		int A = dst[-1 - WEBP_BPS];
+		int B = dst[-1];
+		int C = dst[-1 + WEBP_BPS];
+		int D = dst[-1 + 2 * WEBP_BPS];
+		int E = dst[-1 + 3 * WEBP_BPS];
+		memset (dst, AVG3 (A, B, C), 4);
+		memset (dst + WEBP_BPS, AVG3 (B, C, D), 4);
+		memset (dst + 2 * WEBP_BPS, AVG3 (C, D, E), 4);
+		memset (dst + 3 * WEBP_BPS, AVG3 (D, E, E), 4);
+		break;
+	}
+	case B_RD_PRED:
+	{
+		int I = dst[-1];
+		int J = dst[-1 + WEBP_BPS];
+		int K = dst[-1 + 2 * WEBP_BPS];
+		int L = dst[-1 + 3 * WEBP_BPS];
+		int X = top[-1];
+		int A = top[0], B = top[1], C = top[2], D = top[3];
+		DST (0, 3) = AVG3 (J, K, L);
+		DST (1, 3) = DST (0, 2) = AVG3 (I, J, K);
+		DST (2, 3) = DST (1, 2) = DST (0, 1) = AVG3 (X, I, J);
+		DST (3, 3) = DST (2, 2) = DST (1, 1) = DST (0, 0) = AVG3 (A, X, I);
+		DST (3, 2) = DST (2, 1) = DST (1, 0) = AVG3 (B, A, X);
+		DST (3, 1) = DST (2, 0) = AVG3 (C, B, A);
+		DST (3, 0) = AVG3 (D, C, B);
+		break;
+	}
+	case B_LD_PRED:
+	{
+		int A = top[0], B = top[1], C = top[2], D = top[3];
+		int E = top[4], F = top[5], G = top[6], H = top[7];
+		DST (0, 0) = AVG3 (A, B, C);
+		DST (1, 0) = DST (0, 1) = AVG3 (B, C, D);
+		DST (2, 0) = DST (1, 1) = DST (0, 2) = AVG3 (C, D, E);
+		DST (3, 0) = DST (2, 1) = DST (1, 2) = DST (0, 3) = AVG3 (D, E, F);
+		DST (3, 1) = DST (2, 2) = DST (1, 3) = AVG3 (E, F, G);
+		DST (3, 2) = DST (2, 3) = AVG3 (F, G, H);
+		DST (3, 3) = AVG3 (G, H, H);
+		break;
+	}
+	case B_VR_PRED:
+	{
+		int I = dst[-1];
+		int J = dst[-1 + WEBP_BPS];
+		int K = dst[-1 + 2 * WEBP_BPS];
+		int X = top[-1];
+		int A = top[0], B = top[1], C = top[2], D = top[3];
+		DST (0, 0) = DST (1, 2) = AVG2 (X, A);
+		DST (1, 0) = DST (2, 2) = AVG2 (A, B);
+		DST (2, 0) = DST (3, 2) = AVG2 (B, C);
+		DST (3, 0) = AVG2 (C, D);
+		DST (0, 3) = AVG3 (K, J, I);
+		DST (0, 2) = AVG3 (J, I, X);
+		DST (0, 1) = DST (1, 3) = AVG3 (I, X, A);
+		DST (1, 1) = DST (2, 3) = AVG3 (X, A, B);
+		DST (2, 1) = DST (3, 3) = AVG3 (A, B, C);
+		DST (3, 1) = AVG3 (B, C, D);
+		break;
+	}
+	case B_VL_PRED:
+	{
+		int A = top[0], B = top[1], C = top[2], D = top[3];
+		int E = top[4], F = top[5], G = top[6], H = top[7];
+		DST (0, 0) = AVG2 (A, B);
+		DST (1, 0) = DST (0, 2) = AVG2 (B, C);
+		DST (2, 0) = DST (1, 2) = AVG2 (C, D);
+		DST (3, 0) = DST (2, 2) = AVG2 (D, E);
+		DST (0, 1) = AVG3 (A, B, C);
+		DST (1, 1) = DST (0, 3) = AVG3 (B, C, D);
+		DST (2, 1) = DST (1, 3) = AVG3 (C, D, E);
+		DST (3, 1) = DST (2, 3) = AVG3 (D, E, F);
+		DST (3, 2) = AVG3 (E, F, G);
+		DST (3, 3) = AVG3 (F, G, H);
+		break;
+	}
+	case B_HD_PRED:
+	{
+		int I = dst[-1];
+		int J = dst[-1 + WEBP_BPS];
+		int K = dst[-1 + 2 * WEBP_BPS];
+		int L = dst[-1 + 3 * WEBP_BPS];
+		int X = top[-1];
+		int A = top[0], B = top[1], C = top[2];
+		DST (0, 0) = DST (2, 1) = AVG2 (I, X);
+		DST (0, 1) = DST (2, 2) = AVG2 (J, I);
+		DST (0, 2) = DST (2, 3) = AVG2 (K, J);
+		DST (0, 3) = AVG2 (L, K);
+		DST (3, 0) = AVG3 (A, B, C);
+		DST (2, 0) = AVG3 (X, A, B);
+		DST (1, 0) = DST (3, 1) = AVG3 (I, X, A);
+		DST (1, 1) = DST (3, 2) = AVG3 (J, I, X);
+		DST (1, 2) = DST (3, 3) = AVG3 (K, J, I);
+		DST (1, 3) = AVG3 (L, K, J);
+		break;
+	}
+	default:
+	{
+		int I = dst[-1];
+		int J = dst[-1 + WEBP_BPS];
+		int K = dst[-1 + 2 * WEBP_BPS];
+		int L = dst[-1 + 3 * WEBP_BPS];
+		DST (0, 0) = AVG2 (I, J);
+		DST (2, 0) = DST (0, 1) = AVG2 (J, K);
+		DST (2, 1) = DST (0, 2) = AVG2 (K, L);
+		DST (1, 0) = AVG3 (I, J, K);
+		DST (3, 0) = DST (1, 1) = AVG3 (J, K, L);
+		DST (3, 1) = DST (1, 2) = AVG3 (K, L, L);
+		DST (3, 2) = DST (2, 2) = DST (0, 3) = DST (1, 3) = DST (2, 3) = DST (3, 3) = (BYTE)L;
+		break;
+	}
+	}
+}
+
+#undef AVG3
+#undef AVG2
+#undef DST
+
+/// <summary>
+/// predict a macroblock and add its residuals, in the work areas, then copy it to the planes.
+/// Neighbours come from the unfiltered planes: 127 above the frame, 129 left of it
+/// </summary>
+void VP8DECODER::reconstruct (int mbx, int mby)
+{
+	BYTE* y = ywork + WEBP_BPS + 8;
+	BYTE* u = uwork + WEBP_BPS + 8;
+	BYTE* v = vwork + WEBP_BPS + 8;
+	int x0 = mbx * 16;
+	int y0 = mby * 16;
+
+	if (mby == 0) {
+		memset (y - WEBP_BPS - 1, 127, 16 + 4 + 1);
+		memset (u - WEBP_BPS - 1, 127, 8 + 1);
+		memset (v - WEBP_BPS - 1, 127, 8 + 1);
+	}
+	else {
+		const BYTE* above = Y + (size_t)(y0 - 1) * ystride + x0;
+		const BYTE* uabove = U + (size_t)(y0 / 2 - 1) * uvstride + x0 / 2;
+		const BYTE* vabove = V + (size_t)(y0 / 2 - 1) * uvstride + x0 / 2;
+		memcpy (y - WEBP_BPS, above, 16);
+		if (mbx == mbw - 1) {
+			memset (y - WEBP_BPS + 16, above[15], 4);
+		}
+		else {
+			memcpy (y - WEBP_BPS + 16, above + 16, 4);
+		}
+		memcpy (u - WEBP_BPS, uabove, 8);
+		memcpy (v - WEBP_BPS, vabove, 8);
+		y[-WEBP_BPS - 1] = mbx == 0 ? 129 : above[-1];
+		u[-WEBP_BPS - 1] = mbx == 0 ? 129 : uabove[-1];
+		v[-WEBP_BPS - 1] = mbx == 0 ? 129 : vabove[-1];
+	}
+	for (auto j = 0; j < 16; j++) {
+		y[j * WEBP_BPS - 1] = mbx == 0 ? 129 : Y[(size_t)(y0 + j) * ystride + x0 - 1];
+	}
+	for (auto j = 0; j < 8; j++) {
+		u[j * WEBP_BPS - 1] = mbx == 0 ? 129 : U[(size_t)(y0 / 2 + j) * uvstride + x0 / 2 - 1];
+		v[j * WEBP_BPS - 1] = mbx == 0 ? 129 : V[(size_t)(y0 / 2 + j) * uvstride + x0 / 2 - 1];
+	}
+
+	if (is4x4) {
+		// sub-blocks down the right edge use the pixels above right of the macroblock
+		for (auto j = 3; j < 16; j += 4) {
+			memcpy (y + j * WEBP_BPS + 16, y - WEBP_BPS + 16, 4);
+		}
+		for (auto n = 0; n < 16; n++) {
+			BYTE* dst = y + (n >> 2) * 4 * WEBP_BPS + (n & 3) * 4;
+			predict_subblock (dst, imodes[n]);
+			inverse_dct_add (coeffs + n * 16, dst);
+		}
+	}
+	else {
+		predict_block (y, ymode, 16, mby > 0, mbx > 0);
+		for (auto n = 0; n < 16; n++) {
+			inverse_dct_add (coeffs + n * 16, y + (n >> 2) * 4 * WEBP_BPS + (n & 3) * 4);
+		}
+	}
+	predict_block (u, uvmode, 8, mby > 0, mbx > 0);
+	predict_block (v, uvmode, 8, mby > 0, mbx > 0);
+	for (auto n = 0; n < 4; n++) {
+		inverse_dct_add (coeffs + 256 + n * 16, u + (n >> 1) * 4 * WEBP_BPS + (n & 1) * 4);
+		inverse_dct_add (coeffs + 320 + n * 16, v + (n >> 1) * 4 * WEBP_BPS + (n & 1) * 4);
+	}
+
+	for (auto j = 0; j < 16; j++) {
+		memcpy (Y + (size_t)(y0 + j) * ystride + x0, y + j * WEBP_BPS, 16);
+	}
+	for (auto j = 0; j < 8; j++) {
+		memcpy (U + (size_t)(y0 / 2 + j) * uvstride + x0 / 2, u + j * WEBP_BPS, 8);
+		memcpy (V + (size_t)(y0 / 2 + j) * uvstride + x0 / 2, v + j * WEBP_BPS, 8);
+	}
+}
+
+static inline int abs_diff (int a, int b)
+{
+	return a > b ? a - b : b - a;
+}
+
+static inline int sclip (int v, int lo, int hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+// adjust the two pixels either side of the edge
+static inline void filter2 (BYTE* p, int step)
+{
+	int p1 = p[-2 * step], p0 = p[-step], q0 = p[0], q1 = p[step];
+	int a = 3 * (q0 - p0) + sclip (p1 - q1, -128, 127);
+	int a1 = sclip ((a + 4) >> 3, -16, 15);
+	int a2 = sclip ((a + 3) >> 3, -16, 15);
+	p[-step] = clip8 (p0 + a2);
+	p[0] = clip8 (q0 - a1);
+}
+
+// two pixels either side, for sub-block edges
+static inline void filter4 (BYTE* p, int step)
+{
+	int p1 = p[-2 * step], p0 = p[-step], q0 = p[0], q1 = p[step];
+	int a = 3 * (q0 - p0);
+	int a1 = sclip ((a + 4) >> 3, -16, 15);
+	int a2 = sclip ((a + 3) >> 3, -16, 15);
+	int a3 = (a1 + 1) >> 1;
+	p[-2 * step] = clip8 (p1 + a3);
+	p[-step] = clip8 (p0 + a2);
+	p[0] = clip8 (q0 - a1);
+	p[step] = clip8 (q1 - a3);
+}
+
+// three pixels either side, for macroblock edges
+static inline void filter6 (BYTE* p, int step)
+{
+	int p2 = p[-3 * step], p1 = p[-2 * step], p0 = p[-step];
+	int q0 = p[0], q1 = p[step], q2 = p[2 * step];
+	int a = sclip (3 * (q0 - p0) + sclip (p1 - q1, -128, 127), -128, 127);
+	int a1 = (27 * a + 63) >> 7;
+	int a2 = (18 * a + 63) >> 7;
+	int a3 = (9 * a + 63) >> 7;
+	p[-3 * step] = clip8 (p2 + a3);
+	p[-2 * step] = clip8 (p1 + a2);
+	p[-step] = clip8 (p0 + a1);
+	p[0] = clip8 (q0 - a1);
+	p[step] = clip8 (q1 - a2);
+	p[2 * step] = clip8 (q2 - a3);
+}
+
+static inline bool high_variance (const BYTE* p, int step, int thresh)
+{
+	return abs_diff (p[-2 * step], p[-step]) > thresh || abs_diff (p[step], p[0]) > thresh;
+}
+
+static inline bool needs_filter (const BYTE* p, int step, int t)
+{
+	return 4 * abs_diff (p[-step], p[0]) + abs_diff (p[-2 * step], p[step]) <= t;
+}
+
+static inline bool needs_filter2 (const BYTE* p, int step, int t, int it)
+{
+	int p3 = p[-4 * step], p2 = p[-3 * step], p1 = p[-2 * step], p0 = p[-step];
+	int q0 = p[0], q1 = p[step], q2 = p[2 * step], q3 = p[3 * step];
+	if (4 * abs_diff (p0, q0) + abs_diff (p1, q1) > t) {
+		return false;
+	}
+	return abs_diff (p3, p2) <= it && abs_diff (p2, p1) <= it && abs_diff (p1, p0) <= it &&
+		abs_diff (q3, q2) <= it && abs_diff (q2, q1) <= it && abs_diff (q1, q0) <= it;
+}
+
+/// <summary>
+/// simple filter along an edge
+/// </summary>
+/// <param name="step">across the edge</param>
+/// <param name="along">to the next pixel along it</param>
+static void simple_edge (BYTE* p, int step, int along, int thresh)
+{
+	int thresh2 = 2 * thresh + 1;
+
+	for (auto i = 0; i < 16; i++, p += along) {
+		if (needs_filter (p, step, thresh2)) {
+			filter2 (p, step);
+		}
+	}
+}
+
+/// <summary>
+/// normal filter along an edge of size pixels
+/// </summary>
+/// <param name="mbedge">a macroblock edge, which takes the stronger filter</param>
+static void normal_edge (BYTE* p, int step, int along, int size, int thresh, int ithresh, int hevthresh, bool mbedge)
+{
+	int thresh2 = 2 * thresh + 1;
+
+	for (auto i = 0; i < size; i++, p += along) {
+		if (needs_filter2 (p, step, thresh2, ithresh)) {
+			if (high_variance (p, step, hevthresh)) {
+				filter2 (p, step);
+			}
+			else if (mbedge) {
+				filter6 (p, step);
+			}
+			else {
+				filter4 (p, step);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// the loop filter, over the whole frame in macroblock order: left edge,
+/// vertical sub-block edges, top edge, horizontal sub-block edges
+/// </summary>
+void VP8DECODER::loop_filter ()
+{
+	for (auto mby = 0; mby < mbh; mby++) {
+		for (auto mbx = 0; mbx < mbw; mbx++) {
+			const VP8FILTER* f = filters + (size_t)mby * mbw + mbx;
+			int limit = f->limit;
+			if (limit == 0) {
+				continue;
+			}
+			BYTE* y = Y + (size_t)mby * 16 * ystride + mbx * 16;
+			if (filtertype == 1) {
+				if (mbx > 0) {
+					simple_edge (y, 1, ystride, limit + 4);
+				}
+				if (f->inner) {
+					for (auto k = 4; k < 16; k += 4) {
+						simple_edge (y + k, 1, ystride, limit);
+					}
+				}
+				if (mby > 0) {
+					simple_edge (y, ystride, 1, limit + 4);
+				}
+				if (f->inner) {
+					for (auto k = 4; k < 16; k += 4) {
+						simple_edge (y + k * ystride, ystride, 1, limit);
+					}
+				}
+				continue;
+			}
+			BYTE* u = U + (size_t)mby * 8 * uvstride + mbx * 8;
+			BYTE* v = V + (size_t)mby * 8 * uvstride + mbx * 8;
+			int ilevel = f->ilevel;
+			int hev = f->hev;
+			if (mbx > 0) {
+				normal_edge (y, 1, ystride, 16, limit + 4, ilevel, hev, true);
+				normal_edge (u, 1, uvstride, 8, limit + 4, ilevel, hev, true);
+				normal_edge (v, 1, uvstride, 8, limit + 4, ilevel, hev, true);
+			}
+			if (f->inner) {
+				for (auto k = 4; k < 16; k += 4) {
+					normal_edge (y + k, 1, ystride, 16, limit, ilevel, hev, false);
+				}
+				normal_edge (u + 4, 1, uvstride, 8, limit, ilevel, hev, false);
+				normal_edge (v + 4, 1, uvstride, 8, limit, ilevel, hev, false);
+			}
+			if (mby > 0) {
+				normal_edge (y, ystride, 1, 16, limit + 4, ilevel, hev, true);
+				normal_edge (u, uvstride, 1, 8, limit + 4, ilevel, hev, true);
+				normal_edge (v, uvstride, 1, 8, limit + 4, ilevel, hev, true);
+			}
+			if (f->inner) {
+				for (auto k = 4; k < 16; k += 4) {
+					normal_edge (y + k * ystride, ystride, 1, 16, limit, ilevel, hev, false);
+				}
+				normal_edge (u + 4 * uvstride, uvstride, 1, 8, limit, ilevel, hev, false);
+				normal_edge (v + 4 * uvstride, uvstride, 1, 8, limit, ilevel, hev, false);
+			}
+		}
+	}
+}
+
+/// <summary>
+/// decode a key frame
+/// </summary>
+void VP8DECODER::run (const BYTE* data, size_t N)
+{
+	if (N < 10) {
+		throw general_exception ("parse_error");
+	}
+	unsigned int tag = read24 (data);
+	bool keyframe = !(tag & 1);
+	int profile = (tag >> 1) & 7;
+	bool show = ((tag >> 4) & 1) != 0;
+	size_t first = tag >> 5;
+	if (!keyframe || profile > 3 || !show || data[3] != 0x9D || data[4] != 0x01 || data[5] != 0x2A) {
+		throw general_exception ("parse_error");
+	}
+	width = (data[6] | data[7] << 8) & 0x3FFF;
+	height = (data[8] | data[9] << 8) & 0x3FFF;
+	if (width == 0 || height == 0) {
+		throw general_exception ("parse_error");
+	}
+	data += 10;
+	N -= 10;
+	if (first > N) {
+		throw general_exception ("parse_error");
+	}
+	br.init (data, first);
+	br.getbit (128);                // color space
+	br.getbit (128);                // clamping type
+	read_segments ();
+	read_filter ();
+	read_partitions (data + first, N - first);
+	read_quantisers ();
+	br.getbit (128);                // refresh entropy probabilities, meaningless for a lone key frame
+	read_probabilities ();
+
+	mbw = (width + 15) >> 4;
+	mbh = (height + 15) >> 4;
+	ystride = mbw * 16;
+	uvstride = mbw * 8;
+	Y = new BYTE[(size_t)ystride * mbh * 16];
+	U = new BYTE[(size_t)uvstride * mbh * 8];
+	V = new BYTE[(size_t)uvstride * mbh * 8];
+	filters = new VP8FILTER[(size_t)mbw * mbh];
+	topmodes = new BYTE[4 * mbw];
+	topnz = new BYTE[mbw];
+	topnzdc = new BYTE[mbw];
+	if (!Y || !U || !V || !filters || !topmodes || !topnz || !topnzdc) {
+		throw general_exception ("out_of_memory");
+	}
+	memset (topmodes, B_DC_PRED, 4 * mbw);
+	memset (topnz, 0, mbw);
+	memset (topnzdc, 0, mbw);
+	set_strengths ();
+
+	for (auto mby = 0; mby < mbh; mby++) {
+		VP8BOOL* tb = parts + (mby & (nparts - 1));
+		memset (leftmodes, B_DC_PRED, 4);
+		leftnz = 0;
+		leftnzdc = 0;
+		for (auto mbx = 0; mbx < mbw; mbx++) {
+			bool nonzero = false;
+			read_modes (mbx);
+			if (!skip) {
+				nonzero = read_residuals (mbx, tb);
+			}
+			else {
+				leftnz = topnz[mbx] = 0;
+				if (!is4x4) {
+					leftnzdc = topnzdc[mbx] = 0;
+				}
+				memset (coeffs, 0, sizeof (coeffs));
+			}
+			if (filtertype) {
+				VP8FILTER* f = filters + (size_t)mby * mbw + mbx;
+				*f = strengths[segment][is4x4];
+				f->inner |= nonzero;
+			}
+			reconstruct (mbx, mby);
+			if (tb->eof) {
+				throw general_exception ("parse_error");
+			}
+		}
+		if (br.eof) {
+			throw general_exception ("parse_error");
+		}
+	}
+	if (filtertype) {
+		loop_filter ();
+	}
+}
+
+static inline int mult_hi (int v, int coeff)
+{
+	return (v * coeff) >> 8;
+}
+
+static inline BYTE yuv_clip (int v)
+{
+	return (BYTE)((v & ~16383) == 0 ? v >> 6 : v < 0 ? 0 : 255);
+}
+
+// BT.601 limited range to RGB in 14 bit fixed point
+static inline void yuv_to_rgb (int y, int u, int v, BYTE* rgb)
+{
+	rgb[0] = yuv_clip (mult_hi (y, 19077) + mult_hi (v, 26149) - 14234);
+	rgb[1] = yuv_clip (mult_hi (y, 19077) - mult_hi (u, 6419) - mult_hi (v, 13320) + 8708);
+	rgb[2] = yuv_clip (mult_hi (y, 19077) + mult_hi (u, 33050) - 17685);
+}
+
+/// <summary>
+/// convert two rows of luma, interpolating chroma between the two chroma rows
+/// around them: 9/16 the nearest sample, 3/16 each of the two next and 1/16 the far one
+/// </summary>
+/// <param name="bottomy">NULL for the first and (even heights) last rows, done alone</param>
+static void upsample_rows (const BYTE* topy, const BYTE* bottomy, const BYTE* topu, const BYTE* topv,
+	const BYTE* curu, const BYTE* curv, BYTE* topdst, BYTE* bottomdst, int len, int samples)
+{
+	int last = (len - 1) >> 1;
+	int tlu = topu[0], tlv = topv[0];
+	int lu = curu[0], lv = curv[0];
+
+	yuv_to_rgb (topy[0], (3 * tlu + lu + 2) >> 2, (3 * tlv + lv + 2) >> 2, topdst);
+	if (bottomy) {
+		yuv_to_rgb (bottomy[0], (3 * lu + tlu + 2) >> 2, (3 * lv + tlv + 2) >> 2, bottomdst);
+	}
+	for (auto x = 1; x <= last; x++) {
+		int tu = topu[x], tv = topv[x];
+		int cu = curu[x], cv = curv[x];
+		int avgu = tlu + tu + lu + cu + 8;
+		int avgv = tlv + tv + lv + cv + 8;
+		int diag12u = (avgu + 2 * (tu + lu)) >> 3;
+		int diag12v = (avgv + 2 * (tv + lv)) >> 3;
+		int diag03u = (avgu + 2 * (tlu + cu)) >> 3;
+		int diag03v = (avgv + 2 * (tlv + cv)) >> 3;
+		yuv_to_rgb (topy[2 * x - 1], (diag12u + tlu) >> 1, (diag12v + tlv) >> 1, topdst + (2 * x - 1) * samples);
+		yuv_to_rgb (topy[2 * x], (diag03u + tu) >> 1, (diag03v + tv) >> 1, topdst + 2 * x * samples);
+		if (bottomy) {
+			yuv_to_rgb (bottomy[2 * x - 1], (diag03u + lu) >> 1, (diag03v + lv) >> 1, bottomdst + (2 * x - 1) * samples);
+			yuv_to_rgb (bottomy[2 * x], (diag12u + cu) >> 1, (diag12v + cv) >> 1, bottomdst + 2 * x * samples);
+		}
+		tlu = tu;
+		tlv = tv;
+		lu = cu;
+		lv = cv;
+	}
+	if (!(len & 1)) {
+		yuv_to_rgb (topy[len - 1], (3 * tlu + lu + 2) >> 2, (3 * tlv + lv + 2) >> 2, topdst + (len - 1) * samples);
+		if (bottomy) {
+			yuv_to_rgb (bottomy[len - 1], (3 * lu + tlu + 2) >> 2, (3 * lv + tlv + 2) >> 2, bottomdst + (len - 1) * samples);
+		}
+	}
+}
+
+/// <summary>
+/// the frame as RGB or RGBA (alpha left for the caller), with libwebp's
+/// default fancy upsampling so the pixels come out the same
+/// </summary>
+void VP8DECODER::to_rgb (BYTE* out, int samples) const
+{
+	size_t stride = (size_t)width * samples;
+
+	upsample_rows (Y, NULL, U, V, U, V, out, NULL, width, samples);
+	for (auto y = 1; y + 1 < height; y += 2) {
+		const BYTE* topuv = U + (size_t)(y >> 1) * uvstride;
+		upsample_rows (Y + (size_t)y * ystride, Y + (size_t)(y + 1) * ystride,
+			topuv, V + (size_t)(y >> 1) * uvstride,
+			topuv + uvstride, V + (size_t)((y >> 1) + 1) * uvstride,
+			out + y * stride, out + (y + 1) * stride, width, samples);
+	}
+	if (!(height & 1)) {
+		const BYTE* u = U + (size_t)((height >> 1) - 1) * uvstride;
+		const BYTE* v = V + (size_t)((height >> 1) - 1) * uvstride;
+		upsample_rows (Y + (size_t)(height - 1) * ystride, NULL, u, v, u, v, out + (height - 1) * stride, NULL, width, samples);
+	}
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* container */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// the alpha plane of a lossy image, from its ALPH chunk: raw or a lossless
+/// image's green, then unfiltered
+/// </summary>
+static void decode_alpha (const BYTE* data, size_t N, int width, int height, BYTE* alpha)
+{
+	size_t pixels = (size_t)width * height;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int method = data[0] & 3;
+	int filter = (data[0] >> 2) & 3;
+	int preprocessing = (data[0] >> 4) & 3;
+	if (method > 1 || preprocessing > 1 || (data[0] >> 6) != 0) {
+		throw general_exception ("parse_error");
+	}
+	if (method == 0) {
+		if (N - 1 < pixels) {
+			throw general_exception ("parse_error");
+		}
+		memcpy (alpha, data + 1, pixels);
+	}
+	else {
+		VP8LDECODER lossless (data + 1, N - 1);
+		lossless.decode (width, height);
+		for (size_t i = 0; i < pixels; i++) {
+			alpha[i] = (BYTE)(lossless.argb[i] >> 8);
+		}
+	}
+	if (filter == 0) {
+		return;
+	}
+	for (auto y = 0; y < height; y++) {
+		BYTE* row = alpha + (size_t)y * width;
+		const BYTE* prev = y ? row - width : NULL;
+		if (!prev || filter == 1) {
+			// horizontal, which the first row always is
+			int pred = prev ? prev[0] : 0;
+			for (auto x = 0; x < width; x++) {
+				row[x] = (BYTE)(row[x] + pred);
+				pred = row[x];
+			}
+		}
+		else if (filter == 2) {
+			for (auto x = 0; x < width; x++) {
+				row[x] = (BYTE)(row[x] + prev[x]);
+			}
+		}
+		else {
+			int left = prev[0];
+			int topleft = prev[0];
+			for (auto x = 0; x < width; x++) {
+				int top = prev[x];
+				left = (BYTE)(row[x] + clip255 (left + top - topleft));
+				topleft = top;
+				row[x] = (BYTE)left;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// a WebP file, RIFF wrapped or a bare VP8 or VP8L stream
+/// </summary>
+class WEBPDECODER
+{
+public:
+	BYTE* out;
+	int width;
+	int height;
+	size_t used;
+	BYTE* alpha;
+
+	WEBPDECODER ()
+	{
+		out = NULL;
+		width = height = 0;
+		used = 0;
+		alpha = NULL;
+	}
+	~WEBPDECODER ()
+	{
+		delete[] out;
+		delete[] alpha;
+	}
+	void run (const BYTE* data, size_t N, int samples);
+	void allocate (int w, int h, int samples);
+};
+
+void WEBPDECODER::allocate (int w, int h, int samples)
+{
+	width = w;
+	height = h;
+	used = (size_t)w * h * samples;
+	out = new BYTE[used];
+	if (!out) {
+		throw general_exception ("out_of_memory");
+	}
+}
+
+void WEBPDECODER::run (const BYTE* data, size_t N, int samples)
+{
+	const BYTE* image = data;
+	size_t imagesize = N;
+	const BYTE* alph = NULL;
+	size_t alphsize = 0;
+	int canvaswidth = 0;
+	int canvasheight = 0;
+	bool lossless;
+
+	if (samples != 3 && samples != 4) {
+		throw general_exception ("parse_error");
+	}
+	if (N >= 12 && !memcmp (data, "RIFF", 4) && !memcmp (data + 8, "WEBP", 4)) {
+		size_t riffsize = read32 (data + 4);
+		size_t pos = 12;
+		if (riffsize < 12 || riffsize > N - 8) {
+			throw general_exception ("parse_error");
+		}
+		size_t end = riffsize + 8;
+		image = NULL;
+		while (!image && pos + 8 <= end) {
+			const BYTE* chunk = data + pos;
+			size_t size = read32 (chunk + 4);
+			if (size > end - pos - 8) {
+				throw general_exception ("parse_error");
+			}
+			if (!memcmp (chunk, "VP8X", 4)) {
+				// animation isn't for TIFF
+				if (size < 10 || (chunk[8] & 0x02)) {
+					throw general_exception ("parse_error");
+				}
+				canvaswidth = read24 (chunk + 12) + 1;
+				canvasheight = read24 (chunk + 15) + 1;
+			}
+			else if (!memcmp (chunk, "ALPH", 4)) {
+				if (canvaswidth) {
+					alph = chunk + 8;
+					alphsize = size;
+				}
+			}
+			else if (!memcmp (chunk, "VP8 ", 4) || !memcmp (chunk, "VP8L", 4)) {
+				image = chunk + 8;
+				imagesize = size;
+			}
+			pos += 8 + size + (size & 1);
+		}
+		if (!image) {
+			throw general_exception ("parse_error");
+		}
+	}
+	lossless = imagesize >= 5 && image[0] == VP8L_MAGIC && (image[4] >> 5) == 0;
+
+	if (lossless) {
+		VP8LDECODER decoder (image, imagesize);
+		decoder.readbits (8);
+		int w = decoder.readbits (14) + 1;
+		int h = decoder.readbits (14) + 1;
+		decoder.readbits (1);       // alpha is used: it decodes the same either way
+		if (decoder.readbits (3) != 0) {
+			throw general_exception ("parse_error");
+		}
+		if (canvaswidth && (w != canvaswidth || h != canvasheight)) {
+			throw general_exception ("parse_error");
+		}
+		decoder.decode (w, h);
+		allocate (w, h, samples);
+		size_t pixels = (size_t)w * h;
+		BYTE* dst = out;
+		for (size_t i = 0; i < pixels; i++, dst += samples) {
+			unsigned int pixel = decoder.argb[i];
+			dst[0] = (BYTE)(pixel >> 16);
+			dst[1] = (BYTE)(pixel >> 8);
+			dst[2] = (BYTE)pixel;
+			if (samples == 4) {
+				dst[3] = (BYTE)(pixel >> 24);
+			}
+		}
+	}
+	else {
+		VP8DECODER decoder;
+		decoder.run (image, imagesize);
+		if (canvaswidth && (decoder.width != canvaswidth || decoder.height != canvasheight)) {
+			throw general_exception ("parse_error");
+		}
+		allocate (decoder.width, decoder.height, samples);
+		decoder.to_rgb (out, samples);
+		if (samples == 4) {
+			size_t pixels = (size_t)width * height;
+			if (alph) {
+				alpha = new BYTE[pixels];
+				if (!alpha) {
+					throw general_exception ("out_of_memory");
+				}
+				decode_alpha (alph, alphsize, width, height, alpha);
+			}
+			for (size_t i = 0; i < pixels; i++) {
+				out[i * 4 + 3] = alpha ? alpha[i] : 255;
+			}
+		}
+	}
+}
+
+/// <summary>
+/// decode a WebP strip or tile
+/// </summary>
+/// <param name="samples">3 for RGB, 4 for RGBA</param>
+/// <returns>the pixels, samples bytes each, 0 on fail</returns>
+BYTE* webp_decompress (const BYTE* data, unsigned long N, int samples, int* width, int* height, unsigned long* Nret)
+{
+	WEBPDECODER decoder;
+	BYTE* answer;
+
+	try {
+		decoder.run (data, N, samples);
+		answer = decoder.out;
+		decoder.out = NULL;
+		*width = decoder.width;
+		*height = decoder.height;
+		*Nret = (unsigned long)decoder.used;
+		return answer;
+	}
+	catch (general_exception) {
+		return 0;
+	}
+}
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef webpdec_h
+#define webpdec_h
+
+/*
+  WebP decoder for WebP compressed TIFF strips and tiles (Compression = 50001).
+
+  To use
+	data = webp_decompress (strip, Nstrip, samplesperpixel, &width, &height, &N);
+
+  Each strip or tile is a WebP file of its own, RIFF wrapped. Lossless
+  (VP8L) images decode exactly: the four transforms, color cache, LZ77
+  copies and entropy image. Lossy (VP8) key frames decode with both loop
+  filters and the same fancy chroma upsampling libwebp does for RGB output,
+  and their alpha comes from the ALPH chunk (raw or lossless, filtered or
+  not). Animations are refused.
+
+  samples is 3 for RGB or 4 for RGBA, whatever the file holds; images
+  without alpha come back opaque. Built when TIFF_WEBP (loadtiff.h) is 1.
+*/
+
+typedef unsigned char BYTE;
+
+BYTE* webp_decompress (const BYTE* data, unsigned long N, int samples, int* width, int* height, unsigned long* Nret);
+
+#endif
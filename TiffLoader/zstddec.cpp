@@ -0,0 +1,1335 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "loadtiff.h"
+#include "zstddec.h"
+
+#define ZSTD_MAGIC 0xFD2FB528u
+#define ZSTD_BLOCKMAX (128 * 1024)
+#define ZSTD_SLACK 32                   // wild copies run up to 16 bytes past the end
+
+// literals length codes, base value and extra bits
+static const unsigned int llbase[36] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 18, 20, 22, 24, 28, 32, 40, 48, 64, 128, 256, 512, 1024, 2048, 4096,
+	8192, 16384, 32768, 65536
+};
+static const BYTE llbits[36] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 6, 7, 8, 9, 10, 11, 12,
+	13, 14, 15, 16
+};
+
+// match length codes
+static const unsigned int mlbase[53] = {
+	3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15, 16, 17, 18,
+	19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31, 32, 33, 34,
+	35, 37, 39, 41, 43, 47, 51, 59, 67, 83, 99, 131, 259, 515, 1027, 2051,
+	4099, 8195, 16387, 32771, 65539
+};
+static const BYTE mlbits[53] = {
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+	1, 1, 1, 1, 2, 2, 3, 3, 4, 4, 5, 7, 8, 9, 10, 11,
+	12, 13, 14, 15, 16
+};
+
+// offset codes, code n is 1 << n plus n extra bits
+static const unsigned int ofbase[32] = {
+	0x1, 0x2, 0x4, 0x8, 0x10, 0x20, 0x40, 0x80,
+	0x100, 0x200, 0x400, 0x800, 0x1000, 0x2000, 0x4000, 0x8000,
+	0x10000, 0x20000, 0x40000, 0x80000, 0x100000, 0x200000, 0x400000, 0x800000,
+	0x1000000, 0x2000000, 0x4000000, 0x8000000, 0x10000000, 0x20000000, 0x40000000, 0x80000000
+};
+static const BYTE ofbits[32] = {
+	0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15,
+	16, 17, 18, 19, 20, 21, 22, 23, 24, 25, 26, 27, 28, 29, 30, 31
+};
+
+// predefined distributions, used until a frame sends its own
+static const short lldefault[36] = {
+	4, 3, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 2, 1, 1, 1,
+	2, 2, 2, 2, 2, 2, 2, 2, 2, 3, 2, 1, 1, 1, 1, 1,
+	-1, -1, -1, -1
+};
+static const short mldefault[53] = {
+	1, 4, 3, 2, 2, 2, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, -1, -1,
+	-1, -1, -1, -1, -1
+};
+static const short ofdefault[29] = {
+	1, 1, 1, 1, 1, 1, 2, 2, 2, 1, 1, 1, 1, 1, 1, 1,
+	1, 1, 1, 1, 1, 1, 1, 1, -1, -1, -1, -1, -1
+};
+
+// the format is little endian, so are the hosts this builds for
+static inline unsigned int read32 (const BYTE* p)
+{
+	unsigned int x;
+	memcpy (&x, p, 4);
+	return x;
+}
+
+static inline unsigned long long read64 (const BYTE* p)
+{
+	unsigned long long x;
+	memcpy (&x, p, 8);
+	return x;
+}
+
+static inline int highbit (unsigned int x)
+{
+	int n = 0;
+	while (x >>= 1) {
+		n++;
+	}
+	return n;
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* content checksum */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+static const unsigned long long XXP1 = 11400714785074694791ULL;
+static const unsigned long long XXP2 = 14029467366897019727ULL;
+static const unsigned long long XXP3 = 1609587929392839161ULL;
+static const unsigned long long XXP4 = 9650029242287828579ULL;
+static const unsigned long long XXP5 = 2870177450012600261ULL;
+
+static inline unsigned long long rotl64 (unsigned long long x, int r)
+{
+	return (x << r) | (x >> (64 - r));
+}
+
+static inline unsigned long long xxround (unsigned long long acc, unsigned long long input)
+{
+	acc += input * XXP2;
+	return rotl64 (acc, 31) * XXP1;
+}
+
+static inline unsigned long long xxmerge (unsigned long long acc, unsigned long long val)
+{
+	acc ^= xxround (0, val);
+	return acc * XXP1 + XXP4;
+}
+
+/// <summary>
+/// XXH64, zstd keeps the low 32 bits of it as the content checksum
+/// </summary>
+/// <param name="p">data</param>
+/// <param name="len">bytes of data</param>
+/// <returns></returns>
+static unsigned long long xxh64 (const BYTE* p, size_t len)
+{
+	const BYTE* end = p + len;
+	unsigned long long h;
+
+	if (len >= 32) {
+		const BYTE* limit = end - 32;
+		unsigned long long v1 = XXP1 + XXP2;
+		unsigned long long v2 = XXP2;
+		unsigned long long v3 = 0;
+		unsigned long long v4 = 0 - XXP1;
+		do {
+			v1 = xxround (v1, read64 (p));
+			v2 = xxround (v2, read64 (p + 8));
+			v3 = xxround (v3, read64 (p + 16));
+			v4 = xxround (v4, read64 (p + 24));
+			p += 32;
+		} while (p <= limit);
+		h = rotl64 (v1, 1) + rotl64 (v2, 7) + rotl64 (v3, 12) + rotl64 (v4, 18);
+		h = xxmerge (h, v1);
+		h = xxmerge (h, v2);
+		h = xxmerge (h, v3);
+		h = xxmerge (h, v4);
+	}
+	else {
+		h = XXP5;
+	}
+	h += len;
+	while (p + 8 <= end) {
+		h ^= xxround (0, read64 (p));
+		h = rotl64 (h, 27) * XXP1 + XXP4;
+		p += 8;
+	}
+	if (p + 4 <= end) {
+		h ^= (unsigned long long)read32 (p) * XXP1;
+		h = rotl64 (h, 23) * XXP2 + XXP3;
+		p += 4;
+	}
+	while (p < end) {
+		h ^= *p++ * XXP5;
+		h = rotl64 (h, 11) * XXP1;
+	}
+	h ^= h >> 33;
+	h *= XXP2;
+	h ^= h >> 29;
+	h *= XXP3;
+	h ^= h >> 32;
+	return h;
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* entropy coding */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// reads a bitstream backwards from its last byte, whose top set bit
+/// marks where the data starts. Reading past the start gives zeros, which
+/// finished () and reload () report.
+/// </summary>
+class ZSTDBITS
+{
+public:
+	const BYTE* start;
+	const BYTE* ptr;                // 8 bytes loaded into the container
+	unsigned long long bits;        // the unread ones, shifted to the top
+	unsigned int consumed;          // bits of the 8 bytes used
+
+	bool init (const BYTE* data, size_t N)
+	{
+		if (N == 0 || data[N - 1] == 0) {
+			return false;
+		}
+		start = data;
+		if (N >= 8) {
+			ptr = data + N - 8;
+			bits = read64 (ptr);
+			consumed = 0;
+		}
+		else {
+			ptr = data;
+			bits = 0;
+			for (size_t i = 0; i < N; i++) {
+				bits |= (unsigned long long)data[i] << (i * 8);
+			}
+			consumed = (unsigned int)(8 - N) * 8;
+		}
+		consumed += 8 - highbit (data[N - 1]);
+		bits = consumed < 64 ? bits << consumed : 0;
+		return true;
+	}
+	/// <summary>
+	/// next n bits, 0 to 32
+	/// </summary>
+	inline unsigned int look (int n) const
+	{
+		return (unsigned int)((bits >> 1) >> (63 - n));
+	}
+	inline void skip (int n)
+	{
+		bits <<= n;
+		consumed += n;
+	}
+	inline unsigned int get (int n)
+	{
+		unsigned int x = look (n);
+		skip (n);
+		return x;
+	}
+	/// <summary>
+	/// top the container up, leaves at least 57 bits unless the start is near
+	/// </summary>
+	/// <returns>false once more bits have been read than the stream holds</returns>
+	inline bool reload ()
+	{
+		if (consumed > 64) {
+			return false;
+		}
+		if (ptr >= start + 8) {
+			ptr -= consumed >> 3;
+			consumed &= 7;
+		}
+		else if (ptr == start) {
+			return true;
+		}
+		else {
+			unsigned int n = consumed >> 3;
+			if ((size_t)(ptr - start) < n) {
+				n = (unsigned int)(ptr - start);
+			}
+			ptr -= n;
+			consumed -= n * 8;
+		}
+		bits = consumed < 64 ? read64 (ptr) << consumed : 0;
+		return true;
+	}
+	bool finished () const
+	{
+		return ptr == start && consumed == 64;
+	}
+};
+
+/// <summary>
+/// one cell of an FSE decoding table. For sequences value and extra are the
+/// base and extra bits of the code, otherwise value is the symbol.
+/// </summary>
+class ZSTDFSE
+{
+public:
+	unsigned int value;
+	unsigned short next;            // next state, before adding the bits read
+	BYTE bits;                      // bits to read for the next state
+	BYTE extra;
+};
+
+/// <summary>
+/// forward bit read for the table descriptions, zeros past the end
+/// </summary>
+static inline unsigned int forward_bits (const BYTE* data, size_t N, size_t bitpos)
+{
+	size_t i = bitpos >> 3;
+	unsigned int x = 0;
+
+	for (auto k = 0; k < 4 && i + k < N; k++) {
+		x |= (unsigned int)data[i + k] << (k * 8);
+	}
+	return x >> (bitpos & 7);
+}
+
+/// <summary>
+/// read an FSE table description
+/// </summary>
+/// <param name="data"></param>
+/// <param name="N">bytes available</param>
+/// <param name="norm">return for the normalised counts, -1 for "less than one"</param>
+/// <param name="maxsym">largest symbol allowed, returns the largest present</param>
+/// <param name="log">return for the accuracy log</param>
+/// <param name="maxlog">largest accuracy log allowed</param>
+/// <returns>bytes used, -1 if corrupt</returns>
+static int read_ncount (const BYTE* data, size_t N, short* norm, int* maxsym, int* log, int maxlog)
+{
+	size_t bitpos = 4;
+	int sym = 0;
+	bool previous0 = false;
+
+	if (N < 1) {
+		return -1;
+	}
+	int al = (data[0] & 15) + 5;
+	if (al > maxlog) {
+		return -1;
+	}
+	int remaining = (1 << al) + 1;
+	int threshold = 1 << al;
+	int nbits = al + 1;
+	while (remaining > 1 && sym <= *maxsym) {
+		if (previous0) {
+			int n0 = sym;
+			for (;;) {
+				unsigned int r = forward_bits (data, N, bitpos) & 3;
+				bitpos += 2;
+				n0 += r;
+				if (r != 3 || bitpos > N * 8) {
+					break;
+				}
+			}
+			if (n0 > *maxsym) {
+				return -1;
+			}
+			while (sym < n0) {
+				norm[sym++] = 0;
+			}
+		}
+		unsigned int x = forward_bits (data, N, bitpos);
+		int max = (2 * threshold - 1) - remaining;
+		int count;
+		if ((int)(x & (threshold - 1)) < max) {
+			count = x & (threshold - 1);
+			bitpos += nbits - 1;
+		}
+		else {
+			count = x & (2 * threshold - 1);
+			if (count >= threshold) {
+				count -= max;
+			}
+			bitpos += nbits;
+		}
+		count--;
+		remaining -= count < 0 ? -count : count;
+		if (remaining < 1) {
+			return -1;
+		}
+		norm[sym++] = (short)count;
+		previous0 = count == 0;
+		while (remaining < threshold) {
+			nbits--;
+			threshold >>= 1;
+		}
+	}
+	size_t used = (bitpos + 7) / 8;
+	if (remaining != 1 || used > N) {
+		return -1;
+	}
+	*maxsym = sym - 1;
+	*log = al;
+	return (int)used;
+}
+
+/// <summary>
+/// spread the symbols over a decoding table
+/// </summary>
+/// <param name="table">1 << log cells</param>
+/// <param name="norm">normalised counts</param>
+/// <param name="maxsym">largest symbol</param>
+/// <param name="log">accuracy log</param>
+/// <param name="values">base value of each code, NULL to store the symbol</param>
+/// <param name="extra">extra bits of each code, NULL for none</param>
+/// <returns>false if the counts don't fill the table</returns>
+static bool build_fse (ZSTDFSE* table, const short* norm, int maxsym, int log, const unsigned int* values, const BYTE* extra)
+{
+	int size = 1 << log;
+	int high = size - 1;
+	int step = (size >> 1) + (size >> 3) + 3;
+	int pos = 0;
+	unsigned short next[256];
+	BYTE symbols[512];
+
+	for (auto s = 0; s <= maxsym; s++) {
+		if (norm[s] == -1) {
+			if (high < 0) {
+				return false;
+			}
+			symbols[high--] = (BYTE)s;
+			next[s] = 1;
+		}
+		else {
+			next[s] = norm[s];
+		}
+	}
+	for (auto s = 0; s <= maxsym; s++) {
+		for (auto i = 0; i < norm[s]; i++) {
+			symbols[pos] = (BYTE)s;
+			do {
+				pos = (pos + step) & (size - 1);
+			} while (pos > high);
+		}
+	}
+	if (pos != 0) {
+		return false;
+	}
+	for (auto u = 0; u < size; u++) {
+		int s = symbols[u];
+		int x = next[s]++;
+		int nb = log - highbit (x);
+		table[u].bits = (BYTE)nb;
+		table[u].next = (unsigned short)((x << nb) - size);
+		table[u].value = values ? values[s] : s;
+		table[u].extra = extra ? extra[s] : 0;
+	}
+	return true;
+}
+
+/// <summary>
+/// the predefined sequence tables
+/// </summary>
+class ZSTDDEFAULTS
+{
+public:
+	ZSTDFSE ll[64];
+	ZSTDFSE of[32];
+	ZSTDFSE ml[64];
+
+	ZSTDDEFAULTS ()
+	{
+		build_fse (ll, lldefault, 35, 6, llbase, llbits);
+		build_fse (of, ofdefault, 28, 5, ofbase, ofbits);
+		build_fse (ml, mldefault, 52, 6, mlbase, mlbits);
+	}
+	static const ZSTDDEFAULTS& get ()
+	{
+		static const ZSTDDEFAULTS tables;
+		return tables;
+	}
+};
+
+/// <summary>
+/// Huffman table for literals. Every code is looked up with one read of
+/// maxbits bits.
+/// </summary>
+class ZSTDHUFFMAN
+{
+public:
+	enum { MAX_BITS = 11 };
+	unsigned short table[1 << MAX_BITS];   // symbol, code length in the top byte
+	int maxbits;
+	bool present;
+
+	ZSTDHUFFMAN ()
+	{
+		maxbits = 0;
+		present = false;
+	}
+	int read (const BYTE* data, size_t N);
+	bool build (BYTE* weights, int n);
+};
+
+/// <summary>
+/// read a Huffman tree description
+/// </summary>
+/// <param name="data"></param>
+/// <param name="N">bytes available</param>
+/// <returns>bytes used, -1 if corrupt</returns>
+int ZSTDHUFFMAN::read (const BYTE* data, size_t N)
+{
+	BYTE weights[257];
+	int n = 0;
+	size_t used;
+
+	present = false;
+	if (N < 1) {
+		return -1;
+	}
+	int header = data[0];
+	if (header >= 128) {
+		// 4 bit weights
+		n = header - 127;
+		used = 1 + (n + 1) / 2;
+		if (used > N) {
+			return -1;
+		}
+		for (auto i = 0; i < n; i++) {
+			BYTE b = data[1 + i / 2];
+			weights[i] = (i & 1) ? b & 15 : b >> 4;
+		}
+	}
+	else {
+		// FSE compressed weights, two interleaved states
+		ZSTDFSE fse[64];
+		short norm[256];
+		int maxsym = 255;
+		int log;
+		ZSTDBITS br;
+
+		used = 1 + header;
+		if (header == 0 || used > N) {
+			return -1;
+		}
+		int tablesize = read_ncount (data + 1, header, norm, &maxsym, &log, 6);
+		if (tablesize < 0 || !build_fse (fse, norm, maxsym, log, NULL, NULL)) {
+			return -1;
+		}
+		if (!br.init (data + 1 + tablesize, header - tablesize)) {
+			return -1;
+		}
+		unsigned int s1 = br.get (log);
+		unsigned int s2 = br.get (log);
+		br.reload ();
+		for (;;) {
+			if (n > 253) {
+				return -1;
+			}
+			weights[n++] = (BYTE)fse[s1].value;
+			s1 = fse[s1].next + br.get (fse[s1].bits);
+			if (!br.reload ()) {
+				weights[n++] = (BYTE)fse[s2].value;
+				break;
+			}
+			weights[n++] = (BYTE)fse[s2].value;
+			s2 = fse[s2].next + br.get (fse[s2].bits);
+			if (!br.reload ()) {
+				weights[n++] = (BYTE)fse[s1].value;
+				break;
+			}
+		}
+	}
+	if (!build (weights, n)) {
+		return -1;
+	}
+	present = true;
+	return (int)used;
+}
+
+/// <summary>
+/// build the lookup table from the weights. The last symbol's weight is
+/// implied, it makes the total a power of two.
+/// </summary>
+/// <param name="weights">n weights, room for one more</param>
+/// <param name="n">weights sent</param>
+/// <returns>false if the weights are impossible</returns>
+bool ZSTDHUFFMAN::build (BYTE* weights, int n)
+{
+	int rank[MAX_BITS + 2] = {};
+	int pos[MAX_BITS + 2];
+	unsigned int total = 0;
+
+	if (n < 1 || n > 255) {
+		return false;
+	}
+	for (auto i = 0; i < n; i++) {
+		if (weights[i] > MAX_BITS) {
+			return false;
+		}
+		rank[weights[i]]++;
+		if (weights[i]) {
+			total += 1u << (weights[i] - 1);
+		}
+	}
+	if (total == 0) {
+		return false;
+	}
+	maxbits = highbit (total) + 1;
+	if (maxbits > MAX_BITS) {
+		return false;
+	}
+	unsigned int rest = (1u << maxbits) - total;
+	if (rest & (rest - 1)) {
+		return false;
+	}
+	weights[n] = (BYTE)(highbit (rest) + 1);
+	rank[weights[n]]++;
+
+	// longest codes first, each symbol takes 1 << (weight - 1) cells
+	int p = 0;
+	for (auto w = 1; w <= maxbits; w++) {
+		pos[w] = p;
+		p += rank[w] << (w - 1);
+	}
+	for (auto s = 0; s <= n; s++) {
+		int w = weights[s];
+		if (w) {
+			unsigned short entry = (unsigned short)(s | (maxbits + 1 - w) << 8);
+			for (auto i = 0; i < 1 << (w - 1); i++) {
+				table[pos[w]++] = entry;
+			}
+		}
+	}
+	return true;
+}
+
+/// <summary>
+/// decode one literal
+/// </summary>
+/// <param name="br"></param>
+/// <param name="table">ZSTDHUFFMAN table</param>
+/// <param name="shift">64 - maxbits</param>
+/// <returns></returns>
+static inline BYTE huffman_symbol (ZSTDBITS& br, const unsigned short* table, int shift)
+{
+	unsigned short e = table[br.bits >> shift];
+	br.skip (e >> 8);
+	return (BYTE)e;
+}
+
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+/* decoder */
+/*//////////////////////////////////////////////////////////////////////////////////////////////////*/
+
+/// <summary>
+/// copy in 16 byte steps, may write up to 15 bytes past dst + n.
+/// Overlapping copies are fine as long as dst - src is at least 16.
+/// </summary>
+static inline void wildcopy (BYTE* dst, const BYTE* src, size_t n)
+{
+	BYTE* end = dst + n;
+	do {
+		memcpy (dst, src, 16);
+		dst += 16;
+		src += 16;
+	} while (dst < end);
+}
+
+/// <summary>
+/// copy a match, may write up to 15 bytes past op + n
+/// </summary>
+/// <param name="op">output</param>
+/// <param name="offset">distance back, at least 1</param>
+/// <param name="n">length, at least 3</param>
+static inline void copy_match (BYTE* op, size_t offset, size_t n)
+{
+	const BYTE* match = op - offset;
+	BYTE* end = op + n;
+
+	if (offset >= 16) {
+		wildcopy (op, match, n);
+		return;
+	}
+	if (offset < 8) {
+		// spread the first 8 bytes so the rest can go 8 at a time
+		static const int forward[8] = { 0, 1, 2, 1, 4, 4, 4, 4 };
+		static const int back[8] = { 8, 8, 8, 7, 8, 9, 10, 11 };
+		op[0] = match[0];
+		op[1] = match[1];
+		op[2] = match[2];
+		op[3] = match[3];
+		match += forward[offset];
+		memcpy (op + 4, match, 4);
+		match -= back[offset];
+	}
+	else {
+		memcpy (op, match, 8);
+	}
+	op += 8;
+	match += 8;
+	while (op < end) {
+		memcpy (op, match, 8);
+		op += 8;
+		match += 8;
+	}
+}
+
+/// <summary>
+/// state for decoding one buffer of frames
+/// </summary>
+class ZSTDDECODER
+{
+public:
+	BYTE* out;
+	size_t used;
+	size_t capacity;                // out holds capacity + ZSTD_SLACK bytes
+	size_t framestart;
+	size_t blockmax;
+	unsigned int rep[3];            // repeat offsets
+	BYTE* literals;                 // ZSTD_BLOCKMAX + ZSTD_SLACK bytes
+	ZSTDHUFFMAN huffman;
+	ZSTDFSE lltable[512];
+	ZSTDFSE oftable[256];
+	ZSTDFSE mltable[512];
+	const ZSTDFSE* ll;              // tables in use, NULL until set
+	const ZSTDFSE* of;
+	const ZSTDFSE* ml;
+	int lllog, oflog, mllog;
+
+	ZSTDDECODER ()
+	{
+		out = NULL;
+		used = capacity = 0;
+		framestart = 0;
+		blockmax = ZSTD_BLOCKMAX;
+		literals = NULL;
+		ll = of = ml = NULL;
+		lllog = oflog = mllog = 0;
+		rep[0] = 1;
+		rep[1] = 4;
+		rep[2] = 8;
+	}
+	~ZSTDDECODER ()
+	{
+		delete[] out;
+		delete[] literals;
+	}
+	void run (const BYTE* data, size_t N);
+	size_t frame (const BYTE* p, size_t N);
+	void block (const BYTE* p, size_t N);
+	size_t literals_section (const BYTE* p, size_t N, size_t* nlit);
+	void huffman_streams (const BYTE* p, size_t N, int streams, size_t regen);
+	size_t sequence_table (int kind, int mode, const BYTE* p, size_t N);
+	void sequences (const BYTE* p, size_t N, size_t nlit);
+	void reserve (size_t bytes);
+};
+
+/// <summary>
+/// make room for more output
+/// </summary>
+/// <param name="bytes">bytes about to be written</param>
+void ZSTDDECODER::reserve (size_t bytes)
+{
+	if (used + bytes <= capacity) {
+		return;
+	}
+	size_t need = capacity * 2 > used + bytes ? capacity * 2 : used + bytes;
+	if (need > 0x7FFFFFFF) {
+		throw general_exception ("out_of_memory");
+	}
+	BYTE* bigger = new BYTE[need + ZSTD_SLACK];
+	if (!bigger) {
+		throw general_exception ("out_of_memory");
+	}
+	if (used) {
+		memcpy (bigger, out, used);
+	}
+	delete[] out;
+	out = bigger;
+	capacity = need;
+}
+
+/// <summary>
+/// decode every frame in the buffer
+/// </summary>
+/// <param name="data"></param>
+/// <param name="N">bytes of data</param>
+void ZSTDDECODER::run (const BYTE* data, size_t N)
+{
+	size_t pos = 0;
+
+	literals = new BYTE[ZSTD_BLOCKMAX + ZSTD_SLACK];
+	if (!literals) {
+		throw general_exception ("out_of_memory");
+	}
+	if (N == 0) {
+		throw general_exception ("parse_error");
+	}
+	while (pos < N) {
+		pos += frame (data + pos, N - pos);
+	}
+}
+
+/// <summary>
+/// decode one frame, or pass over a skippable one
+/// </summary>
+/// <param name="p">start of frame</param>
+/// <param name="N">bytes available</param>
+/// <returns>bytes used</returns>
+size_t ZSTDDECODER::frame (const BYTE* p, size_t N)
+{
+	static const int dictbytes[4] = { 0, 1, 2, 4 };
+	unsigned long long window = 0;
+	unsigned long long content = 0;
+	unsigned int dictid = 0;
+	size_t pos = 4;
+
+	if (N < 4) {
+		throw general_exception ("parse_error");
+	}
+	unsigned int magic = read32 (p);
+	if ((magic & 0xFFFFFFF0u) == 0x184D2A50u) {
+		if (N < 8 || read32 (p + 4) > N - 8) {
+			throw general_exception ("parse_error");
+		}
+		return 8 + (size_t)read32 (p + 4);
+	}
+	if (magic != ZSTD_MAGIC || N < 6) {
+		throw general_exception ("parse_error");
+	}
+	int descriptor = p[pos++];
+	bool single = (descriptor & 0x20) != 0;
+	bool checksum = (descriptor & 0x04) != 0;
+	int sizebytes = descriptor >> 6 ? 1 << (descriptor >> 6) : single ? 1 : 0;
+	if (descriptor & 0x08) {
+		throw general_exception ("parse_error");
+	}
+	if (!single) {
+		int exponent = p[pos] >> 3;
+		window = 1ULL << (10 + exponent);
+		window += (window >> 3) * (p[pos] & 7);
+		pos++;
+	}
+	if (pos + dictbytes[descriptor & 3] + sizebytes > N) {
+		throw general_exception ("parse_error");
+	}
+	for (auto i = 0; i < dictbytes[descriptor & 3]; i++) {
+		dictid |= (unsigned int)p[pos++] << (i * 8);
+	}
+	if (dictid != 0) {
+		// no dictionary to hand
+		throw general_exception ("parse_error");
+	}
+	for (auto i = 0; i < sizebytes; i++) {
+		content |= (unsigned long long)p[pos++] << (i * 8);
+	}
+	if (sizebytes == 2) {
+		content += 256;
+	}
+	if (single) {
+		window = content;
+	}
+	blockmax = window < ZSTD_BLOCKMAX ? (size_t)window : ZSTD_BLOCKMAX;
+
+	framestart = used;
+	rep[0] = 1;
+	rep[1] = 4;
+	rep[2] = 8;
+	huffman.present = false;
+	ll = of = ml = NULL;
+	if (sizebytes) {
+		if (content > 0x7FFFFFFF) {
+			throw general_exception ("out_of_memory");
+		}
+		reserve ((size_t)content);
+	}
+	else {
+		// streamed frames (libtiff writes these) don't say, guess at 4:1
+		reserve (N < 0x10000000 && N * 4 > blockmax ? N * 4 : blockmax);
+	}
+
+	for (;;) {
+		if (pos + 3 > N) {
+			throw general_exception ("parse_error");
+		}
+		unsigned int header = p[pos] | p[pos + 1] << 8 | p[pos + 2] << 16;
+		size_t size = header >> 3;
+		pos += 3;
+		if (size > blockmax) {
+			throw general_exception ("parse_error");
+		}
+		switch ((header >> 1) & 3) {
+		case 0:
+			// raw
+			if (pos + size > N) {
+				throw general_exception ("parse_error");
+			}
+			reserve (size);
+			memcpy (out + used, p + pos, size);
+			used += size;
+			pos += size;
+			break;
+		case 1:
+			// one byte repeated
+			if (pos + 1 > N) {
+				throw general_exception ("parse_error");
+			}
+			reserve (size);
+			memset (out + used, p[pos], size);
+			used += size;
+			pos += 1;
+			break;
+		case 2:
+			if (pos + size > N) {
+				throw general_exception ("parse_error");
+			}
+			if (sizebytes) {
+				size_t left = (size_t)content - (used - framestart);
+				reserve (left < blockmax ? left : blockmax);
+			}
+			else {
+				reserve (blockmax);
+			}
+			block (p + pos, size);
+			pos += size;
+			break;
+		default:
+			throw general_exception ("parse_error");
+		}
+		if (header & 1) {
+			break;
+		}
+	}
+	if (sizebytes && used - framestart != content) {
+		throw general_exception ("parse_error");
+	}
+	if (checksum) {
+		if (pos + 4 > N || (unsigned int)xxh64 (out + framestart, used - framestart) != read32 (p + pos)) {
+			throw general_exception ("parse_error");
+		}
+		pos += 4;
+	}
+	return pos;
+}
+
+/// <summary>
+/// decode a compressed block
+/// </summary>
+/// <param name="p"></param>
+/// <param name="N">block size</param>
+void ZSTDDECODER::block (const BYTE* p, size_t N)
+{
+	size_t nlit;
+	size_t pos = literals_section (p, N, &nlit);
+	sequences (p + pos, N - pos, nlit);
+}
+
+/// <summary>
+/// decode the literals into the literals buffer
+/// </summary>
+/// <param name="p"></param>
+/// <param name="N">bytes available</param>
+/// <param name="nlit">return for number of literals</param>
+/// <returns>bytes used</returns>
+size_t ZSTDDECODER::literals_section (const BYTE* p, size_t N, size_t* nlit)
+{
+	size_t header;
+	size_t regen;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	int type = p[0] & 3;
+	int format = (p[0] >> 2) & 3;
+	if (type < 2) {
+		// raw or RLE
+		switch (format) {
+		case 1:
+			header = 2;
+			break;
+		case 3:
+			header = 3;
+			break;
+		default:
+			header = 1;
+			break;
+		}
+		if (header + (type == 1 ? 1 : 0) > N) {
+			throw general_exception ("parse_error");
+		}
+		if (header == 1) {
+			regen = p[0] >> 3;
+		}
+		else if (header == 2) {
+			regen = (p[0] >> 4) + (p[1] << 4);
+		}
+		else {
+			regen = (p[0] >> 4) + (p[1] << 4) + (p[2] << 12);
+		}
+		if (regen > ZSTD_BLOCKMAX) {
+			throw general_exception ("parse_error");
+		}
+		*nlit = regen;
+		if (type == 1) {
+			memset (literals, p[header], regen);
+			return header + 1;
+		}
+		if (header + regen > N) {
+			throw general_exception ("parse_error");
+		}
+		memcpy (literals, p + header, regen);
+		return header + regen;
+	}
+
+	// Huffman coded, with a new tree or the last one
+	int streams = format == 0 ? 1 : 4;
+	int sizebits = format < 2 ? 10 : format == 2 ? 14 : 18;
+	header = format < 2 ? 3 : format == 2 ? 4 : 5;
+	if (header > N) {
+		throw general_exception ("parse_error");
+	}
+	unsigned long long h = 0;
+	for (size_t i = 0; i < header; i++) {
+		h |= (unsigned long long)p[i] << (i * 8);
+	}
+	regen = (size_t)(h >> 4) & ((1 << sizebits) - 1);
+	size_t compressed = (size_t)(h >> (4 + sizebits)) & ((1 << sizebits) - 1);
+	if (regen > ZSTD_BLOCKMAX || header + compressed > N) {
+		throw general_exception ("parse_error");
+	}
+	const BYTE* q = p + header;
+	size_t n = compressed;
+	if (type == 2) {
+		int tree = huffman.read (q, n);
+		if (tree < 0) {
+			throw general_exception ("parse_error");
+		}
+		q += tree;
+		n -= tree;
+	}
+	else if (!huffman.present) {
+		throw general_exception ("parse_error");
+	}
+	huffman_streams (q, n, streams, regen);
+	*nlit = regen;
+	return header + compressed;
+}
+
+/// <summary>
+/// decode Huffman coded literals, the four stream layout is decoded
+/// four symbols per stream at a time, interleaved
+/// </summary>
+/// <param name="p">the streams, after the tree</param>
+/// <param name="N">bytes of streams</param>
+/// <param name="streams">1 or 4</param>
+/// <param name="regen">literals to decode</param>
+void ZSTDDECODER::huffman_streams (const BYTE* p, size_t N, int streams, size_t regen)
+{
+	const unsigned short* table = huffman.table;
+	int shift = 64 - huffman.maxbits;
+	ZSTDBITS br[4];
+	BYTE* op[4];
+	BYTE* end[4];
+
+	if (streams == 1) {
+		BYTE* o = literals;
+		if (!br[0].init (p, N)) {
+			throw general_exception ("parse_error");
+		}
+		while (o + 4 <= literals + regen) {
+			br[0].reload ();
+			o[0] = huffman_symbol (br[0], table, shift);
+			o[1] = huffman_symbol (br[0], table, shift);
+			o[2] = huffman_symbol (br[0], table, shift);
+			o[3] = huffman_symbol (br[0], table, shift);
+			o += 4;
+		}
+		while (o < literals + regen) {
+			br[0].reload ();
+			*o++ = huffman_symbol (br[0], table, shift);
+		}
+		br[0].reload ();
+		if (!br[0].finished ()) {
+			throw general_exception ("parse_error");
+		}
+		return;
+	}
+
+	if (N < 6) {
+		throw general_exception ("parse_error");
+	}
+	size_t sizes[4];
+	sizes[0] = p[0] | p[1] << 8;
+	sizes[1] = p[2] | p[3] << 8;
+	sizes[2] = p[4] | p[5] << 8;
+	if (6 + sizes[0] + sizes[1] + sizes[2] > N) {
+		throw general_exception ("parse_error");
+	}
+	sizes[3] = N - 6 - sizes[0] - sizes[1] - sizes[2];
+	size_t segment = (regen + 3) / 4;
+	if (segment * 3 > regen) {
+		throw general_exception ("parse_error");
+	}
+	const BYTE* q = p + 6;
+	for (auto i = 0; i < 4; i++) {
+		if (!br[i].init (q, sizes[i])) {
+			throw general_exception ("parse_error");
+		}
+		q += sizes[i];
+		op[i] = literals + segment * i;
+		end[i] = i < 3 ? op[i] + segment : literals + regen;
+	}
+	// the last stream is never the longest. Everything in locals, stores
+	// through BYTE* would otherwise force the readers back to memory.
+	ZSTDBITS b0 = br[0], b1 = br[1], b2 = br[2], b3 = br[3];
+	BYTE* o0 = op[0];
+	BYTE* o1 = op[1];
+	BYTE* o2 = op[2];
+	BYTE* o3 = op[3];
+	while (o3 + 4 <= end[3]) {
+		b0.reload ();
+		b1.reload ();
+		b2.reload ();
+		b3.reload ();
+		for (auto k = 0; k < 4; k++) {
+			o0[k] = huffman_symbol (b0, table, shift);
+			o1[k] = huffman_symbol (b1, table, shift);
+			o2[k] = huffman_symbol (b2, table, shift);
+			o3[k] = huffman_symbol (b3, table, shift);
+		}
+		o0 += 4;
+		o1 += 4;
+		o2 += 4;
+		o3 += 4;
+	}
+	br[0] = b0;
+	br[1] = b1;
+	br[2] = b2;
+	br[3] = b3;
+	op[0] = o0;
+	op[1] = o1;
+	op[2] = o2;
+	op[3] = o3;
+	for (auto i = 0; i < 4; i++) {
+		while (op[i] < end[i]) {
+			br[i].reload ();
+			*op[i]++ = huffman_symbol (br[i], table, shift);
+		}
+		br[i].reload ();
+		if (!br[i].finished ()) {
+			throw general_exception ("parse_error");
+		}
+	}
+}
+
+/// <summary>
+/// set up the table for literal lengths, offsets or match lengths
+/// </summary>
+/// <param name="kind">0 literal lengths, 1 offsets, 2 match lengths</param>
+/// <param name="mode">0 predefined, 1 RLE, 2 FSE description, 3 repeat</param>
+/// <param name="p"></param>
+/// <param name="N">bytes available</param>
+/// <returns>bytes used</returns>
+size_t ZSTDDECODER::sequence_table (int kind, int mode, const BYTE* p, size_t N)
+{
+	static const int maxsyms[3] = { 35, 31, 52 };
+	static const int maxlogs[3] = { 9, 8, 9 };
+	const unsigned int* values[3] = { llbase, ofbase, mlbase };
+	const BYTE* extra[3] = { llbits, ofbits, mlbits };
+	const ZSTDDEFAULTS& defaults = ZSTDDEFAULTS::get ();
+	ZSTDFSE* own[3] = { lltable, oftable, mltable };
+	const ZSTDFSE** table[3] = { &ll, &of, &ml };
+	int* log[3] = { &lllog, &oflog, &mllog };
+	short norm[64];
+	int maxsym = maxsyms[kind];
+	int used;
+
+	switch (mode) {
+	case 0:
+		*table[kind] = kind == 0 ? defaults.ll : kind == 1 ? defaults.of : defaults.ml;
+		*log[kind] = kind == 1 ? 5 : 6;
+		return 0;
+	case 1:
+		if (N < 1 || p[0] > maxsym) {
+			throw general_exception ("parse_error");
+		}
+		own[kind][0].value = values[kind][p[0]];
+		own[kind][0].extra = extra[kind][p[0]];
+		own[kind][0].next = 0;
+		own[kind][0].bits = 0;
+		*table[kind] = own[kind];
+		*log[kind] = 0;
+		return 1;
+	case 2:
+		used = read_ncount (p, N, norm, &maxsym, log[kind], maxlogs[kind]);
+		if (used < 0 || !build_fse (own[kind], norm, maxsym, *log[kind], values[kind], extra[kind])) {
+			throw general_exception ("parse_error");
+		}
+		*table[kind] = own[kind];
+		return used;
+	default:
+		if (!*table[kind]) {
+			throw general_exception ("parse_error");
+		}
+		return 0;
+	}
+}
+
+/// <summary>
+/// decode the sequences and build the block's output from them and the literals
+/// </summary>
+/// <param name="p">sequences section</param>
+/// <param name="N">bytes of section</param>
+/// <param name="nlit">literals decoded</param>
+void ZSTDDECODER::sequences (const BYTE* p, size_t N, size_t nlit)
+{
+	size_t nseq;
+	size_t pos;
+	BYTE* op = out + used;
+	BYTE* oend = out + capacity;
+	const BYTE* base = out + framestart;
+	const BYTE* lit = literals;
+	const BYTE* litend = literals + nlit;
+
+	if (N < 1) {
+		throw general_exception ("parse_error");
+	}
+	if (p[0] < 128) {
+		nseq = p[0];
+		pos = 1;
+	}
+	else if (p[0] < 255) {
+		if (N < 2) {
+			throw general_exception ("parse_error");
+		}
+		nseq = ((p[0] - 128) << 8) + p[1];
+		pos = 2;
+	}
+	else {
+		if (N < 3) {
+			throw general_exception ("parse_error");
+		}
+		nseq = p[1] + (p[2] << 8) + 0x7F00;
+		pos = 3;
+	}
+
+	if (nseq > 0) {
+		ZSTDBITS br;
+
+		if (pos >= N || (p[pos] & 3)) {
+			throw general_exception ("parse_error");
+		}
+		int modes = p[pos++];
+		pos += sequence_table (0, modes >> 6, p + pos, N - pos);
+		pos += sequence_table (1, (modes >> 4) & 3, p + pos, N - pos);
+		pos += sequence_table (2, (modes >> 2) & 3, p + pos, N - pos);
+		if (!br.init (p + pos, N - pos)) {
+			throw general_exception ("parse_error");
+		}
+		// locals again, out can alias anything
+		const ZSTDFSE* lt = ll;
+		const ZSTDFSE* ot = of;
+		const ZSTDFSE* mt = ml;
+		size_t rep0 = rep[0];
+		size_t rep1 = rep[1];
+		size_t rep2 = rep[2];
+		unsigned int ls = br.get (lllog);
+		unsigned int os = br.get (oflog);
+		unsigned int ms = br.get (mllog);
+		br.reload ();
+		for (size_t i = 0; i < nseq; i++) {
+			const ZSTDFSE& l = lt[ls];
+			const ZSTDFSE& o = ot[os];
+			const ZSTDFSE& m = mt[ms];
+			size_t offset = o.value + (size_t)br.get (o.extra);
+			if (o.extra + m.extra + l.extra > 31) {
+				// the container can't hold all three plus the state bits
+				br.reload ();
+			}
+			size_t matchlen = m.value + br.get (m.extra);
+			size_t litlen = l.value + br.get (l.extra);
+
+			if (o.extra > 1) {
+				// codes 2 and up are new offsets, plus 3
+				offset -= 3;
+				rep2 = rep1;
+				rep1 = rep0;
+				rep0 = offset;
+			}
+			else {
+				// 1 to 3 pick a repeat offset, shifted by one when there are no literals
+				size_t index = offset - 1 + (litlen == 0);
+				if (index == 0) {
+					offset = rep0;
+				}
+				else {
+					offset = index == 1 ? rep1 : index == 2 ? rep2 : rep0 - 1;
+					if (index != 1) {
+						rep2 = rep1;
+					}
+					rep1 = rep0;
+					rep0 = offset;
+				}
+			}
+
+			if (litlen > (size_t)(litend - lit) || litlen + matchlen > (size_t)(oend - op) ||
+				offset == 0 || offset > (size_t)(op - base) + litlen) {
+				throw general_exception ("parse_error");
+			}
+			if (litlen) {
+				wildcopy (op, lit, litlen);
+				op += litlen;
+				lit += litlen;
+			}
+			copy_match (op, offset, matchlen);
+			op += matchlen;
+
+			if (i + 1 < nseq) {
+				if (m.extra + l.extra > 31) {
+					br.reload ();
+				}
+				ls = l.next + br.get (l.bits);
+				ms = m.next + br.get (m.bits);
+				os = o.next + br.get (o.bits);
+				br.reload ();
+			}
+		}
+		rep[0] = (unsigned int)rep0;
+		rep[1] = (unsigned int)rep1;
+		rep[2] = (unsigned int)rep2;
+		if (!br.finished ()) {
+			throw general_exception ("parse_error");
+		}
+	}
+	else if (pos != N) {
+		throw general_exception ("parse_error");
+	}
+
+	// the literals after the last match
+	size_t rest = litend - lit;
+	if (rest > (size_t)(oend - op)) {
+		throw general_exception ("parse_error");
+	}
+	memcpy (op, lit, rest);
+	op += rest;
+	used = op - out;
+}
+
+/// <summary>
+/// decode a Zstandard buffer
+/// </summary>
+/// <param name="data">one or more frames</param>
+/// <param name="N">bytes of data</param>
+/// <param name="Nret">return for bytes decoded</param>
+/// <returns>the decoded bytes, 0 on fail</returns>
+BYTE* zstd_decompress (const BYTE* data, unsigned long N, unsigned long* Nret)
+{
+	ZSTDDECODER decoder;
+	BYTE* answer;
+
+	try {
+		decoder.run (data, N);
+		answer = decoder.out;
+		decoder.out = NULL;
+		*Nret = (unsigned long)decoder.used;
+		return answer;
+	}
+	catch (general_exception) {
+		return 0;
+	}
+}
@@ -0,0 +1,21 @@
+#ifndef zstddec_h
+#define zstddec_h
+
+/*
+  Zstandard decoder for ZSTD compressed TIFF strips and tiles (Compression = 50000).
+
+  To use
+	data = zstd_decompress (strip, Nstrip, &N);
+
+  Every frame in the buffer is decoded and the results concatenated, as
+  zstd itself does; skippable frames are passed over. Raw, RLE and
+  compressed blocks, Huffman and treeless literals, predefined, RLE, FSE
+  and repeat sequence tables. The content checksum is verified when the
+  frame carries one. Dictionaries are refused (TIFF writers don't use them).
+*/
+
+typedef unsigned char BYTE;
+
+BYTE* zstd_decompress (const BYTE* data, unsigned long N, unsigned long* Nret);
+
+#endif